@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* startup.cc - Process startup cost of preloading sycophant */
+/*
+	Runs /bin/true over and over, bare and with sycophant preloaded in each startup mode, and reports
+	the spawn to exit time of each. Everything else in the environment is passed through, so set
+	SYCOPHANT_MODULE, SYCOPHANT_BUNDLE and friends as usual to see what they cost.
+
+	usage: startup <path to sycophant.so> [runs (default 200)] [program (default /bin/true)]
+*/
+#include <spawn.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <array>
+#include <filesystem>
+
+#include <histogram.hh>
+
+extern char** environ;
+
+namespace fs = std::filesystem;
+
+namespace {
+	struct startup_mode_t final {
+		const char* name;
+		/* Added on top of the inherited environment */
+		std::vector<std::string> env;
+		sycophant::atomic_histogram_t times{};
+		std::uint32_t failed{0U};
+	};
+
+	[[nodiscard]]
+	std::uint64_t monotonic_ns() noexcept {
+		timespec now{};
+		::clock_gettime(CLOCK_MONOTONIC, &now);
+		return (static_cast<std::uint64_t>(now.tv_sec) * 1000000000U) + static_cast<std::uint64_t>(now.tv_nsec);
+	}
+
+	void run(const char* const program, posix_spawn_file_actions_t* const quiet, startup_mode_t& mode) {
+		std::vector<char*> env{};
+		for (auto& var : mode.env) {
+			env.push_back(var.data());
+		}
+		for (char** var = environ; *var != nullptr; ++var) {
+			if (std::strncmp(*var, "LD_PRELOAD=", 11) != 0 && std::strncmp(*var, "SYCOPHANT_STARTUP=", 18) != 0) {
+				env.push_back(*var);
+			}
+		}
+		env.push_back(nullptr);
+
+		std::array<char*, 2> argv{{const_cast<char*>(program), nullptr}};
+		const auto start{monotonic_ns()};
+		pid_t pid{};
+		std::int32_t status{};
+		if (posix_spawn(&pid, program, quiet, nullptr, argv.data(), env.data()) != 0 ||
+			waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			++mode.failed;
+			return;
+		}
+		mode.times.record(monotonic_ns() - start);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::fputs("usage: startup <path to sycophant.so> [runs] [program]\n", stderr);
+		return 1;
+	}
+	const auto library{"LD_PRELOAD=" + fs::absolute(argv[1]).string()};
+	const std::size_t runs{argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200U};
+	const char* const program{argc > 3 ? argv[3] : "/bin/true"};
+
+	std::array<startup_mode_t, 3> modes{{
+		{"bare",     {}},
+		{"eager",    {library, "SYCOPHANT_STARTUP=eager"}},
+		{"deferred", {library, "SYCOPHANT_STARTUP=deferred"}},
+	}};
+
+	/* Whatever the hook module prints would only get in the way */
+	posix_spawn_file_actions_t quiet{};
+	posix_spawn_file_actions_init(&quiet);
+	posix_spawn_file_actions_addopen(&quiet, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+	/* Round robin so the page cache and the machine's load treat every mode the same */
+	for (auto& mode : modes) {
+		run(program, &quiet, mode);
+		mode.times.reset();
+		mode.failed = 0U;
+	}
+	for (std::size_t iter{}; iter < runs; ++iter) {
+		for (auto& mode : modes) {
+			run(program, &quiet, mode);
+		}
+	}
+
+	posix_spawn_file_actions_destroy(&quiet);
+
+	std::printf("%s, %zu runs each\n", program, runs);
+	for (const auto& mode : modes) {
+		const auto hist{mode.times.snapshot()};
+		std::printf(
+			"  %-9s mean %9.0f us  p50 %7lu us  p90 %7lu us  p99 %7lu us  max %7lu us",
+			mode.name, hist.mean() / 1000.0, hist.percentile(0.5) / 1000U, hist.percentile(0.9) / 1000U,
+			hist.percentile(0.99) / 1000U, hist.max / 1000U
+		);
+		if (mode.failed != 0U) {
+			std::printf("  (%u failed)", mode.failed);
+		}
+		std::putchar('\n');
+	}
+	return 0;
+}
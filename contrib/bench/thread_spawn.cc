@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* thread_spawn.cc - Cost of the pthread_create interposer */
+/*
+	Times a plain pthread_create and pthread_join loop, bare and with sycophant preloaded, so it's the
+	interposer as a real program sees it that's being measured, dlsym'd pthread_create and all. Each
+	batch runs in a child of its own and only the loop is timed, not the child's startup. Everything
+	else in the environment is passed through, so set SYCOPHANT_MODULE and friends as usual.
+
+	usage: thread_spawn <path to sycophant.so> [threads (default 1000000)] [concurrent (default 1)]
+*/
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <filesystem>
+
+extern char** environ;
+
+namespace fs = std::filesystem;
+
+namespace {
+	/* Passed to ourselves to run the loop rather than drive it */
+	constexpr std::string_view loop_flag{"--loop"};
+	/* The child reports how long the loop took on this fd, stdout is left to the hook module */
+	constexpr std::int32_t result_fd{3};
+
+	struct spawn_mode_t final {
+		const char* name;
+		/* Added on top of the inherited environment */
+		std::vector<std::string> env;
+		std::uint64_t ns{0U};
+		std::uint32_t failed{0U};
+	};
+
+	[[nodiscard]]
+	std::uint64_t monotonic_ns() noexcept {
+		timespec now{};
+		::clock_gettime(CLOCK_MONOTONIC, &now);
+		return (static_cast<std::uint64_t>(now.tv_sec) * 1000000000U) + static_cast<std::uint64_t>(now.tv_nsec);
+	}
+
+	void* nothing(void*) {
+		return nullptr;
+	}
+
+	/* Joined after every `concurrent` threads so it's the create/start/exit/join round trip being measured */
+	[[nodiscard]]
+	std::uint64_t spawn_loop(const std::size_t count, const std::size_t concurrent) {
+		std::vector<pthread_t> threads(concurrent);
+		const auto start{monotonic_ns()};
+		for (std::size_t done{}; done < count; done += concurrent) {
+			for (auto& thread : threads) {
+				if (pthread_create(&thread, nullptr, &nothing, nullptr) != 0) {
+					std::fputs("thread_spawn: unable to create a thread\n", stderr);
+					std::exit(1);
+				}
+			}
+			for (const auto thread : threads) {
+				pthread_join(thread, nullptr);
+			}
+		}
+		return monotonic_ns() - start;
+	}
+
+	/* Runs a batch of `count` threads in a child with `mode`'s environment */
+	void run(const char* const self, const std::size_t count, const std::size_t concurrent, spawn_mode_t& mode) {
+		std::vector<char*> env{};
+		for (auto& var : mode.env) {
+			env.push_back(var.data());
+		}
+		for (char** var = environ; *var != nullptr; ++var) {
+			if (std::strncmp(*var, "LD_PRELOAD=", 11) != 0) {
+				env.push_back(*var);
+			}
+		}
+		env.push_back(nullptr);
+
+		std::array<std::int32_t, 2> result{{-1, -1}};
+		if (pipe2(result.data(), O_CLOEXEC) != 0) {
+			++mode.failed;
+			return;
+		}
+		/* Whatever the hook module prints would only get in the way */
+		posix_spawn_file_actions_t actions{};
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+		posix_spawn_file_actions_adddup2(&actions, result[1], result_fd);
+
+		auto todo{std::to_string(count)};
+		auto width{std::to_string(concurrent)};
+		std::string flag{loop_flag};
+		std::array<char*, 5> argv{{const_cast<char*>(self), flag.data(), todo.data(), width.data(), nullptr}};
+		pid_t pid{};
+		const auto spawned{posix_spawn(&pid, "/proc/self/exe", &actions, nullptr, argv.data(), env.data()) == 0};
+		posix_spawn_file_actions_destroy(&actions);
+		close(result[1]);
+
+		std::array<char, 32> buffer{};
+		std::size_t length{};
+		while (spawned && length < buffer.size() - 1U) {
+			const auto got{read(result[0], buffer.data() + length, buffer.size() - 1U - length)};
+			if (got <= 0) {
+				break;
+			}
+			length += static_cast<std::size_t>(got);
+		}
+		close(result[0]);
+
+		std::int32_t status{};
+		if (!spawned || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+			length == 0U) {
+			++mode.failed;
+			return;
+		}
+		mode.ns += std::strtoull(buffer.data(), nullptr, 10);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc > 3 && argv[1] == loop_flag) {
+		const std::size_t count{std::strtoul(argv[2], nullptr, 10)};
+		const std::size_t concurrent{std::max<std::size_t>(std::strtoul(argv[3], nullptr, 10), 1U)};
+		/* Warm up the allocator, the interposer and the kernel's stack cache */
+		static_cast<void>(spawn_loop(std::min<std::size_t>(count, 1000U), concurrent));
+		const auto ns{spawn_loop(count, concurrent)};
+		return dprintf(result_fd, "%lu", ns) > 0 ? 0 : 1;
+	}
+	if (argc < 2) {
+		std::fputs("usage: thread_spawn <path to sycophant.so> [threads] [concurrent]\n", stderr);
+		return 1;
+	}
+	const auto library{"LD_PRELOAD=" + fs::absolute(argv[1]).string()};
+	const std::size_t count{argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000U};
+	const std::size_t concurrent{argc > 3 ? std::max<std::size_t>(std::strtoul(argv[3], nullptr, 10), 1U) : 1U};
+
+	std::array<spawn_mode_t, 2> modes{{
+		{"bare",      {}},
+		{"preloaded", {library}},
+	}};
+
+	/* Interleaved in batches so drift in the machine's load hits both sides the same */
+	constexpr std::size_t batch{100000U};
+	for (std::size_t done{}; done < count; done += batch) {
+		const auto todo{std::min(batch, count - done)};
+		for (auto& mode : modes) {
+			run(argv[0], todo, concurrent, mode);
+		}
+	}
+
+	std::printf("%zu threads, %zu at a time\n", count, concurrent);
+	for (const auto& mode : modes) {
+		std::printf("  %-10s %10.1f ns/thread", mode.name, static_cast<double>(mode.ns) / static_cast<double>(count));
+		if (mode.failed != 0U) {
+			std::printf("  (%u batches failed)", mode.failed);
+		}
+		std::putchar('\n');
+	}
+	const auto bare{static_cast<double>(modes[0].ns) / static_cast<double>(count)};
+	const auto preloaded{static_cast<double>(modes[1].ns) / static_cast<double>(count)};
+	std::printf("  overhead   %10.1f ns/thread (%+.1f%%)\n", preloaded - bare, ((preloaded / bare) - 1.0) * 100.0);
+	return 0;
+}
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* reader.cc - Reads the metrics a process publishes with SYCOPHANT_METRICS */
+/*
+	Maps the segment read only and copies the records out, so reading it as often as you like costs
+	the target nothing at all. Without an interval it prints everything once, with one it prints
+	again every time the target has published something new until the target stops publishing.
+
+	usage: sycophant-metrics <pid|segment> [interval ms]
+*/
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fd.hh>
+#include <mmap.hh>
+#include <metrics.hh>
+
+using sycophant::metrics_header_t;
+using sycophant::metrics_kind_t;
+using sycophant::metrics_record_t;
+using sycophant::metrics_values_t;
+
+namespace {
+	/* A writer that died halfway through a record leaves its `seq` odd for good, so don't wait on it forever */
+	constexpr std::uint32_t read_attempts{1000U};
+
+	struct metric_t final {
+		metrics_kind_t kind;
+		std::string name;
+		metrics_values_t values;
+		/* Set when no consistent copy could be had in `read_attempts` tries */
+		bool torn;
+	};
+
+	[[nodiscard]]
+	std::string segment_name(const std::string_view target) {
+		const auto pid{std::all_of(target.begin(), target.end(), [](const char c) { return c >= '0' && c <= '9'; })};
+		const auto name{pid ? "sycophant." + std::string{target} : std::string{target}};
+		return name.front() == '/' ? name : '/' + name;
+	}
+
+	[[nodiscard]]
+	bool valid_segment(const sycophant::mmap_t& map) noexcept {
+		if (map.length() < sizeof(metrics_header_t)) {
+			return false;
+		}
+		const auto& head{*map.address<metrics_header_t>()};
+		return head.magic == sycophant::metrics_magic && head.version == sycophant::metrics_version &&
+			head.record_size == sizeof(metrics_record_t) &&
+			map.length() >= sizeof(metrics_header_t) + (std::size_t{head.capacity} * sizeof(metrics_record_t));
+	}
+
+	/* Retries any record that was being written while it was copied, up to `read_attempts` times */
+	void read_metrics(const metrics_header_t& head, std::vector<metric_t>& metrics) {
+		const auto records{reinterpret_cast<const metrics_record_t*>(&head + 1)};
+		const auto count{std::min(head.count.load(std::memory_order_acquire), head.capacity)};
+		metrics.resize(count);
+		for (std::uint32_t idx{}; idx < count; ++idx) {
+			const auto& record{records[idx]};
+			auto& metric{metrics[idx]};
+			if (metric.name.empty()) {
+				metric.kind = record.kind;
+				metric.name.assign(record.name.data(), strnlen(record.name.data(), record.name.size()));
+			}
+			metric.torn = true;
+			for (std::uint32_t attempt{}; attempt < read_attempts; ++attempt) {
+				const auto before{record.seq.load(std::memory_order_acquire)};
+				if ((before & 1U) != 0U) {
+					static_cast<void>(::sched_yield());
+					continue;
+				}
+				std::memcpy(&metric.values, &record.values, sizeof(metrics_values_t));
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (record.seq.load(std::memory_order_relaxed) == before) {
+					metric.torn = false;
+					break;
+				}
+			}
+		}
+	}
+
+	void print_metrics(const metrics_header_t& head, const std::vector<metric_t>& metrics) {
+		std::printf("[pid %u update %lu]\n", head.pid, head.updates.load(std::memory_order_relaxed));
+		for (const auto& metric : metrics) {
+			const auto& values{metric.values};
+			if (metric.torn) {
+				std::printf("  %-36s %16s\n", metric.name.c_str(), "(torn)");
+				continue;
+			}
+			if (metric.kind != metrics_kind_t::histogram) {
+				std::printf("  %-36s %16lu\n", metric.name.c_str(), values.value);
+				continue;
+			}
+			const auto mean{values.value != 0U ? values.sum / values.value : 0U};
+			std::printf(
+				"  %-36s count=%lu mean=%lu p50=%lu p90=%lu p99=%lu p999=%lu max=%lu\n", metric.name.c_str(),
+				values.value, mean, values.p50, values.p90, values.p99, values.p999, values.max
+			);
+		}
+		std::fflush(stdout);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::fputs("usage: sycophant-metrics <pid|segment> [interval ms]\n", stderr);
+		return 1;
+	}
+
+	const auto name{segment_name(argv[1])};
+	sycophant::fd_t file{::shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0)};
+	const auto map{file.map(sycophant::prot_t::R, MAP_SHARED)};
+	if (!map.valid()) {
+		std::fprintf(stderr, "unable to open %s\n", name.c_str());
+		return 1;
+	}
+	if (!valid_segment(map)) {
+		std::fprintf(stderr, "%s isn't a sycophant metrics segment this knows how to read\n", name.c_str());
+		return 1;
+	}
+
+	const auto& head{*map.address<metrics_header_t>()};
+	const auto interval{argc > 2 ? std::strtol(argv[2], nullptr, 10) : 0L};
+	const timespec pause{interval / 1000L, (interval % 1000L) * 1000000L};
+	std::vector<metric_t> metrics{};
+	std::uint64_t seen{};
+	while (true) {
+		const auto updated{head.updated.load(std::memory_order_acquire)};
+		const auto updates{head.updates.load(std::memory_order_acquire)};
+		if (updates != seen || interval <= 0) {
+			seen = updates;
+			read_metrics(head, metrics);
+			print_metrics(head, metrics);
+		}
+		if (updated == 0U) {
+			std::fputs("target has stopped publishing\n", stderr);
+			break;
+		}
+		if (interval <= 0) {
+			break;
+		}
+		/* A process that died without getting to stop leaves its segment behind */
+		if (::kill(static_cast<::pid_t>(head.pid), 0) != 0 && errno == ESRCH) {
+			std::fputs("target has gone away\n", stderr);
+			break;
+		}
+		static_cast<void>(::nanosleep(&pause, nullptr));
+	}
+	return 0;
+}
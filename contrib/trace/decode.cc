@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* decode.cc - Turns sycophant trace files into Chrome/Perfetto JSON */
+/*
+	Reads a trace written with SYCOPHANT_TRACE or `sycophant.trace.start` and writes it out in the
+	Chrome trace event format, which chrome://tracing and ui.perfetto.dev both load. A flight recorder
+	trace usually starts part way into some spans, their ends are left out.
+
+	usage: sycophant-trace <trace> [output (default stdout)]
+*/
+#include <fcntl.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fd.hh>
+#include <mmap.hh>
+#include <trace.hh>
+
+using sycophant::trace_event_t;
+
+namespace {
+	struct event_t final {
+		std::uint64_t tsc;
+		std::uint32_t tid;
+		trace_event_t kind;
+		std::uint64_t name;
+		std::uint64_t value;
+	};
+
+	struct trace_file_t final {
+		std::uint32_t pid{};
+		std::vector<sycophant::trace_clock_t> clocks{};
+		std::unordered_map<std::uint64_t, std::string> names{};
+		std::vector<event_t> events{};
+
+		~trace_file_t() noexcept;
+	};
+
+	trace_file_t::~trace_file_t() noexcept = default;
+
+	template<typename T>
+	[[nodiscard]]
+	bool take(const std::uint8_t*& data, const std::uint8_t* const end, T& value) noexcept {
+		if (static_cast<std::size_t>(end - data) < sizeof(T)) {
+			return false;
+		}
+		std::memcpy(&value, data, sizeof(T));
+		data += sizeof(T);
+		return true;
+	}
+
+	void read_names(const std::uint8_t* data, const std::uint8_t* const end, trace_file_t& trace) {
+		std::uint64_t id{};
+		std::uint64_t length{};
+		while (
+			sycophant::varint_read(data, end, id) && sycophant::varint_read(data, end, length) &&
+			length <= static_cast<std::size_t>(end - data)
+		) {
+			trace.names[id].assign(reinterpret_cast<const char*>(data), length);
+			data += length;
+		}
+	}
+
+	/* A block cut short is kept up to its last whole record */
+	void read_block(const std::uint8_t* data, const std::uint8_t* const end, trace_file_t& trace) {
+		sycophant::trace_block_t block{};
+		if (!take(data, end, block)) {
+			return;
+		}
+		auto tsc{block.tsc};
+		while (data != end) {
+			event_t event{0U, block.tid, static_cast<trace_event_t>(*data++), 0U, 0U};
+			if (event.kind < trace_event_t::begin || event.kind > trace_event_t::counter) {
+				return;
+			}
+			std::uint64_t delta{};
+			if (!sycophant::varint_read(data, end, delta) || !sycophant::varint_read(data, end, event.name)) {
+				return;
+			}
+			if (event.kind != trace_event_t::begin && !sycophant::varint_read(data, end, event.value)) {
+				return;
+			}
+			tsc += delta;
+			event.tsc = tsc;
+			trace.events.push_back(event);
+		}
+	}
+
+	[[nodiscard]]
+	bool read_trace(const sycophant::mmap_t& map, trace_file_t& trace) {
+		auto data{map.address<std::uint8_t>()};
+		const auto end{data + map.length()};
+
+		sycophant::trace_header_t header{};
+		if (!take(data, end, header) || header.magic != sycophant::trace_magic) {
+			std::fputs("not a sycophant trace\n", stderr);
+			return false;
+		}
+		if (header.version != sycophant::trace_version) {
+			std::fprintf(stderr, "unsupported trace version %u\n", header.version);
+			return false;
+		}
+		trace.pid = header.pid;
+
+		sycophant::trace_chunk_t chunk{};
+		while (take(data, end, chunk)) {
+			if (chunk.length > static_cast<std::size_t>(end - data)) {
+				std::fputs("trace is truncated, decoding what's there\n", stderr);
+				break;
+			}
+			const auto payload{data};
+			data += chunk.length;
+			switch (chunk.type) {
+				case sycophant::trace_chunk_type_t::clock: {
+					auto clock{payload};
+					sycophant::trace_clock_t value{};
+					if (take(clock, data, value)) {
+						trace.clocks.push_back(value);
+					}
+					break;
+				}
+				case sycophant::trace_chunk_type_t::names:
+					read_names(payload, data, trace);
+					break;
+				case sycophant::trace_chunk_type_t::block:
+					read_block(payload, data, trace);
+					break;
+				default:
+					break;
+			}
+		}
+		return true;
+	}
+
+	void write_string(std::FILE* const out, const std::string_view str) {
+		std::fputc('"', out);
+		for (const auto chr : str) {
+			if (chr == '"' || chr == '\\') {
+				std::fputc('\\', out);
+				std::fputc(chr, out);
+			} else if (static_cast<unsigned char>(chr) < 0x20U) {
+				std::fprintf(out, "\\u%04x", static_cast<unsigned int>(chr));
+			} else {
+				std::fputc(chr, out);
+			}
+		}
+		std::fputc('"', out);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::fputs("usage: sycophant-trace <trace> [output]\n", stderr);
+		return 1;
+	}
+
+	sycophant::fd_t file{argv[1], O_RDONLY | O_CLOEXEC};
+	const auto map{file.map(sycophant::prot_t::R, MAP_PRIVATE)};
+	if (!map.valid()) {
+		std::fprintf(stderr, "unable to read %s\n", argv[1]);
+		return 1;
+	}
+	trace_file_t trace{};
+	if (!read_trace(map, trace)) {
+		return 1;
+	}
+
+	/* Ticks per nanosecond from the first and last clock samples */
+	double rate{1.0};
+	const auto& first{trace.clocks.empty() ? sycophant::trace_clock_t{} : trace.clocks.front()};
+	if (trace.clocks.size() >= 2U) {
+		const auto& last{trace.clocks.back()};
+		if (last.tsc > first.tsc && last.ns > first.ns) {
+			rate = static_cast<double>(last.tsc - first.tsc) / static_cast<double>(last.ns - first.ns);
+		}
+	} else {
+		std::fputs("trace has no clock samples to go by, treating a tick as a nanosecond\n", stderr);
+	}
+
+	std::stable_sort(trace.events.begin(), trace.events.end(), [](const event_t& a, const event_t& b) {
+		return a.tid != b.tid ? a.tid < b.tid : a.tsc < b.tsc;
+	});
+
+	std::FILE* const out{argc > 2 ? std::fopen(argv[2], "w") : stdout};
+	if (out == nullptr) {
+		std::fprintf(stderr, "unable to write %s\n", argv[2]);
+		return 1;
+	}
+
+	std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+	bool comma{false};
+	std::unordered_map<std::uint32_t, std::size_t> depth{};
+	for (const auto& event : trace.events) {
+		auto& open{depth[event.tid]};
+		if (event.kind == trace_event_t::end) {
+			/* Its begin was overwritten before the trace was written out */
+			if (open == 0U) {
+				continue;
+			}
+			--open;
+		} else if (event.kind == trace_event_t::begin) {
+			++open;
+		}
+
+		const auto ticks{static_cast<double>(event.tsc) - static_cast<double>(first.tsc)};
+		const auto us{((ticks / rate) + static_cast<double>(first.ns)) / 1000.0};
+		const auto name{trace.names.find(event.name)};
+
+		std::fputs(comma ? ",\n" : "\n", out);
+		comma = true;
+		std::fputs("{\"name\":", out);
+		if (name != trace.names.end()) {
+			write_string(out, name->second);
+		} else {
+			std::fprintf(out, "\"#%lu\"", event.name);
+		}
+		std::fprintf(out, ",\"pid\":%u,\"tid\":%u,\"ts\":%.3f", trace.pid, event.tid, us);
+		switch (event.kind) {
+			case trace_event_t::begin:
+				std::fputs(",\"ph\":\"B\"}", out);
+				break;
+			case trace_event_t::end:
+				std::fprintf(out, ",\"ph\":\"E\",\"args\":{\"value\":%lu}}", event.value);
+				break;
+			case trace_event_t::instant:
+				std::fprintf(out, ",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"value\":%lu}}", event.value);
+				break;
+			case trace_event_t::counter:
+				std::fprintf(out, ",\"ph\":\"C\",\"args\":{\"value\":%lu}}", event.value);
+				break;
+		}
+	}
+	std::fputs("\n]}\n", out);
+
+	if (out != stdout) {
+		std::fclose(out);
+	}
+	std::fprintf(stderr, "%zu events, %zu names\n", trace.events.size(), trace.names.size());
+	return 0;
+}
@@ -1,7 +1,48 @@
 # SPDX-License-Identifier: BSD-3-Clause
 
 from . import proc
+from . import hooks
+from . import elf
+from . import modules
+from . import symbols
+from . import profiler
+from . import startup
+from . import channels
+from . import interpreters
+from . import stats
+from . import trace
+from . import heap
+from . import io
+from . import locks
+from . import metrics
 
 __all__ = (
+    'histogram',
     'proc',
+    'hooks',
+    'elf',
+    'modules',
+    'symbols',
+    'profiler',
+    'startup',
+    'channels',
+    'interpreters',
+    'stats',
+    'trace',
+    'heap',
+    'io',
+    'locks',
+    'metrics',
 )
+
+class histogram:
+	count: int
+	sum: int
+	min: int
+	max: int
+
+	def mean(self) -> float: ...
+	def percentile(self, quantile: float) -> int: ...
+	def bins(self) -> list[tuple[int, int, int]]: ...
+
+	def __len__(self) -> int: ...
@@ -0,0 +1,17 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+from collections.abc import Buffer
+
+__all__ = (
+	'open',
+	'send',
+	'receive',
+	'size',
+	'refused',
+)
+
+def open(name: str, capacity: int = 1024, size: int = 256) -> int: ...
+def send(handle: int, data: Buffer) -> bool: ...
+def receive(handle: int) -> bytes | None: ...
+def size(handle: int) -> int: ...
+def refused(handle: int) -> int: ...
@@ -0,0 +1,85 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+from .proc.maps import mapentry
+
+__all__ = (
+	'program_header',
+	'section',
+	'dynamic_entry',
+	'symbol',
+	'note',
+	'relocation',
+	'elf',
+	'self',
+	'trim_self',
+	'from_map',
+)
+
+class program_header:
+	type: int = ...
+	flags: int = ...
+	offset: int = ...
+	vaddr: int = ...
+	paddr: int = ...
+	filesz: int = ...
+	memsz: int = ...
+	align: int = ...
+
+class section:
+	type: int = ...
+	flags: int = ...
+	addr: int = ...
+	offset: int = ...
+	size: int = ...
+	link: int = ...
+	info: int = ...
+	addralign: int = ...
+	entsize: int = ...
+
+class dynamic_entry:
+	tag: int = ...
+	value: int = ...
+
+class symbol:
+	name: str = ...
+	value: int = ...
+	size: int = ...
+	section_index: int = ...
+	type: int = ...
+	bind: int = ...
+	defined: bool = ...
+
+class note:
+	type: int = ...
+	name: str = ...
+	desc: bytes = ...
+
+class relocation:
+	offset: int = ...
+	type: int = ...
+	symbol: int = ...
+	addend: int = ...
+
+class elf:
+	valid: bool = ...
+	type: None | int = ...
+	machine: None | int = ...
+	entry: None | int = ...
+	build_id: None | bytes = ...
+
+	def __init__(self, path: str) -> None: ...
+
+	def program_headers(self) -> list[program_header]: ...
+	def sections(self) -> list[section]: ...
+	def section(self, name: str) -> None | section: ...
+	def section_name(self, section: section) -> str: ...
+	def dynamic(self) -> list[dynamic_entry]: ...
+	def symbols(self) -> list[symbol]: ...
+	def dynamic_symbols(self) -> list[symbol]: ...
+	def notes(self) -> list[note]: ...
+	def relocations(self) -> list[relocation]: ...
+	def vaddr_to_offset(self, vaddr: int) -> None | int: ...
+
+def self() -> elf: ...
+def trim_self() -> None: ...
+def from_map(entry: mapentry) -> None | elf: ...
@@ -0,0 +1,31 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+__all__ = (
+	'heap_stats',
+	'start',
+	'stop',
+	'clear',
+	'running',
+	'stats',
+	'live',
+	'allocated',
+)
+
+class heap_stats:
+	samples: int
+	live_count: int
+	live_bytes: int
+	allocated_count: int
+	allocated_bytes: int
+	elapsed: int
+	sites: int
+
+	def rate(self) -> float: ...
+
+def start(interval: int = 524288) -> bool: ...
+def stop() -> None: ...
+def clear() -> None: ...
+def running() -> bool: ...
+def stats() -> heap_stats: ...
+def live() -> str: ...
+def allocated() -> str: ...
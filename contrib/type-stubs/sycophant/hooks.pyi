@@ -0,0 +1,48 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+from typing import Callable
+
+__all__ = (
+    'hook',
+    'batch',
+    'install',
+    'all',
+    'in_handler',
+)
+
+class hook:
+	address: int
+	original: int
+	nested: bool
+
+	@property
+	def installed(self) -> bool: ...
+	@property
+	def calls(self) -> int: ...
+	@property
+	def bypassed(self) -> int: ...
+	@property
+	def dropped(self) -> int: ...
+
+	def remove(self) -> bool: ...
+
+class batch:
+	def __init__(self) -> None: ...
+
+	def install(
+		self, address: int, handler: Callable[..., None] | str | None = None, nested: bool = False,
+		on_exit: Callable[[int, int], None] | str | None = None
+	) -> hook: ...
+	def remove(self, hook: hook) -> None: ...
+	def commit(self) -> bool: ...
+
+	def __len__(self) -> int: ...
+	def __enter__(self) -> 'batch': ...
+	def __exit__(self, exc_type, exc_value, traceback) -> bool: ...
+
+def install(
+	address: int, handler: Callable[..., None] | str | None = None, nested: bool = False,
+	on_exit: Callable[[int, int], None] | str | None = None
+) -> hook: ...
+def all() -> list[hook]: ...
+def in_handler() -> bool: ...
@@ -0,0 +1,11 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+__all__ = (
+	'supported',
+	'start',
+	'size',
+)
+
+def supported() -> bool: ...
+def start(count: int = 0) -> int: ...
+def size() -> int: ...
@@ -0,0 +1,40 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+from typing import Optional
+
+from . import histogram
+
+__all__ = (
+	'io_entry',
+	'io_snapshot',
+	'start',
+	'stop',
+	'reset',
+	'running',
+	'dropped',
+	'snapshot',
+)
+
+class io_entry:
+	fd: int
+	generation: int
+	op: str
+	path: Optional[str]
+	latency: histogram
+	bytes: histogram
+
+class io_snapshot:
+	taken: int
+	entries: list[io_entry]
+
+	def diff(self, before: io_snapshot) -> io_snapshot: ...
+	def by_path(self) -> list[io_entry]: ...
+
+	def __len__(self) -> int: ...
+
+def start() -> None: ...
+def stop() -> None: ...
+def reset() -> None: ...
+def running() -> bool: ...
+def dropped() -> int: ...
+def snapshot() -> io_snapshot: ...
@@ -0,0 +1,40 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+__all__ = (
+	'lock_counts',
+	'lock_site',
+	'lock_report',
+	'start',
+	'stop',
+	'clear',
+	'running',
+	'dropped',
+	'report',
+)
+
+class lock_counts:
+	waits: int
+	wait_ns: int
+	max_wait_ns: int
+	holds: int
+	hold_ns: int
+	max_hold_ns: int
+
+class lock_site:
+	caller: int
+	name: str
+	counts: lock_counts
+
+class lock_report:
+	address: int
+	kind: str
+	name: str
+	counts: lock_counts
+	sites: list[lock_site]
+
+def start() -> None: ...
+def stop() -> None: ...
+def clear() -> None: ...
+def running() -> bool: ...
+def dropped() -> int: ...
+def report() -> list[lock_report]: ...
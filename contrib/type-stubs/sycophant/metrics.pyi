@@ -0,0 +1,19 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+from typing import Optional
+
+__all__ = (
+	'start',
+	'stop',
+	'update',
+	'running',
+	'name',
+	'dropped',
+)
+
+def start(name: str = '', interval: int = 100, capacity: int = 1024) -> bool: ...
+def stop() -> None: ...
+def update() -> None: ...
+def running() -> bool: ...
+def name() -> Optional[str]: ...
+def dropped() -> int: ...
@@ -0,0 +1,39 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+from typing import Optional
+
+__all__ = (
+	'segment',
+	'module',
+	'all',
+	'refresh',
+	'resolve',
+	'find',
+)
+
+class segment:
+	start: int
+	end: int
+	offset: int
+	flags: int
+
+class module:
+	name: str
+	path: str
+	bias: int
+	start: int
+	end: int
+	segments: list[segment]
+	tls_modid: int
+
+	@property
+	def dynamic(self) -> int: ...
+	@property
+	def build_id(self) -> Optional[bytes]: ...
+
+	def contains(self, address: int) -> bool: ...
+
+def all() -> list[module]: ...
+def refresh() -> bool: ...
+def resolve(address: int) -> Optional[tuple[module, int]]: ...
+def find(name: str) -> Optional[module]: ...
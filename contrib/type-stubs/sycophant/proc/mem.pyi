@@ -3,7 +3,20 @@
 __all__ = (
     'read',
     'write',
+    'patch',
+    'patch_batch',
 )
 
 def read(addr: int, len: int) -> None | bytearray: ...
 def write(addr: int, buff: bytearray) -> int: ...
+def patch(addr: int, buff: bytearray) -> bool: ...
+
+class patch_batch:
+	def __init__(self) -> None: ...
+
+	def add(self, addr: int, buff: bytearray) -> None: ...
+	def commit(self) -> bool: ...
+
+	def __len__(self) -> int: ...
+	def __enter__(self) -> 'patch_batch': ...
+	def __exit__(self, exc_type, exc_value, traceback) -> bool: ...
@@ -1,9 +1,58 @@
 # SPDX-License-Identifier: BSD-3-Clause
 
-from typing import Collection
+from typing import Collection, Union
+
+from .. import histogram
 
 __all__ = (
+    'thread',
     'known',
+    'info',
+    'snapshot',
+    'freeze',
+    'routine',
+    'routines',
+    'reset_routines',
 )
 
+class thread:
+	handle: int
+	tid: int
+	name: str
+	start: int
+	created: int
+	creator: int
+
 def known() -> Collection[int]: ...
+def info() -> list[thread]: ...
+def snapshot() -> dict[str, Union[list[int], list[str], str]]: ...
+
+# Every other thread is parked in a signal handler while frozen, possibly holding the malloc
+# arena lock or one of sycophant's own (the heap profiler's, the trace's). Anything in the
+# `with freeze():` block that ends up in malloc, which includes most Python code that creates
+# objects, can deadlock the process. Keep the block to reading memory and patching code.
+class freeze:
+	frozen: bool
+	threads: int
+	suspend_ns: int
+	frozen_ns: int
+	resume_ns: int
+
+	def __init__(self) -> None: ...
+
+	def resume(self) -> None: ...
+
+	def __enter__(self) -> 'freeze': ...
+	def __exit__(self, exc_type, exc_value, traceback) -> bool: ...
+
+class routine:
+	start: int
+	spawned: int
+	returned: int
+	exited: int
+	cancelled: int
+	spawn_latency: histogram
+	lifetime: histogram
+
+def routines() -> list[routine]: ...
+def reset_routines() -> None: ...
@@ -0,0 +1,24 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+__all__ = (
+	'profile_stats',
+	'start',
+	'stop',
+	'clear',
+	'running',
+	'stats',
+	'folded',
+)
+
+class profile_stats:
+	samples: int
+	dropped: int
+	threads: int
+	nodes: int
+
+def start(hz: int = 99) -> bool: ...
+def stop() -> None: ...
+def clear() -> None: ...
+def running() -> bool: ...
+def stats() -> profile_stats: ...
+def folded() -> str: ...
@@ -0,0 +1,18 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+from types import ModuleType
+from importlib.machinery import ModuleSpec
+
+__all__ = (
+	'bundle_importer',
+	'deferred',
+	'main_started',
+)
+
+def deferred() -> bool: ...
+def main_started() -> bool: ...
+
+class bundle_importer:
+	def find_spec(self, fullname: str, path: object = None, target: object = None) -> ModuleSpec | None: ...
+	def create_module(self, spec: ModuleSpec) -> None: ...
+	def exec_module(self, module: ModuleType) -> None: ...
@@ -0,0 +1,11 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+__all__ = (
+	'phases',
+	'counters',
+	'report',
+)
+
+def phases() -> list[tuple[str, int]]: ...
+def counters() -> dict[str, int]: ...
+def report() -> str: ...
@@ -0,0 +1,40 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+from typing import Optional
+
+from .modules import module
+
+__all__ = (
+	'symbolized',
+	'lookup',
+	'lookup_many',
+	'refresh',
+	'modules',
+	'symbolize',
+	'symbolize_many',
+	'function_bounds',
+	'ingest',
+	'wait',
+	'pending',
+)
+
+class symbolized:
+	address: int
+	function: str
+	offset: int
+	file: str
+	line: int
+
+	@property
+	def module(self) -> Optional[module]: ...
+
+def lookup(name: str) -> list[int]: ...
+def lookup_many(names: list[str]) -> dict[str, list[int]]: ...
+def refresh() -> None: ...
+def modules() -> int: ...
+def symbolize(address: int) -> symbolized: ...
+def symbolize_many(addresses: list[int]) -> list[symbolized]: ...
+def function_bounds(address: int) -> Optional[tuple[int, int]]: ...
+def ingest(threads: int = 0, wait: bool = True) -> None: ...
+def wait() -> None: ...
+def pending() -> int: ...
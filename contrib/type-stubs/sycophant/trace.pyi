@@ -0,0 +1,26 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+from typing import Literal
+
+__all__ = (
+	'start',
+	'stop',
+	'flush',
+	'running',
+	'dropped',
+	'begin',
+	'end',
+	'marker',
+	'counter',
+)
+
+def start(path: str, mode: Literal['flight', 'continuous'] = 'flight', size: int = 1048576) -> bool: ...
+def stop() -> None: ...
+def flush() -> None: ...
+def running() -> bool: ...
+def dropped() -> int: ...
+
+def begin(name: str) -> None: ...
+def end(name: str, value: int = 0) -> None: ...
+def marker(name: str, value: int = 0) -> None: ...
+def counter(name: str, value: int) -> None: ...
@@ -0,0 +1,16 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Only importable from the isolated interpreters that run "module:function" hook handlers
+
+from collections.abc import Buffer
+
+__all__ = (
+	'open',
+	'send',
+	'receive',
+	'index',
+)
+
+def open(name: str, capacity: int = 1024, size: int = 256) -> int: ...
+def send(handle: int, data: Buffer) -> bool: ...
+def receive(handle: int) -> bytes | None: ...
+def index() -> int: ...
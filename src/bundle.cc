@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* bundle.cc - Precompiled hook module bundles */
+#include <fcntl.h>
+#include <algorithm>
+
+#include <fd.hh>
+#include <bundle.hh>
+
+namespace sycophant {
+	namespace {
+		[[nodiscard]]
+		std::string_view record_name(const char* const base, const bundle_record_t& record) noexcept {
+			return {base + record.name_offset, record.name_length};
+		}
+	}
+
+	std::string_view bundle_t::name(const bundle_record_t& record) const noexcept {
+		return record_name(_map.address<char>(), record);
+	}
+
+	bool bundle_t::open(const fs::path& path) noexcept {
+		if (valid()) {
+			return false;
+		}
+		auto map{fd_t{path, O_RDONLY | O_CLOEXEC}.map(prot_t::R, MAP_PRIVATE)};
+		if (!map.valid() || map.length() < sizeof(bundle_header_t)) {
+			return false;
+		}
+
+		const auto header{map.address<bundle_header_t>()};
+		const auto len{map.length()};
+		if (header->magic != bundle_magic || header->version != bundle_version ||
+			header->count > (len - sizeof(bundle_header_t)) / sizeof(bundle_record_t)) {
+			return false;
+		}
+
+		const auto records{reinterpret_cast<const bundle_record_t*>(header + 1)};
+		const auto in_bounds{[len](const std::uint32_t offset, const std::uint32_t length) {
+			return offset <= len && length <= len - offset;
+		}};
+		for (std::uint32_t idx{}; idx < header->count; ++idx) {
+			const auto& record{records[idx]};
+			if (!in_bounds(record.name_offset, record.name_length) || !in_bounds(record.code_offset, record.code_length)) {
+				return false;
+			}
+		}
+
+		/* Lookups are a binary search, so don't take the builder's word that they're sorted */
+		const auto base{map.address<char>()};
+		const auto sorted{std::is_sorted(records, records + header->count, [base](const bundle_record_t& a, const bundle_record_t& b) {
+			return record_name(base, a) < record_name(base, b);
+		})};
+		if (!sorted) {
+			return false;
+		}
+
+		_map = std::move(map);
+		_header = header;
+		_records = records;
+		return true;
+	}
+
+	std::optional<bundle_module_t> bundle_t::find(const std::string_view module) const noexcept {
+		if (!valid()) {
+			return std::nullopt;
+		}
+		const auto end{_records + _header->count};
+		const auto record{std::lower_bound(_records, end, module, [this](const bundle_record_t& rec, const std::string_view val) {
+			return name(rec) < val;
+		})};
+		if (record == end || name(*record) != module) {
+			return std::nullopt;
+		}
+		return bundle_module_t{
+			module, _map.address<char>() + record->code_offset, record->code_length, (record->flags & bundle_package) != 0U
+		};
+	}
+}
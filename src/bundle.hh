@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* bundle.hh - Precompiled hook module bundles */
+#pragma once
+#if !defined(SYCOPHANT_BUNDLE_HH)
+#define SYCOPHANT_BUNDLE_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <string_view>
+#include <optional>
+#include <filesystem>
+
+#include <mmap.hh>
+
+namespace fs = std::filesystem;
+
+namespace sycophant {
+	/*
+		The on-disk layout, all little-endian. The header is followed by `count` records sorted by
+		module name, the names and marshalled code objects they point at can be anywhere after them.
+	*/
+	struct bundle_header_t final {
+		std::array<char, 8> magic;
+		std::uint32_t version;
+		/* importlib.util.MAGIC_NUMBER of the Python that compiled it */
+		std::uint32_t pyc_magic;
+		std::uint32_t count;
+		std::uint32_t reserved;
+	};
+
+	struct bundle_record_t final {
+		std::uint32_t name_offset;
+		std::uint32_t name_length;
+		std::uint32_t code_offset;
+		std::uint32_t code_length;
+		std::uint32_t flags;
+	};
+
+	inline constexpr std::array<char, 8> bundle_magic{{'S', 'Y', 'C', 'O', 'B', 'N', 'D', 'L'}};
+	inline constexpr std::uint32_t bundle_version{1U};
+	inline constexpr std::uint32_t bundle_package{1U << 0U};
+
+	struct bundle_module_t final {
+		std::string_view name;
+		const char* code;
+		std::size_t length;
+		bool package;
+	};
+
+	/*
+		A set of modules compiled ahead of time by contrib/bundle/sycophant-bundle, mapped read-only
+		and looked up by name so importing out of it never touches the filesystem. Everything is
+		bounds checked once when it's opened.
+	*/
+	struct bundle_t final {
+	private:
+		mmap_t _map{};
+		const bundle_header_t* _header{nullptr};
+		const bundle_record_t* _records{nullptr};
+
+		[[nodiscard]]
+		std::string_view name(const bundle_record_t& record) const noexcept;
+
+	public:
+		bundle_t() noexcept = default;
+
+		bundle_t(const bundle_t&) = delete;
+		bundle_t& operator=(const bundle_t&) = delete;
+
+		[[nodiscard]]
+		bool open(const fs::path& path) noexcept;
+
+		[[nodiscard]]
+		bool valid() const noexcept { return _header != nullptr; }
+		[[nodiscard]]
+		std::uint32_t pyc_magic() const noexcept { return valid() ? _header->pyc_magic : 0U; }
+		[[nodiscard]]
+		std::size_t size() const noexcept { return valid() ? _header->count : 0U; }
+
+		[[nodiscard]]
+		std::optional<bundle_module_t> find(std::string_view name) const noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_BUNDLE_HH */
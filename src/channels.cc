@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* channels.cc - Lock-free message channels shared between interpreters */
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <channels.hh>
+
+namespace sycophant {
+	namespace {
+		[[nodiscard]]
+		std::uint32_t round_capacity(const std::uint32_t capacity) {
+			if (capacity == 0U || capacity > (1U << 24U)) {
+				throw std::invalid_argument("channel capacity must be between 1 and 16777216");
+			}
+			std::uint32_t res{1U};
+			while (res < capacity) {
+				res <<= 1U;
+			}
+			return res;
+		}
+	}
+
+	channel_t::channel_t(const std::string_view name, const std::uint32_t capacity, const std::uint32_t message_size) :
+		_capacity{round_capacity(capacity)}, _message_size{message_size},
+		_cells{std::make_unique<cell_t[]>(_capacity)},
+		_messages{std::make_unique<std::uint8_t[]>(std::size_t{_capacity} * message_size)} {
+		if (name.empty() || name.size() >= _name.size()) {
+			throw std::invalid_argument("channel names must be between 1 and 63 characters");
+		}
+		std::copy(name.begin(), name.end(), _name.begin());
+		for (std::uint32_t idx{}; idx < _capacity; ++idx) {
+			_cells[idx].sequence.store(idx, std::memory_order_relaxed);
+		}
+	}
+
+	std::size_t channel_t::size() const noexcept {
+		const auto head{_head.load(std::memory_order_relaxed)};
+		const auto tail{_tail.load(std::memory_order_relaxed)};
+		return head > tail ? static_cast<std::size_t>(std::min<std::uint64_t>(head - tail, _capacity)) : 0U;
+	}
+
+	bool channel_t::send(const void* const data, const std::size_t length) noexcept {
+		if (length > _message_size) {
+			_refused.fetch_add(1U, std::memory_order_relaxed);
+			return false;
+		}
+		auto pos{_head.load(std::memory_order_relaxed)};
+		for (;;) {
+			auto& cell{_cells[pos & (_capacity - 1U)]};
+			const auto seq{cell.sequence.load(std::memory_order_acquire)};
+			const auto diff{static_cast<std::int64_t>(seq - pos)};
+			if (diff == 0) {
+				if (_head.compare_exchange_weak(pos, pos + 1U, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				_refused.fetch_add(1U, std::memory_order_relaxed);
+				return false;
+			} else {
+				pos = _head.load(std::memory_order_relaxed);
+			}
+		}
+		auto& cell{_cells[pos & (_capacity - 1U)]};
+		if (length != 0U) {
+			std::memcpy(message(pos), data, length);
+		}
+		cell.length = static_cast<std::uint32_t>(length);
+		cell.sequence.store(pos + 1U, std::memory_order_release);
+		return true;
+	}
+
+	channel_registry_t::~channel_registry_t() noexcept {
+		for (auto& channel : _channels) {
+			delete channel.load(std::memory_order_relaxed);
+		}
+	}
+
+	std::int32_t channel_registry_t::open(const std::string_view name, const std::uint32_t capacity, const std::uint32_t message_size) {
+		std::unique_ptr<channel_t> created{};
+		for (std::size_t idx{}; idx < _channels.size(); ++idx) {
+			auto current{_channels[idx].load(std::memory_order_acquire)};
+			if (current == nullptr) {
+				if (!created) {
+					created = std::make_unique<channel_t>(name, capacity, message_size);
+				}
+				if (_channels[idx].compare_exchange_strong(current, created.get(), std::memory_order_acq_rel)) {
+					static_cast<void>(created.release());
+					return static_cast<std::int32_t>(idx);
+				}
+				/* Someone else got the slot first, it might even be the same name */
+			}
+			if (current->name() == name) {
+				return static_cast<std::int32_t>(idx);
+			}
+		}
+		return -1;
+	}
+
+	channel_t* channel_registry_t::get(const std::int32_t handle) const noexcept {
+		if (handle < 0 || static_cast<std::size_t>(handle) >= _channels.size()) {
+			return nullptr;
+		}
+		return _channels[static_cast<std::size_t>(handle)].load(std::memory_order_acquire);
+	}
+}
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* channels.hh - Lock-free message channels shared between interpreters */
+#pragma once
+#if !defined(SYCOPHANT_CHANNELS_HH)
+#define SYCOPHANT_CHANNELS_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string_view>
+
+namespace sycophant {
+	/*
+		A bounded many producer many consumer queue of byte messages (Vyukov's sequence numbered
+		ring). Every cell has room for a fixed size message so nothing is allocated once it exists,
+		a message that doesn't fit or a send into a full channel is refused rather than waited on.
+	*/
+	struct channel_t final {
+	private:
+		struct cell_t final {
+			std::atomic<std::uint64_t> sequence;
+			std::uint32_t length;
+		};
+
+		std::array<char, 64> _name{};
+		const std::uint32_t _capacity;
+		const std::uint32_t _message_size;
+		std::unique_ptr<cell_t[]> _cells;
+		std::unique_ptr<std::uint8_t[]> _messages;
+
+		alignas(64) std::atomic<std::uint64_t> _head{0U};
+		alignas(64) std::atomic<std::uint64_t> _tail{0U};
+		alignas(64) std::atomic<std::uint64_t> _refused{0U};
+
+		[[nodiscard]]
+		std::uint8_t* message(const std::uint64_t pos) const noexcept {
+			return _messages.get() + ((pos & (_capacity - 1U)) * _message_size);
+		}
+
+	public:
+		/* `capacity` is rounded up to a power of two */
+		channel_t(std::string_view name, std::uint32_t capacity, std::uint32_t message_size);
+
+		channel_t(const channel_t&) = delete;
+		channel_t& operator=(const channel_t&) = delete;
+
+		[[nodiscard]]
+		std::string_view name() const noexcept { return _name.data(); }
+		[[nodiscard]]
+		std::uint32_t capacity() const noexcept { return _capacity; }
+		[[nodiscard]]
+		std::uint32_t message_size() const noexcept { return _message_size; }
+		/* Sends turned away because the channel was full or the message too big */
+		[[nodiscard]]
+		std::uint64_t refused() const noexcept { return _refused.load(std::memory_order_relaxed); }
+		/* Only a hint while anything is sending or receiving */
+		[[nodiscard]]
+		std::size_t size() const noexcept;
+
+		[[nodiscard]]
+		bool send(const void* data, std::size_t length) noexcept;
+
+		/* Hands the oldest message to `consume(const std::uint8_t*, std::size_t)` while it's still in its cell */
+		template<typename consume_t>
+		bool receive(consume_t&& consume) {
+			auto pos{_tail.load(std::memory_order_relaxed)};
+			for (;;) {
+				auto& cell{_cells[pos & (_capacity - 1U)]};
+				const auto seq{cell.sequence.load(std::memory_order_acquire)};
+				const auto diff{static_cast<std::int64_t>(seq - (pos + 1U))};
+				if (diff == 0) {
+					if (_tail.compare_exchange_weak(pos, pos + 1U, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = _tail.load(std::memory_order_relaxed);
+				}
+			}
+			auto& cell{_cells[pos & (_capacity - 1U)]};
+			/* Hand the cell back even if `consume` throws */
+			struct release_t final {
+				std::atomic<std::uint64_t>& sequence;
+				const std::uint64_t next;
+				~release_t() noexcept { sequence.store(next, std::memory_order_release); }
+			} release{cell.sequence, pos + _capacity};
+			consume(static_cast<const std::uint8_t*>(message(pos)), static_cast<std::size_t>(cell.length));
+			return true;
+		}
+	};
+
+	/* Channels are looked up by name and live as long as the process, so handles to them never dangle */
+	struct channel_registry_t final {
+	private:
+		static constexpr std::size_t max_channels{64U};
+		std::array<std::atomic<channel_t*>, max_channels> _channels{};
+
+	public:
+		channel_registry_t() noexcept = default;
+		~channel_registry_t() noexcept;
+
+		channel_registry_t(const channel_registry_t&) = delete;
+		channel_registry_t& operator=(const channel_registry_t&) = delete;
+
+		/* The existing channel called `name` or a new one, the sizes only matter for a new one. -1 if it's full */
+		[[nodiscard]]
+		std::int32_t open(std::string_view name, std::uint32_t capacity, std::uint32_t message_size);
+		[[nodiscard]]
+		channel_t* get(std::int32_t handle) const noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_CHANNELS_HH */
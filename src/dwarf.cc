@@ -0,0 +1,1371 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* dwarf.cc - DWARF line table and call frame lookups */
+#include <cstring>
+#include <array>
+#include <algorithm>
+#include <system_error>
+#include <utility>
+#include <unordered_map>
+
+#include <dwarf.hh>
+
+namespace sycophant {
+	namespace {
+		constexpr std::uint64_t all_units{~std::uint64_t{0U}};
+
+		constexpr std::uint16_t DW_FORM_addr{0x01U};
+		constexpr std::uint16_t DW_FORM_block2{0x03U};
+		constexpr std::uint16_t DW_FORM_block4{0x04U};
+		constexpr std::uint16_t DW_FORM_data2{0x05U};
+		constexpr std::uint16_t DW_FORM_data4{0x06U};
+		constexpr std::uint16_t DW_FORM_data8{0x07U};
+		constexpr std::uint16_t DW_FORM_string{0x08U};
+		constexpr std::uint16_t DW_FORM_block{0x09U};
+		constexpr std::uint16_t DW_FORM_block1{0x0AU};
+		constexpr std::uint16_t DW_FORM_data1{0x0BU};
+		constexpr std::uint16_t DW_FORM_flag{0x0CU};
+		constexpr std::uint16_t DW_FORM_sdata{0x0DU};
+		constexpr std::uint16_t DW_FORM_strp{0x0EU};
+		constexpr std::uint16_t DW_FORM_udata{0x0FU};
+		constexpr std::uint16_t DW_FORM_ref_addr{0x10U};
+		constexpr std::uint16_t DW_FORM_ref1{0x11U};
+		constexpr std::uint16_t DW_FORM_ref2{0x12U};
+		constexpr std::uint16_t DW_FORM_ref4{0x13U};
+		constexpr std::uint16_t DW_FORM_ref8{0x14U};
+		constexpr std::uint16_t DW_FORM_ref_udata{0x15U};
+		constexpr std::uint16_t DW_FORM_indirect{0x16U};
+		constexpr std::uint16_t DW_FORM_sec_offset{0x17U};
+		constexpr std::uint16_t DW_FORM_exprloc{0x18U};
+		constexpr std::uint16_t DW_FORM_flag_present{0x19U};
+		constexpr std::uint16_t DW_FORM_strx{0x1AU};
+		constexpr std::uint16_t DW_FORM_addrx{0x1BU};
+		constexpr std::uint16_t DW_FORM_ref_sup4{0x1CU};
+		constexpr std::uint16_t DW_FORM_strp_sup{0x1DU};
+		constexpr std::uint16_t DW_FORM_data16{0x1EU};
+		constexpr std::uint16_t DW_FORM_line_strp{0x1FU};
+		constexpr std::uint16_t DW_FORM_ref_sig8{0x20U};
+		constexpr std::uint16_t DW_FORM_implicit_const{0x21U};
+		constexpr std::uint16_t DW_FORM_loclistx{0x22U};
+		constexpr std::uint16_t DW_FORM_rnglistx{0x23U};
+		constexpr std::uint16_t DW_FORM_ref_sup8{0x24U};
+		constexpr std::uint16_t DW_FORM_strx1{0x25U};
+		constexpr std::uint16_t DW_FORM_strx2{0x26U};
+		constexpr std::uint16_t DW_FORM_strx3{0x27U};
+		constexpr std::uint16_t DW_FORM_strx4{0x28U};
+		constexpr std::uint16_t DW_FORM_addrx1{0x29U};
+		constexpr std::uint16_t DW_FORM_addrx2{0x2AU};
+		constexpr std::uint16_t DW_FORM_addrx3{0x2BU};
+		constexpr std::uint16_t DW_FORM_addrx4{0x2CU};
+		constexpr std::uint16_t DW_FORM_GNU_addr_index{0x1F01U};
+		constexpr std::uint16_t DW_FORM_GNU_str_index{0x1F02U};
+		constexpr std::uint16_t DW_FORM_GNU_ref_alt{0x1F20U};
+		constexpr std::uint16_t DW_FORM_GNU_strp_alt{0x1F21U};
+
+		constexpr std::uint64_t DW_AT_stmt_list{0x10U};
+		constexpr std::uint64_t DW_AT_comp_dir{0x1BU};
+
+		constexpr std::uint8_t DW_UT_skeleton{0x04U};
+		constexpr std::uint8_t DW_UT_split_compile{0x05U};
+
+		constexpr std::uint64_t DW_LNCT_path{0x1U};
+		constexpr std::uint64_t DW_LNCT_directory_index{0x2U};
+
+		constexpr std::uint8_t DW_LNS_copy{0x01U};
+		constexpr std::uint8_t DW_LNS_advance_pc{0x02U};
+		constexpr std::uint8_t DW_LNS_advance_line{0x03U};
+		constexpr std::uint8_t DW_LNS_set_file{0x04U};
+		constexpr std::uint8_t DW_LNS_const_add_pc{0x08U};
+		constexpr std::uint8_t DW_LNS_fixed_advance_pc{0x09U};
+
+		constexpr std::uint8_t DW_LNE_end_sequence{0x01U};
+		constexpr std::uint8_t DW_LNE_set_address{0x02U};
+		constexpr std::uint8_t DW_LNE_define_file{0x03U};
+
+		constexpr std::uint8_t DW_EH_PE_absptr{0x00U};
+		constexpr std::uint8_t DW_EH_PE_uleb128{0x01U};
+		constexpr std::uint8_t DW_EH_PE_udata2{0x02U};
+		constexpr std::uint8_t DW_EH_PE_udata4{0x03U};
+		constexpr std::uint8_t DW_EH_PE_udata8{0x04U};
+		constexpr std::uint8_t DW_EH_PE_sleb128{0x09U};
+		constexpr std::uint8_t DW_EH_PE_sdata2{0x0AU};
+		constexpr std::uint8_t DW_EH_PE_sdata4{0x0BU};
+		constexpr std::uint8_t DW_EH_PE_sdata8{0x0CU};
+		constexpr std::uint8_t DW_EH_PE_pcrel{0x10U};
+		constexpr std::uint8_t DW_EH_PE_datarel{0x30U};
+		constexpr std::uint8_t DW_EH_PE_indirect{0x80U};
+		constexpr std::uint8_t DW_EH_PE_omit{0xFFU};
+
+		constexpr std::uint8_t DW_CFA_advance_loc{0x40U};
+		constexpr std::uint8_t DW_CFA_offset{0x80U};
+		constexpr std::uint8_t DW_CFA_restore{0xC0U};
+		constexpr std::uint8_t DW_CFA_nop{0x00U};
+		constexpr std::uint8_t DW_CFA_set_loc{0x01U};
+		constexpr std::uint8_t DW_CFA_advance_loc1{0x02U};
+		constexpr std::uint8_t DW_CFA_advance_loc2{0x03U};
+		constexpr std::uint8_t DW_CFA_advance_loc4{0x04U};
+		constexpr std::uint8_t DW_CFA_offset_extended{0x05U};
+		constexpr std::uint8_t DW_CFA_restore_extended{0x06U};
+		constexpr std::uint8_t DW_CFA_undefined{0x07U};
+		constexpr std::uint8_t DW_CFA_same_value{0x08U};
+		constexpr std::uint8_t DW_CFA_register{0x09U};
+		constexpr std::uint8_t DW_CFA_remember_state{0x0AU};
+		constexpr std::uint8_t DW_CFA_restore_state{0x0BU};
+		constexpr std::uint8_t DW_CFA_def_cfa{0x0CU};
+		constexpr std::uint8_t DW_CFA_def_cfa_register{0x0DU};
+		constexpr std::uint8_t DW_CFA_def_cfa_offset{0x0EU};
+		constexpr std::uint8_t DW_CFA_def_cfa_expression{0x0FU};
+		constexpr std::uint8_t DW_CFA_expression{0x10U};
+		constexpr std::uint8_t DW_CFA_offset_extended_sf{0x11U};
+		constexpr std::uint8_t DW_CFA_def_cfa_sf{0x12U};
+		constexpr std::uint8_t DW_CFA_def_cfa_offset_sf{0x13U};
+		constexpr std::uint8_t DW_CFA_val_offset{0x14U};
+		constexpr std::uint8_t DW_CFA_val_offset_sf{0x15U};
+		constexpr std::uint8_t DW_CFA_val_expression{0x16U};
+		constexpr std::uint8_t DW_CFA_GNU_args_size{0x2EU};
+		constexpr std::uint8_t DW_CFA_GNU_negative_offset_extended{0x2FU};
+
+		/* The x86_64 DWARF register numbers we care about */
+		constexpr std::uint64_t dwarf_rbp{6U};
+		constexpr std::uint64_t dwarf_rsp{7U};
+
+		/* A bounds checked cursor over a debug section, reading past the end sets `ok` to false and yields zeros */
+		struct reader_t final {
+			const std::uint8_t* cur;
+			const std::uint8_t* end;
+			bool ok{true};
+
+			reader_t(const elf_bytes_t data) noexcept : cur{data.data}, end{data.data + data.size} { }
+			reader_t(const std::uint8_t* begin, const std::uint8_t* last) noexcept : cur{begin}, end{last} { }
+
+			[[nodiscard]]
+			std::size_t remaining() const noexcept { return ok ? static_cast<std::size_t>(end - cur) : 0U; }
+
+			[[nodiscard]]
+			bool skip(const std::uint64_t len) noexcept {
+				if (!ok || len > remaining()) {
+					ok = false;
+					return false;
+				}
+				cur += len;
+				return true;
+			}
+
+			[[nodiscard]]
+			std::uint64_t fixed(const std::size_t len) noexcept {
+				const auto ptr{cur};
+				if (len > 8U || !skip(len)) {
+					return 0U;
+				}
+				std::uint64_t val{0U};
+				std::memcpy(&val, ptr, len);
+				return val;
+			}
+
+			std::uint8_t u8() noexcept { return static_cast<std::uint8_t>(fixed(1U)); }
+			std::uint16_t u16() noexcept { return static_cast<std::uint16_t>(fixed(2U)); }
+			std::uint32_t u32() noexcept { return static_cast<std::uint32_t>(fixed(4U)); }
+			std::uint64_t u64() noexcept { return fixed(8U); }
+
+			std::uint64_t uleb() noexcept {
+				std::uint64_t val{0U};
+				for (std::uint32_t shift{0U}; ok; shift += 7U) {
+					const auto byte{u8()};
+					if (shift < 64U) {
+						val |= std::uint64_t{byte & 0x7FU} << shift;
+					}
+					if ((byte & 0x80U) == 0U) {
+						break;
+					}
+				}
+				return val;
+			}
+
+			std::int64_t sleb() noexcept {
+				std::uint64_t val{0U};
+				std::uint32_t shift{0U};
+				std::uint8_t byte{0x80U};
+				while (ok && (byte & 0x80U) != 0U) {
+					byte = u8();
+					if (shift < 64U) {
+						val |= std::uint64_t{byte & 0x7FU} << shift;
+					}
+					shift += 7U;
+				}
+				if (shift < 64U && (byte & 0x40U) != 0U) {
+					val |= ~std::uint64_t{0U} << shift;
+				}
+				return static_cast<std::int64_t>(val);
+			}
+
+			std::string_view cstr() noexcept {
+				const auto len{::strnlen(reinterpret_cast<const char*>(cur), remaining())};
+				const std::string_view str{reinterpret_cast<const char*>(cur), len};
+				if (!skip(len + 1U)) {
+					return {};
+				}
+				return str;
+			}
+
+			/* Reads an initial length, setting `dwarf64` and returning a reader over just the unit */
+			[[nodiscard]]
+			reader_t unit(bool& dwarf64) noexcept {
+				auto len{static_cast<std::uint64_t>(u32())};
+				dwarf64 = len == 0xFFFFFFFFU;
+				if (dwarf64) {
+					len = u64();
+				}
+				const auto begin{cur};
+				if (!skip(len)) {
+					return {begin, begin};
+				}
+				return {begin, cur};
+			}
+
+			std::uint64_t offset(const bool dwarf64) noexcept { return dwarf64 ? u64() : u32(); }
+		};
+
+		[[nodiscard]]
+		std::string_view string_at(const elf_bytes_t sect, const std::uint64_t offset) noexcept {
+			if (offset >= sect.size) {
+				return {};
+			}
+			const auto str{reinterpret_cast<const char*>(sect.data + offset)};
+			return {str, ::strnlen(str, sect.size - offset)};
+		}
+
+		struct form_ctx_t final {
+			std::uint8_t address_size;
+			std::uint16_t version;
+			bool dwarf64;
+		};
+
+		/* Skips over an attribute value, returns false if the form is unknown */
+		bool skip_form(reader_t& rd, std::uint64_t form, const form_ctx_t& ctx) noexcept {
+			const auto off_size{ctx.dwarf64 ? 8U : 4U};
+			switch (form) {
+				case DW_FORM_flag_present:
+				case DW_FORM_implicit_const:
+					return true;
+				case DW_FORM_addr:
+					return rd.skip(ctx.address_size);
+				case DW_FORM_data1: case DW_FORM_ref1: case DW_FORM_flag: case DW_FORM_strx1: case DW_FORM_addrx1:
+					return rd.skip(1U);
+				case DW_FORM_data2: case DW_FORM_ref2: case DW_FORM_strx2: case DW_FORM_addrx2:
+					return rd.skip(2U);
+				case DW_FORM_strx3: case DW_FORM_addrx3:
+					return rd.skip(3U);
+				case DW_FORM_data4: case DW_FORM_ref4: case DW_FORM_ref_sup4: case DW_FORM_strx4: case DW_FORM_addrx4:
+					return rd.skip(4U);
+				case DW_FORM_data8: case DW_FORM_ref8: case DW_FORM_ref_sig8: case DW_FORM_ref_sup8:
+					return rd.skip(8U);
+				case DW_FORM_data16:
+					return rd.skip(16U);
+				case DW_FORM_strp: case DW_FORM_sec_offset: case DW_FORM_line_strp: case DW_FORM_strp_sup:
+				case DW_FORM_GNU_ref_alt: case DW_FORM_GNU_strp_alt:
+					return rd.skip(off_size);
+				case DW_FORM_ref_addr:
+					return rd.skip(ctx.version <= 2U ? ctx.address_size : off_size);
+				case DW_FORM_sdata:
+					static_cast<void>(rd.sleb());
+					return rd.ok;
+				case DW_FORM_udata: case DW_FORM_ref_udata: case DW_FORM_strx: case DW_FORM_addrx:
+				case DW_FORM_loclistx: case DW_FORM_rnglistx: case DW_FORM_GNU_addr_index: case DW_FORM_GNU_str_index:
+					static_cast<void>(rd.uleb());
+					return rd.ok;
+				case DW_FORM_string:
+					static_cast<void>(rd.cstr());
+					return rd.ok;
+				case DW_FORM_block1:
+					return rd.skip(rd.u8());
+				case DW_FORM_block2:
+					return rd.skip(rd.u16());
+				case DW_FORM_block4:
+					return rd.skip(rd.u32());
+				case DW_FORM_block: case DW_FORM_exprloc:
+					return rd.skip(rd.uleb());
+				case DW_FORM_indirect:
+					form = rd.uleb();
+					return form != DW_FORM_indirect && skip_form(rd, form, ctx);
+				default:
+					return false;
+			}
+		}
+
+		struct line_header_t final {
+			std::uint16_t version;
+			bool dwarf64;
+			std::uint8_t address_size;
+			std::uint8_t min_inst_len;
+			std::uint8_t max_ops;
+			bool default_is_stmt;
+			std::int8_t line_base;
+			std::uint8_t line_range;
+			std::uint8_t opcode_base;
+			std::array<std::uint8_t, 256> std_lengths;
+		};
+
+		[[nodiscard]]
+		std::string join_path(const std::string_view dir, const std::string_view name) {
+			if (name.empty() || name.front() == '/' || dir.empty()) {
+				return std::string{name};
+			}
+			return (fs::path{dir} / name).lexically_normal().string();
+		}
+
+		/* Reads a DWARF 5 directory or file name table, only the path and directory index are kept */
+		[[nodiscard]]
+		bool read_entry_table(
+			reader_t& rd, const line_header_t& hdr, const elf_bytes_t line_str, const elf_bytes_t str,
+			std::vector<std::pair<std::string_view, std::uint64_t>>& entries
+		) {
+			const auto format_count{rd.u8()};
+			std::vector<std::pair<std::uint64_t, std::uint64_t>> format{};
+			for (std::uint8_t idx{}; idx < format_count && rd.ok; ++idx) {
+				const auto type{rd.uleb()};
+				const auto form{rd.uleb()};
+				format.emplace_back(type, form);
+			}
+
+			const form_ctx_t ctx{hdr.address_size, hdr.version, hdr.dwarf64};
+			const auto count{rd.uleb()};
+			for (std::uint64_t entry{}; entry < count && rd.ok; ++entry) {
+				std::string_view path{};
+				std::uint64_t dir{0U};
+				for (const auto& [type, form] : format) {
+					if (type == DW_LNCT_path) {
+						switch (form) {
+							case DW_FORM_string: path = rd.cstr(); break;
+							case DW_FORM_line_strp: path = string_at(line_str, rd.offset(hdr.dwarf64)); break;
+							case DW_FORM_strp: path = string_at(str, rd.offset(hdr.dwarf64)); break;
+							default: if (!skip_form(rd, form, ctx)) { return false; } break;
+						}
+					} else if (type == DW_LNCT_directory_index) {
+						switch (form) {
+							case DW_FORM_data1: dir = rd.u8(); break;
+							case DW_FORM_data2: dir = rd.u16(); break;
+							case DW_FORM_udata: dir = rd.uleb(); break;
+							default: if (!skip_form(rd, form, ctx)) { return false; } break;
+						}
+					} else if (!skip_form(rd, form, ctx)) {
+						return false;
+					}
+				}
+				entries.emplace_back(path, dir);
+			}
+			return rd.ok;
+		}
+
+		/* Decodes one line program starting at `rd`, appending its rows and files to `lines` */
+		void decode_program(
+			reader_t& rd, const elf_bytes_t line_str, const elf_bytes_t str, const std::string_view comp_dir,
+			dwarf_lines_t& lines
+		) {
+			line_header_t hdr{};
+			auto unit{rd.unit(hdr.dwarf64)};
+			hdr.version = unit.u16();
+			if (!unit.ok || hdr.version < 2U || hdr.version > 5U) {
+				return;
+			}
+			hdr.address_size = 8U;
+			if (hdr.version >= 5U) {
+				hdr.address_size = unit.u8();
+				static_cast<void>(unit.u8());
+			}
+			const auto header_len{unit.offset(hdr.dwarf64)};
+			auto program{unit};
+			if (!program.skip(header_len)) {
+				return;
+			}
+			hdr.min_inst_len = unit.u8();
+			hdr.max_ops = hdr.version >= 4U ? unit.u8() : std::uint8_t{1U};
+			hdr.default_is_stmt = unit.u8() != 0U;
+			hdr.line_base = static_cast<std::int8_t>(unit.u8());
+			hdr.line_range = unit.u8();
+			hdr.opcode_base = unit.u8();
+			if (!unit.ok || hdr.line_range == 0U || hdr.opcode_base == 0U) {
+				return;
+			}
+			hdr.std_lengths.fill(0U);
+			for (std::size_t idx{1U}; idx < hdr.opcode_base; ++idx) {
+				hdr.std_lengths[idx] = unit.u8();
+			}
+
+			/* Files get indices into `lines.files` so units can share a single table */
+			const auto file_base{lines.files.size()};
+			std::size_t file_bias{0U};
+			if (hdr.version >= 5U) {
+				std::vector<std::pair<std::string_view, std::uint64_t>> dirs{};
+				std::vector<std::pair<std::string_view, std::uint64_t>> files{};
+				if (!read_entry_table(unit, hdr, line_str, str, dirs) || !read_entry_table(unit, hdr, line_str, str, files)) {
+					return;
+				}
+				const auto base_dir{dirs.empty() ? comp_dir : dirs.front().first};
+				for (const auto& [name, dir] : files) {
+					auto dir_name{dir < dirs.size() ? dirs[dir].first : std::string_view{}};
+					lines.files.push_back(join_path(base_dir, join_path(dir_name, name)));
+				}
+			} else {
+				std::vector<std::string_view> dirs{comp_dir};
+				for (auto dir{unit.cstr()}; unit.ok && !dir.empty(); dir = unit.cstr()) {
+					dirs.push_back(dir);
+				}
+				for (auto name{unit.cstr()}; unit.ok && !name.empty(); name = unit.cstr()) {
+					const auto dir{unit.uleb()};
+					static_cast<void>(unit.uleb());
+					static_cast<void>(unit.uleb());
+					auto dir_name{dir < dirs.size() ? dirs[dir] : std::string_view{}};
+					lines.files.push_back(join_path(comp_dir, join_path(dir_name, name)));
+				}
+				/* File numbers before DWARF 5 start at 1 */
+				file_bias = 1U;
+			}
+
+			std::vector<dwarf_row_t> sequence{};
+			std::uint64_t address{0U};
+			std::uint64_t file{1U};
+			std::int64_t line{1};
+			const auto reset = [&]() noexcept {
+				address = 0U;
+				file = 1U;
+				line = 1;
+			};
+			const auto emit = [&](const bool end) {
+				const auto file_idx{file >= file_bias ? file_base + (file - file_bias) : lines.files.size()};
+				sequence.push_back({
+					address, static_cast<std::uint32_t>(file_idx < lines.files.size() ? file_idx : ~0U),
+					static_cast<std::uint32_t>(line), end
+				});
+				if (end) {
+					/* Sequences at 0 (or a tombstone) are functions the linker threw away */
+					if (sequence.front().address != 0U && sequence.front().address != ~std::uint64_t{0U}) {
+						lines.rows.insert(lines.rows.end(), sequence.begin(), sequence.end());
+					}
+					sequence.clear();
+				}
+			};
+
+			while (program.ok && program.remaining() != 0U) {
+				const auto opcode{program.u8()};
+				if (opcode >= hdr.opcode_base) {
+					const auto adjusted{static_cast<std::uint8_t>(opcode - hdr.opcode_base)};
+					address += std::uint64_t{hdr.min_inst_len} * (adjusted / hdr.line_range);
+					line += hdr.line_base + (adjusted % hdr.line_range);
+					emit(false);
+					continue;
+				}
+				switch (opcode) {
+					case 0U: {
+						const auto len{program.uleb()};
+						if (len == 0U) {
+							break;
+						}
+						auto ext{reader_t{program.cur, program.cur + std::min<std::uint64_t>(len, program.remaining())}};
+						if (!program.skip(len)) {
+							break;
+						}
+						switch (ext.u8()) {
+							case DW_LNE_end_sequence:
+								emit(true);
+								reset();
+								break;
+							case DW_LNE_set_address:
+								address = ext.fixed(static_cast<std::size_t>(len - 1U));
+								break;
+							case DW_LNE_define_file:
+								lines.files.push_back(join_path(comp_dir, ext.cstr()));
+								break;
+							default:
+								break;
+						}
+						break;
+					}
+					case DW_LNS_copy:
+						emit(false);
+						break;
+					case DW_LNS_advance_pc:
+						address += std::uint64_t{hdr.min_inst_len} * program.uleb();
+						break;
+					case DW_LNS_advance_line:
+						line += program.sleb();
+						break;
+					case DW_LNS_set_file:
+						file = program.uleb();
+						break;
+					case DW_LNS_const_add_pc:
+						address += std::uint64_t{hdr.min_inst_len} * ((255U - hdr.opcode_base) / hdr.line_range);
+						break;
+					case DW_LNS_fixed_advance_pc:
+						address += program.u16();
+						break;
+					default:
+						/* Everything else only carries ULEB operands we don't care about */
+						for (std::uint8_t arg{}; arg < hdr.std_lengths[opcode]; ++arg) {
+							static_cast<void>(program.uleb());
+						}
+						break;
+				}
+			}
+		}
+
+		void sort_rows(dwarf_lines_t& lines) {
+			/* End rows sort first so a sequence starting where another ends wins */
+			std::stable_sort(lines.rows.begin(), lines.rows.end(), [](const dwarf_row_t& a, const dwarf_row_t& b) {
+				if (a.address != b.address) {
+					return a.address < b.address;
+				}
+				return a.end && !b.end;
+			});
+		}
+
+		[[nodiscard]]
+		bool has_lines(const elf_t& image) noexcept {
+			const auto sect{image.section(".debug_line")};
+			return sect != nullptr && sect->sh_type != SHT_NOBITS && (sect->sh_flags & SHF_COMPRESSED) == 0U;
+		}
+
+		[[nodiscard]]
+		std::string hex(const elf_bytes_t bytes) {
+			constexpr std::string_view digits{"0123456789abcdef"};
+			std::string res{};
+			res.reserve(bytes.size * 2U);
+			for (std::size_t idx{}; idx < bytes.size; ++idx) {
+				res.push_back(digits[bytes.data[idx] >> 4U]);
+				res.push_back(digits[bytes.data[idx] & 0x0FU]);
+			}
+			return res;
+		}
+
+		[[nodiscard]]
+		bool matches(const elf_t& debug, const elf_bytes_t build_id) noexcept {
+			if (!debug.valid()) {
+				return false;
+			}
+			if (build_id.empty()) {
+				return true;
+			}
+			const auto id{debug.build_id()};
+			return !id || (id->size == build_id.size && std::memcmp(id->data, build_id.data, build_id.size) == 0);
+		}
+		/*
+			Reads a pointer encoded as in .eh_frame, `pc` relative values are relative to where they sit
+			in memory and `data` relative ones to the start of .eh_frame_hdr. Indirect and function or
+			text relative pointers aren't used for anything we read and come back empty.
+		*/
+		[[nodiscard]]
+		std::optional<std::uint64_t> read_encoded(reader_t& rd, const std::uint8_t enc, const std::uintptr_t data) noexcept {
+			if (enc == DW_EH_PE_omit || (enc & DW_EH_PE_indirect) != 0U) {
+				return std::nullopt;
+			}
+			const auto pc{reinterpret_cast<std::uintptr_t>(rd.cur)};
+			std::uint64_t val{};
+			switch (enc & 0x0FU) {
+				case DW_EH_PE_absptr: val = rd.u64(); break;
+				case DW_EH_PE_uleb128: val = rd.uleb(); break;
+				case DW_EH_PE_udata2: val = rd.u16(); break;
+				case DW_EH_PE_udata4: val = rd.u32(); break;
+				case DW_EH_PE_udata8: val = rd.u64(); break;
+				case DW_EH_PE_sleb128: val = static_cast<std::uint64_t>(rd.sleb()); break;
+				case DW_EH_PE_sdata2: val = static_cast<std::uint64_t>(static_cast<std::int16_t>(rd.u16())); break;
+				case DW_EH_PE_sdata4: val = static_cast<std::uint64_t>(static_cast<std::int32_t>(rd.u32())); break;
+				case DW_EH_PE_sdata8: val = rd.u64(); break;
+				default: return std::nullopt;
+			}
+			if (!rd.ok) {
+				return std::nullopt;
+			}
+			switch (enc & 0x70U) {
+				case DW_EH_PE_absptr: return val;
+				case DW_EH_PE_pcrel: return pc + val;
+				case DW_EH_PE_datarel: return data + val;
+				default: return std::nullopt;
+			}
+		}
+
+		struct cie_t final {
+			std::uint64_t code_align;
+			std::int64_t data_align;
+			std::uint64_t ra;
+			/* How the FDE's addresses are encoded */
+			std::uint8_t enc;
+			/* Whether FDEs have augmentation data to skip */
+			bool augmented;
+			/* The CFI for signal trampolines, where the return address isn't one */
+			bool signal;
+			reader_t program;
+		};
+
+		/* Parses a CIE from just after its id */
+		[[nodiscard]]
+		std::optional<cie_t> parse_cie(reader_t cie) noexcept {
+			const auto version{cie.u8()};
+			const auto augmentation{cie.cstr()};
+			if (!cie.ok || (!augmentation.empty() && augmentation.front() != 'z')) {
+				return std::nullopt;
+			}
+			if (augmentation.find("eh") != std::string_view::npos) {
+				static_cast<void>(cie.u64());
+			}
+			cie_t res{cie.uleb(), cie.sleb(), 0U, DW_EH_PE_absptr, !augmentation.empty(), false, {nullptr, nullptr}};
+			res.ra = version == 1U ? cie.u8() : cie.uleb();
+			if (!res.augmented) {
+				res.program = cie;
+				return cie.ok ? std::make_optional(res) : std::nullopt;
+			}
+
+			const auto aug_len{cie.uleb()};
+			const auto aug_end{cie.cur + std::min<std::uint64_t>(aug_len, cie.remaining())};
+			for (const auto aug : augmentation.substr(1U)) {
+				switch (aug) {
+					case 'R':
+						res.enc = cie.u8();
+						break;
+					case 'P': {
+						const auto enc{cie.u8()};
+						/* We only need to get past it */
+						if (!read_encoded(cie, static_cast<std::uint8_t>(enc & 0x0FU), 0U)) {
+							return std::nullopt;
+						}
+						break;
+					}
+					case 'L':
+						static_cast<void>(cie.u8());
+						break;
+					case 'S':
+						res.signal = true;
+						break;
+					case 'B':
+						break;
+					default:
+						/* The length lets us skip anything we don't know, but not whatever it means for the FDEs */
+						return std::nullopt;
+				}
+			}
+			if (!cie.ok || cie.cur > aug_end) {
+				return std::nullopt;
+			}
+			res.program = {aug_end, cie.end};
+			return res;
+		}
+
+		/* The FDE pointer encoding from a CIE's augmentation, absptr if it doesn't say */
+		[[nodiscard]]
+		std::optional<std::uint8_t> cie_encoding(reader_t cie) noexcept {
+			if (const auto res = parse_cie(cie)) {
+				return res->enc;
+			}
+			return std::nullopt;
+		}
+
+		struct fde_reader_t final {
+			/* Bounds of the segment .eh_frame lives in */
+			const std::uint8_t* begin;
+			const std::uint8_t* end;
+			std::uintptr_t hdr;
+			std::unordered_map<const std::uint8_t*, std::optional<std::uint8_t>> cies{};
+
+			/* Returns the runtime [start, end) of the FDE at `fde`, or nothing if it's a CIE or malformed */
+			[[nodiscard]]
+			std::optional<std::pair<std::uint64_t, std::uint64_t>> read(const std::uint8_t* fde) {
+				if (fde < begin || fde >= end) {
+					return std::nullopt;
+				}
+				reader_t rd{fde, end};
+				bool dwarf64{false};
+				auto entry{rd.unit(dwarf64)};
+				const auto cie_field{entry.cur};
+				const auto cie_ptr{entry.offset(dwarf64)};
+				if (!entry.ok || cie_ptr == 0U || cie_ptr > static_cast<std::uint64_t>(cie_field - begin)) {
+					return std::nullopt;
+				}
+
+				const auto cie{cie_field - cie_ptr};
+				auto it{cies.find(cie)};
+				if (it == cies.end()) {
+					reader_t cie_rd{cie, end};
+					bool cie64{false};
+					auto body{cie_rd.unit(cie64)};
+					if (body.offset(cie64) != 0U) {
+						it = cies.emplace(cie, std::nullopt).first;
+					} else {
+						it = cies.emplace(cie, cie_encoding(body)).first;
+					}
+				}
+				if (!it->second) {
+					return std::nullopt;
+				}
+
+				const auto enc{*it->second};
+				const auto start{read_encoded(entry, enc, hdr)};
+				const auto range{read_encoded(entry, static_cast<std::uint8_t>(enc & 0x0FU), hdr)};
+				if (!start || !range || *start == 0U || *range == 0U) {
+					return std::nullopt;
+				}
+				return std::make_pair(*start, *start + *range);
+			}
+		};
+
+		struct eh_hdr_t final {
+			std::uintptr_t addr;
+			/* Positioned at the start of the search table */
+			reader_t table;
+			std::uint8_t table_enc;
+			std::optional<std::uint64_t> count;
+			std::uintptr_t frame;
+			const module_segment_t* segment;
+		};
+
+		/* Finds and parses the module's .eh_frame_hdr through PT_GNU_EH_FRAME */
+		[[nodiscard]]
+		std::optional<eh_hdr_t> read_eh_hdr(const module_t& module) noexcept {
+			const Elf64_Phdr* eh_hdr{nullptr};
+			for (std::size_t idx{}; idx < module.phnum; ++idx) {
+				if (module.phdrs[idx].p_type == PT_GNU_EH_FRAME) {
+					eh_hdr = &module.phdrs[idx];
+					break;
+				}
+			}
+			if (eh_hdr == nullptr) {
+				return std::nullopt;
+			}
+
+			const auto addr{module.bias + eh_hdr->p_vaddr};
+			reader_t hdr{reinterpret_cast<const std::uint8_t*>(addr), reinterpret_cast<const std::uint8_t*>(addr + eh_hdr->p_memsz)};
+			const auto version{hdr.u8()};
+			const auto frame_enc{hdr.u8()};
+			const auto count_enc{hdr.u8()};
+			const auto table_enc{hdr.u8()};
+			const auto frame{read_encoded(hdr, frame_enc, addr)};
+			if (version != 1U || !frame) {
+				return std::nullopt;
+			}
+			const auto segment{module.segment(*frame)};
+			if (segment == nullptr) {
+				return std::nullopt;
+			}
+			const auto count{read_encoded(hdr, count_enc, addr)};
+			return eh_hdr_t{addr, hdr, table_enc, count, static_cast<std::uintptr_t>(*frame), segment};
+		}
+
+		struct reg_rule_t final {
+			enum struct kind_t : std::uint8_t {
+				same,
+				undefined,
+				/* Saved at CFA + offset */
+				offset,
+				/* Is CFA + offset */
+				value,
+			} kind;
+			std::int64_t offset;
+		};
+
+		struct cfa_state_t final {
+			std::uint64_t reg;
+			std::int64_t offset;
+			reg_rule_t fp;
+			reg_rule_t ra;
+		};
+
+		/*
+			Runs a CFA program up to `target`, only tracking the CFA and the rules for rbp and the return
+			address since that's all we need to step a frame. Anything we can't follow (expressions, the
+			registers we track being moved into other registers) fails the whole thing.
+		*/
+		[[nodiscard]]
+		bool run_cfa(
+			reader_t prog, const cie_t& cie, std::uint64_t loc, const std::uint64_t target, const std::uintptr_t hdr,
+			cfa_state_t& state, const cfa_state_t& initial
+		) noexcept {
+			constexpr std::size_t max_saved{8U};
+			std::array<cfa_state_t, max_saved> saved{};
+			std::size_t depth{};
+
+			const auto set_rule = [&](const std::uint64_t reg, const reg_rule_t rule) noexcept {
+				if (reg == dwarf_rbp) {
+					state.fp = rule;
+				} else if (reg == cie.ra) {
+					state.ra = rule;
+				}
+			};
+			const auto restore = [&](const std::uint64_t reg) noexcept {
+				if (reg == dwarf_rbp) {
+					state.fp = initial.fp;
+				} else if (reg == cie.ra) {
+					state.ra = initial.ra;
+				}
+			};
+			const auto tracked = [&](const std::uint64_t reg) noexcept {
+				return reg == dwarf_rbp || reg == cie.ra;
+			};
+			const auto advance = [&](const std::uint64_t delta) noexcept {
+				loc += delta * cie.code_align;
+				return loc <= target;
+			};
+			const auto offset = [&](const std::int64_t factored) noexcept {
+				return factored * cie.data_align;
+			};
+
+			while (prog.ok && prog.remaining() > 0U) {
+				const auto op{prog.u8()};
+				const auto low{static_cast<std::uint8_t>(op & 0x3FU)};
+				switch (op & 0xC0U) {
+					case DW_CFA_advance_loc:
+						if (!advance(low)) {
+							return true;
+						}
+						continue;
+					case DW_CFA_offset:
+						set_rule(low, {reg_rule_t::kind_t::offset, offset(static_cast<std::int64_t>(prog.uleb()))});
+						continue;
+					case DW_CFA_restore:
+						restore(low);
+						continue;
+					default:
+						break;
+				}
+
+				switch (op) {
+					case DW_CFA_nop:
+						break;
+					case DW_CFA_set_loc: {
+						const auto addr{read_encoded(prog, cie.enc, hdr)};
+						if (!addr) {
+							return false;
+						}
+						loc = *addr;
+						if (loc > target) {
+							return true;
+						}
+						break;
+					}
+					case DW_CFA_advance_loc1:
+						if (!advance(prog.u8())) {
+							return true;
+						}
+						break;
+					case DW_CFA_advance_loc2:
+						if (!advance(prog.u16())) {
+							return true;
+						}
+						break;
+					case DW_CFA_advance_loc4:
+						if (!advance(prog.u32())) {
+							return true;
+						}
+						break;
+					case DW_CFA_offset_extended: {
+						const auto reg{prog.uleb()};
+						set_rule(reg, {reg_rule_t::kind_t::offset, offset(static_cast<std::int64_t>(prog.uleb()))});
+						break;
+					}
+					case DW_CFA_offset_extended_sf: {
+						const auto reg{prog.uleb()};
+						set_rule(reg, {reg_rule_t::kind_t::offset, offset(prog.sleb())});
+						break;
+					}
+					case DW_CFA_GNU_negative_offset_extended: {
+						const auto reg{prog.uleb()};
+						set_rule(reg, {reg_rule_t::kind_t::offset, -offset(static_cast<std::int64_t>(prog.uleb()))});
+						break;
+					}
+					case DW_CFA_val_offset: {
+						const auto reg{prog.uleb()};
+						set_rule(reg, {reg_rule_t::kind_t::value, offset(static_cast<std::int64_t>(prog.uleb()))});
+						break;
+					}
+					case DW_CFA_val_offset_sf: {
+						const auto reg{prog.uleb()};
+						set_rule(reg, {reg_rule_t::kind_t::value, offset(prog.sleb())});
+						break;
+					}
+					case DW_CFA_restore_extended:
+						restore(prog.uleb());
+						break;
+					case DW_CFA_undefined:
+						set_rule(prog.uleb(), {reg_rule_t::kind_t::undefined, 0});
+						break;
+					case DW_CFA_same_value:
+						set_rule(prog.uleb(), {reg_rule_t::kind_t::same, 0});
+						break;
+					case DW_CFA_register: {
+						const auto reg{prog.uleb()};
+						static_cast<void>(prog.uleb());
+						if (tracked(reg)) {
+							return false;
+						}
+						break;
+					}
+					case DW_CFA_remember_state:
+						if (depth == max_saved) {
+							return false;
+						}
+						saved[depth++] = state;
+						break;
+					case DW_CFA_restore_state:
+						if (depth == 0U) {
+							return false;
+						}
+						state = saved[--depth];
+						break;
+					case DW_CFA_def_cfa:
+						state.reg = prog.uleb();
+						state.offset = static_cast<std::int64_t>(prog.uleb());
+						break;
+					case DW_CFA_def_cfa_sf:
+						state.reg = prog.uleb();
+						state.offset = offset(prog.sleb());
+						break;
+					case DW_CFA_def_cfa_register:
+						state.reg = prog.uleb();
+						break;
+					case DW_CFA_def_cfa_offset:
+						state.offset = static_cast<std::int64_t>(prog.uleb());
+						break;
+					case DW_CFA_def_cfa_offset_sf:
+						state.offset = offset(prog.sleb());
+						break;
+					case DW_CFA_def_cfa_expression:
+						return false;
+					case DW_CFA_expression:
+					case DW_CFA_val_expression: {
+						const auto reg{prog.uleb()};
+						if (tracked(reg) || !prog.skip(prog.uleb())) {
+							return false;
+						}
+						break;
+					}
+					case DW_CFA_GNU_args_size:
+						static_cast<void>(prog.uleb());
+						break;
+					default:
+						return false;
+				}
+			}
+			return prog.ok;
+		}
+
+		/* Reads a word off the stack if it's inside the bounds we were given */
+		[[nodiscard]]
+		bool read_stack(const std::uintptr_t addr, const std::uintptr_t lo, const std::uintptr_t hi, std::uintptr_t& val) noexcept {
+			if (addr < lo || addr > hi || hi - addr < sizeof(std::uintptr_t) || (addr % alignof(std::uintptr_t)) != 0U) {
+				return false;
+			}
+			val = *reinterpret_cast<const std::uintptr_t*>(addr);
+			return true;
+		}
+	}
+
+	const dwarf_row_t* dwarf_lines_t::find(const std::uint64_t address) const noexcept {
+		auto it = std::upper_bound(rows.begin(), rows.end(), address, [](const std::uint64_t addr, const dwarf_row_t& row) {
+			return addr < row.address;
+		});
+		if (it == rows.begin()) {
+			return nullptr;
+		}
+		--it;
+		return it->end ? nullptr : &*it;
+	}
+
+	dwarf_t::dwarf_t(elf_t&& image) noexcept : _image{std::move(image)} {
+		_info = section(".debug_info");
+		_abbrev = section(".debug_abbrev");
+		_line = section(".debug_line");
+		_line_str = section(".debug_line_str");
+		_str = section(".debug_str");
+		read_aranges();
+	}
+
+	elf_bytes_t dwarf_t::section(const std::string_view name) const noexcept {
+		const auto sect{_image.section(name)};
+		if (sect == nullptr || (sect->sh_flags & SHF_COMPRESSED) != 0U) {
+			return {};
+		}
+		return _image.contents(*sect);
+	}
+
+	void dwarf_t::read_aranges() noexcept {
+		reader_t rd{section(".debug_aranges")};
+		while (rd.ok && rd.remaining() != 0U) {
+			const auto set_start{rd.cur};
+			bool dwarf64{false};
+			auto set{rd.unit(dwarf64)};
+			const auto version{set.u16()};
+			const auto unit{set.offset(dwarf64)};
+			const auto address_size{set.u8()};
+			const auto segment_size{set.u8()};
+			if (!set.ok || version != 2U || address_size == 0U || address_size > 8U || segment_size != 0U) {
+				continue;
+			}
+			/* Tuples are aligned to twice the address size from the start of the set */
+			const auto tuple_size{2U * std::size_t{address_size}};
+			const auto used{static_cast<std::size_t>(set.cur - set_start)};
+			if (used % tuple_size != 0U && !set.skip(tuple_size - (used % tuple_size))) {
+				continue;
+			}
+			while (set.ok && set.remaining() >= tuple_size) {
+				const auto start{set.fixed(address_size)};
+				const auto len{set.fixed(address_size)};
+				if (start == 0U && len == 0U) {
+					break;
+				}
+				if (start != 0U && len != 0U) {
+					_aranges.push_back({start, start + len, unit});
+				}
+			}
+		}
+		std::sort(_aranges.begin(), _aranges.end(), [](const arange_t& a, const arange_t& b) {
+			return a.start < b.start;
+		});
+	}
+
+	const dwarf_lines_t& dwarf_t::unit_lines(const std::uint64_t unit) {
+		if (const auto it = _units.find(unit); it != _units.end()) {
+			return it->second;
+		}
+		auto& lines{_units[unit]};
+
+		/* Pull DW_AT_stmt_list and DW_AT_comp_dir out of the unit DIE */
+		reader_t rd{_info};
+		if (unit >= _info.size || !rd.skip(unit)) {
+			return lines;
+		}
+		form_ctx_t ctx{};
+		auto cu{rd.unit(ctx.dwarf64)};
+		ctx.version = cu.u16();
+		std::uint64_t abbrev_off{0U};
+		if (ctx.version >= 5U) {
+			const auto type{cu.u8()};
+			ctx.address_size = cu.u8();
+			abbrev_off = cu.offset(ctx.dwarf64);
+			if (type == DW_UT_skeleton || type == DW_UT_split_compile) {
+				static_cast<void>(cu.u64());
+			}
+		} else {
+			abbrev_off = cu.offset(ctx.dwarf64);
+			ctx.address_size = cu.u8();
+		}
+		const auto code{cu.uleb()};
+		if (!cu.ok || code == 0U || abbrev_off >= _abbrev.size) {
+			return lines;
+		}
+
+		reader_t abbrev{_abbrev};
+		static_cast<void>(abbrev.skip(abbrev_off));
+		while (abbrev.ok) {
+			const auto entry{abbrev.uleb()};
+			if (entry == 0U) {
+				return lines;
+			}
+			static_cast<void>(abbrev.uleb());
+			static_cast<void>(abbrev.u8());
+			if (entry == code) {
+				break;
+			}
+			/* Not ours, skip its attribute specs */
+			for (auto attr{abbrev.uleb()}, form{abbrev.uleb()}; abbrev.ok && (attr != 0U || form != 0U); attr = abbrev.uleb(), form = abbrev.uleb()) {
+				if (form == DW_FORM_implicit_const) {
+					static_cast<void>(abbrev.sleb());
+				}
+			}
+		}
+
+		std::optional<std::uint64_t> stmt_list{};
+		std::string_view comp_dir{};
+		while (abbrev.ok && cu.ok) {
+			const auto attr{abbrev.uleb()};
+			const auto form{abbrev.uleb()};
+			if (attr == 0U && form == 0U) {
+				break;
+			}
+			if (form == DW_FORM_implicit_const) {
+				static_cast<void>(abbrev.sleb());
+			}
+			if (attr == DW_AT_stmt_list && (form == DW_FORM_sec_offset || form == DW_FORM_data4 || form == DW_FORM_data8)) {
+				stmt_list = form == DW_FORM_data8 ? cu.u64() : (form == DW_FORM_data4 ? cu.u32() : cu.offset(ctx.dwarf64));
+			} else if (attr == DW_AT_comp_dir && form == DW_FORM_string) {
+				comp_dir = cu.cstr();
+			} else if (attr == DW_AT_comp_dir && form == DW_FORM_strp) {
+				comp_dir = string_at(_str, cu.offset(ctx.dwarf64));
+			} else if (attr == DW_AT_comp_dir && form == DW_FORM_line_strp) {
+				comp_dir = string_at(_line_str, cu.offset(ctx.dwarf64));
+			} else if (!skip_form(cu, form, ctx)) {
+				break;
+			}
+		}
+
+		if (!stmt_list || *stmt_list >= _line.size) {
+			return lines;
+		}
+		reader_t program{_line};
+		static_cast<void>(program.skip(*stmt_list));
+		decode_program(program, _line_str, _str, comp_dir, lines);
+		sort_rows(lines);
+		return lines;
+	}
+
+	const dwarf_lines_t& dwarf_t::all_lines() {
+		if (const auto it = _units.find(all_units); it != _units.end()) {
+			return it->second;
+		}
+		auto& lines{_units[all_units]};
+		reader_t rd{_line};
+		while (rd.ok && rd.remaining() != 0U) {
+			decode_program(rd, _line_str, _str, {}, lines);
+		}
+		sort_rows(lines);
+		return lines;
+	}
+
+	std::optional<dwarf_location_t> dwarf_t::location(const std::uint64_t address) {
+		if (!valid()) {
+			return std::nullopt;
+		}
+
+		const dwarf_lines_t* lines{nullptr};
+		if (!_aranges.empty()) {
+			auto it = std::upper_bound(_aranges.begin(), _aranges.end(), address, [](const std::uint64_t addr, const arange_t& range) {
+				return addr < range.start;
+			});
+			if (it == _aranges.begin() || address >= (--it)->end) {
+				return std::nullopt;
+			}
+			lines = &unit_lines(it->unit);
+		} else {
+			lines = &all_lines();
+		}
+
+		const auto row{lines->find(address)};
+		if (row == nullptr || row->file >= lines->files.size()) {
+			return std::nullopt;
+		}
+		return dwarf_location_t{lines->files[row->file], row->line};
+	}
+
+	eh_frame_t::eh_frame_t(const module_t& module) {
+		auto info{read_eh_hdr(module)};
+		if (!info) {
+			return;
+		}
+		const auto hdr_addr{info->addr};
+		auto& hdr{info->table};
+		const auto table_enc{info->table_enc};
+		fde_reader_t fdes{
+			reinterpret_cast<const std::uint8_t*>(info->segment->start), reinterpret_cast<const std::uint8_t*>(info->segment->end),
+			hdr_addr
+		};
+
+		const auto add = [&](const std::optional<std::pair<std::uint64_t, std::uint64_t>>& range) {
+			if (range && range->first >= module.bias) {
+				_ranges.push_back({range->first - module.bias, range->second - module.bias});
+			}
+		};
+
+		const auto count{info->count};
+		if (count && table_enc != DW_EH_PE_omit) {
+			/* The search table is sorted by start address and points right at every FDE */
+			_ranges.reserve(static_cast<std::size_t>(std::min<std::uint64_t>(*count, hdr.remaining())));
+			for (std::uint64_t idx{}; idx < *count && hdr.ok; ++idx) {
+				static_cast<void>(read_encoded(hdr, table_enc, hdr_addr));
+				if (const auto fde = read_encoded(hdr, table_enc, hdr_addr)) {
+					add(fdes.read(reinterpret_cast<const std::uint8_t*>(*fde)));
+				}
+			}
+		} else {
+			reader_t rd{reinterpret_cast<const std::uint8_t*>(info->frame), fdes.end};
+			while (rd.ok && rd.remaining() >= 4U) {
+				const auto entry{rd.cur};
+				bool dwarf64{false};
+				const auto body{rd.unit(dwarf64)};
+				/* A zero length entry terminates .eh_frame */
+				if (body.cur == body.end) {
+					break;
+				}
+				add(fdes.read(entry));
+			}
+		}
+
+		std::sort(_ranges.begin(), _ranges.end(), [](const eh_range_t& a, const eh_range_t& b) {
+			return a.start < b.start;
+		});
+	}
+
+	const eh_range_t* eh_frame_t::find(const std::uint64_t address) const noexcept {
+		auto it = std::upper_bound(_ranges.begin(), _ranges.end(), address, [](const std::uint64_t addr, const eh_range_t& range) {
+			return addr < range.start;
+		});
+		if (it == _ranges.begin() || address >= (--it)->end) {
+			return nullptr;
+		}
+		return &*it;
+	}
+
+	std::optional<eh_unwind_table_t> eh_unwind_table(const module_t& module) noexcept {
+		const auto info{read_eh_hdr(module)};
+		/* Only the usual datarel|sdata4 table, anything else would need walking .eh_frame in the handler */
+		if (!info || !info->count || info->table_enc != (DW_EH_PE_datarel | DW_EH_PE_sdata4)) {
+			return std::nullopt;
+		}
+		const auto table{info->table.cur};
+		if (*info->count > info->table.remaining() / (sizeof(std::int32_t) * 2U)) {
+			return std::nullopt;
+		}
+		return eh_unwind_table_t{
+			module.start, module.end, info->addr, table,
+			static_cast<std::size_t>(*info->count),
+			reinterpret_cast<const std::uint8_t*>(info->segment->start), reinterpret_cast<const std::uint8_t*>(info->segment->end)
+		};
+	}
+
+	bool eh_unwind_step(
+		const eh_unwind_table_t& table, unwind_regs_t& regs, const bool caller,
+		const std::uintptr_t stack_lo, const std::uintptr_t stack_hi
+	) noexcept {
+		/* A return address points after the call, which might be the start of the next function */
+		const auto target{caller ? regs.pc - 1U : regs.pc};
+		if (target < table.start || target >= table.end || table.count == 0U) {
+			return false;
+		}
+
+		/* The table is pairs of (initial location, FDE) relative to .eh_frame_hdr, sorted by location */
+		const auto field = [&](const std::size_t idx) noexcept {
+			std::int32_t val{};
+			std::memcpy(&val, table.table + (idx * sizeof(std::int32_t)), sizeof(val));
+			return table.hdr + static_cast<std::uintptr_t>(static_cast<std::intptr_t>(val));
+		};
+		std::size_t lo{};
+		std::size_t hi{table.count};
+		while (hi - lo > 1U) {
+			const auto mid{lo + ((hi - lo) / 2U)};
+			if (field(mid * 2U) <= target) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+		const auto fde{reinterpret_cast<const std::uint8_t*>(field((lo * 2U) + 1U))};
+		if (fde < table.frames_begin || fde >= table.frames_end) {
+			return false;
+		}
+
+		bool dwarf64{false};
+		reader_t rd{fde, table.frames_end};
+		auto entry{rd.unit(dwarf64)};
+		const auto cie_field{entry.cur};
+		const auto cie_ptr{entry.offset(dwarf64)};
+		if (!entry.ok || cie_ptr == 0U || cie_ptr > static_cast<std::uint64_t>(cie_field - table.frames_begin)) {
+			return false;
+		}
+		bool cie64{false};
+		reader_t cie_rd{cie_field - cie_ptr, table.frames_end};
+		auto cie_body{cie_rd.unit(cie64)};
+		if (cie_body.offset(cie64) != 0U) {
+			return false;
+		}
+		const auto cie{parse_cie(cie_body)};
+		if (!cie || cie->signal) {
+			return false;
+		}
+
+		const auto start{read_encoded(entry, cie->enc, table.hdr)};
+		const auto range{read_encoded(entry, static_cast<std::uint8_t>(cie->enc & 0x0FU), table.hdr)};
+		if (!start || !range || target < *start || target - *start >= *range) {
+			return false;
+		}
+		if (cie->augmented && !entry.skip(entry.uleb())) {
+			return false;
+		}
+
+		cfa_state_t initial{dwarf_rsp, 0, {reg_rule_t::kind_t::same, 0}, {reg_rule_t::kind_t::undefined, 0}};
+		if (!run_cfa(cie->program, *cie, *start, ~std::uint64_t{0U}, table.hdr, initial, initial)) {
+			return false;
+		}
+		auto state{initial};
+		if (!run_cfa(entry, *cie, *start, target, table.hdr, state, initial)) {
+			return false;
+		}
+
+		std::uintptr_t cfa{};
+		if (state.reg == dwarf_rsp) {
+			cfa = regs.sp;
+		} else if (state.reg == dwarf_rbp) {
+			cfa = regs.fp;
+		} else {
+			return false;
+		}
+		cfa += static_cast<std::uintptr_t>(state.offset);
+
+		const auto recover = [&](const reg_rule_t& rule, std::uintptr_t& val) noexcept {
+			switch (rule.kind) {
+				case reg_rule_t::kind_t::same: return true;
+				case reg_rule_t::kind_t::undefined: return false;
+				case reg_rule_t::kind_t::offset:
+					return read_stack(cfa + static_cast<std::uintptr_t>(rule.offset), stack_lo, stack_hi, val);
+				case reg_rule_t::kind_t::value:
+					val = cfa + static_cast<std::uintptr_t>(rule.offset);
+					return true;
+			}
+			return false;
+		};
+
+		std::uintptr_t pc{};
+		auto fp{regs.fp};
+		if (!recover(state.ra, pc) || !recover(state.fp, fp) || pc == 0U) {
+			return false;
+		}
+		regs.pc = pc;
+		regs.sp = cfa;
+		regs.fp = fp;
+		return true;
+	}
+
+	fs::path find_debug_file(const fs::path& path, const elf_bytes_t build_id) {
+		const fs::path debug_root{"/usr/lib/debug"};
+		std::error_code ec{};
+
+		if (build_id.size > 1U) {
+			const auto id{hex(build_id)};
+			auto file{debug_root / ".build-id" / id.substr(0U, 2U) / (id.substr(2U) + ".debug")};
+			if (fs::is_regular_file(file, ec)) {
+				return file;
+			}
+		}
+
+		const elf_t image{path};
+		if (!image.valid()) {
+			return {};
+		}
+		const auto link{image.section(".gnu_debuglink")};
+		if (link == nullptr) {
+			return {};
+		}
+		reader_t rd{image.contents(*link)};
+		const auto name{rd.cstr()};
+		if (name.empty()) {
+			return {};
+		}
+
+		const auto dir{path.parent_path()};
+		for (const auto& file : {dir / name, dir / ".debug" / name, debug_root / dir.relative_path() / name}) {
+			if (file != path && fs::is_regular_file(file, ec) && matches(elf_t{file}, build_id)) {
+				return file;
+			}
+		}
+		return {};
+	}
+
+	dwarf_t open_dwarf(const fs::path& path, const elf_bytes_t build_id) {
+		elf_t image{path};
+		if (image.valid() && has_lines(image)) {
+			return dwarf_t{std::move(image)};
+		}
+
+		const auto debug{find_debug_file(path, build_id)};
+		if (debug.empty()) {
+			return {};
+		}
+		elf_t debug_image{debug};
+		if (!has_lines(debug_image)) {
+			return {};
+		}
+		return dwarf_t{std::move(debug_image)};
+	}
+}
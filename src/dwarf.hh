@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* dwarf.hh - DWARF line table and call frame lookups */
+#pragma once
+#if !defined(SYCOPHANT_DWARF_HH)
+#define SYCOPHANT_DWARF_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <filesystem>
+
+#include <elf.hh>
+#include <modules.hh>
+
+namespace fs = std::filesystem;
+
+namespace sycophant {
+	struct dwarf_row_t final {
+		std::uint64_t address;
+		std::uint32_t file;
+		std::uint32_t line;
+		/* Marks the first address past the end of a sequence */
+		bool end;
+	};
+
+	/* The decoded line program of a single compilation unit, or of all of them if there's no .debug_aranges */
+	struct dwarf_lines_t final {
+		std::vector<std::string> files{};
+		/* Sorted by address */
+		std::vector<dwarf_row_t> rows{};
+
+		[[nodiscard]]
+		const dwarf_row_t* find(std::uint64_t address) const noexcept;
+	};
+
+	struct dwarf_location_t final {
+		std::string_view file;
+		std::uint32_t line;
+	};
+
+	/*
+		Address to file:line lookups for a single module. `.debug_aranges` is read up front to map
+		addresses to compilation units and a unit's line program is only decoded the first time
+		something lands in it. Without aranges every line program is decoded on the first lookup.
+
+		Compressed (SHF_COMPRESSED) debug sections aren't supported and are treated as missing.
+	*/
+	struct dwarf_t final {
+	private:
+		struct arange_t final {
+			std::uint64_t start;
+			std::uint64_t end;
+			std::uint64_t unit;
+		};
+
+		elf_t _image{};
+		elf_bytes_t _info{};
+		elf_bytes_t _abbrev{};
+		elf_bytes_t _line{};
+		elf_bytes_t _line_str{};
+		elf_bytes_t _str{};
+
+		std::vector<arange_t> _aranges{};
+		/* Keyed by .debug_info unit offset, or ~0 for the table covering everything */
+		std::unordered_map<std::uint64_t, dwarf_lines_t> _units{};
+
+		[[nodiscard]]
+		elf_bytes_t section(std::string_view name) const noexcept;
+		void read_aranges() noexcept;
+		[[nodiscard]]
+		const dwarf_lines_t& unit_lines(std::uint64_t unit);
+		[[nodiscard]]
+		const dwarf_lines_t& all_lines();
+
+	public:
+		dwarf_t() noexcept = default;
+		explicit dwarf_t(elf_t&& image) noexcept;
+
+		dwarf_t(dwarf_t&&) noexcept = default;
+		dwarf_t& operator=(dwarf_t&&) noexcept = default;
+		dwarf_t(const dwarf_t&) = delete;
+		dwarf_t& operator=(const dwarf_t&) = delete;
+
+		[[nodiscard]]
+		bool valid() const noexcept { return !_line.empty(); }
+
+		/* `address` is a link-time address, the returned file name points into us */
+		[[nodiscard]]
+		std::optional<dwarf_location_t> location(std::uint64_t address);
+	};
+
+	struct eh_range_t final {
+		/* Link-time addresses, `end` is one past the last byte of the function */
+		std::uint64_t start;
+		std::uint64_t end;
+	};
+
+	/*
+		Function boundaries recovered from the FDEs in a loaded module's .eh_frame, which survives
+		stripping. The FDEs are found through the .eh_frame_hdr search table (or by walking .eh_frame
+		if it doesn't have one) and are read straight out of the module's mapped segments.
+	*/
+	struct eh_frame_t final {
+	private:
+		std::vector<eh_range_t> _ranges{};
+
+	public:
+		eh_frame_t() noexcept = default;
+		explicit eh_frame_t(const module_t& module);
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return _ranges.size(); }
+		[[nodiscard]]
+		const std::vector<eh_range_t>& ranges() const noexcept { return _ranges; }
+
+		/* The function containing the link-time address `address` */
+		[[nodiscard]]
+		const eh_range_t* find(std::uint64_t address) const noexcept;
+	};
+
+	/* The registers needed to step out of a frame */
+	struct unwind_regs_t final {
+		std::uintptr_t pc;
+		std::uintptr_t sp;
+		std::uintptr_t fp;
+	};
+
+	/* What's needed to find a loaded module's FDEs through its .eh_frame_hdr search table */
+	struct eh_unwind_table_t final {
+		/* The module's address range */
+		std::uintptr_t start;
+		std::uintptr_t end;
+		std::uintptr_t hdr;
+		/* `count` pairs of 32-bit (initial location, FDE) relative to `hdr`, with no alignment promised */
+		const std::uint8_t* table;
+		std::size_t count;
+		/* The segment .eh_frame lives in, nothing outside of it is read */
+		const std::uint8_t* frames_begin;
+		const std::uint8_t* frames_end;
+	};
+
+	/* Only modules with the usual sorted datarel search table get one */
+	[[nodiscard]]
+	std::optional<eh_unwind_table_t> eh_unwind_table(const module_t& module) noexcept;
+
+	/*
+		Steps `regs` out to the calling frame using the CFI covering `regs.pc`, set `caller` if the pc
+		is a return address rather than where execution stopped. Only stack memory inside [stack_lo,
+		stack_hi) is read and nothing is allocated or locked, so it can be used from a signal handler.
+	*/
+	[[nodiscard]]
+	bool eh_unwind_step(
+		const eh_unwind_table_t& table, unwind_regs_t& regs, bool caller, std::uintptr_t stack_lo, std::uintptr_t stack_hi
+	) noexcept;
+
+	/*
+		Finds the separate debug info for an ELF file, first by build-id under /usr/lib/debug/.build-id
+		and then by .gnu_debuglink next to the file, in a .debug directory beside it, and under
+		/usr/lib/debug. Returns an empty path if there isn't any.
+	*/
+	[[nodiscard]]
+	fs::path find_debug_file(const fs::path& path, elf_bytes_t build_id);
+
+	/* Opens the DWARF for `path`, from the file itself if it has line info otherwise from its separate debug file */
+	[[nodiscard]]
+	dwarf_t open_dwarf(const fs::path& path, elf_bytes_t build_id);
+}
+
+#endif /* SYCOPHANT_DWARF_HH */
@@ -2,8 +2,229 @@
 /* elf.cc - RAII Wrapper for ELF introspection */
 
 #include <elf.hh>
+#include <fd.hh>
 
 namespace sycophant {
+	elf_t::elf_t(mmap_t&& map) noexcept : _map{std::move(map)} {
+		_data = _map.address<std::uint8_t>();
+		_len = _map.length();
+		validate();
+	}
 
+	elf_t::elf_t(const mmap_t& map) noexcept :
+		_data{map.address<std::uint8_t>()}, _len{map.length()} {
+		validate();
+	}
 
+	elf_t::elf_t(lazy_map_t& map) noexcept :
+		_lazy{&map}, _data{map.data()}, _len{map.length()} {
+		if (!map.ensure(0U, sizeof(Elf64_Ehdr))) {
+			_data = nullptr;
+			_len = 0U;
+		}
+		validate();
+	}
+
+	elf_t::elf_t(const void* data, const std::size_t len) noexcept :
+		_data{static_cast<const std::uint8_t*>(data)}, _len{len} {
+		validate();
+	}
+
+	elf_t::elf_t(const fs::path& path) noexcept :
+		elf_t{fd_t{path, O_RDONLY}.map(prot_t::R, MAP_PRIVATE)} { }
+
+	/* We only deal with native images, anything else is treated as not being an ELF at all */
+	void elf_t::validate() noexcept {
+		const auto valid_header{[&]() noexcept {
+			if (
+				_data == nullptr || _len < sizeof(Elf64_Ehdr) ||
+				reinterpret_cast<std::uintptr_t>(_data) % alignof(Elf64_Ehdr) != 0U
+			) {
+				return false;
+			}
+
+			const auto& ehdr{header()};
+			return
+				std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0 &&
+				ehdr.e_ident[EI_CLASS] == ELFCLASS64 &&
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+				ehdr.e_ident[EI_DATA] == ELFDATA2LSB &&
+#else
+				ehdr.e_ident[EI_DATA] == ELFDATA2MSB &&
+#endif
+				ehdr.e_ident[EI_VERSION] == EV_CURRENT;
+		}()};
+
+		if (!valid_header) {
+			_data = nullptr;
+			_len = 0U;
+		}
+	}
+
+	bool elf_t::in_bounds(const std::uint64_t offset, const std::uint64_t len) const noexcept {
+		return offset <= _len && len <= _len - offset && (_lazy == nullptr || _lazy->ensure(offset, len));
+	}
+
+	elf_table_t<Elf64_Phdr> elf_t::program_headers() const noexcept {
+		if (!valid()) {
+			return {};
+		}
+		const auto& ehdr{header()};
+		return table<Elf64_Phdr>(ehdr.e_phoff, ehdr.e_phnum, ehdr.e_phentsize);
+	}
+
+	elf_table_t<Elf64_Shdr> elf_t::sections() const noexcept {
+		if (!valid() || header().e_shoff == 0U) {
+			return {};
+		}
+		const auto& ehdr{header()};
+		return table<Elf64_Shdr>(ehdr.e_shoff, ehdr.e_shnum, ehdr.e_shentsize);
+	}
+
+	std::string_view elf_t::section_name(const Elf64_Shdr& sect) const noexcept {
+		const auto sects{sections()};
+		const auto strndx{header().e_shstrndx};
+		if (strndx == SHN_UNDEF || strndx >= sects.size()) {
+			return {};
+		}
+
+		const auto strs{contents(sects[strndx])};
+		if (sect.sh_name >= strs.size) {
+			return {};
+		}
+		const auto name{reinterpret_cast<const char*>(strs.data) + sect.sh_name};
+		return {name, ::strnlen(name, strs.size - sect.sh_name)};
+	}
+
+	const Elf64_Shdr* elf_t::section(const std::string_view name) const noexcept {
+		for (const auto& sect : sections()) {
+			if (section_name(sect) == name) {
+				return &sect;
+			}
+		}
+		return nullptr;
+	}
+
+	elf_bytes_t elf_t::contents(const Elf64_Shdr& sect) const noexcept {
+		if (sect.sh_type == SHT_NOBITS || !in_bounds(sect.sh_offset, sect.sh_size)) {
+			return {};
+		}
+		return {_data + sect.sh_offset, static_cast<std::size_t>(sect.sh_size)};
+	}
+
+	elf_bytes_t elf_t::contents(const Elf64_Phdr& phdr) const noexcept {
+		if (!in_bounds(phdr.p_offset, phdr.p_filesz)) {
+			return {};
+		}
+		return {_data + phdr.p_offset, static_cast<std::size_t>(phdr.p_filesz)};
+	}
+
+	elf_table_t<Elf64_Dyn> elf_t::dynamic() const noexcept {
+		for (const auto& phdr : program_headers()) {
+			if (phdr.p_type != PT_DYNAMIC) {
+				continue;
+			}
+
+			const auto dyn{table<Elf64_Dyn>(phdr.p_offset, phdr.p_filesz / sizeof(Elf64_Dyn), sizeof(Elf64_Dyn))};
+			/* The segment is usually padded out with more DT_NULLs than it needs */
+			std::size_t count{};
+			while (count < dyn.size() && dyn[count].d_tag != DT_NULL) {
+				++count;
+			}
+			return table<Elf64_Dyn>(phdr.p_offset, count, sizeof(Elf64_Dyn));
+		}
+		return {};
+	}
+
+	elf_symtab_t elf_t::symtab(const std::uint32_t type) const noexcept {
+		const auto sects{sections()};
+		for (const auto& sect : sects) {
+			if (sect.sh_type != type || sect.sh_link >= sects.size()) {
+				continue;
+			}
+
+			const auto syms{table<Elf64_Sym>(
+				sect.sh_offset, sect.sh_entsize != 0U ? sect.sh_size / sect.sh_entsize : 0U, sect.sh_entsize
+			)};
+			const auto strs{contents(sects[sect.sh_link])};
+			return {syms, reinterpret_cast<const char*>(strs.data), strs.size};
+		}
+		return {};
+	}
+
+	elf_notes_t elf_t::notes(const Elf64_Phdr& phdr) const noexcept {
+		if (phdr.p_type != PT_NOTE) {
+			return {};
+		}
+		return {contents(phdr), static_cast<std::size_t>(phdr.p_align)};
+	}
+
+	elf_notes_t elf_t::notes(const Elf64_Shdr& sect) const noexcept {
+		if (sect.sh_type != SHT_NOTE) {
+			return {};
+		}
+		return {contents(sect), static_cast<std::size_t>(sect.sh_addralign)};
+	}
+
+	elf_relocs_t elf_t::relocations(const Elf64_Shdr& sect) const noexcept {
+		if (sect.sh_type != SHT_RELA && sect.sh_type != SHT_REL) {
+			return {};
+		}
+
+		const auto rela{sect.sh_type == SHT_RELA};
+		const auto stride{rela ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel)};
+		if (sect.sh_offset % alignof(Elf64_Rela) != 0U || !in_bounds(sect.sh_offset, sect.sh_size)) {
+			return {};
+		}
+		return {_data + sect.sh_offset, static_cast<std::size_t>(sect.sh_size / stride), rela};
+	}
+
+	std::optional<elf_bytes_t> elf_t::build_id() const noexcept {
+		for (const auto& phdr : program_headers()) {
+			for (const auto note : notes(phdr)) {
+				if (note.type == NT_GNU_BUILD_ID && note.name == "GNU") {
+					return note.desc;
+				}
+			}
+		}
+		/* Some things (like split debug info) only have the section */
+		for (const auto& sect : sections()) {
+			for (const auto note : notes(sect)) {
+				if (note.type == NT_GNU_BUILD_ID && note.name == "GNU") {
+					return note.desc;
+				}
+			}
+		}
+		return std::nullopt;
+	}
+
+	std::optional<std::uint64_t> elf_t::vaddr_to_offset(const std::uint64_t vaddr) const noexcept {
+		for (const auto& phdr : program_headers()) {
+			if (phdr.p_type == PT_LOAD && vaddr >= phdr.p_vaddr && vaddr - phdr.p_vaddr < phdr.p_filesz) {
+				return phdr.p_offset + (vaddr - phdr.p_vaddr);
+			}
+		}
+		return std::nullopt;
+	}
+
+	std::uint32_t gnu_hash(const std::string_view name) noexcept {
+		std::uint32_t hash{5381U};
+		for (const auto c : name) {
+			hash = (hash << 5U) + hash + static_cast<std::uint8_t>(c);
+		}
+		return hash;
+	}
+
+	std::uint32_t sysv_hash(const std::string_view name) noexcept {
+		std::uint32_t hash{0U};
+		for (const auto c : name) {
+			hash = (hash << 4U) + static_cast<std::uint8_t>(c);
+			const auto high{hash & 0xF0000000U};
+			if (high != 0U) {
+				hash ^= high >> 24U;
+			}
+			hash &= ~high;
+		}
+		return hash;
+	}
 }
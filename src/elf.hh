@@ -5,16 +5,486 @@
 #define SYCOPHANT_ELF_HH
 
 #include <cstdint>
-
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <filesystem>
+#include <elf.h>
 
 #include <types.hh>
+#include <mmap.hh>
+#include <lazymap.hh>
+
+namespace fs = std::filesystem;
 
 namespace sycophant {
+	/* A non-owning run of bytes inside of an ELF image */
+	struct elf_bytes_t final {
+		const std::uint8_t* data{nullptr};
+		std::size_t size{0};
+
+		[[nodiscard]]
+		bool empty() const noexcept { return size == 0U; }
+	};
+
+	/* `ptr` has to be aligned for `T`, `elf_t` refuses to hand out any table or header that isn't */
+	template<typename T>
+	[[nodiscard]]
+	const T* elf_record(const std::uint8_t* const ptr) noexcept {
+		return static_cast<const T*>(__builtin_assume_aligned(ptr, alignof(T)));
+	}
+
+	/* A table of fixed size records inside of an ELF image, iterating it hands out references into the image */
+	template<typename T>
+	struct elf_table_t final {
+	private:
+		const std::uint8_t* _base{nullptr};
+		std::size_t _count{0};
+		std::size_t _stride{sizeof(T)};
+
+	public:
+		struct iterator final {
+		private:
+			const std::uint8_t* _ptr;
+			std::size_t _stride;
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const T*;
+			using reference = const T&;
+
+			constexpr iterator(const std::uint8_t* ptr, const std::size_t stride) noexcept :
+				_ptr{ptr}, _stride{stride} { }
+
+			[[nodiscard]]
+			reference operator*() const noexcept { return *elf_record<T>(_ptr); }
+			[[nodiscard]]
+			pointer operator->() const noexcept { return elf_record<T>(_ptr); }
+
+			iterator& operator++() noexcept {
+				_ptr += _stride;
+				return *this;
+			}
+			iterator operator++(int) noexcept {
+				auto tmp{*this};
+				++(*this);
+				return tmp;
+			}
+
+			[[nodiscard]]
+			bool operator==(const iterator& it) const noexcept { return _ptr == it._ptr; }
+			[[nodiscard]]
+			bool operator!=(const iterator& it) const noexcept { return _ptr != it._ptr; }
+		};
+
+		constexpr elf_table_t() noexcept = default;
+		constexpr elf_table_t(const std::uint8_t* base, const std::size_t count, const std::size_t stride) noexcept :
+			_base{base}, _count{count}, _stride{stride} { }
+
+		[[nodiscard]]
+		iterator begin() const noexcept { return {_base, _stride}; }
+		[[nodiscard]]
+		iterator end() const noexcept { return {_base + (_count * _stride), _stride}; }
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return _count; }
+		[[nodiscard]]
+		bool empty() const noexcept { return _count == 0U; }
+
+		[[nodiscard]]
+		const T& operator[](const std::size_t idx) const noexcept {
+			return *elf_record<T>(_base + (idx * _stride));
+		}
+	};
+
+	struct elf_sym_t final {
+		std::string_view name;
+		const Elf64_Sym* sym;
+
+		[[nodiscard]]
+		std::uint8_t type() const noexcept { return ELF64_ST_TYPE(sym->st_info); }
+		[[nodiscard]]
+		std::uint8_t bind() const noexcept { return ELF64_ST_BIND(sym->st_info); }
+		[[nodiscard]]
+		bool defined() const noexcept { return sym->st_shndx != SHN_UNDEF; }
+	};
+
+	/* A symbol table and the string table its names live in */
+	struct elf_symtab_t final {
+	private:
+		elf_table_t<Elf64_Sym> _syms{};
+		const char* _strs{nullptr};
+		std::size_t _strs_len{0};
+
+	public:
+		struct iterator final {
+		private:
+			const elf_symtab_t* _tab;
+			std::size_t _idx;
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = elf_sym_t;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const elf_sym_t*;
+			using reference = elf_sym_t;
+
+			constexpr iterator(const elf_symtab_t* tab, const std::size_t idx) noexcept :
+				_tab{tab}, _idx{idx} { }
+
+			[[nodiscard]]
+			elf_sym_t operator*() const noexcept { return (*_tab)[_idx]; }
+
+			iterator& operator++() noexcept {
+				++_idx;
+				return *this;
+			}
+			iterator operator++(int) noexcept {
+				auto tmp{*this};
+				++(*this);
+				return tmp;
+			}
+
+			[[nodiscard]]
+			bool operator==(const iterator& it) const noexcept { return _idx == it._idx; }
+			[[nodiscard]]
+			bool operator!=(const iterator& it) const noexcept { return _idx != it._idx; }
+		};
+
+		constexpr elf_symtab_t() noexcept = default;
+		constexpr elf_symtab_t(const elf_table_t<Elf64_Sym> syms, const char* strs, const std::size_t strs_len) noexcept :
+			_syms{syms}, _strs{strs}, _strs_len{strs_len} { }
+
+		[[nodiscard]]
+		iterator begin() const noexcept { return {this, 0U}; }
+		[[nodiscard]]
+		iterator end() const noexcept { return {this, _syms.size()}; }
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return _syms.size(); }
+		[[nodiscard]]
+		bool empty() const noexcept { return _syms.empty(); }
+
+		[[nodiscard]]
+		std::string_view name(const std::size_t offset) const noexcept {
+			if (offset >= _strs_len) {
+				return {};
+			}
+			return {_strs + offset, ::strnlen(_strs + offset, _strs_len - offset)};
+		}
+
+		[[nodiscard]]
+		elf_sym_t operator[](const std::size_t idx) const noexcept {
+			const auto& sym{_syms[idx]};
+			return {name(sym.st_name), &sym};
+		}
+	};
+
+	struct elf_note_t final {
+		std::uint32_t type;
+		std::string_view name;
+		elf_bytes_t desc;
+	};
+
+	/* The notes in a single PT_NOTE segment or SHT_NOTE section */
+	struct elf_notes_t final {
+	private:
+		elf_bytes_t _data{};
+		std::size_t _align{4U};
+
+	public:
+		struct iterator final {
+		private:
+			elf_bytes_t _data;
+			std::size_t _align;
+			std::size_t _offset;
+
+			[[nodiscard]]
+			std::size_t align(const std::size_t val) const noexcept {
+				return (val + _align - 1U) & ~(_align - 1U);
+			}
+
+			[[nodiscard]]
+			std::size_t next() const noexcept {
+				Elf64_Nhdr hdr{};
+				if (_offset + sizeof(hdr) > _data.size) {
+					return _data.size;
+				}
+				std::memcpy(&hdr, _data.data + _offset, sizeof(hdr));
+				const auto next{align(align(_offset + sizeof(hdr) + hdr.n_namesz) + hdr.n_descsz)};
+				/* Anything too short to hold another header is just padding */
+				if (next + sizeof(hdr) > _data.size) {
+					return _data.size;
+				}
+				return next;
+			}
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = elf_note_t;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const elf_note_t*;
+			using reference = elf_note_t;
+
+			constexpr iterator(const elf_bytes_t data, const std::size_t align, const std::size_t offset) noexcept :
+				_data{data}, _align{align}, _offset{offset} { }
 
+			[[nodiscard]]
+			elf_note_t operator*() const noexcept {
+				Elf64_Nhdr hdr{};
+				std::memcpy(&hdr, _data.data + _offset, sizeof(hdr));
+
+				const auto name_off{_offset + sizeof(hdr)};
+				const auto desc_off{align(name_off + hdr.n_namesz)};
+				if (desc_off + hdr.n_descsz > _data.size) {
+					return {hdr.n_type, {}, {}};
+				}
+
+				/* The name size includes the NUL terminator */
+				const auto name_len{hdr.n_namesz != 0U ? hdr.n_namesz - 1U : 0U};
+				return {
+					hdr.n_type,
+					{reinterpret_cast<const char*>(_data.data + name_off), name_len},
+					{_data.data + desc_off, hdr.n_descsz}
+				};
+			}
+
+			iterator& operator++() noexcept {
+				_offset = next();
+				return *this;
+			}
+			iterator operator++(int) noexcept {
+				auto tmp{*this};
+				++(*this);
+				return tmp;
+			}
+
+			[[nodiscard]]
+			bool operator==(const iterator& it) const noexcept { return _offset == it._offset; }
+			[[nodiscard]]
+			bool operator!=(const iterator& it) const noexcept { return _offset != it._offset; }
+		};
+
+		constexpr elf_notes_t() noexcept = default;
+		constexpr elf_notes_t(const elf_bytes_t data, const std::size_t align) noexcept :
+			_data{data}, _align{align == 8U ? 8U : 4U} { }
+
+		[[nodiscard]]
+		iterator begin() const noexcept {
+			return {_data, _align, _data.size < sizeof(Elf64_Nhdr) ? _data.size : 0U};
+		}
+		[[nodiscard]]
+		iterator end() const noexcept { return {_data, _align, _data.size}; }
+	};
+
+	struct elf_reloc_t final {
+		std::uint64_t offset;
+		std::uint32_t type;
+		std::uint32_t sym;
+		std::int64_t addend;
+	};
+
+	/* A SHT_REL or SHT_RELA section, REL entries are given an addend of 0 */
+	struct elf_relocs_t final {
+	private:
+		const std::uint8_t* _base{nullptr};
+		std::size_t _count{0};
+		bool _rela{true};
+
+		[[nodiscard]]
+		std::size_t stride() const noexcept { return _rela ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel); }
+
+	public:
+		struct iterator final {
+		private:
+			const elf_relocs_t* _relocs;
+			std::size_t _idx;
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = elf_reloc_t;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const elf_reloc_t*;
+			using reference = elf_reloc_t;
+
+			constexpr iterator(const elf_relocs_t* relocs, const std::size_t idx) noexcept :
+				_relocs{relocs}, _idx{idx} { }
+
+			[[nodiscard]]
+			elf_reloc_t operator*() const noexcept { return (*_relocs)[_idx]; }
+
+			iterator& operator++() noexcept {
+				++_idx;
+				return *this;
+			}
+			iterator operator++(int) noexcept {
+				auto tmp{*this};
+				++(*this);
+				return tmp;
+			}
+
+			[[nodiscard]]
+			bool operator==(const iterator& it) const noexcept { return _idx == it._idx; }
+			[[nodiscard]]
+			bool operator!=(const iterator& it) const noexcept { return _idx != it._idx; }
+		};
+
+		constexpr elf_relocs_t() noexcept = default;
+		constexpr elf_relocs_t(const std::uint8_t* base, const std::size_t count, const bool rela) noexcept :
+			_base{base}, _count{count}, _rela{rela} { }
+
+		[[nodiscard]]
+		iterator begin() const noexcept { return {this, 0U}; }
+		[[nodiscard]]
+		iterator end() const noexcept { return {this, _count}; }
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return _count; }
+		[[nodiscard]]
+		bool empty() const noexcept { return _count == 0U; }
+
+		[[nodiscard]]
+		elf_reloc_t operator[](const std::size_t idx) const noexcept {
+			const auto ptr{_base + (idx * stride())};
+			if (_rela) {
+				const auto& rel{*elf_record<Elf64_Rela>(ptr)};
+				return {
+					rel.r_offset, static_cast<std::uint32_t>(ELF64_R_TYPE(rel.r_info)),
+					static_cast<std::uint32_t>(ELF64_R_SYM(rel.r_info)), rel.r_addend
+				};
+			}
+			const auto& rel{*elf_record<Elf64_Rel>(ptr)};
+			return {
+				rel.r_offset, static_cast<std::uint32_t>(ELF64_R_TYPE(rel.r_info)),
+				static_cast<std::uint32_t>(ELF64_R_SYM(rel.r_info)), 0
+			};
+		}
+	};
+
+	/*
+		A zero-copy view of an ELF64 image laid out as it is on disk. It either owns the mapping it was
+		built from or borrows one (like `state.self`, which is only mapped in as it's read), none of the
+		accessors copy or allocate, everything hands out references into the image and anything that
+		falls outside of it comes back empty.
+	*/
 	struct elf_t final {
+	private:
+		mmap_t _map{};
+		/* Set when we're a view over a lazy mapping, anything we touch gets mapped in first */
+		lazy_map_t* _lazy{nullptr};
+		const std::uint8_t* _data{nullptr};
+		std::size_t _len{0};
+
+		[[nodiscard]]
+		bool in_bounds(std::uint64_t offset, std::uint64_t len) const noexcept;
+
+		template<typename T>
+		[[nodiscard]]
+		elf_table_t<T> table(const std::uint64_t offset, const std::uint64_t count, std::uint64_t stride) const noexcept {
+			if (stride == 0U) {
+				stride = sizeof(T);
+			}
+			if (
+				stride < sizeof(T) || offset % alignof(T) != 0U || stride % alignof(T) != 0U ||
+				count > _len / stride || !in_bounds(offset, count * stride)
+			) {
+				return {};
+			}
+			return {_data + offset, static_cast<std::size_t>(count), static_cast<std::size_t>(stride)};
+		}
+
+		[[nodiscard]]
+		elf_symtab_t symtab(std::uint32_t type) const noexcept;
+
+		void validate() noexcept;
+
+	public:
+		elf_t() noexcept = default;
+		/* Takes ownership of the mapping */
+		explicit elf_t(mmap_t&& map) noexcept;
+		/* Borrows the mapping, it has to outlive us */
+		explicit elf_t(const mmap_t& map) noexcept;
+		/* Borrows the lazy mapping, it has to outlive us */
+		explicit elf_t(lazy_map_t& map) noexcept;
+		elf_t(const void* data, std::size_t len) noexcept;
+		explicit elf_t(const fs::path& path) noexcept;
+
+		elf_t(elf_t&& elf) noexcept : elf_t{} { swap(elf); }
+		void operator=(elf_t&& elf) noexcept { swap(elf); }
+		elf_t(const elf_t&) = delete;
+		elf_t& operator=(const elf_t&) = delete;
+
+		void swap(elf_t& elf) noexcept {
+			_map.swap(elf._map);
+			std::swap(_lazy, elf._lazy);
+			std::swap(_data, elf._data);
+			std::swap(_len, elf._len);
+		}
+
+		[[nodiscard]]
+		bool valid() const noexcept { return _data != nullptr; }
 
+		[[nodiscard]]
+		const std::uint8_t* data() const noexcept { return _data; }
+		[[nodiscard]]
+		std::size_t length() const noexcept { return _len; }
+
+		[[nodiscard]]
+		const Elf64_Ehdr& header() const noexcept { return *elf_record<Elf64_Ehdr>(_data); }
+
+		[[nodiscard]]
+		elf_table_t<Elf64_Phdr> program_headers() const noexcept;
+		[[nodiscard]]
+		elf_table_t<Elf64_Shdr> sections() const noexcept;
+
+		[[nodiscard]]
+		std::string_view section_name(const Elf64_Shdr& sect) const noexcept;
+		[[nodiscard]]
+		const Elf64_Shdr* section(std::string_view name) const noexcept;
+		[[nodiscard]]
+		elf_bytes_t contents(const Elf64_Shdr& sect) const noexcept;
+		[[nodiscard]]
+		elf_bytes_t contents(const Elf64_Phdr& phdr) const noexcept;
+
+		[[nodiscard]]
+		elf_table_t<Elf64_Dyn> dynamic() const noexcept;
+
+		/* .symtab, this is usually stripped from anything installed */
+		[[nodiscard]]
+		elf_symtab_t symbols() const noexcept { return symtab(SHT_SYMTAB); }
+		/* .dynsym */
+		[[nodiscard]]
+		elf_symtab_t dynamic_symbols() const noexcept { return symtab(SHT_DYNSYM); }
+
+		[[nodiscard]]
+		elf_notes_t notes(const Elf64_Phdr& phdr) const noexcept;
+		[[nodiscard]]
+		elf_notes_t notes(const Elf64_Shdr& sect) const noexcept;
+
+		[[nodiscard]]
+		elf_relocs_t relocations(const Elf64_Shdr& sect) const noexcept;
+
+		/* The contents of the NT_GNU_BUILD_ID note if there is one */
+		[[nodiscard]]
+		std::optional<elf_bytes_t> build_id() const noexcept;
+
+		/* Translates a virtual address into a file offset using the PT_LOAD segments */
+		[[nodiscard]]
+		std::optional<std::uint64_t> vaddr_to_offset(std::uint64_t vaddr) const noexcept;
 	};
 
+	inline void swap(elf_t& a, elf_t& b) noexcept { a.swap(b); }
+
+	/* The name hashes used by DT_GNU_HASH and DT_HASH */
+	[[nodiscard]]
+	std::uint32_t gnu_hash(std::string_view name) noexcept;
+	[[nodiscard]]
+	std::uint32_t sysv_hash(std::string_view name) noexcept;
 }
 
 #endif /* SYCOPHANT_ELF_HH */
@@ -0,0 +1,567 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* heap.cc - Sampling heap profiler */
+#include <execinfo.h>
+#include <pthread.h>
+#include <cerrno>
+#include <unistd.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <new>
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#undef _GNU_SOURCE
+
+#include <heap.hh>
+#include <stats.hh>
+
+namespace sycophant {
+	namespace {
+		/* What a thread counts down from while nothing is sampling, so it checks back in every so often */
+		constexpr std::int64_t idle_countdown{1024 * 1024};
+
+		struct heap_thread_t final {
+			std::int64_t countdown;
+			std::uint64_t rng;
+			/* Inside the profiler, nothing allocated is sampled and nothing freed is looked up */
+			bool busy;
+			/* The lock `fork_prepare` took for this thread's fork, released again once it's done */
+			std::mutex* forking;
+		};
+
+		/* We're always loaded along with the executable, so this is a single %fs relative access */
+		[[gnu::tls_model("initial-exec")]]
+		thread_local heap_thread_t heap_thread{};
+
+		/* Takes the lock with the thread marked busy, whatever the tables allocate or free doesn't come back in */
+		struct guard_t final {
+		private:
+			std::mutex& _lock;
+			const bool _busy;
+
+		public:
+			explicit guard_t(std::mutex& lock) noexcept : _lock{lock}, _busy{heap_thread.busy} {
+				heap_thread.busy = true;
+				_lock.lock();
+			}
+			~guard_t() noexcept {
+				_lock.unlock();
+				heap_thread.busy = _busy;
+			}
+
+			guard_t(const guard_t&) = delete;
+			guard_t& operator=(const guard_t&) = delete;
+		};
+
+		/* An exponentially distributed number of bytes with a mean of `interval` */
+		[[nodiscard]]
+		std::int64_t next_countdown(heap_thread_t& thread, const std::uint64_t interval) noexcept {
+			if (thread.rng == 0U) {
+				thread.rng = (reinterpret_cast<std::uintptr_t>(&thread) * 0x9E3779B97F4A7C15U) | 1U;
+			}
+			/* xorshift64* */
+			thread.rng ^= thread.rng >> 12U;
+			thread.rng ^= thread.rng << 25U;
+			thread.rng ^= thread.rng >> 27U;
+			const auto uniform{static_cast<double>(((thread.rng * 0x2545F4914F6CDD1DU) >> 11U) + 1U) * 0x1.0p-53};
+			return static_cast<std::int64_t>(-std::log(uniform) * static_cast<double>(interval)) + 1;
+		}
+	}
+
+	std::atomic<heap_profiler_t*> heap_profiler_t::_instance{nullptr};
+	std::atomic<std::uint64_t> heap_profiler_t::_tracked{0U};
+
+	std::size_t heap_profiler_t::frames_hash_t::operator()(const std::vector<std::uintptr_t>& frames) const noexcept {
+		std::size_t res{frames.size()};
+		for (const auto frame : frames) {
+			res = (res ^ frame) * 0x100000001B3U;
+		}
+		return res;
+	}
+
+	std::size_t heap_profiler_t::bucket(const std::uintptr_t addr) noexcept {
+		return static_cast<std::size_t>(((addr >> 4U) * 0x9E3779B97F4A7C15U) >> (64U - filter_bits));
+	}
+
+	heap_profiler_t::heap_profiler_t(symbol_index_t& symbols) noexcept :
+		_symbols{symbols}, _tables{*new tables_t{}} {
+		static_cast<void>(::pthread_atfork(&fork_prepare, &fork_done, &fork_done));
+		_instance.store(this, std::memory_order_release);
+	}
+
+	/* Runs at exit, a thread that already loaded `_instance` may still be in `record` or `forget` */
+	heap_profiler_t::~heap_profiler_t() noexcept {
+		stop();
+		_instance.store(nullptr, std::memory_order_release);
+	}
+
+	/* fork() frees and allocates with the lock held, the thread is marked busy so none of that comes back in */
+	void heap_profiler_t::fork_prepare() noexcept {
+		auto& thread{heap_thread};
+		const auto profiler{_instance.load(std::memory_order_acquire)};
+		if (profiler == nullptr) {
+			return;
+		}
+		thread.busy = true;
+		thread.forking = &profiler->_tables.lock;
+		thread.forking->lock();
+	}
+
+	/* Runs in both the parent and the child, the child's copy of the lock is still ours to release */
+	void heap_profiler_t::fork_done() noexcept {
+		auto& thread{heap_thread};
+		if (thread.forking == nullptr) {
+			return;
+		}
+		thread.forking->unlock();
+		thread.forking = nullptr;
+		thread.busy = false;
+	}
+
+	void heap_profiler_t::sample(void* const ptr, const std::size_t size, const std::uintptr_t caller) noexcept {
+		auto& thread{heap_thread};
+		const auto profiler{_instance.load(std::memory_order_acquire)};
+		if (profiler == nullptr || !profiler->_running.load(std::memory_order_relaxed)) {
+			thread.countdown = idle_countdown;
+			return;
+		}
+		const auto interval{profiler->_interval.load(std::memory_order_relaxed)};
+		thread.countdown = next_countdown(thread, interval);
+		if (thread.busy) {
+			return;
+		}
+		thread.busy = true;
+		profiler->record(reinterpret_cast<std::uintptr_t>(ptr), size, caller, interval);
+		thread.busy = false;
+	}
+
+	void heap_profiler_t::release(void* const ptr) noexcept {
+		auto& thread{heap_thread};
+		const auto profiler{_instance.load(std::memory_order_acquire)};
+		const auto addr{reinterpret_cast<std::uintptr_t>(ptr)};
+		if (
+			thread.busy || profiler == nullptr ||
+			profiler->_tables.filter[bucket(addr)].load(std::memory_order_relaxed) == 0U
+		) {
+			return;
+		}
+		thread.busy = true;
+		profiler->forget(addr);
+		thread.busy = false;
+	}
+
+	void heap_profiler_t::record(
+		const std::uintptr_t addr, const std::size_t size, const std::uintptr_t caller, const std::uint64_t interval
+	) noexcept {
+		std::array<void*, max_depth + 8U> raw{};
+		const auto depth{static_cast<std::size_t>(std::max(::backtrace(raw.data(), static_cast<std::int32_t>(raw.size())), 0))};
+		/* Everything before the interposer's caller is us */
+		std::size_t first{0U};
+		for (std::size_t idx{}; idx < depth; ++idx) {
+			if (reinterpret_cast<std::uintptr_t>(raw[idx]) == caller) {
+				first = idx;
+				break;
+			}
+		}
+
+		const auto probability{-std::expm1(-static_cast<double>(size) / static_cast<double>(interval))};
+		const sample_t sample{
+			0U, static_cast<std::uint64_t>(std::llround(1.0 / probability)),
+			static_cast<std::uint64_t>(std::llround(static_cast<double>(size) / probability))
+		};
+
+		try {
+			std::vector<std::uintptr_t> frames{};
+			frames.reserve(std::min(depth - first, max_depth));
+			for (auto idx{first}; idx < depth && frames.size() < max_depth; ++idx) {
+				frames.push_back(reinterpret_cast<std::uintptr_t>(raw[idx]) - 1U);
+			}
+
+			std::lock_guard<std::mutex> lock{_tables.lock};
+			const auto [id, added] = _tables.site_ids.try_emplace(frames, static_cast<std::uint32_t>(_tables.sites.size()));
+			if (added) {
+				_tables.sites.push_back({std::move(frames)});
+			}
+			const auto [entry, inserted] = _tables.samples.try_emplace(addr, sample);
+			if (inserted) {
+				_tables.filter[bucket(addr)].fetch_add(1U, std::memory_order_relaxed);
+				_tracked.fetch_add(1U, std::memory_order_relaxed);
+			} else {
+				/* Its free went somewhere we don't see */
+				auto& old{_tables.sites[entry->second.site]};
+				old.live_count -= entry->second.count;
+				old.live_bytes -= entry->second.bytes;
+			}
+			entry->second = sample;
+			entry->second.site = id->second;
+
+			auto& site{_tables.sites[id->second]};
+			site.live_count += sample.count;
+			site.live_bytes += sample.bytes;
+			site.allocated_count += sample.count;
+			site.allocated_bytes += sample.bytes;
+			++_tables.sampled;
+		} catch (...) {
+			/* Out of memory, the sample is dropped */
+		}
+	}
+
+	void heap_profiler_t::forget(const std::uintptr_t addr) noexcept {
+		std::lock_guard<std::mutex> lock{_tables.lock};
+		const auto entry{_tables.samples.find(addr)};
+		if (entry == _tables.samples.end()) {
+			return;
+		}
+		auto& site{_tables.sites[entry->second.site]};
+		site.live_count -= entry->second.count;
+		site.live_bytes -= entry->second.bytes;
+		_tables.filter[bucket(addr)].fetch_sub(1U, std::memory_order_relaxed);
+		_tracked.fetch_sub(1U, std::memory_order_relaxed);
+		_tables.samples.erase(entry);
+	}
+
+	bool heap_profiler_t::start(const std::size_t interval) {
+		guard_t guard{_tables.lock};
+		if (_running.load(std::memory_order_relaxed)) {
+			return false;
+		}
+		/* The first backtrace loads the unwinder, get that out of the way while nothing is sampled */
+		std::array<void*, 1> warm{};
+		static_cast<void>(::backtrace(warm.data(), static_cast<std::int32_t>(warm.size())));
+
+		_interval.store(std::max<std::size_t>(interval, 1U), std::memory_order_relaxed);
+		if (_tables.since == 0U) {
+			_tables.since = stats_clock_ns();
+		}
+		_running.store(true, std::memory_order_release);
+		return true;
+	}
+
+	void heap_profiler_t::stop() noexcept {
+		_running.store(false, std::memory_order_release);
+	}
+
+	void heap_profiler_t::clear() noexcept {
+		guard_t guard{_tables.lock};
+		for (auto& site : _tables.sites) {
+			site.allocated_count = 0U;
+			site.allocated_bytes = 0U;
+		}
+		_tables.sampled = 0U;
+		_tables.since = stats_clock_ns();
+	}
+
+	heap_stats_t heap_profiler_t::stats() noexcept {
+		guard_t guard{_tables.lock};
+		const auto elapsed{_tables.since != 0U ? stats_clock_ns() - _tables.since : 0U};
+		heap_stats_t res{_tables.sampled, 0U, 0U, 0U, 0U, elapsed, _tables.sites.size()};
+		for (const auto& site : _tables.sites) {
+			res.live_count += site.live_count;
+			res.live_bytes += site.live_bytes;
+			res.allocated_count += site.allocated_count;
+			res.allocated_bytes += site.allocated_bytes;
+		}
+		return res;
+	}
+
+	std::string heap_profiler_t::folded(const bool live) {
+		std::vector<std::pair<std::vector<std::uintptr_t>, std::uint64_t>> sites{};
+		{
+			guard_t guard{_tables.lock};
+			for (const auto& site : _tables.sites) {
+				if (const auto bytes{live ? site.live_bytes : site.allocated_bytes}; bytes != 0U) {
+					sites.emplace_back(site.frames, bytes);
+				}
+			}
+		}
+
+		std::vector<std::uintptr_t> pcs{};
+		for (const auto& [frames, bytes] : sites) {
+			pcs.insert(pcs.end(), frames.begin(), frames.end());
+		}
+		std::sort(pcs.begin(), pcs.end());
+		pcs.erase(std::unique(pcs.begin(), pcs.end()), pcs.end());
+		const auto syms{_symbols.symbolize_many(pcs)};
+		const auto name = [&](const std::uintptr_t pc) -> const symbolized_t& {
+			return syms[static_cast<std::size_t>(std::lower_bound(pcs.begin(), pcs.end(), pc) - pcs.begin())];
+		};
+
+		std::map<std::string, std::uint64_t> stacks{};
+		for (const auto& [frames, bytes] : sites) {
+			std::string stack{};
+			for (auto it{frames.rbegin()}; it != frames.rend(); ++it) {
+				if (!stack.empty()) {
+					stack.push_back(';');
+				}
+				stack.append(name(*it).frame());
+			}
+			stacks[stack] += bytes;
+		}
+
+		std::string res{};
+		for (const auto& [stack, bytes] : stacks) {
+			res.append(stack);
+			res.push_back(' ');
+			res.append(std::to_string(bytes));
+			res.push_back('\n');
+		}
+		return res;
+	}
+
+	namespace {
+		using malloc_t = void*(*)(std::size_t);
+		using free_t = void(*)(void*);
+		using calloc_t = void*(*)(std::size_t, std::size_t);
+		using realloc_t = void*(*)(void*, std::size_t);
+		using posix_memalign_t = std::int32_t(*)(void**, std::size_t, std::size_t);
+
+		/* The allocator underneath us, libc's unless something else was preloaded first */
+		struct real_allocator_t final {
+			malloc_t malloc;
+			free_t free;
+			calloc_t calloc;
+			realloc_t realloc;
+			posix_memalign_t posix_memalign;
+		};
+
+		real_allocator_t real{};
+		/* 0 until it's looked up, 1 while dlsym is running and 2 once it's done */
+		std::atomic<std::uint32_t> real_state{0U};
+
+		/* dlsym can allocate while we're looking for the real allocator, that comes out of here and is never freed */
+		alignas(std::max_align_t) std::array<std::uint8_t, 16384U> bootstrap{};
+		std::atomic<std::size_t> bootstrap_used{0U};
+
+		[[nodiscard]]
+		void* bootstrap_alloc(const std::size_t size) noexcept {
+			constexpr auto align{alignof(std::max_align_t)};
+			auto used{bootstrap_used.load(std::memory_order_relaxed)};
+			std::size_t end{};
+			do {
+				end = ((used + align - 1U) & ~(align - 1U)) + size;
+				if (end > bootstrap.size() || end < used) {
+					return nullptr;
+				}
+			} while (!bootstrap_used.compare_exchange_weak(used, end, std::memory_order_relaxed));
+			return bootstrap.data() + (end - size);
+		}
+
+		[[nodiscard]]
+		bool bootstrapped(const void* const ptr) noexcept {
+			const auto addr{static_cast<const std::uint8_t*>(ptr)};
+			return addr >= bootstrap.data() && addr < bootstrap.data() + bootstrap.size();
+		}
+
+		/* nullptr while the lookup is still running, which is dlsym allocating */
+		[[nodiscard]]
+		const real_allocator_t* allocator() noexcept {
+			if (__builtin_expect(real_state.load(std::memory_order_acquire) == 2U, 1)) {
+				return &real;
+			}
+			std::uint32_t expected{0U};
+			if (!real_state.compare_exchange_strong(expected, 1U, std::memory_order_acq_rel)) {
+				return expected == 2U ? &real : nullptr;
+			}
+			real.malloc = reinterpret_cast<malloc_t>(dlsym(RTLD_NEXT, "malloc"));
+			real.free = reinterpret_cast<free_t>(dlsym(RTLD_NEXT, "free"));
+			real.calloc = reinterpret_cast<calloc_t>(dlsym(RTLD_NEXT, "calloc"));
+			real.realloc = reinterpret_cast<realloc_t>(dlsym(RTLD_NEXT, "realloc"));
+			real.posix_memalign = reinterpret_cast<posix_memalign_t>(dlsym(RTLD_NEXT, "posix_memalign"));
+			if (
+				real.malloc == nullptr || real.free == nullptr || real.calloc == nullptr ||
+				real.realloc == nullptr || real.posix_memalign == nullptr
+			) {
+				constexpr std::string_view error{"[sycophant] unable to find the real allocator, bailing\n"};
+				static_cast<void>(::write(STDERR_FILENO, error.data(), error.size()));
+				std::abort();
+			}
+			real_state.store(2U, std::memory_order_release);
+			return &real;
+		}
+
+		/* Charges the allocation to the thread's countdown and samples it if that ran out */
+		[[gnu::always_inline]]
+		inline void account(void* const ptr, const std::size_t size, const std::uintptr_t caller) noexcept {
+			if (ptr == nullptr) {
+				return;
+			}
+			auto& thread{heap_thread};
+			thread.countdown -= static_cast<std::int64_t>(size);
+			if (__builtin_expect(thread.countdown < 0, 0)) {
+				heap_profiler_t::sample(ptr, size, caller);
+			}
+		}
+
+		[[gnu::always_inline]]
+		inline void* allocate(const std::size_t size, const std::uintptr_t caller) noexcept {
+			const auto alloc{allocator()};
+			if (alloc == nullptr) {
+				return bootstrap_alloc(size);
+			}
+			const auto ptr{alloc->malloc(size)};
+			account(ptr, size, caller);
+			return ptr;
+		}
+
+		[[gnu::always_inline]]
+		inline void deallocate(void* const ptr) noexcept {
+			if (ptr == nullptr || bootstrapped(ptr)) {
+				return;
+			}
+			if (heap_profiler_t::tracking()) {
+				heap_profiler_t::release(ptr);
+			}
+			if (const auto alloc{allocator()}) {
+				alloc->free(ptr);
+			}
+		}
+
+		/* operator new never hands back nullptr, it runs the new handler until it can allocate or throws */
+		[[nodiscard]]
+		void* allocate_new(std::size_t size, const std::uintptr_t caller) {
+			size = std::max<std::size_t>(size, 1U);
+			for (;;) {
+				if (const auto ptr{allocate(size, caller)}) {
+					return ptr;
+				}
+				const auto handler{std::get_new_handler()};
+				if (handler == nullptr) {
+					throw std::bad_alloc{};
+				}
+				handler();
+			}
+		}
+
+		[[nodiscard]]
+		void* allocate_new(const std::size_t size, const std::uintptr_t caller, const std::nothrow_t&) noexcept {
+			try {
+				return allocate_new(size, caller);
+			} catch (...) {
+				return nullptr;
+			}
+		}
+	}
+}
+
+using sycophant::heap_profiler_t;
+
+#define SYCOPHANT_CALLER reinterpret_cast<std::uintptr_t>(__builtin_return_address(0))
+
+extern "C" {
+	[[gnu::used, gnu::visibility("default")]]
+	void* malloc(const std::size_t size) noexcept {
+		return sycophant::allocate(size, SYCOPHANT_CALLER);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	void free(void* const ptr) noexcept {
+		sycophant::deallocate(ptr);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	void* calloc(const std::size_t count, const std::size_t size) noexcept {
+		const auto alloc{sycophant::allocator()};
+		std::size_t bytes{};
+		if (__builtin_mul_overflow(count, size, &bytes)) {
+			return alloc != nullptr ? alloc->calloc(count, size) : nullptr;
+		}
+		/* The bootstrap arena is never reused, so it's still all zeros */
+		if (alloc == nullptr) {
+			return sycophant::bootstrap_alloc(bytes);
+		}
+		const auto ptr{alloc->calloc(count, size)};
+		sycophant::account(ptr, bytes, SYCOPHANT_CALLER);
+		return ptr;
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	void* realloc(void* const ptr, const std::size_t size) noexcept {
+		const auto alloc{sycophant::allocator()};
+		if (alloc == nullptr || sycophant::bootstrapped(ptr)) {
+			/* We don't know how big it was, only that it can't run past the end of the arena */
+			const auto res{alloc != nullptr ? alloc->malloc(size) : sycophant::bootstrap_alloc(size)};
+			if (res != nullptr && ptr != nullptr) {
+				const auto left{static_cast<std::size_t>(sycophant::bootstrap.data() + sycophant::bootstrap.size() - static_cast<std::uint8_t*>(ptr))};
+				std::memcpy(res, ptr, std::min(size, left));
+			}
+			return res;
+		}
+		/* Forgotten first, once it's handed back the address can be sampled again by someone else */
+		if (ptr != nullptr && heap_profiler_t::tracking()) {
+			heap_profiler_t::release(ptr);
+		}
+		const auto res{alloc->realloc(ptr, size)};
+		sycophant::account(res, size, SYCOPHANT_CALLER);
+		return res;
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t posix_memalign(void** const ptr, const std::size_t align, const std::size_t size) noexcept {
+		const auto alloc{sycophant::allocator()};
+		if (alloc == nullptr) {
+			return ENOMEM;
+		}
+		const auto res{alloc->posix_memalign(ptr, align, size)};
+		if (res == 0) {
+			sycophant::account(*ptr, size, SYCOPHANT_CALLER);
+		}
+		return res;
+	}
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void* operator new(const std::size_t size) {
+	return sycophant::allocate_new(size, SYCOPHANT_CALLER);
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void* operator new[](const std::size_t size) {
+	return sycophant::allocate_new(size, SYCOPHANT_CALLER);
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void* operator new(const std::size_t size, const std::nothrow_t& nothrow) noexcept {
+	return sycophant::allocate_new(size, SYCOPHANT_CALLER, nothrow);
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void* operator new[](const std::size_t size, const std::nothrow_t& nothrow) noexcept {
+	return sycophant::allocate_new(size, SYCOPHANT_CALLER, nothrow);
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void operator delete(void* const ptr) noexcept {
+	sycophant::deallocate(ptr);
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void operator delete[](void* const ptr) noexcept {
+	sycophant::deallocate(ptr);
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void operator delete(void* const ptr, std::size_t) noexcept {
+	sycophant::deallocate(ptr);
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void operator delete[](void* const ptr, std::size_t) noexcept {
+	sycophant::deallocate(ptr);
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void operator delete(void* const ptr, const std::nothrow_t&) noexcept {
+	sycophant::deallocate(ptr);
+}
+
+[[gnu::used, gnu::visibility("default")]]
+void operator delete[](void* const ptr, const std::nothrow_t&) noexcept {
+	sycophant::deallocate(ptr);
+}
+
+#undef SYCOPHANT_CALLER
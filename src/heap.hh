@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* heap.hh - Sampling heap profiler */
+#pragma once
+#if !defined(SYCOPHANT_HEAP_HH)
+#define SYCOPHANT_HEAP_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <symbols.hh>
+
+namespace sycophant {
+	/* Mean bytes allocated between samples unless asked otherwise */
+	constexpr std::size_t heap_interval_default{512U * 1024U};
+
+	/* All but `samples` and `elapsed` are estimates scaled up from the samples */
+	struct heap_stats_t final {
+		std::uint64_t samples;
+		std::uint64_t live_count;
+		std::uint64_t live_bytes;
+		/* Since the profiler started or was last cleared */
+		std::uint64_t allocated_count;
+		std::uint64_t allocated_bytes;
+		/* Nanoseconds the allocated totals cover */
+		std::uint64_t elapsed;
+		/* Distinct allocation stacks */
+		std::size_t sites;
+	};
+
+	/*
+		Samples allocations the way tcmalloc does. Each thread counts down the bytes it allocates and
+		takes a sample once it crosses zero, drawing the next countdown from an exponential distribution
+		with a mean of the sampling interval. That makes sampling a Poisson process over bytes, so an
+		allocation of `size` is sampled with probability 1 - e^(-size/interval) and each sample is scaled
+		back up by the inverse of that. Every allocation that isn't sampled costs a TLS decrement.
+
+		Sampled allocations are tracked by address until they're freed, a counting filter over those
+		addresses lets nearly every free skip the table. Each distinct stack is stored once and shared by
+		every sample taken from it. Nothing the profiler allocates for itself is sampled, and nothing
+		in here ever calls into the interpreter, so it's safe to hit from any allocation it makes.
+		Destroying the profiler only stops it, the tables outlive it for the threads still running.
+
+		The allocator interposers live in heap.cc, they run long before anything else is constructed.
+	*/
+	struct heap_profiler_t final {
+	private:
+		static constexpr std::size_t max_depth{64U};
+		static constexpr std::size_t filter_bits{16U};
+
+		struct site_t final {
+			/* Return addresses - 1, innermost first */
+			std::vector<std::uintptr_t> frames{};
+			std::uint64_t live_count{0U};
+			std::uint64_t live_bytes{0U};
+			std::uint64_t allocated_count{0U};
+			std::uint64_t allocated_bytes{0U};
+		};
+
+		struct sample_t final {
+			std::uint32_t site;
+			std::uint64_t count;
+			std::uint64_t bytes;
+		};
+
+		struct frames_hash_t final {
+			[[nodiscard]]
+			std::size_t operator()(const std::vector<std::uintptr_t>& frames) const noexcept;
+		};
+
+		/* The profiler the interposers feed, there's only ever the one */
+		static std::atomic<heap_profiler_t*> _instance;
+		/* Sampled allocations that haven't been freed yet, every free checks this first */
+		static std::atomic<std::uint64_t> _tracked;
+
+		symbol_index_t& _symbols;
+		std::atomic<bool> _running{false};
+		std::atomic<std::uint64_t> _interval{heap_interval_default};
+
+		/* Never freed, threads can still be allocating and freeing through them while the process tears down */
+		struct tables_t final {
+			/* How many tracked addresses hash to each bucket */
+			std::array<std::atomic<std::uint16_t>, std::size_t{1U} << filter_bits> filter{};
+			std::mutex lock{};
+			std::vector<site_t> sites{};
+			std::unordered_map<std::vector<std::uintptr_t>, std::uint32_t, frames_hash_t> site_ids{};
+			std::unordered_map<std::uintptr_t, sample_t> samples{};
+			std::uint64_t sampled{0U};
+			std::uint64_t since{0U};
+		};
+		tables_t& _tables;
+
+		[[nodiscard]]
+		static std::size_t bucket(std::uintptr_t addr) noexcept;
+
+		/* Holds the lock across fork() so the child never inherits it taken by a thread it doesn't have */
+		static void fork_prepare() noexcept;
+		static void fork_done() noexcept;
+
+		/* Both are run with the thread marked as inside the profiler */
+		void record(std::uintptr_t addr, std::size_t size, std::uintptr_t caller, std::uint64_t interval) noexcept;
+		void forget(std::uintptr_t addr) noexcept;
+
+		[[nodiscard]]
+		std::string folded(bool live);
+
+	public:
+		explicit heap_profiler_t(symbol_index_t& symbols) noexcept;
+		~heap_profiler_t() noexcept;
+
+		heap_profiler_t(const heap_profiler_t&) = delete;
+		heap_profiler_t& operator=(const heap_profiler_t&) = delete;
+		heap_profiler_t(heap_profiler_t&&) = delete;
+		heap_profiler_t& operator=(heap_profiler_t&&) = delete;
+
+		/* Starts sampling every `interval` bytes on average, false if it's already running */
+		[[nodiscard]]
+		bool start(std::size_t interval);
+		/* Stops taking samples, what's already sampled is still tracked until it's freed */
+		void stop() noexcept;
+		/* Forgets everything allocated so far, allocations that are still live are kept */
+		void clear() noexcept;
+
+		[[nodiscard]]
+		bool running() const noexcept { return _running.load(std::memory_order_relaxed); }
+		[[nodiscard]]
+		heap_stats_t stats() noexcept;
+
+		/* Folded stacks weighted by bytes, of what's live now and of everything allocated since `clear` */
+		[[nodiscard]]
+		std::string live() { return folded(true); }
+		[[nodiscard]]
+		std::string allocated() { return folded(false); }
+
+		/* Called from the interposers once the thread's countdown runs out */
+		static void sample(void* ptr, std::size_t size, std::uintptr_t caller) noexcept;
+		/* Called from the interposers for every free while `tracking` */
+		static void release(void* ptr) noexcept;
+
+		[[nodiscard]]
+		static bool tracking() noexcept { return _tracked.load(std::memory_order_relaxed) != 0U; }
+	};
+}
+
+#endif /* SYCOPHANT_HEAP_HH */
@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* histogram.cc - Lock-free log-linear value histograms */
+#include <algorithm>
+#include <cmath>
+
+#include <histogram.hh>
+
+namespace sycophant {
+	std::uint64_t histogram_t::percentile(const double quantile) const noexcept {
+		if (count == 0U) {
+			return 0U;
+		}
+		const auto rank{static_cast<std::uint64_t>(
+			std::ceil(std::clamp(quantile, 0.0, 1.0) * static_cast<double>(count))
+		)};
+		std::uint64_t seen{};
+		for (std::size_t bucket{}; bucket < counts.size(); ++bucket) {
+			seen += counts[bucket];
+			if (seen >= std::max<std::uint64_t>(rank, 1U)) {
+				return std::min(std::max(histogram_upper(bucket), min), max);
+			}
+		}
+		return max;
+	}
+
+	std::vector<histogram_bin_t> histogram_t::bins() const {
+		std::vector<histogram_bin_t> res{};
+		for (std::size_t bucket{}; bucket < counts.size(); ++bucket) {
+			if (counts[bucket] != 0U) {
+				res.push_back({histogram_lower(bucket), histogram_upper(bucket), counts[bucket]});
+			}
+		}
+		return res;
+	}
+
+	void histogram_t::merge(const histogram_t& other) noexcept {
+		for (std::size_t bucket{}; bucket < counts.size(); ++bucket) {
+			counts[bucket] += other.counts[bucket];
+		}
+		count += other.count;
+		sum += other.sum;
+		min = std::min(min, other.min);
+		max = std::max(max, other.max);
+	}
+
+	void histogram_t::subtract(const histogram_t& earlier) noexcept {
+		std::size_t first{counts.size()};
+		std::size_t last{};
+		count = 0U;
+		for (std::size_t bucket{}; bucket < counts.size(); ++bucket) {
+			counts[bucket] -= std::min(counts[bucket], earlier.counts[bucket]);
+			if (counts[bucket] != 0U) {
+				first = std::min(first, bucket);
+				last = bucket;
+				count += counts[bucket];
+			}
+		}
+		sum -= std::min(sum, earlier.sum);
+		if (count == 0U) {
+			sum = 0U;
+			min = std::numeric_limits<std::uint64_t>::max();
+			max = 0U;
+			return;
+		}
+		min = std::max(min, histogram_lower(first));
+		max = std::min(max, histogram_upper(last));
+	}
+
+	histogram_t atomic_histogram_t::snapshot() const noexcept {
+		histogram_t res{};
+		for (std::size_t bucket{}; bucket < _counts.size(); ++bucket) {
+			res.counts[bucket] = _counts[bucket].load(std::memory_order_relaxed);
+			res.count += res.counts[bucket];
+		}
+		res.sum = _sum.load(std::memory_order_relaxed);
+		res.min = _min.load(std::memory_order_relaxed);
+		res.max = _max.load(std::memory_order_relaxed);
+		return res;
+	}
+
+	void atomic_histogram_t::reset() noexcept {
+		for (auto& bucket : _counts) {
+			bucket.store(0U, std::memory_order_relaxed);
+		}
+		_sum.store(0U, std::memory_order_relaxed);
+		_min.store(std::numeric_limits<std::uint64_t>::max(), std::memory_order_relaxed);
+		_max.store(0U, std::memory_order_relaxed);
+	}
+}
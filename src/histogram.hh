@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* histogram.hh - Lock-free log-linear value histograms */
+#pragma once
+#if !defined(SYCOPHANT_HISTOGRAM_HH)
+#define SYCOPHANT_HISTOGRAM_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <vector>
+
+namespace sycophant {
+	/*
+		HDR style buckets, every power of two is split into `histogram_sub_buckets` linear buckets so
+		a value is never off by more than 1/16th of itself. Values below 16 get a bucket each and the
+		whole 64-bit range fits in under a thousand buckets.
+	*/
+	constexpr std::size_t histogram_sub_bits{4U};
+	constexpr std::size_t histogram_sub_buckets{1U << histogram_sub_bits};
+	constexpr std::size_t histogram_buckets{((64U - histogram_sub_bits) + 1U) * histogram_sub_buckets};
+
+	[[nodiscard]]
+	constexpr std::size_t histogram_bucket(const std::uint64_t value) noexcept {
+		if (value < histogram_sub_buckets) {
+			return static_cast<std::size_t>(value);
+		}
+		const auto msb{static_cast<std::size_t>(63 - __builtin_clzll(value))};
+		const auto shift{msb - histogram_sub_bits};
+		return ((shift + 1U) << histogram_sub_bits) + static_cast<std::size_t>((value >> shift) & (histogram_sub_buckets - 1U));
+	}
+
+	/* The smallest value that lands in `bucket` */
+	[[nodiscard]]
+	constexpr std::uint64_t histogram_lower(const std::size_t bucket) noexcept {
+		if (bucket < histogram_sub_buckets) {
+			return bucket;
+		}
+		const auto shift{(bucket >> histogram_sub_bits) - 1U};
+		return static_cast<std::uint64_t>(histogram_sub_buckets + (bucket & (histogram_sub_buckets - 1U))) << shift;
+	}
+
+	/* The largest value that lands in `bucket` */
+	[[nodiscard]]
+	constexpr std::uint64_t histogram_upper(const std::size_t bucket) noexcept {
+		return bucket + 1U < histogram_buckets ? histogram_lower(bucket + 1U) - 1U : std::numeric_limits<std::uint64_t>::max();
+	}
+
+	static_assert(histogram_bucket(std::numeric_limits<std::uint64_t>::max()) == histogram_buckets - 1U);
+	static_assert(histogram_lower(histogram_bucket(1000U)) <= 1000U && histogram_upper(histogram_bucket(1000U)) >= 1000U);
+
+	struct histogram_bin_t final {
+		std::uint64_t lower;
+		std::uint64_t upper;
+		std::uint64_t count;
+	};
+
+	/* A point in time copy of an `atomic_histogram_t` */
+	struct histogram_t final {
+		std::array<std::uint64_t, histogram_buckets> counts{};
+		std::uint64_t count{0U};
+		std::uint64_t sum{0U};
+		std::uint64_t min{std::numeric_limits<std::uint64_t>::max()};
+		std::uint64_t max{0U};
+
+		[[nodiscard]]
+		double mean() const noexcept {
+			return count == 0U ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+		}
+
+		/* The upper bound of the bucket holding the `quantile` (0 to 1) value, clamped to `max` */
+		[[nodiscard]]
+		std::uint64_t percentile(double quantile) const noexcept;
+		/* Just the buckets that have anything in them */
+		[[nodiscard]]
+		std::vector<histogram_bin_t> bins() const;
+
+		void merge(const histogram_t& other) noexcept;
+		/* Takes out an earlier snapshot of the same histogram, min and max are narrowed to the buckets left */
+		void subtract(const histogram_t& earlier) noexcept;
+	};
+
+	/* Safe to record into from any number of threads at once, including from signal handlers */
+	struct atomic_histogram_t final {
+	private:
+		std::array<std::atomic<std::uint64_t>, histogram_buckets> _counts{};
+		std::atomic<std::uint64_t> _sum{0U};
+		std::atomic<std::uint64_t> _min{std::numeric_limits<std::uint64_t>::max()};
+		std::atomic<std::uint64_t> _max{0U};
+
+	public:
+		atomic_histogram_t() noexcept = default;
+
+		atomic_histogram_t(const atomic_histogram_t&) = delete;
+		atomic_histogram_t& operator=(const atomic_histogram_t&) = delete;
+
+		void record(const std::uint64_t value) noexcept {
+			_counts[histogram_bucket(value)].fetch_add(1U, std::memory_order_relaxed);
+			_sum.fetch_add(value, std::memory_order_relaxed);
+			/* Only ever contended by a new extreme, which stops happening quickly */
+			auto min{_min.load(std::memory_order_relaxed)};
+			while (value < min && !_min.compare_exchange_weak(min, value, std::memory_order_relaxed)) { }
+			auto max{_max.load(std::memory_order_relaxed)};
+			while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) { }
+		}
+
+		/* For histograms only ever recorded into by one thread, which can skip the locked instructions */
+		void record_owned(const std::uint64_t value) noexcept {
+			auto& bucket{_counts[histogram_bucket(value)]};
+			bucket.store(bucket.load(std::memory_order_relaxed) + 1U, std::memory_order_relaxed);
+			_sum.store(_sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+			if (value < _min.load(std::memory_order_relaxed)) {
+				_min.store(value, std::memory_order_relaxed);
+			}
+			if (value > _max.load(std::memory_order_relaxed)) {
+				_max.store(value, std::memory_order_relaxed);
+			}
+		}
+
+		/* Not atomic as a whole, a value recorded part way through may only show up in some of the totals */
+		[[nodiscard]]
+		histogram_t snapshot() const noexcept;
+		void reset() noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_HISTOGRAM_HH */
@@ -0,0 +1,741 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* hook.cc - Inline function hooks and the native dispatch path */
+
+#include <hook.hh>
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <unwind.h>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include <exception>
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#undef _GNU_SOURCE
+
+#if defined(__x86_64__)
+#	include <x86intrin.h>
+#endif
+
+#include <quiesce.hh>
+#include <x86_64.hh>
+
+#if !defined(MAP_FIXED_NOREPLACE)
+#	define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+namespace sycophant {
+	namespace {
+		struct shadow_frame_t final {
+			hook_t* hook;
+			/* Where the function was really going to return to */
+			std::uintptr_t ret;
+			/* Stack slot holding the return address, doubles as a frame identifier */
+			std::uintptr_t slot;
+			std::uint64_t tsc;
+		};
+
+		struct hook_tls_t final {
+			std::uint32_t depth;
+			std::uint32_t shadow_depth;
+			shadow_frame_t* shadow;
+		};
+
+		/* We're always loaded at startup so we can use the static TLS block and skip __tls_get_addr */
+		[[gnu::tls_model("initial-exec")]]
+		thread_local hook_tls_t hook_tls{};
+
+		/* Each hook gets a slot holding its entry stub followed by the relocated prologue */
+		constexpr std::size_t slot_size{128U};
+		constexpr std::size_t stub_size{32U};
+		constexpr std::size_t chunk_size{64U * 1024U};
+		/* Slots have to be reachable with a rel32 from the target, with some room to spare for the chunk itself */
+		constexpr std::uintptr_t max_distance{0x7FFF0000U - chunk_size};
+		constexpr std::uintptr_t user_max{0x00007FFFFFFFF000U};
+		constexpr std::size_t jmp_rel32_len{5U};
+
+		struct chunk_t final {
+			std::uintptr_t base;
+			std::size_t used;
+		};
+
+		struct registry_t final {
+			std::mutex lock{};
+			std::vector<std::unique_ptr<hook_t>> hooks{};
+			/* Hooks that never got installed, only kept so nothing that was handed one ends up dangling */
+			std::vector<std::unique_ptr<hook_t>> discarded{};
+			std::vector<chunk_t> chunks{};
+			/* Slots given back that weren't the last in their chunk */
+			std::vector<std::uintptr_t> spare{};
+		};
+
+		/* Intentionally leaked, hooks can keep firing right up until the process is gone */
+		[[nodiscard]]
+		registry_t& registry() {
+			static auto reg{new registry_t{}};
+			return *reg;
+		}
+
+		[[nodiscard]]
+		std::uintptr_t distance(const std::uintptr_t a, const std::uintptr_t b) noexcept {
+			return a > b ? a - b : b - a;
+		}
+
+		[[nodiscard]]
+		std::uintptr_t map_near(const std::uintptr_t target, const std::vector<mapentry_t>& maps) {
+			std::vector<std::uintptr_t> candidates{};
+			const auto align_down{[](const std::uintptr_t addr) { return addr & ~(chunk_size - 1U); }};
+			const auto align_up{[&](const std::uintptr_t addr) { return align_down(addr + chunk_size - 1U); }};
+
+			std::uintptr_t prev_end{chunk_size};
+			const auto add_gap{[&](const std::uintptr_t start, const std::uintptr_t end) {
+				if (end < chunk_size || align_up(start) > align_down(end - chunk_size)) {
+					return;
+				}
+				const auto lo{align_up(start)};
+				const auto hi{align_down(end - chunk_size)};
+				const auto cand{std::clamp(align_down(target), lo, hi)};
+				if (distance(cand, target) < max_distance) {
+					candidates.push_back(cand);
+				}
+			}};
+
+			for (const auto& map : maps) {
+				if (map.addr_s >= user_max) {
+					break;
+				}
+				add_gap(prev_end, map.addr_s);
+				prev_end = std::max(prev_end, map.addr_e);
+			}
+			add_gap(prev_end, user_max);
+
+			std::sort(std::begin(candidates), std::end(candidates), [&](const std::uintptr_t a, const std::uintptr_t b) {
+				return distance(a, target) < distance(b, target);
+			});
+
+			for (const auto cand : candidates) {
+				const auto ptr{::mmap(
+					reinterpret_cast<void*>(cand), chunk_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0
+				)};
+				if (ptr == MAP_FAILED) {
+					continue;
+				} else if (reinterpret_cast<std::uintptr_t>(ptr) != cand) {
+					/* Older kernels treat MAP_FIXED_NOREPLACE as just a hint */
+					::munmap(ptr, chunk_size);
+					continue;
+				}
+				return cand;
+			}
+
+			return 0U;
+		}
+
+		[[nodiscard]]
+		std::uintptr_t alloc_slot(registry_t& reg, const std::uintptr_t target, const std::vector<mapentry_t>& maps) {
+			const auto spare{std::find_if(std::begin(reg.spare), std::end(reg.spare), [&](const std::uintptr_t slot) {
+				return distance(slot, target) < max_distance;
+			})};
+			if (spare != std::end(reg.spare)) {
+				const auto slot{*spare};
+				reg.spare.erase(spare);
+				return slot;
+			}
+			for (auto& chunk : reg.chunks) {
+				if (chunk.used + slot_size <= chunk_size && distance(chunk.base, target) < max_distance) {
+					const auto slot{chunk.base + chunk.used};
+					chunk.used += slot_size;
+					return slot;
+				}
+			}
+
+			const auto base{map_near(target, maps)};
+			if (base == 0U) {
+				return 0U;
+			}
+			reg.chunks.push_back({base, slot_size});
+			return base;
+		}
+
+		/* The most recently handed out slot in a chunk goes back to it, any other is kept aside for reuse */
+		void free_slot(registry_t& reg, const std::uintptr_t slot) noexcept {
+			for (auto& chunk : reg.chunks) {
+				if (chunk.base + chunk.used == slot + slot_size) {
+					chunk.used -= slot_size;
+					return;
+				}
+			}
+			try {
+				reg.spare.push_back(slot);
+			} catch (const std::bad_alloc&) {
+				/* It's just never used again */
+			}
+		}
+
+		/* Nothing can be running through a hook that was never installed, so its slot can go straight back */
+		void discard(registry_t& reg, hook_t* const hook) noexcept {
+			free_slot(reg, hook->stub);
+			const auto entry{std::find_if(std::begin(reg.hooks), std::end(reg.hooks), [&](const std::unique_ptr<hook_t>& known) {
+				return known.get() == hook;
+			})};
+			if (entry == std::end(reg.hooks)) {
+				return;
+			}
+			try {
+				reg.discarded.push_back(std::move(*entry));
+			} catch (const std::bad_alloc&) {
+				static_cast<void>(entry->release());
+			}
+			reg.hooks.erase(entry);
+		}
+
+		constexpr std::size_t shadow_size{shadow_stack_depth * sizeof(shadow_frame_t)};
+		pthread_key_t shadow_key{};
+		pthread_once_t shadow_once{PTHREAD_ONCE_INIT};
+
+		void shadow_release(void* frames) noexcept {
+			hook_tls.shadow = nullptr;
+			hook_tls.shadow_depth = 0U;
+			::munmap(frames, shadow_size);
+		}
+
+		/* Allocated once per thread on the first return probe it hits, nothing is allocated per call */
+		[[nodiscard]]
+		shadow_frame_t* shadow_stack() noexcept {
+			auto& tls{hook_tls};
+			if (tls.shadow != nullptr) {
+				return tls.shadow;
+			}
+
+			::pthread_once(&shadow_once, []() {
+				static_cast<void>(::pthread_key_create(&shadow_key, shadow_release));
+			});
+
+			const auto frames{::mmap(nullptr, shadow_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)};
+			if (frames == MAP_FAILED) {
+				return nullptr;
+			}
+			static_cast<void>(::pthread_setspecific(shadow_key, frames));
+			tls.shadow = static_cast<shadow_frame_t*>(frames);
+			return tls.shadow;
+		}
+
+		/* Frames at or below `slot` have been unwound past by a longjmp or exception */
+		void shadow_prune(hook_tls_t& tls, const std::uintptr_t slot) noexcept {
+			while (tls.shadow_depth != 0U && tls.shadow[tls.shadow_depth - 1U].slot < slot) {
+				--tls.shadow_depth;
+			}
+		}
+
+		/* Put the real return addresses back so the unwinder can walk through hooked frames */
+		void shadow_disarm() noexcept {
+			auto& tls{hook_tls};
+			for (std::uint32_t idx{}; idx < tls.shadow_depth; ++idx) {
+				const auto& frame{tls.shadow[idx]};
+				*reinterpret_cast<std::uintptr_t*>(frame.slot) = frame.ret;
+			}
+		}
+
+		void shadow_rearm(std::uintptr_t sp) noexcept;
+
+		template<typename T>
+		[[nodiscard]]
+		T next_symbol(const char* name) noexcept {
+			return reinterpret_cast<T>(dlsym(RTLD_NEXT, name));
+		}
+
+		[[nodiscard]]
+		hook_t* find_hook_locked(registry_t& reg, const std::uintptr_t target) noexcept {
+			for (auto& hook : reg.hooks) {
+				if (hook->target == target && hook->installed.load()) {
+					return hook.get();
+				}
+			}
+			return nullptr;
+		}
+	}
+}
+
+#if defined(__x86_64__)
+extern "C" {
+	void sycophant_hook_entry() asm("sycophant_hook_entry");
+	void sycophant_hook_return() asm("sycophant_hook_return");
+
+	/* Called from the entry stub, returns where to go once the handler is done */
+	[[gnu::used, gnu::visibility("hidden")]]
+	std::uintptr_t sycophant_hook_dispatch(sycophant::hook_t* hook, sycophant::hook_regs_t* regs) noexcept {
+		hook->calls.fetch_add(1U, std::memory_order_relaxed);
+
+		auto& tls{sycophant::hook_tls};
+		if (tls.depth != 0U && !hook->nested.load(std::memory_order_relaxed)) {
+			hook->bypassed.fetch_add(1U, std::memory_order_relaxed);
+			return hook->original;
+		}
+
+		++tls.depth;
+		if (hook->on_entry) {
+			hook->on_entry(*hook, *regs);
+		}
+
+		if (hook->on_exit) {
+			const auto frames{sycophant::shadow_stack()};
+			sycophant::shadow_prune(tls, regs->rsp + 1U);
+
+			if (frames == nullptr || tls.shadow_depth == sycophant::shadow_stack_depth) {
+				hook->dropped.fetch_add(1U, std::memory_order_relaxed);
+			} else {
+				auto& ret_addr{*reinterpret_cast<std::uintptr_t*>(regs->rsp)};
+				frames[tls.shadow_depth++] = {hook, ret_addr, regs->rsp, __rdtsc()};
+				ret_addr = reinterpret_cast<std::uintptr_t>(&sycophant_hook_return);
+			}
+		}
+		--tls.depth;
+
+		return hook->original;
+	}
+
+	/* Called from the return stub with the slot the return address was popped from */
+	[[gnu::used, gnu::visibility("hidden")]]
+	std::uintptr_t sycophant_hook_exit(sycophant::hook_ret_t* ret, std::uintptr_t slot) noexcept {
+		const auto tsc{__rdtsc()};
+		auto& tls{sycophant::hook_tls};
+
+		++tls.depth;
+		sycophant::shadow_prune(tls, slot);
+		if (tls.shadow_depth == 0U || tls.shadow[tls.shadow_depth - 1U].slot != slot) {
+			/* We have no idea where to go, there is nothing sensible left to do */
+			static constexpr char msg[]{"[sycophant] return probe shadow stack is corrupt, bailing\n"};
+			static_cast<void>(::write(STDERR_FILENO, msg, sizeof(msg) - 1U));
+			std::abort();
+		}
+
+		const auto frame{tls.shadow[--tls.shadow_depth]};
+		ret->cycles = tsc - frame.tsc;
+		frame.hook->on_exit(*frame.hook, *ret);
+		--tls.depth;
+
+		return frame.ret;
+	}
+}
+
+namespace sycophant {
+	namespace {
+		/*
+			Re-hijack the frames that survived an exception being caught, anything below `sp` is gone. If
+			another exception is still in flight (we're being caught inside of a cleanup) leave it all be.
+		*/
+		void shadow_rearm(const std::uintptr_t sp) noexcept {
+			auto& tls{hook_tls};
+			shadow_prune(tls, sp);
+			if (std::uncaught_exceptions() != 0) {
+				return;
+			}
+
+			for (std::uint32_t idx{}; idx < tls.shadow_depth; ++idx) {
+				*reinterpret_cast<std::uintptr_t*>(tls.shadow[idx].slot) =
+					reinterpret_cast<std::uintptr_t>(&sycophant_hook_return);
+			}
+		}
+	}
+}
+
+static_assert(offsetof(sycophant::hook_regs_t, rdi) == 0,   "hook_regs_t layout must match sycophant_hook_entry");
+static_assert(offsetof(sycophant::hook_regs_t, rsp) == 64,  "hook_regs_t layout must match sycophant_hook_entry");
+static_assert(offsetof(sycophant::hook_regs_t, xmm) == 80,  "hook_regs_t layout must match sycophant_hook_entry");
+static_assert(sizeof(sycophant::hook_regs_t) == 336,        "hook_regs_t layout must match sycophant_hook_entry");
+static_assert(offsetof(sycophant::hook_ret_t, xmm) == 16,   "hook_ret_t layout must match sycophant_hook_return");
+static_assert(sizeof(sycophant::hook_ret_t) == 64,          "hook_ret_t layout must match sycophant_hook_return");
+
+/*
+	Entered from a hook stub with the caller's r11 pushed and the hook in r11. The argument registers
+	are spilled into a hook_regs_t so the handler can see (and change) them, then everything is put back
+	and we `ret` into wherever the dispatcher tells us to go so not a single register is disturbed.
+
+	Callers in the same TU as the target are allowed to skip the ABI stack alignment and to keep values
+	in registers the target is known not to touch (-fipa-ra), so the stack is realigned by hand and all
+	of the caller-saved registers are preserved, not just the argument ones.
+*/
+asm(R"(
+	.text
+	.p2align 4
+	.globl sycophant_hook_entry
+	.hidden sycophant_hook_entry
+	.type sycophant_hook_entry, @function
+sycophant_hook_entry:
+	.cfi_startproc
+	.cfi_def_cfa_offset 16
+	endbr64
+	pushq %rbp
+	.cfi_def_cfa_offset 24
+	.cfi_offset %rbp, -24
+	movq %rsp, %rbp
+	.cfi_def_cfa_register %rbp
+	andq $-16, %rsp
+	subq $336, %rsp
+	movq %rdi, 0(%rsp)
+	movq %rsi, 8(%rsp)
+	movq %rdx, 16(%rsp)
+	movq %rcx, 24(%rsp)
+	movq %r8, 32(%rsp)
+	movq %r9, 40(%rsp)
+	movq %rax, 48(%rsp)
+	movq %r10, 56(%rsp)
+	leaq 16(%rbp), %rax
+	movq %rax, 64(%rsp)
+	movaps %xmm0, 80(%rsp)
+	movaps %xmm1, 96(%rsp)
+	movaps %xmm2, 112(%rsp)
+	movaps %xmm3, 128(%rsp)
+	movaps %xmm4, 144(%rsp)
+	movaps %xmm5, 160(%rsp)
+	movaps %xmm6, 176(%rsp)
+	movaps %xmm7, 192(%rsp)
+	movaps %xmm8, 208(%rsp)
+	movaps %xmm9, 224(%rsp)
+	movaps %xmm10, 240(%rsp)
+	movaps %xmm11, 256(%rsp)
+	movaps %xmm12, 272(%rsp)
+	movaps %xmm13, 288(%rsp)
+	movaps %xmm14, 304(%rsp)
+	movaps %xmm15, 320(%rsp)
+	movq %r11, %rdi
+	movq %rsp, %rsi
+	call sycophant_hook_dispatch
+	movq 8(%rbp), %r11
+	movq %rax, 8(%rbp)
+	movaps 80(%rsp), %xmm0
+	movaps 96(%rsp), %xmm1
+	movaps 112(%rsp), %xmm2
+	movaps 128(%rsp), %xmm3
+	movaps 144(%rsp), %xmm4
+	movaps 160(%rsp), %xmm5
+	movaps 176(%rsp), %xmm6
+	movaps 192(%rsp), %xmm7
+	movaps 208(%rsp), %xmm8
+	movaps 224(%rsp), %xmm9
+	movaps 240(%rsp), %xmm10
+	movaps 256(%rsp), %xmm11
+	movaps 272(%rsp), %xmm12
+	movaps 288(%rsp), %xmm13
+	movaps 304(%rsp), %xmm14
+	movaps 320(%rsp), %xmm15
+	movq 0(%rsp), %rdi
+	movq 8(%rsp), %rsi
+	movq 16(%rsp), %rdx
+	movq 24(%rsp), %rcx
+	movq 32(%rsp), %r8
+	movq 40(%rsp), %r9
+	movq 48(%rsp), %rax
+	movq 56(%rsp), %r10
+	leave
+	.cfi_def_cfa %rsp, 16
+	ret
+	.cfi_endproc
+	.size sycophant_hook_entry, .-sycophant_hook_entry
+)");
+
+/*
+	Hooked functions with an exit handler return here instead of to their caller. The slot the return
+	address was popped from is reused for the real one, so once the exit handler has run we simply
+	return again. Like the entry every caller-saved register is preserved, rax/rdx and xmm0/xmm1 are
+	handed to the exit handler as they carry the return value.
+*/
+asm(R"(
+	.text
+	.p2align 4
+	.globl sycophant_hook_return
+	.hidden sycophant_hook_return
+	.type sycophant_hook_return, @function
+sycophant_hook_return:
+	.cfi_startproc
+	.cfi_undefined %rip
+	pushq $0
+	pushq %rbp
+	movq %rsp, %rbp
+	andq $-16, %rsp
+	subq $352, %rsp
+	movq %rax, 0(%rsp)
+	movq %rdx, 8(%rsp)
+	movq %rcx, 64(%rsp)
+	movq %rsi, 72(%rsp)
+	movq %rdi, 80(%rsp)
+	movq %r8, 88(%rsp)
+	movq %r9, 96(%rsp)
+	movq %r10, 104(%rsp)
+	movq %r11, 112(%rsp)
+	movaps %xmm0, 16(%rsp)
+	movaps %xmm1, 32(%rsp)
+	movaps %xmm2, 128(%rsp)
+	movaps %xmm3, 144(%rsp)
+	movaps %xmm4, 160(%rsp)
+	movaps %xmm5, 176(%rsp)
+	movaps %xmm6, 192(%rsp)
+	movaps %xmm7, 208(%rsp)
+	movaps %xmm8, 224(%rsp)
+	movaps %xmm9, 240(%rsp)
+	movaps %xmm10, 256(%rsp)
+	movaps %xmm11, 272(%rsp)
+	movaps %xmm12, 288(%rsp)
+	movaps %xmm13, 304(%rsp)
+	movaps %xmm14, 320(%rsp)
+	movaps %xmm15, 336(%rsp)
+	movq %rsp, %rdi
+	leaq 8(%rbp), %rsi
+	call sycophant_hook_exit
+	movq %rax, 8(%rbp)
+	movaps 16(%rsp), %xmm0
+	movaps 32(%rsp), %xmm1
+	movaps 128(%rsp), %xmm2
+	movaps 144(%rsp), %xmm3
+	movaps 160(%rsp), %xmm4
+	movaps 176(%rsp), %xmm5
+	movaps 192(%rsp), %xmm6
+	movaps 208(%rsp), %xmm7
+	movaps 224(%rsp), %xmm8
+	movaps 240(%rsp), %xmm9
+	movaps 256(%rsp), %xmm10
+	movaps 272(%rsp), %xmm11
+	movaps 288(%rsp), %xmm12
+	movaps 304(%rsp), %xmm13
+	movaps 320(%rsp), %xmm14
+	movaps 336(%rsp), %xmm15
+	movq 0(%rsp), %rax
+	movq 8(%rsp), %rdx
+	movq 64(%rsp), %rcx
+	movq 72(%rsp), %rsi
+	movq 80(%rsp), %rdi
+	movq 88(%rsp), %r8
+	movq 96(%rsp), %r9
+	movq 104(%rsp), %r10
+	movq 112(%rsp), %r11
+	leave
+	ret
+	.cfi_endproc
+	.size sycophant_hook_return, .-sycophant_hook_return
+)");
+
+/*
+	The unwinder can't find its way through sycophant_hook_return, so anything that's about to walk the
+	stack gets the real return addresses put back first. Frames that survive are re-armed once the
+	exception is caught.
+*/
+extern "C" {
+	void* sycophant_cxa_begin_catch(void* exc) noexcept asm("__cxa_begin_catch");
+
+	[[gnu::used, gnu::visibility("default")]]
+	_Unwind_Reason_Code _Unwind_RaiseException(_Unwind_Exception* exc) {
+		static const auto real{sycophant::next_symbol<decltype(&_Unwind_RaiseException)>("_Unwind_RaiseException")};
+		sycophant::shadow_disarm();
+		return real(exc);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	_Unwind_Reason_Code _Unwind_Resume_or_Rethrow(_Unwind_Exception* exc) {
+		static const auto real{sycophant::next_symbol<decltype(&_Unwind_Resume_or_Rethrow)>("_Unwind_Resume_or_Rethrow")};
+		sycophant::shadow_disarm();
+		return real(exc);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	_Unwind_Reason_Code _Unwind_ForcedUnwind(_Unwind_Exception* exc, _Unwind_Stop_Fn stop, void* arg) {
+		static const auto real{sycophant::next_symbol<decltype(&_Unwind_ForcedUnwind)>("_Unwind_ForcedUnwind")};
+		sycophant::shadow_disarm();
+		return real(exc, stop, arg);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	_Unwind_Reason_Code _Unwind_Backtrace(_Unwind_Trace_Fn trace, void* arg) {
+		static const auto real{sycophant::next_symbol<decltype(&_Unwind_Backtrace)>("_Unwind_Backtrace")};
+		sycophant::shadow_disarm();
+		const auto res{real(trace, arg)};
+		sycophant::shadow_rearm(reinterpret_cast<std::uintptr_t>(__builtin_dwarf_cfa()));
+		return res;
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	void* sycophant_cxa_begin_catch(void* exc) noexcept {
+		using begin_catch_t = void* (*)(void*);
+		static const auto real{sycophant::next_symbol<begin_catch_t>("__cxa_begin_catch")};
+		const auto res{real(exc)};
+		sycophant::shadow_rearm(reinterpret_cast<std::uintptr_t>(__builtin_dwarf_cfa()));
+		return res;
+	}
+}
+#endif
+
+namespace sycophant {
+	hook_t& hook_batch_t::install(
+		const std::uintptr_t target, hook_t::handler_t on_entry, hook_t::exit_handler_t on_exit,
+		const bool nested, const std::vector<mapentry_t>& maps
+	) {
+#if !defined(__x86_64__)
+		static_cast<void>(target);
+		static_cast<void>(on_entry);
+		static_cast<void>(on_exit);
+		static_cast<void>(nested);
+		static_cast<void>(maps);
+		throw std::runtime_error("hooks are only supported on x86-64");
+#else
+		auto& reg{registry()};
+		const std::lock_guard<std::mutex> lock{reg.lock};
+
+		const auto map{std::find_if(std::begin(maps), std::end(maps), [&](const mapentry_t& entry) {
+			return target >= entry.addr_s && target + x86_64::max_insn_len * 2U <= entry.addr_e;
+		})};
+		if (map == std::end(maps) || (map->flags & mapentry_flags_t::EXEC) != mapentry_flags_t::EXEC) {
+			throw std::runtime_error("hook target is not in executable memory");
+		}
+
+		const auto pending{std::any_of(std::begin(_install), std::end(_install), [&](const hook_t* hook) {
+			return hook->target == target;
+		})};
+		if (pending || find_hook_locked(reg, target) != nullptr) {
+			throw std::runtime_error("target is already hooked");
+		}
+
+		const auto slot{alloc_slot(reg, target, maps)};
+		if (slot == 0U) {
+			throw std::runtime_error("unable to allocate a trampoline near the hook target");
+		}
+
+		auto hook{std::make_unique<hook_t>()};
+		hook->target   = target;
+		hook->stub     = slot;
+		hook->original = slot + stub_size;
+		hook->on_entry = std::move(on_entry);
+		hook->on_exit  = std::move(on_exit);
+		hook->nested.store(nested);
+
+		/* push r11; movabs r11, hook; jmp sycophant_hook_entry */
+		std::vector<std::uint8_t> stub{0x41U, 0x53U, 0x49U, 0xBBU};
+		const auto hook_addr{reinterpret_cast<std::uintptr_t>(hook.get())};
+		for (std::size_t idx{}; idx < sizeof(hook_addr); ++idx) {
+			stub.push_back(static_cast<std::uint8_t>(hook_addr >> (idx * 8U)));
+		}
+		x86_64::emit_abs_jmp(stub, reinterpret_cast<std::uintptr_t>(&sycophant_hook_entry));
+
+		std::vector<std::uint8_t> original{};
+		const auto consumed{x86_64::relocate(
+			reinterpret_cast<const std::uint8_t*>(target), target, jmp_rel32_len, original, hook->original
+		)};
+
+		if (!consumed || *consumed > hook->saved.size() || original.size() + 14U > slot_size - stub_size) {
+			free_slot(reg, slot);
+			throw std::runtime_error("unable to relocate the prologue of the hook target");
+		}
+		x86_64::emit_abs_jmp(original, target + *consumed);
+
+		hook->patch_len = *consumed;
+		std::memcpy(hook->saved.data(), reinterpret_cast<const void*>(target), hook->patch_len);
+
+		std::vector<std::uint8_t> patch{};
+		if (!x86_64::emit_rel_jmp(patch, target, hook->stub)) {
+			free_slot(reg, slot);
+			throw std::runtime_error("hook trampoline is out of range of the target");
+		}
+		/* Pad out whatever is left of the instructions we clobbered, nothing should ever land here */
+		patch.resize(hook->patch_len, 0xCCU);
+		std::copy(std::begin(patch), std::end(patch), std::begin(hook->patch));
+
+		std::memcpy(reinterpret_cast<void*>(hook->stub), stub.data(), stub.size());
+		std::memcpy(reinterpret_cast<void*>(hook->original), original.data(), original.size());
+
+		auto& res{*hook};
+		reg.hooks.emplace_back(std::move(hook));
+		_install.push_back(&res);
+		return res;
+#endif
+	}
+
+	void hook_batch_t::remove(hook_t& hook) {
+		const auto pending{std::find(std::begin(_install), std::end(_install), &hook)};
+		if (pending != std::end(_install)) {
+			auto& reg{registry()};
+			const std::lock_guard<std::mutex> lock{reg.lock};
+			discard(reg, &hook);
+			_install.erase(pending);
+		} else if (hook.installed.load()) {
+			_remove.push_back(&hook);
+		}
+	}
+
+	void hook_batch_t::clear() noexcept {
+		if (!_install.empty()) {
+			auto& reg{registry()};
+			const std::lock_guard<std::mutex> lock{reg.lock};
+			/* Newest first so as many slots as possible go straight back to their chunks */
+			for (auto hook{_install.rbegin()}; hook != _install.rend(); ++hook) {
+				discard(reg, *hook);
+			}
+		}
+		_install.clear();
+		_remove.clear();
+	}
+
+	bool hook_batch_t::commit(const std::vector<mapentry_t>& maps) noexcept {
+		if (size() == 0U) {
+			return true;
+		}
+
+		patch_batch_t patches{};
+		try {
+			for (const auto hook : _install) {
+				patches.add(hook->target, hook->patch.data(), hook->patch_len);
+			}
+			for (const auto hook : _remove) {
+				patches.add(hook->target, hook->saved.data(), hook->patch_len);
+			}
+		} catch (const std::bad_alloc&) {
+			clear();
+			return false;
+		}
+
+		if (!patches.commit(maps)) {
+			clear();
+			return false;
+		}
+
+		for (const auto hook : _install) {
+			hook->installed.store(true);
+		}
+		for (const auto hook : _remove) {
+			hook->installed.store(false);
+		}
+
+		/* They're in now, so they mustn't be discarded by `clear` */
+		_install.clear();
+		_remove.clear();
+		return true;
+	}
+
+	std::vector<hook_t*> hooks() {
+		auto& reg{registry()};
+		const std::lock_guard<std::mutex> lock{reg.lock};
+
+		std::vector<hook_t*> res{};
+		res.reserve(reg.hooks.size());
+		for (auto& hook : reg.hooks) {
+			res.push_back(hook.get());
+		}
+		return res;
+	}
+
+	hook_t* find_hook(const std::uintptr_t target) noexcept {
+		auto& reg{registry()};
+		const std::lock_guard<std::mutex> lock{reg.lock};
+		return find_hook_locked(reg, target);
+	}
+
+	bool in_hook_handler() noexcept {
+		return hook_tls.depth != 0U;
+	}
+}
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* hook.hh - Inline function hooks and the native dispatch path */
+#pragma once
+#if !defined(SYCOPHANT_HOOK_HH)
+#define SYCOPHANT_HOOK_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <string>
+
+#include <types.hh>
+
+namespace sycophant {
+
+	/* Register state at the hooked function's entry, the layout is shared with the entry stub */
+	struct hook_regs_t final {
+		std::uint64_t rdi;
+		std::uint64_t rsi;
+		std::uint64_t rdx;
+		std::uint64_t rcx;
+		std::uint64_t r8;
+		std::uint64_t r9;
+		std::uint64_t rax;
+		std::uint64_t r10;
+		/* Points at the return address */
+		std::uint64_t rsp;
+		std::uint64_t _pad;
+		std::array<std::array<std::uint64_t, 2>, 16> xmm;
+
+		[[nodiscard]]
+		std::uint64_t arg(const std::size_t idx) const noexcept {
+			switch (idx) {
+				case 0: return rdi;
+				case 1: return rsi;
+				case 2: return rdx;
+				case 3: return rcx;
+				case 4: return r8;
+				case 5: return r9;
+				default: return 0U;
+			}
+		}
+	};
+
+	/* Return value of a hooked function as seen by the exit handler, the layout is shared with the return stub */
+	struct hook_ret_t final {
+		std::uint64_t rax;
+		std::uint64_t rdx;
+		std::array<std::array<std::uint64_t, 2>, 2> xmm;
+		/* TSC ticks from just after the entry handler ran to the function returning */
+		std::uint64_t cycles;
+		std::uint64_t _pad;
+	};
+
+	inline constexpr std::size_t hook_max_args{6U};
+	/* Number of in-flight return probes each thread can track, deeper calls still get their entry handler */
+	inline constexpr std::size_t shadow_stack_depth{1024U};
+
+	struct hook_t final {
+		using handler_t = std::function<void(hook_t&, hook_regs_t&)>;
+		using exit_handler_t = std::function<void(hook_t&, hook_ret_t&)>;
+
+		std::uintptr_t target{};
+		/* Relocated prologue followed by a jump back into the target, call this to get the real function */
+		std::uintptr_t original{};
+		std::uintptr_t stub{};
+		std::size_t patch_len{};
+		std::array<std::uint8_t, 32> saved{};
+		std::array<std::uint8_t, 32> patch{};
+
+		/* If set the handler is also run for calls made from inside of a handler on the same thread */
+		std::atomic<bool> nested{false};
+		std::atomic<bool> installed{false};
+		std::atomic<std::uint64_t> calls{0};
+		/* Calls that went straight to `original` because the thread was already inside a handler */
+		std::atomic<std::uint64_t> bypassed{0};
+		/* Calls that didn't get a return probe because the thread's shadow stack was full */
+		std::atomic<std::uint64_t> dropped{0};
+
+		handler_t on_entry{};
+		/* If set the return address is swapped out on entry so this is run when the function returns */
+		exit_handler_t on_exit{};
+	};
+
+	/*
+		A set of hook installs and removals applied under a single stop-the-world, the hooks are fully
+		prepared (trampolines allocated and prologues relocated) before anything is stopped.
+	*/
+	struct hook_batch_t final {
+	private:
+		std::vector<hook_t*> _install{};
+		std::vector<hook_t*> _remove{};
+
+	public:
+		hook_batch_t() = default;
+		~hook_batch_t() noexcept { clear(); }
+
+		hook_batch_t(const hook_batch_t&) = delete;
+		hook_batch_t& operator=(const hook_batch_t&) = delete;
+		hook_batch_t(hook_batch_t&&) = delete;
+		hook_batch_t& operator=(hook_batch_t&&) = delete;
+
+		/* Prepares a new hook, throws std::runtime_error if `target` can't be hooked */
+		hook_t& install(
+			std::uintptr_t target, hook_t::handler_t on_entry, hook_t::exit_handler_t on_exit, bool nested,
+			const std::vector<mapentry_t>& maps
+		);
+		/* A hook that's still waiting to be installed by this batch is discarded */
+		void remove(hook_t& hook);
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return _install.size() + _remove.size(); }
+		/* Drops everything, hooks that were waiting to be installed are discarded */
+		void clear() noexcept;
+
+		/* The batch is empty afterwards either way, if it fails nothing was changed and its installs are discarded */
+		[[nodiscard]]
+		bool commit(const std::vector<mapentry_t>& maps) noexcept;
+	};
+
+	/* Every hook installed or waiting to be, these are never freed as a thread could still be running through one */
+	[[nodiscard]]
+	std::vector<hook_t*> hooks();
+
+	[[nodiscard]]
+	hook_t* find_hook(std::uintptr_t target) noexcept;
+
+	/* Is the calling thread currently inside of a hook handler */
+	[[nodiscard]]
+	bool in_hook_handler() noexcept;
+}
+
+#endif /* SYCOPHANT_HOOK_HH */
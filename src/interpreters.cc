@@ -0,0 +1,431 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* interpreters.cc - Isolated sub-interpreters for running hook handlers */
+#include <Python.h>
+#include <marshal.h>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+
+#include <interpreters.hh>
+
+namespace sycophant {
+	std::atomic<interpreter_pool_t*> interpreter_pool_t::_active{nullptr};
+
+	namespace {
+		/* This thread's state in each of the interpreters, made the first time it runs something in one */
+		struct thread_states_t final {
+			std::array<PyThreadState*, max_interpreters> states{};
+			/* The interpreter whose GIL this thread holds right now */
+			std::int32_t current{-1};
+			std::size_t preferred{static_cast<std::size_t>(::gettid())};
+
+			~thread_states_t() noexcept;
+		};
+
+		thread_local thread_states_t thread_states{};
+
+		[[nodiscard]]
+		PyThreadState* attached_state() noexcept {
+#if PY_VERSION_HEX >= 0x030D0000
+			return PyThreadState_GetUnchecked();
+#else
+			return _PyThreadState_UncheckedGet();
+#endif
+		}
+
+		thread_states_t::~thread_states_t() noexcept {
+			if (!Py_IsInitialized()) {
+				return;
+			}
+			/* The main thread can still be holding the main interpreter's GIL when it exits */
+			const auto outer{attached_state()};
+			if (outer != nullptr) {
+				static_cast<void>(PyEval_SaveThread());
+			}
+			for (auto state : states) {
+				if (state != nullptr) {
+					PyEval_RestoreThread(state);
+					PyThreadState_Clear(state);
+					PyThreadState_DeleteCurrent();
+				}
+			}
+			if (outer != nullptr) {
+				PyEval_RestoreThread(outer);
+			}
+		}
+
+#if PY_VERSION_HEX >= 0x030C0000
+		/* The sycophant_worker module, only the isolated interpreters that need 3.12 ever import it */
+		[[nodiscard]]
+		channel_t* worker_channel(PyObject* const handle) noexcept {
+			const auto pool{interpreter_pool_t::active()};
+			const auto value{PyLong_AsLong(handle)};
+			if (value == -1 && PyErr_Occurred()) {
+				return nullptr;
+			}
+			const auto channel{pool != nullptr ? pool->channels().get(static_cast<std::int32_t>(value)) : nullptr};
+			if (channel == nullptr) {
+				PyErr_SetString(PyExc_ValueError, "not a channel handle");
+			}
+			return channel;
+		}
+
+		PyObject* worker_open(PyObject*, PyObject* args, PyObject* kwargs) {
+			static const char* keywords[]{"name", "capacity", "size", nullptr};
+			const char* name{};
+			std::uint32_t capacity{1024U};
+			std::uint32_t size{256U};
+			if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|II", const_cast<char**>(keywords), &name, &capacity, &size)) {
+				return nullptr;
+			}
+			const auto pool{interpreter_pool_t::active()};
+			if (pool == nullptr) {
+				PyErr_SetString(PyExc_RuntimeError, "no interpreter pool");
+				return nullptr;
+			}
+			try {
+				const auto handle{pool->channels().open(name, capacity, size)};
+				if (handle < 0) {
+					PyErr_SetString(PyExc_RuntimeError, "too many channels");
+					return nullptr;
+				}
+				return PyLong_FromLong(handle);
+			} catch (const std::exception& err) {
+				PyErr_SetString(PyExc_ValueError, err.what());
+				return nullptr;
+			}
+		}
+
+		PyObject* worker_send(PyObject*, PyObject* const* args, const Py_ssize_t nargs) {
+			if (nargs != 2) {
+				PyErr_SetString(PyExc_TypeError, "send(handle, data)");
+				return nullptr;
+			}
+			const auto channel{worker_channel(args[0])};
+			if (channel == nullptr) {
+				return nullptr;
+			}
+			Py_buffer view{};
+			if (PyObject_GetBuffer(args[1], &view, PyBUF_SIMPLE) != 0) {
+				return nullptr;
+			}
+			const auto sent{channel->send(view.buf, static_cast<std::size_t>(view.len))};
+			PyBuffer_Release(&view);
+			return PyBool_FromLong(sent);
+		}
+
+		PyObject* worker_receive(PyObject*, PyObject* const handle) {
+			const auto channel{worker_channel(handle)};
+			if (channel == nullptr) {
+				return nullptr;
+			}
+			PyObject* res{nullptr};
+			if (!channel->receive([&](const std::uint8_t* data, const std::size_t length) {
+				res = PyBytes_FromStringAndSize(reinterpret_cast<const char*>(data), static_cast<Py_ssize_t>(length));
+			})) {
+				Py_RETURN_NONE;
+			}
+			return res;
+		}
+
+		PyObject* worker_index(PyObject*, PyObject*) {
+			return PyLong_FromLong(interpreter_pool_t::index());
+		}
+
+		/* What the bundle importer each interpreter gets calls into */
+		PyObject* worker_bundled(PyObject*, PyObject* const name) {
+			const auto pool{interpreter_pool_t::active()};
+			if (pool == nullptr) {
+				PyErr_SetString(PyExc_RuntimeError, "no active interpreter pool");
+				return nullptr;
+			}
+			const auto module{PyUnicode_AsUTF8(name)};
+			if (module == nullptr) {
+				return nullptr;
+			}
+			if (const auto found{pool->bundle().find(module)}) {
+				return PyBool_FromLong(found->package);
+			}
+			Py_RETURN_NONE;
+		}
+
+		PyObject* worker_exec_bundled(PyObject*, PyObject* const* args, const Py_ssize_t nargs) {
+			const auto pool{interpreter_pool_t::active()};
+			if (pool == nullptr) {
+				PyErr_SetString(PyExc_RuntimeError, "no active interpreter pool");
+				return nullptr;
+			}
+			if (nargs != 2) {
+				PyErr_Format(PyExc_TypeError, "_exec_bundled expected 2 arguments, got %zd", nargs);
+				return nullptr;
+			}
+			/* Sets its own error when the name isn't a str */
+			const auto module{PyUnicode_AsUTF8(args[0])};
+			if (module == nullptr) {
+				return nullptr;
+			}
+			const auto found{pool->bundle().find(module)};
+			if (!found) {
+				PyErr_Format(PyExc_ImportError, "no module named %s in the bundle", module);
+				return nullptr;
+			}
+			const auto code{PyMarshal_ReadObjectFromString(found->code, static_cast<Py_ssize_t>(found->length))};
+			if (code == nullptr) {
+				return nullptr;
+			}
+			const auto res{PyEval_EvalCode(code, args[1], args[1])};
+			Py_DECREF(code);
+			return res;
+		}
+
+		PyMethodDef worker_methods[]{
+			{"open", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(worker_open)), METH_VARARGS | METH_KEYWORDS,
+				"open(name, capacity=1024, size=256) -> handle of the channel called name"},
+			{"send", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(worker_send)), METH_FASTCALL,
+				"send(handle, data) -> False if the channel is full or data too big"},
+			{"receive", worker_receive, METH_O, "receive(handle) -> the oldest message or None"},
+			{"index", worker_index, METH_NOARGS, "index() -> the interpreter this is running in"},
+			{"_bundled", worker_bundled, METH_O, nullptr},
+			{"_exec_bundled", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(worker_exec_bundled)), METH_FASTCALL, nullptr},
+			{nullptr, nullptr, 0, nullptr},
+		};
+
+		PyModuleDef_Slot worker_slots[]{
+			{Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+			{0, nullptr},
+		};
+
+		PyModuleDef worker_module{
+			PyModuleDef_HEAD_INIT, "sycophant_worker", "Sycophant API for isolated interpreters", 0,
+			worker_methods, worker_slots, nullptr, nullptr, nullptr
+		};
+
+		PyObject* init_worker() {
+			return PyModuleDef_Init(&worker_module);
+		}
+
+		/* Lets the interpreter import out of the same bundle as the main one */
+		constexpr auto bundle_importer{R"(
+import sys, _frozen_importlib, sycophant_worker
+
+class bundle_importer:
+	def find_spec(self, fullname, path = None, target = None):
+		package = sycophant_worker._bundled(fullname)
+		if package is None:
+			return None
+		return _frozen_importlib.ModuleSpec(fullname, self, origin = '<bundle>', is_package = package)
+
+	def create_module(self, spec):
+		return None
+
+	def exec_module(self, module):
+		sycophant_worker._exec_bundled(module.__spec__.name, module.__dict__)
+
+sys.meta_path.insert(0, bundle_importer())
+)"};
+#endif
+	}
+
+	interpreter_pool_t::interpreter_pool_t(channel_registry_t& channels, const bundle_t& bundle) noexcept :
+		_channels{channels}, _bundle{bundle} { }
+
+	bool interpreter_pool_t::supported() noexcept {
+		return PY_VERSION_HEX >= 0x030C0000;
+	}
+
+	void interpreter_pool_t::prepare() noexcept {
+#if PY_VERSION_HEX >= 0x030C0000
+		static_cast<void>(PyImport_AppendInittab("sycophant_worker", &init_worker));
+#endif
+	}
+
+	std::int32_t interpreter_pool_t::index() noexcept {
+		return thread_states.current;
+	}
+
+	bool interpreter_pool_t::create(const std::size_t index, const std::vector<std::string>& path) noexcept {
+#if PY_VERSION_HEX >= 0x030C0000
+		PyInterpreterConfig config{};
+		config.use_main_obmalloc = 0;
+		config.allow_fork = 0;
+		config.allow_exec = 0;
+		config.allow_threads = 1;
+		config.allow_daemon_threads = 0;
+		config.check_multi_interp_extensions = 1;
+		config.gil = PyInterpreterConfig_OWN_GIL;
+
+		/* On failure we're handed back the main interpreter just like we left it */
+		const auto outer{PyThreadState_Get()};
+		PyThreadState* state{nullptr};
+		if (PyStatus_Exception(Py_NewInterpreterFromConfig(&state, &config)) || state == nullptr) {
+			return false;
+		}
+
+		auto ok{true};
+		if (const auto paths{PyList_New(0)}) {
+			for (const auto& entry : path) {
+				if (const auto item{PyUnicode_FromStringAndSize(entry.data(), static_cast<Py_ssize_t>(entry.size()))}) {
+					static_cast<void>(PyList_Append(paths, item));
+					Py_DECREF(item);
+				}
+			}
+			ok = PySys_SetObject("path", paths) == 0;
+			Py_DECREF(paths);
+		}
+		if (ok && _bundle.valid()) {
+			ok = PyRun_SimpleString(bundle_importer) == 0;
+		}
+		if (!ok) {
+			PyErr_Print();
+		}
+
+		auto& interpreter{_interpreters[index]};
+		interpreter.interp = PyThreadState_GetInterpreter(state);
+		thread_states.states[index] = state;
+		static_cast<void>(PyEval_SaveThread());
+		PyEval_RestoreThread(outer);
+		return true;
+#else
+		static_cast<void>(index);
+		static_cast<void>(path);
+		return false;
+#endif
+	}
+
+	std::size_t interpreter_pool_t::start(std::size_t count, const std::vector<std::string>& path) {
+		std::lock_guard<std::mutex> lock{_lock};
+		if (count == 0U) {
+			count = std::max(std::thread::hardware_concurrency(), 1U);
+		}
+		count = std::min(count, max_interpreters);
+
+		auto size{_size.load(std::memory_order_relaxed)};
+		_active.store(this, std::memory_order_release);
+		for (; size < count && create(size, path); ++size) {
+			_size.store(size + 1U, std::memory_order_release);
+		}
+		return size;
+	}
+
+	template<typename call_t>
+	void interpreter_pool_t::enter(call_t&& call) noexcept {
+		auto& states{thread_states};
+		/* A handler that ends up in another hooked function stays in the interpreter it's already in */
+		if (states.current >= 0) {
+			call(_interpreters[static_cast<std::size_t>(states.current)]);
+			return;
+		}
+
+		const auto count{size()};
+		if (count == 0U) {
+			return;
+		}
+		const auto first{states.preferred % count};
+		auto pick{first};
+		auto claimed{false};
+		for (std::size_t offset{}; offset < count && !claimed; ++offset) {
+			const auto idx{(first + offset) % count};
+			auto idle{false};
+			if (_interpreters[idx].busy.compare_exchange_strong(idle, true, std::memory_order_acquire)) {
+				pick = idx;
+				claimed = true;
+			}
+		}
+
+		auto& interpreter{_interpreters[pick]};
+		auto& state{states.states[pick]};
+		if (state == nullptr) {
+			state = PyThreadState_New(interpreter.interp);
+		}
+		if (state != nullptr) {
+			/* Each interpreter has its own GIL, so whatever this thread was holding has to be let go of first */
+			const auto outer{attached_state()};
+			if (outer != nullptr) {
+				static_cast<void>(PyEval_SaveThread());
+			}
+			PyEval_RestoreThread(state);
+			states.current = static_cast<std::int32_t>(pick);
+			call(interpreter);
+			states.current = -1;
+			static_cast<void>(PyEval_SaveThread());
+			if (outer != nullptr) {
+				PyEval_RestoreThread(outer);
+			}
+		}
+		if (claimed) {
+			interpreter.busy.store(false, std::memory_order_release);
+		}
+	}
+
+	const interpreter_pool_t::handler_t& interpreter_pool_t::resolve(interpreter_t& interpreter, const std::string& spec) noexcept {
+		if (const auto handler{interpreter.handlers.find(spec)}; handler != interpreter.handlers.end()) {
+			return handler->second;
+		}
+
+		/* A spec that can't be resolved is reported once and then ignored */
+		handler_t res{nullptr, 0U};
+		const auto split{spec.find(':')};
+		if (split == std::string::npos) {
+			PyErr_Format(PyExc_ValueError, "isolated handlers are named 'module:function', not '%s'", spec.c_str());
+		} else if (auto obj{PyImport_ImportModule(spec.substr(0, split).c_str())}) {
+			auto name{spec.substr(split + 1U)};
+			for (std::size_t pos{}; obj != nullptr && pos <= name.size();) {
+				const auto end{std::min(name.find('.', pos), name.size())};
+				const auto attr{PyObject_GetAttrString(obj, name.substr(pos, end - pos).c_str())};
+				Py_DECREF(obj);
+				obj = attr;
+				pos = end + 1U;
+			}
+			res.func = obj;
+		}
+
+		if (res.func != nullptr) {
+			/* Only plain functions say how many arguments they take, anything else gets all of them */
+			res.nargs = SIZE_MAX;
+			if (const auto code{PyObject_GetAttrString(res.func, "__code__")}) {
+				const auto argcount{PyObject_GetAttrString(code, "co_argcount")};
+				const auto flags{PyObject_GetAttrString(code, "co_flags")};
+				if (argcount != nullptr && flags != nullptr && (PyLong_AsLong(flags) & CO_VARARGS) == 0) {
+					res.nargs = static_cast<std::size_t>(PyLong_AsSize_t(argcount));
+				}
+				Py_XDECREF(argcount);
+				Py_XDECREF(flags);
+				Py_DECREF(code);
+			}
+			PyErr_Clear();
+		} else {
+			PyErr_WriteUnraisable(nullptr);
+		}
+		return interpreter.handlers.emplace(spec, res).first->second;
+	}
+
+	void interpreter_pool_t::call(const std::string& spec, const std::uint64_t* const args, const std::size_t nargs) noexcept {
+		enter([&](interpreter_t& interpreter) {
+			const auto& handler{resolve(interpreter, spec)};
+			if (handler.func == nullptr) {
+				return;
+			}
+			const auto count{std::min(nargs, handler.nargs)};
+			const auto tuple{PyTuple_New(static_cast<Py_ssize_t>(count))};
+			if (tuple == nullptr) {
+				PyErr_WriteUnraisable(handler.func);
+				return;
+			}
+			for (std::size_t idx{}; idx < count; ++idx) {
+				const auto arg{PyLong_FromUnsignedLongLong(args[idx])};
+				if (arg == nullptr) {
+					Py_DECREF(tuple);
+					PyErr_WriteUnraisable(handler.func);
+					return;
+				}
+				PyTuple_SET_ITEM(tuple, static_cast<Py_ssize_t>(idx), arg);
+			}
+			if (const auto res{PyObject_Call(handler.func, tuple, nullptr)}) {
+				Py_DECREF(res);
+			} else {
+				PyErr_WriteUnraisable(handler.func);
+			}
+			Py_DECREF(tuple);
+		});
+	}
+}
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* interpreters.hh - Isolated sub-interpreters for running hook handlers */
+#pragma once
+#if !defined(SYCOPHANT_INTERPRETERS_HH)
+#define SYCOPHANT_INTERPRETERS_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+
+#include <channels.hh>
+#include <bundle.hh>
+
+namespace fs = std::filesystem;
+
+/* PyInterpreterState and PyObject, so this can be included without Python.h */
+struct _is;
+struct _object;
+
+namespace sycophant {
+	constexpr std::size_t max_interpreters{64U};
+
+	/*
+		A pool of sub-interpreters that each have their own GIL (PEP 684, Python 3.12+), so handlers
+		running in different ones really do run at the same time. Nothing can be shared with them
+		but plain data, so a handler is named as "module:function" and every interpreter imports
+		it for itself the first time it's called there. Whatever needs to be shared goes through the
+		channels, the `sycophant_worker` module exposes them in each interpreter.
+
+		A caller takes the first idle interpreter, starting from one picked by its thread id, and if
+		they're all busy it queues up on the GIL of that first pick.
+	*/
+	struct interpreter_pool_t final {
+	private:
+		struct handler_t final {
+			_object* func;
+			std::size_t nargs;
+		};
+
+		struct interpreter_t final {
+			_is* interp{nullptr};
+			alignas(64) std::atomic<bool> busy{false};
+			/* Only touched with the interpreter's GIL held */
+			std::unordered_map<std::string, handler_t> handlers{};
+		};
+
+		/* The one the `sycophant_worker` module talks to */
+		static std::atomic<interpreter_pool_t*> _active;
+
+		channel_registry_t& _channels;
+		const bundle_t& _bundle;
+		std::mutex _lock{};
+		std::array<interpreter_t, max_interpreters> _interpreters{};
+		std::atomic<std::size_t> _size{0U};
+
+		/* Imports `spec` in the current interpreter, a handler without a function if that didn't work */
+		[[nodiscard]]
+		static const handler_t& resolve(interpreter_t& interpreter, const std::string& spec) noexcept;
+		[[nodiscard]]
+		bool create(std::size_t index, const std::vector<std::string>& path) noexcept;
+
+		/* Runs `call` with the GIL of one of the interpreters held */
+		template<typename call_t>
+		void enter(call_t&& call) noexcept;
+
+	public:
+		interpreter_pool_t(channel_registry_t& channels, const bundle_t& bundle) noexcept;
+
+		interpreter_pool_t(const interpreter_pool_t&) = delete;
+		interpreter_pool_t& operator=(const interpreter_pool_t&) = delete;
+
+		/* If this Python can give sub-interpreters their own GIL */
+		[[nodiscard]]
+		static bool supported() noexcept;
+		/* Registers `sycophant_worker`, has to happen before the main interpreter is initialized */
+		static void prepare() noexcept;
+		/* The pool that's been started, if any */
+		[[nodiscard]]
+		static interpreter_pool_t* active() noexcept { return _active.load(std::memory_order_acquire); }
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return _size.load(std::memory_order_acquire); }
+		[[nodiscard]]
+		channel_registry_t& channels() const noexcept { return _channels; }
+		[[nodiscard]]
+		const bundle_t& bundle() const noexcept { return _bundle; }
+		/* The index of the interpreter the calling thread is running in, -1 if it's not one of ours */
+		[[nodiscard]]
+		static std::int32_t index() noexcept;
+
+		/*
+			Starts up to `count` interpreters (0 for one per CPU) that see `path` as their sys.path,
+			the main interpreter's GIL must be held. Returns how many there are now.
+		*/
+		std::size_t start(std::size_t count, const std::vector<std::string>& path);
+
+		/* Runs the "module:function" `spec` with `args` as ints, errors are reported as unraisable */
+		void call(const std::string& spec, const std::uint64_t* args, std::size_t nargs) noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_INTERPRETERS_HH */
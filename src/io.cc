@@ -0,0 +1,659 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* io.cc - Latency and size histograms for I/O calls */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstdarg>
+#include <cstring>
+#include <charconv>
+#include <map>
+#include <new>
+#include <tuple>
+#include <utility>
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#undef _GNU_SOURCE
+
+#include <io.hh>
+#include <stats.hh>
+
+namespace sycophant {
+	namespace {
+		using entry_key_t = std::tuple<std::int32_t, std::uint32_t, io_op_t>;
+
+		[[nodiscard]]
+		constexpr bool moves_data(const io_op_t op) noexcept {
+			return op < io_op_t::fsync;
+		}
+
+		void merge_into(io_entry_t& into, const io_entry_t& from) {
+			if (into.path.empty()) {
+				into.path = from.path;
+			}
+			into.latency.merge(from.latency);
+			into.bytes.merge(from.bytes);
+		}
+	}
+
+	std::atomic<io_profiler_t*> io_profiler_t::_instance{nullptr};
+
+	io_profiler_t::block_t::block_t(mmap_t&& table) noexcept : map{std::move(table)} {
+		for (std::size_t idx{}; idx <= max_entries; ++idx) {
+			new(entries() + idx) entry_t{};
+		}
+		auto& other{entries()[max_entries]};
+		other.fd = io_fd_other;
+		other.used.store(true, std::memory_order_release);
+	}
+
+	io_profiler_t::owner_t::~owner_t() noexcept {
+		if (block != nullptr) {
+			block->owned.store(false, std::memory_order_release);
+		}
+	}
+
+	io_profiler_t::io_profiler_t() noexcept {
+		_instance.store(this, std::memory_order_release);
+	}
+
+	io_profiler_t::~io_profiler_t() noexcept {
+		_instance.store(nullptr, std::memory_order_release);
+	}
+
+	io_profiler_t::block_t* io_profiler_t::block() noexcept {
+		/* There's only the one io_profiler_t, so which one the block belongs to doesn't need tracking */
+		static thread_local owner_t current{};
+		if (current.block != nullptr) {
+			return current.block;
+		}
+
+		for (auto block{_blocks.load(std::memory_order_acquire)}; block != nullptr; block = block->next) {
+			auto owned{false};
+			if (block->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+				current.block = block;
+				return block;
+			}
+		}
+
+		mmap_t map{-1, sizeof(entry_t) * (max_entries + 1U), prot_t::RW, MAP_PRIVATE | MAP_ANONYMOUS};
+		if (!map.valid()) {
+			return nullptr;
+		}
+		auto block{new(std::nothrow) block_t{std::move(map)}};
+		if (block == nullptr) {
+			return nullptr;
+		}
+		block->epoch.store(_epoch.load(std::memory_order_acquire), std::memory_order_release);
+		block->next = _blocks.load(std::memory_order_relaxed);
+		while (!_blocks.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed)) { }
+		current.block = block;
+		return block;
+	}
+
+	void io_profiler_t::clear(block_t& block, const std::uint64_t epoch) noexcept {
+		/* Anyone reading it while we're at it throws away what they read */
+		block.epoch.store(epoch_invalid, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		const auto entries{block.entries()};
+		for (std::size_t idx{}; idx <= max_entries; ++idx) {
+			auto& entry{entries[idx]};
+			if (idx != max_entries) {
+				entry.used.store(false, std::memory_order_relaxed);
+			}
+			for (auto& series : entry.series) {
+				series.store(nullptr, std::memory_order_relaxed);
+			}
+			entry.resolved.store(false, std::memory_order_relaxed);
+		}
+		block.chunk = block.chunks;
+		block.chunk_used = block.chunks != nullptr ? 0U : chunk_series;
+		block.epoch.store(epoch, std::memory_order_release);
+	}
+
+	io_profiler_t::entry_t& io_profiler_t::entry(block_t& block, const std::int32_t fd, const std::uint32_t generation) noexcept {
+		const auto entries{block.entries()};
+		const auto key{(static_cast<std::uint64_t>(static_cast<std::uint32_t>(fd)) << 32U) | generation};
+		auto idx{static_cast<std::size_t>((key * 0x9E3779B97F4A7C15U) >> 32U) % max_entries};
+		for (std::size_t probe{}; probe < max_probe; ++probe, idx = (idx + 1U) % max_entries) {
+			auto& entry{entries[idx]};
+			if (!entry.used.load(std::memory_order_relaxed)) {
+				entry.fd = fd;
+				entry.generation = generation;
+				entry.used.store(true, std::memory_order_release);
+				return entry;
+			}
+			if (entry.fd == fd && entry.generation == generation) {
+				return entry;
+			}
+		}
+		return entries[max_entries];
+	}
+
+	io_profiler_t::series_t* io_profiler_t::series(block_t& block, entry_t& entry, const io_op_t op) noexcept {
+		auto& slot{entry.series[static_cast<std::size_t>(op)]};
+		if (const auto res{slot.load(std::memory_order_relaxed)}) {
+			return res;
+		}
+
+		if (block.chunk_used == chunk_series) {
+			auto& link{block.chunk != nullptr ? block.chunk->next : block.chunks};
+			if (link == nullptr) {
+				mmap_t map{-1, sizeof(series_t) * chunk_series, prot_t::RW, MAP_PRIVATE | MAP_ANONYMOUS};
+				if (!map.valid()) {
+					return nullptr;
+				}
+				link = new(std::nothrow) chunk_t{std::move(map)};
+				if (link == nullptr) {
+					return nullptr;
+				}
+			}
+			block.chunk = link;
+			block.chunk_used = 0U;
+		}
+
+		const auto res{new(block.chunk->map.address<series_t>() + block.chunk_used++) series_t{}};
+		slot.store(res, std::memory_order_release);
+		return res;
+	}
+
+	void io_profiler_t::resolve(entry_t& entry, const std::int32_t fd) noexcept {
+		constexpr std::string_view prefix{"/proc/self/fd/"};
+		std::array<char, prefix.size() + 16U> link{};
+		std::memcpy(link.data(), prefix.data(), prefix.size());
+		const auto [end, err] = std::to_chars(link.data() + prefix.size(), link.data() + link.size() - 1U, fd);
+		if (err != std::errc{}) {
+			return;
+		}
+		*end = '\0';
+
+		const auto len{::readlink(link.data(), entry.path.data(), entry.path.size() - 1U)};
+		if (len <= 0) {
+			return;
+		}
+		entry.path[static_cast<std::size_t>(len)] = '\0';
+		entry.resolved.store(true, std::memory_order_release);
+	}
+
+	void io_profiler_t::record(
+		const io_op_t op, const std::int32_t fd, const std::uint32_t generation, const std::uint64_t ns, const std::int64_t bytes
+	) noexcept {
+		const auto block{this->block()};
+		if (block == nullptr) {
+			_dropped.fetch_add(1U, std::memory_order_relaxed);
+			return;
+		}
+		const auto epoch{_epoch.load(std::memory_order_acquire)};
+		if (block->epoch.load(std::memory_order_relaxed) != epoch) {
+			clear(*block, epoch);
+		}
+
+		auto& entry{this->entry(*block, fd, generation)};
+		/*
+			A close has already moved the fd on to its next file, and the entry for `io_fd_other` is shared
+			by every file that didn't fit so it never gets a path of its own.
+		*/
+		if (
+			op != io_op_t::close && fd >= 0 && static_cast<std::size_t>(fd) < max_fds &&
+			&entry != block->entries() + max_entries && !entry.resolved.load(std::memory_order_relaxed)
+		) {
+			/* Threads sharing an fd can lose a count to each other, which only makes it hot a little later */
+			auto& calls{_fds[static_cast<std::size_t>(fd)].calls};
+			const auto seen{calls.load(std::memory_order_relaxed)};
+			if (seen < hot_calls) {
+				calls.store(seen + 1U, std::memory_order_relaxed);
+				if (seen + 1U == hot_calls) {
+					resolve(entry, fd);
+				}
+			}
+		}
+
+		const auto series{this->series(*block, entry, op)};
+		if (series == nullptr) {
+			_dropped.fetch_add(1U, std::memory_order_relaxed);
+			return;
+		}
+		series->latency.record_owned(ns);
+		if (moves_data(op) && bytes >= 0) {
+			series->bytes.record_owned(static_cast<std::uint64_t>(bytes));
+		}
+	}
+
+	void io_profiler_t::called(const io_op_t op, const std::int32_t fd, const std::uint64_t ns, const std::int64_t bytes) noexcept {
+		const auto instance{_instance.load(std::memory_order_acquire)};
+		if (instance == nullptr) {
+			return;
+		}
+		const auto generation{
+			fd >= 0 && static_cast<std::size_t>(fd) < max_fds ?
+				instance->_fds[static_cast<std::size_t>(fd)].generation.load(std::memory_order_relaxed) : 0U
+		};
+		instance->record(op, fd, generation, ns, bytes);
+	}
+
+	std::uint32_t io_profiler_t::closing(const std::int32_t fd) noexcept {
+		const auto instance{_instance.load(std::memory_order_acquire)};
+		if (instance == nullptr || fd < 0 || static_cast<std::size_t>(fd) >= max_fds) {
+			return 0U;
+		}
+		auto& state{instance->_fds[static_cast<std::size_t>(fd)]};
+		state.calls.store(0U, std::memory_order_relaxed);
+		return state.generation.fetch_add(1U, std::memory_order_relaxed);
+	}
+
+	void io_profiler_t::opened(const std::int32_t fd) noexcept {
+		/* As far as the fd's generation goes it's the same as a close */
+		static_cast<void>(closing(fd));
+	}
+
+	void io_profiler_t::closed(const std::int32_t fd, const std::uint32_t generation, const std::uint64_t ns) noexcept {
+		const auto instance{_instance.load(std::memory_order_acquire)};
+		if (instance != nullptr) {
+			instance->record(io_op_t::close, fd, generation, ns, -1);
+		}
+	}
+
+	io_snapshot_t io_profiler_t::snapshot() const {
+		std::map<entry_key_t, io_entry_t> merged{};
+		const auto epoch{_epoch.load(std::memory_order_acquire)};
+		for (auto block{_blocks.load(std::memory_order_acquire)}; block != nullptr; block = block->next) {
+			if (block->epoch.load(std::memory_order_acquire) != epoch) {
+				continue;
+			}
+
+			std::vector<io_entry_t> found{};
+			const auto entries{block->entries()};
+			for (std::size_t idx{}; idx <= max_entries; ++idx) {
+				const auto& entry{entries[idx]};
+				if (!entry.used.load(std::memory_order_acquire)) {
+					continue;
+				}
+				std::string path{};
+				if (entry.resolved.load(std::memory_order_acquire)) {
+					path.assign(entry.path.data(), ::strnlen(entry.path.data(), entry.path.size()));
+				}
+				for (std::size_t op{}; op < entry.series.size(); ++op) {
+					if (const auto series{entry.series[op].load(std::memory_order_acquire)}) {
+						found.push_back({
+							entry.fd, entry.generation, static_cast<io_op_t>(op), path,
+							series->latency.snapshot(), series->bytes.snapshot()
+						});
+					}
+				}
+			}
+
+			/* It was reset while we were reading it, so there's nothing in it for this epoch */
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (block->epoch.load(std::memory_order_relaxed) != epoch) {
+				continue;
+			}
+			for (auto& entry : found) {
+				const auto [slot, inserted] = merged.try_emplace({entry.fd, entry.generation, entry.op}, entry);
+				if (!inserted) {
+					merge_into(slot->second, entry);
+				}
+			}
+		}
+
+		/* Whichever thread made the file hot only looked it up for the call it was making */
+		std::map<std::pair<std::int32_t, std::uint32_t>, std::string> paths{};
+		for (const auto& [key, entry] : merged) {
+			if (!entry.path.empty()) {
+				paths.try_emplace({entry.fd, entry.generation}, entry.path);
+			}
+		}
+
+		io_snapshot_t res{stats_clock_ns(), {}};
+		res.entries.reserve(merged.size());
+		for (auto& [key, entry] : merged) {
+			if (entry.path.empty()) {
+				const auto path{paths.find({entry.fd, entry.generation})};
+				if (path != paths.end()) {
+					entry.path = path->second;
+				}
+			}
+			res.entries.push_back(std::move(entry));
+		}
+		return res;
+	}
+
+	io_snapshot_t io_snapshot_t::diff(const io_snapshot_t& before) const {
+		std::map<entry_key_t, const io_entry_t*> earlier{};
+		for (const auto& entry : before.entries) {
+			earlier.emplace(entry_key_t{entry.fd, entry.generation, entry.op}, &entry);
+		}
+
+		io_snapshot_t res{taken, {}};
+		for (const auto& entry : entries) {
+			auto later{entry};
+			const auto prev{earlier.find({entry.fd, entry.generation, entry.op})};
+			if (prev != earlier.end()) {
+				later.latency.subtract(prev->second->latency);
+				later.bytes.subtract(prev->second->bytes);
+				if (later.path.empty()) {
+					later.path = prev->second->path;
+				}
+			}
+			if (later.latency.count != 0U) {
+				res.entries.push_back(std::move(later));
+			}
+		}
+		return res;
+	}
+
+	std::vector<io_entry_t> io_snapshot_t::by_path() const {
+		std::map<std::pair<std::string, io_op_t>, io_entry_t> merged{};
+		for (const auto& entry : entries) {
+			if (entry.path.empty()) {
+				continue;
+			}
+			const auto [slot, inserted] = merged.try_emplace({entry.path, entry.op}, entry);
+			if (inserted) {
+				slot->second.fd = -1;
+				slot->second.generation = 0U;
+			} else {
+				merge_into(slot->second, entry);
+			}
+		}
+
+		std::vector<io_entry_t> res{};
+		res.reserve(merged.size());
+		for (auto& [key, entry] : merged) {
+			res.push_back(std::move(entry));
+		}
+		return res;
+	}
+
+	namespace {
+		/* Looked up on first use, the interposers can run before any constructor has */
+		template<typename T>
+		[[nodiscard]]
+		T next_symbol(const char* const name) noexcept {
+			return reinterpret_cast<T>(dlsym(RTLD_NEXT, name));
+		}
+
+		/* Times `call` and files it under `fd`, leaving errno as the real call left it */
+		template<typename F>
+		[[gnu::always_inline]]
+		inline auto timed(const io_op_t op, const std::int32_t fd, F&& call) noexcept {
+			if (!io_profiler_t::active()) {
+				return call();
+			}
+			const auto start{stats_clock_ns()};
+			const auto res{call()};
+			const auto elapsed{stats_clock_ns() - start};
+			const auto err{errno};
+			io_profiler_t::called(op, fd, elapsed, static_cast<std::int64_t>(res));
+			errno = err;
+			return res;
+		}
+
+		/* Same as `timed` but files it under the fd the call hands back */
+		template<typename F>
+		[[gnu::always_inline]]
+		inline std::int32_t timed_open(F&& call) noexcept {
+			if (!io_profiler_t::active()) {
+				const auto res{call()};
+				if (res >= 0) {
+					const auto err{errno};
+					io_profiler_t::opened(res);
+					errno = err;
+				}
+				return res;
+			}
+			const auto start{stats_clock_ns()};
+			const auto res{call()};
+			const auto elapsed{stats_clock_ns() - start};
+			const auto err{errno};
+			if (res >= 0) {
+				io_profiler_t::opened(res);
+			}
+			io_profiler_t::called(io_op_t::open, res, elapsed, res);
+			errno = err;
+			return res;
+		}
+
+		[[nodiscard]]
+		constexpr bool needs_mode(const std::int32_t flags) noexcept {
+			return (flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE;
+		}
+
+		[[nodiscard]]
+		std::int32_t missing() noexcept {
+			errno = ENOSYS;
+			return -1;
+		}
+	}
+}
+
+using sycophant::io_op_t;
+using sycophant::io_profiler_t;
+
+using read_t = ::ssize_t (*)(std::int32_t, void*, std::size_t);
+using write_t = ::ssize_t (*)(std::int32_t, const void*, std::size_t);
+using pread_t = ::ssize_t (*)(std::int32_t, void*, std::size_t, ::off_t);
+using pwrite_t = ::ssize_t (*)(std::int32_t, const void*, std::size_t, ::off_t);
+using readv_t = ::ssize_t (*)(std::int32_t, const iovec*, std::int32_t);
+using read_chk_t = ::ssize_t (*)(std::int32_t, void*, std::size_t, std::size_t);
+using pread_chk_t = ::ssize_t (*)(std::int32_t, void*, std::size_t, ::off_t, std::size_t);
+using fsync_t = std::int32_t (*)(std::int32_t);
+using open_t = std::int32_t (*)(const char*, std::int32_t, ...);
+using openat_t = std::int32_t (*)(std::int32_t, const char*, std::int32_t, ...);
+using open_chk_t = std::int32_t (*)(const char*, std::int32_t);
+using openat_chk_t = std::int32_t (*)(std::int32_t, const char*, std::int32_t);
+
+/*
+	Each one stands in for the libc wrapper of the same name. The 64-bit offset names are the same
+	functions on x86_64 but anything built with _FILE_OFFSET_BITS=64 links against them, and the
+	fortified names are what _FORTIFY_SOURCE turns calls into when it can check the buffer.
+*/
+#define SYCOPHANT_REAL(type, name) \
+	static const auto real{sycophant::next_symbol<type>(name)}; \
+	if (real == nullptr) { \
+		return sycophant::missing(); \
+	}
+
+extern "C" {
+	::ssize_t sycophant_read(std::int32_t fd, void* buff, std::size_t len) asm ("read");
+	::ssize_t sycophant_write(std::int32_t fd, const void* buff, std::size_t len) asm ("write");
+	::ssize_t sycophant_pread(std::int32_t fd, void* buff, std::size_t len, ::off_t off) asm ("pread");
+	::ssize_t sycophant_pread64(std::int32_t fd, void* buff, std::size_t len, ::off_t off) asm ("pread64");
+	::ssize_t sycophant_pwrite(std::int32_t fd, const void* buff, std::size_t len, ::off_t off) asm ("pwrite");
+	::ssize_t sycophant_pwrite64(std::int32_t fd, const void* buff, std::size_t len, ::off_t off) asm ("pwrite64");
+	::ssize_t sycophant_readv(std::int32_t fd, const iovec* iov, std::int32_t count) asm ("readv");
+	::ssize_t sycophant_writev(std::int32_t fd, const iovec* iov, std::int32_t count) asm ("writev");
+	::ssize_t sycophant_read_chk(std::int32_t fd, void* buff, std::size_t len, std::size_t size) asm ("__read_chk");
+	::ssize_t sycophant_pread_chk(std::int32_t fd, void* buff, std::size_t len, ::off_t off, std::size_t size) asm ("__pread_chk");
+	::ssize_t sycophant_pread64_chk(std::int32_t fd, void* buff, std::size_t len, ::off_t off, std::size_t size) asm ("__pread64_chk");
+	std::int32_t sycophant_fsync(std::int32_t fd) asm ("fsync");
+	std::int32_t sycophant_fdatasync(std::int32_t fd) asm ("fdatasync");
+	std::int32_t sycophant_open(const char* path, std::int32_t flags, ...) asm ("open");
+	std::int32_t sycophant_open64(const char* path, std::int32_t flags, ...) asm ("open64");
+	std::int32_t sycophant_openat(std::int32_t dir, const char* path, std::int32_t flags, ...) asm ("openat");
+	std::int32_t sycophant_openat64(std::int32_t dir, const char* path, std::int32_t flags, ...) asm ("openat64");
+	std::int32_t sycophant_open_2(const char* path, std::int32_t flags) asm ("__open_2");
+	std::int32_t sycophant_open64_2(const char* path, std::int32_t flags) asm ("__open64_2");
+	std::int32_t sycophant_openat_2(std::int32_t dir, const char* path, std::int32_t flags) asm ("__openat_2");
+	std::int32_t sycophant_openat64_2(std::int32_t dir, const char* path, std::int32_t flags) asm ("__openat64_2");
+	std::int32_t sycophant_close(std::int32_t fd) asm ("close");
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_read(const std::int32_t fd, void* const buff, const std::size_t len) {
+		SYCOPHANT_REAL(read_t, "read")
+		return sycophant::timed(io_op_t::read, fd, [&]() { return real(fd, buff, len); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_write(const std::int32_t fd, const void* const buff, const std::size_t len) {
+		SYCOPHANT_REAL(write_t, "write")
+		return sycophant::timed(io_op_t::write, fd, [&]() { return real(fd, buff, len); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_pread(const std::int32_t fd, void* const buff, const std::size_t len, const ::off_t off) {
+		SYCOPHANT_REAL(pread_t, "pread")
+		return sycophant::timed(io_op_t::pread, fd, [&]() { return real(fd, buff, len, off); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_pread64(const std::int32_t fd, void* const buff, const std::size_t len, const ::off_t off) {
+		SYCOPHANT_REAL(pread_t, "pread64")
+		return sycophant::timed(io_op_t::pread, fd, [&]() { return real(fd, buff, len, off); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_pwrite(const std::int32_t fd, const void* const buff, const std::size_t len, const ::off_t off) {
+		SYCOPHANT_REAL(pwrite_t, "pwrite")
+		return sycophant::timed(io_op_t::pwrite, fd, [&]() { return real(fd, buff, len, off); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_pwrite64(const std::int32_t fd, const void* const buff, const std::size_t len, const ::off_t off) {
+		SYCOPHANT_REAL(pwrite_t, "pwrite64")
+		return sycophant::timed(io_op_t::pwrite, fd, [&]() { return real(fd, buff, len, off); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_readv(const std::int32_t fd, const iovec* const iov, const std::int32_t count) {
+		SYCOPHANT_REAL(readv_t, "readv")
+		return sycophant::timed(io_op_t::readv, fd, [&]() { return real(fd, iov, count); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_writev(const std::int32_t fd, const iovec* const iov, const std::int32_t count) {
+		SYCOPHANT_REAL(readv_t, "writev")
+		return sycophant::timed(io_op_t::writev, fd, [&]() { return real(fd, iov, count); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_read_chk(const std::int32_t fd, void* const buff, const std::size_t len, const std::size_t size) {
+		SYCOPHANT_REAL(read_chk_t, "__read_chk")
+		return sycophant::timed(io_op_t::read, fd, [&]() { return real(fd, buff, len, size); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_pread_chk(
+		const std::int32_t fd, void* const buff, const std::size_t len, const ::off_t off, const std::size_t size
+	) {
+		SYCOPHANT_REAL(pread_chk_t, "__pread_chk")
+		return sycophant::timed(io_op_t::pread, fd, [&]() { return real(fd, buff, len, off, size); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	::ssize_t sycophant_pread64_chk(
+		const std::int32_t fd, void* const buff, const std::size_t len, const ::off_t off, const std::size_t size
+	) {
+		SYCOPHANT_REAL(pread_chk_t, "__pread64_chk")
+		return sycophant::timed(io_op_t::pread, fd, [&]() { return real(fd, buff, len, off, size); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_fsync(const std::int32_t fd) {
+		SYCOPHANT_REAL(fsync_t, "fsync")
+		return sycophant::timed(io_op_t::fsync, fd, [&]() { return real(fd); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_fdatasync(const std::int32_t fd) {
+		SYCOPHANT_REAL(fsync_t, "fdatasync")
+		return sycophant::timed(io_op_t::fsync, fd, [&]() { return real(fd); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_open(const char* const path, const std::int32_t flags, ...) {
+		SYCOPHANT_REAL(open_t, "open")
+		::mode_t mode{};
+		if (sycophant::needs_mode(flags)) {
+			std::va_list args;
+			va_start(args, flags);
+			mode = va_arg(args, ::mode_t);
+			va_end(args);
+		}
+		return sycophant::timed_open([&]() { return real(path, flags, mode); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_open64(const char* const path, const std::int32_t flags, ...) {
+		SYCOPHANT_REAL(open_t, "open64")
+		::mode_t mode{};
+		if (sycophant::needs_mode(flags)) {
+			std::va_list args;
+			va_start(args, flags);
+			mode = va_arg(args, ::mode_t);
+			va_end(args);
+		}
+		return sycophant::timed_open([&]() { return real(path, flags, mode); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_openat(const std::int32_t dir, const char* const path, const std::int32_t flags, ...) {
+		SYCOPHANT_REAL(openat_t, "openat")
+		::mode_t mode{};
+		if (sycophant::needs_mode(flags)) {
+			std::va_list args;
+			va_start(args, flags);
+			mode = va_arg(args, ::mode_t);
+			va_end(args);
+		}
+		return sycophant::timed_open([&]() { return real(dir, path, flags, mode); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_openat64(const std::int32_t dir, const char* const path, const std::int32_t flags, ...) {
+		SYCOPHANT_REAL(openat_t, "openat64")
+		::mode_t mode{};
+		if (sycophant::needs_mode(flags)) {
+			std::va_list args;
+			va_start(args, flags);
+			mode = va_arg(args, ::mode_t);
+			va_end(args);
+		}
+		return sycophant::timed_open([&]() { return real(dir, path, flags, mode); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_open_2(const char* const path, const std::int32_t flags) {
+		SYCOPHANT_REAL(open_chk_t, "__open_2")
+		return sycophant::timed_open([&]() { return real(path, flags); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_open64_2(const char* const path, const std::int32_t flags) {
+		SYCOPHANT_REAL(open_chk_t, "__open64_2")
+		return sycophant::timed_open([&]() { return real(path, flags); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_openat_2(const std::int32_t dir, const char* const path, const std::int32_t flags) {
+		SYCOPHANT_REAL(openat_chk_t, "__openat_2")
+		return sycophant::timed_open([&]() { return real(dir, path, flags); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_openat64_2(const std::int32_t dir, const char* const path, const std::int32_t flags) {
+		SYCOPHANT_REAL(openat_chk_t, "__openat64_2")
+		return sycophant::timed_open([&]() { return real(dir, path, flags); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t sycophant_close(const std::int32_t fd) {
+		SYCOPHANT_REAL(fsync_t, "close")
+		/* Before the real close, once it's closed the fd can be handed straight back out */
+		const auto generation{io_profiler_t::closing(fd)};
+		if (!io_profiler_t::active()) {
+			return real(fd);
+		}
+		const auto start{sycophant::stats_clock_ns()};
+		const auto res{real(fd)};
+		const auto elapsed{sycophant::stats_clock_ns() - start};
+		const auto err{errno};
+		io_profiler_t::closed(fd, generation, elapsed);
+		errno = err;
+		return res;
+	}
+}
+
+#undef SYCOPHANT_REAL
@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* io.hh - Latency and size histograms for I/O calls */
+#pragma once
+#if !defined(SYCOPHANT_IO_HH)
+#define SYCOPHANT_IO_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mmap.hh>
+#include <histogram.hh>
+
+namespace sycophant {
+	enum struct io_op_t : std::uint8_t {
+		read,
+		write,
+		pread,
+		pwrite,
+		readv,
+		writev,
+		fsync,
+		open,
+		close,
+		count,
+	};
+
+	inline constexpr std::array<std::string_view, static_cast<std::size_t>(io_op_t::count)> io_op_names{{
+		"read",
+		"write",
+		"pread",
+		"pwrite",
+		"readv",
+		"writev",
+		"fsync",
+		"open",
+		"close",
+	}};
+
+	/* Where calls go once a thread has seen more files than it has room for */
+	inline constexpr std::int32_t io_fd_other{-2};
+
+	/* Everything one kind of call did to one open file, `generation` tells apart files that reused an fd */
+	struct io_entry_t final {
+		std::int32_t fd;
+		std::uint32_t generation;
+		io_op_t op;
+		/* Only looked up for files that turn out to be hot, empty otherwise */
+		std::string path;
+		/* Nanoseconds */
+		histogram_t latency;
+		/* Bytes moved, left empty for calls that don't move any */
+		histogram_t bytes;
+	};
+
+	struct io_snapshot_t final {
+		/* CLOCK_MONOTONIC nanoseconds */
+		std::uint64_t taken{0U};
+		std::vector<io_entry_t> entries{};
+
+		/* What happened between `before` and this, files that are in both have `before` taken out */
+		[[nodiscard]]
+		io_snapshot_t diff(const io_snapshot_t& before) const;
+		/* Entries with a path merged by path and call, with an fd of -1 and a generation of 0 */
+		[[nodiscard]]
+		std::vector<io_entry_t> by_path() const;
+	};
+
+	/*
+		Times the I/O calls the process makes through libc, the interposers live in io.cc. Every thread
+		records into a table of its own keyed by fd and generation, with a pair of histograms per kind of
+		call that are only ever written by that thread, so recording never takes a lock or a locked
+		instruction. Tables are handed to the next new thread once their owner exits and are never
+		unmapped, `snapshot` merges them all.
+
+		An fd's path is looked up through /proc/self/fd by whichever thread makes its `hot_calls`th call
+		on it, so short lived files never pay for it.
+
+		`reset` just bumps an epoch, each thread clears its own table on its next call and tables from an
+		old epoch are left out of snapshots until then.
+
+		Calls libc makes for itself, like those from stdio, don't go through the interposers.
+	*/
+	struct io_profiler_t final {
+	private:
+		static constexpr std::size_t max_entries{1024U};
+		static constexpr std::size_t max_probe{32U};
+		static constexpr std::size_t max_fds{16384U};
+		static constexpr std::size_t max_path{256U};
+		static constexpr std::size_t chunk_series{16U};
+		static constexpr std::uint32_t hot_calls{64U};
+		static constexpr std::uint64_t epoch_invalid{~std::uint64_t{}};
+
+		struct series_t final {
+			atomic_histogram_t latency{};
+			atomic_histogram_t bytes{};
+		};
+
+		/* Series are carved out of these, they're kept around and reused after a reset */
+		struct chunk_t final {
+			mmap_t map;
+			chunk_t* next{nullptr};
+
+			explicit chunk_t(mmap_t&& chunk) noexcept : map{std::move(chunk)} { }
+		};
+
+		struct entry_t final {
+			std::atomic<bool> used{false};
+			std::int32_t fd{0};
+			std::uint32_t generation{0U};
+			std::array<std::atomic<series_t*>, static_cast<std::size_t>(io_op_t::count)> series{};
+			std::atomic<bool> resolved{false};
+			std::array<char, max_path> path{};
+		};
+
+		struct block_t final {
+			mmap_t map;
+			std::atomic<std::uint64_t> epoch{0U};
+			std::atomic<bool> owned{true};
+			block_t* next{nullptr};
+
+			/* Only ever touched by the owning thread */
+			chunk_t* chunks{nullptr};
+			chunk_t* chunk{nullptr};
+			std::size_t chunk_used{chunk_series};
+
+			explicit block_t(mmap_t&& table) noexcept;
+
+			/* `max_entries` of them keyed by fd and generation, then the one for `io_fd_other` */
+			[[nodiscard]]
+			entry_t* entries() noexcept { return map.address<entry_t>(); }
+		};
+
+		/* Lets go of the thread's block when it exits so the next new thread can have it */
+		struct owner_t final {
+			block_t* block{nullptr};
+			~owner_t() noexcept;
+		};
+
+		struct fd_state_t final {
+			/* Bumped on every close and again on every open, as an fd can be closed where we don't see it */
+			std::atomic<std::uint32_t> generation{0U};
+			/* Stops counting once it's hot */
+			std::atomic<std::uint32_t> calls{0U};
+		};
+
+		/* The profiler the interposers feed, there's only ever the one */
+		static std::atomic<io_profiler_t*> _instance;
+
+		std::atomic<bool> _running{false};
+		std::atomic<std::uint64_t> _epoch{0U};
+		std::atomic<block_t*> _blocks{nullptr};
+		/* Calls from threads that couldn't map a table */
+		std::atomic<std::uint64_t> _dropped{0U};
+		std::array<fd_state_t, max_fds> _fds{};
+
+		/* nullptr if the thread has no table and can't get one */
+		[[nodiscard]]
+		block_t* block() noexcept;
+		void clear(block_t& block, std::uint64_t epoch) noexcept;
+		[[nodiscard]]
+		entry_t& entry(block_t& block, std::int32_t fd, std::uint32_t generation) noexcept;
+		[[nodiscard]]
+		series_t* series(block_t& block, entry_t& entry, io_op_t op) noexcept;
+		static void resolve(entry_t& entry, std::int32_t fd) noexcept;
+
+		void record(io_op_t op, std::int32_t fd, std::uint32_t generation, std::uint64_t ns, std::int64_t bytes) noexcept;
+
+	public:
+		io_profiler_t() noexcept;
+		~io_profiler_t() noexcept;
+
+		io_profiler_t(const io_profiler_t&) = delete;
+		io_profiler_t& operator=(const io_profiler_t&) = delete;
+		io_profiler_t(io_profiler_t&&) = delete;
+		io_profiler_t& operator=(io_profiler_t&&) = delete;
+
+		void start() noexcept { _running.store(true, std::memory_order_release); }
+		void stop() noexcept { _running.store(false, std::memory_order_release); }
+		/* Throws away everything recorded so far */
+		void reset() noexcept { _epoch.fetch_add(1U, std::memory_order_acq_rel); }
+
+		[[nodiscard]]
+		bool running() const noexcept { return _running.load(std::memory_order_relaxed); }
+		[[nodiscard]]
+		std::uint64_t dropped() const noexcept { return _dropped.load(std::memory_order_relaxed); }
+
+		[[nodiscard]]
+		io_snapshot_t snapshot() const;
+
+		/* Called from the interposers, `bytes` is what the call returned and is only used if it moves data */
+		static void called(io_op_t op, std::int32_t fd, std::uint64_t ns, std::int64_t bytes) noexcept;
+		/*
+			Called from the interposers for every close before the real one, whether or not it's running.
+			Moves the fd on to its next generation so a file opened on it right after is kept apart, and
+			hands back the generation being closed for `closed`.
+		*/
+		[[nodiscard]]
+		static std::uint32_t closing(std::int32_t fd) noexcept;
+		static void closed(std::int32_t fd, std::uint32_t generation, std::uint64_t ns) noexcept;
+		/*
+			Called from the interposers for every fd an open hands back, whether or not it's running. The
+			fd is a new file no matter what happened to the last one on it, fclose, dup2, close_range and
+			exec all close fds without going through `closing`.
+		*/
+		static void opened(std::int32_t fd) noexcept;
+		[[nodiscard]]
+		static bool active() noexcept {
+			const auto instance{_instance.load(std::memory_order_relaxed)};
+			return instance != nullptr && instance->running();
+		}
+	};
+}
+
+#endif /* SYCOPHANT_IO_HH */
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* lazymap.cc - Piecewise on-demand file mappings */
+#include <unistd.h>
+#include <algorithm>
+
+#include <lazymap.hh>
+
+namespace sycophant {
+	namespace {
+		/* Anything bigger than this is probably debug info we're going to poke at here and there */
+		constexpr std::uint64_t readahead_limit{1024U * 1024U};
+
+		[[nodiscard]]
+		std::uint64_t page_size() noexcept {
+			static const auto size{static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE))};
+			return size;
+		}
+	}
+
+	bool lazy_map_t::open(const fs::path& path) noexcept {
+		if (valid()) {
+			return false;
+		}
+		fd_t fd{path, O_RDONLY | O_CLOEXEC};
+		if (!fd.valid() || fd.length() <= 0) {
+			return false;
+		}
+		const auto len{static_cast<std::size_t>(fd.length())};
+
+		mmap_t reserve{-1, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE};
+		if (!reserve.valid()) {
+			return false;
+		}
+		_fd = std::move(fd);
+		_reserve = std::move(reserve);
+		_len = len;
+		/* The ELF header and usually the program headers */
+		return ensure(0U, std::min<std::uint64_t>(_len, page_size()));
+	}
+
+	bool lazy_map_t::ensure(const std::uint64_t offset, const std::uint64_t len) noexcept {
+		if (!valid() || offset > _len || len > _len - offset) {
+			return false;
+		}
+		if (len == 0U) {
+			return true;
+		}
+
+		const auto page{page_size()};
+		const auto begin{offset & ~(page - 1U)};
+		const auto end{(offset + len + page - 1U) & ~(page - 1U)};
+		const auto base{_reserve.numeric_address()};
+
+		std::lock_guard<std::mutex> lock{_lock};
+		const auto tick{++_tick};
+		auto it = std::lower_bound(_chunks.begin(), _chunks.end(), begin, [](const chunk_t& chunk, const std::uint64_t val) {
+			return chunk.end <= val;
+		});
+
+		auto pos{begin};
+		bool added{false};
+		while (pos < end) {
+			if (it != _chunks.end() && it->start <= pos) {
+				it->used = tick;
+				if (!it->resident) {
+					it->resident = true;
+					_resident += it->end - it->start;
+				}
+				pos = it->end;
+				++it;
+				continue;
+			}
+
+			const auto gap_end{it != _chunks.end() ? std::min(end, it->start) : end};
+			const auto gap{gap_end - pos};
+			const auto addr{reinterpret_cast<void*>(base + pos)};
+			if (::mmap(addr, gap, PROT_READ, MAP_PRIVATE | MAP_FIXED, _fd, static_cast<::off_t>(pos)) == MAP_FAILED) {
+				return false;
+			}
+			static_cast<void>(::madvise(addr, gap, gap <= readahead_limit ? MADV_WILLNEED : MADV_RANDOM));
+
+			it = _chunks.insert(it, {pos, gap_end, tick, true}) + 1;
+			_mapped += gap;
+			_resident += gap;
+			added = true;
+			pos = gap_end;
+		}
+
+		if (added && _resident > _budget) {
+			shed();
+		}
+		return true;
+	}
+
+	void lazy_map_t::shed() noexcept {
+		std::vector<chunk_t*> idle{};
+		for (auto& chunk : _chunks) {
+			if (chunk.resident && chunk.used != _tick) {
+				idle.push_back(&chunk);
+			}
+		}
+		std::sort(idle.begin(), idle.end(), [](const chunk_t* a, const chunk_t* b) {
+			return a->used < b->used;
+		});
+
+		/* Go to half the budget so we aren't back in here on the very next mapping */
+		const auto base{_reserve.numeric_address()};
+		for (const auto chunk : idle) {
+			if (_resident <= _budget / 2U) {
+				break;
+			}
+			const auto len{chunk->end - chunk->start};
+			if (::madvise(reinterpret_cast<void*>(base + chunk->start), len, MADV_DONTNEED) == 0) {
+				chunk->resident = false;
+				_resident -= len;
+			}
+		}
+	}
+
+	void lazy_map_t::trim() noexcept {
+		std::lock_guard<std::mutex> lock{_lock};
+		const auto budget{_budget};
+		_budget = 0U;
+		shed();
+		_budget = budget;
+	}
+
+	void lazy_map_t::budget(const std::size_t bytes) noexcept {
+		std::lock_guard<std::mutex> lock{_lock};
+		_budget = bytes;
+		if (_resident > _budget) {
+			shed();
+		}
+	}
+
+	std::size_t lazy_map_t::mapped() noexcept {
+		std::lock_guard<std::mutex> lock{_lock};
+		return _mapped;
+	}
+
+	std::size_t lazy_map_t::resident() noexcept {
+		std::lock_guard<std::mutex> lock{_lock};
+		return _resident;
+	}
+}
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* lazymap.hh - Piecewise on-demand file mappings */
+#pragma once
+#if !defined(SYCOPHANT_LAZYMAP_HH)
+#define SYCOPHANT_LAZYMAP_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <filesystem>
+
+#include <mmap.hh>
+#include <fd.hh>
+
+namespace fs = std::filesystem;
+
+namespace sycophant {
+	/*
+		A read-only view of a whole file where only the parts that get used are ever mapped. The file's
+		length is reserved up front as inaccessible address space (which costs no memory and touches no
+		page cache) and pieces of the file are mapped `MAP_PRIVATE` over the top of it as `ensure` asks
+		for them, so anything already handed out keeps pointing at the same place.
+
+		Once more than the budget is resident the least recently used pieces have their pages dropped,
+		they stay mapped and just fault back in from the file if they're touched again.
+	*/
+	struct lazy_map_t final {
+	private:
+		struct chunk_t final {
+			std::uint64_t start;
+			std::uint64_t end;
+			std::uint64_t used;
+			bool resident;
+		};
+
+		fd_t _fd{};
+		mmap_t _reserve{};
+		std::size_t _len{0};
+
+		std::mutex _lock{};
+		/* Sorted by `start` and never overlapping */
+		std::vector<chunk_t> _chunks{};
+		std::uint64_t _tick{0};
+		std::size_t _mapped{0};
+		std::size_t _resident{0};
+		std::size_t _budget{64U * 1024U * 1024U};
+
+		void shed() noexcept;
+
+	public:
+		lazy_map_t() noexcept = default;
+		lazy_map_t(const lazy_map_t&) = delete;
+		lazy_map_t& operator=(const lazy_map_t&) = delete;
+		lazy_map_t(lazy_map_t&&) = delete;
+		lazy_map_t& operator=(lazy_map_t&&) = delete;
+
+		/* Reserves space for the file and maps just its first page, this can only be done once */
+		[[nodiscard]]
+		bool open(const fs::path& path) noexcept;
+
+		[[nodiscard]]
+		bool valid() const noexcept { return _reserve.valid(); }
+		[[nodiscard]]
+		const std::uint8_t* data() const noexcept { return _reserve.address<std::uint8_t>(); }
+		[[nodiscard]]
+		std::size_t length() const noexcept { return _len; }
+
+		/* Makes sure [offset, offset + len) is mapped, returns false if it's out of bounds or couldn't be mapped */
+		[[nodiscard]]
+		bool ensure(std::uint64_t offset, std::uint64_t len) noexcept;
+		/* Drops the pages of everything not used in the last `ensure` */
+		void trim() noexcept;
+
+		/* How many bytes can be resident before older pieces are dropped */
+		void budget(std::size_t bytes) noexcept;
+		[[nodiscard]]
+		std::size_t mapped() noexcept;
+		[[nodiscard]]
+		std::size_t resident() noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_LAZYMAP_HH */
@@ -0,0 +1,621 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* locks.cc - Lock contention profiler */
+#include <pthread.h>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <unordered_map>
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#undef _GNU_SOURCE
+
+#include <locks.hh>
+#include <stats.hh>
+
+namespace sycophant {
+	namespace {
+		/* Deeper than anything sane nests its locks, past this holds just aren't timed */
+		constexpr std::size_t max_held{16U};
+
+		struct held_t final {
+			std::uintptr_t lock;
+			void* entry;
+			void* site;
+			std::uint64_t since;
+		};
+
+		struct lock_thread_t final {
+			std::array<held_t, max_held> held;
+			std::size_t count;
+		};
+
+		/* We're always loaded along with the executable, so this is a single %fs relative access */
+		[[gnu::tls_model("initial-exec")]]
+		thread_local lock_thread_t lock_thread{};
+
+		[[nodiscard]]
+		std::size_t lock_hash(const std::uintptr_t lock, const std::uintptr_t caller) noexcept {
+			return static_cast<std::size_t>(((lock ^ (caller * 0xC2B2AE3D27D4EB4FU)) * 0x9E3779B97F4A7C15U) >> 32U);
+		}
+
+		void raise_max(std::atomic<std::uint64_t>& max, const std::uint64_t value) noexcept {
+			auto current{max.load(std::memory_order_relaxed)};
+			while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) { }
+		}
+
+		void add_counts(lock_counts_t& into, const lock_counts_t& from) noexcept {
+			into.waits += from.waits;
+			into.wait_ns += from.wait_ns;
+			into.max_wait_ns = std::max(into.max_wait_ns, from.max_wait_ns);
+			into.holds += from.holds;
+			into.hold_ns += from.hold_ns;
+			into.max_hold_ns = std::max(into.max_hold_ns, from.max_hold_ns);
+		}
+
+		[[nodiscard]]
+		bool counted(const lock_counts_t& counts) noexcept {
+			return counts.waits != 0U || counts.holds != 0U;
+		}
+	}
+
+	std::atomic<lock_profiler_t*> lock_profiler_t::_instance{nullptr};
+
+	void lock_profiler_t::counters_t::wait(const std::uint64_t ns) noexcept {
+		waits.fetch_add(1U, std::memory_order_relaxed);
+		wait_ns.fetch_add(ns, std::memory_order_relaxed);
+		raise_max(max_wait_ns, ns);
+	}
+
+	void lock_profiler_t::counters_t::hold(const std::uint64_t ns) noexcept {
+		holds.fetch_add(1U, std::memory_order_relaxed);
+		hold_ns.fetch_add(ns, std::memory_order_relaxed);
+		raise_max(max_hold_ns, ns);
+	}
+
+	void lock_profiler_t::counters_t::reset() noexcept {
+		waits.store(0U, std::memory_order_relaxed);
+		wait_ns.store(0U, std::memory_order_relaxed);
+		max_wait_ns.store(0U, std::memory_order_relaxed);
+		holds.store(0U, std::memory_order_relaxed);
+		hold_ns.store(0U, std::memory_order_relaxed);
+		max_hold_ns.store(0U, std::memory_order_relaxed);
+	}
+
+	lock_counts_t lock_profiler_t::counters_t::load() const noexcept {
+		return {
+			waits.load(std::memory_order_relaxed), wait_ns.load(std::memory_order_relaxed),
+			max_wait_ns.load(std::memory_order_relaxed), holds.load(std::memory_order_relaxed),
+			hold_ns.load(std::memory_order_relaxed), max_hold_ns.load(std::memory_order_relaxed)
+		};
+	}
+
+	lock_profiler_t::lock_profiler_t(symbol_index_t& symbols) noexcept : _symbols{symbols} {
+		_instance.store(this, std::memory_order_release);
+	}
+
+	lock_profiler_t::~lock_profiler_t() noexcept {
+		_instance.store(nullptr, std::memory_order_release);
+	}
+
+	lock_profiler_t::lock_entry_t* lock_profiler_t::find_lock(
+		const std::uintptr_t lock, const lock_kind_t kind, const bool insert
+	) noexcept {
+		auto idx{lock_hash(lock, 0U) % max_locks};
+		for (std::size_t probe{}; probe < max_probe; ++probe, idx = (idx + 1U) % max_locks) {
+			auto& entry{_locks[idx]};
+			auto address{entry.address.load(std::memory_order_acquire)};
+			if (address == lock) {
+				return &entry;
+			}
+			if (address != 0U) {
+				continue;
+			}
+			if (!insert) {
+				return nullptr;
+			}
+			if (entry.address.compare_exchange_strong(address, lock, std::memory_order_acq_rel)) {
+				entry.kind.store(kind, std::memory_order_relaxed);
+				return &entry;
+			}
+			/* Someone beat us to it, maybe with the same lock */
+			if (address == lock) {
+				return &entry;
+			}
+		}
+		if (insert) {
+			_dropped.fetch_add(1U, std::memory_order_relaxed);
+		}
+		return nullptr;
+	}
+
+	lock_profiler_t::site_entry_t* lock_profiler_t::find_site(const std::uintptr_t lock, const std::uintptr_t caller) noexcept {
+		auto idx{lock_hash(lock, caller) % max_sites};
+		for (std::size_t probe{}; probe < max_probe; ++probe, idx = (idx + 1U) % max_sites) {
+			auto& site{_sites[idx]};
+			auto claimed{site.lock.load(std::memory_order_acquire)};
+			if (claimed == 0U) {
+				if (!site.lock.compare_exchange_strong(claimed, lock, std::memory_order_acq_rel)) {
+					continue;
+				}
+				site.caller.store(caller, std::memory_order_release);
+				return &site;
+			}
+			/* One that's still being filled in can end up in here twice, `report` adds them back together */
+			if (claimed == lock && site.caller.load(std::memory_order_acquire) == caller) {
+				return &site;
+			}
+		}
+		_dropped.fetch_add(1U, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	void lock_profiler_t::acquired(
+		const std::uintptr_t lock, const lock_kind_t kind, const std::uintptr_t caller, const bool waited, const std::uint64_t ns
+	) noexcept {
+		const auto instance{_instance.load(std::memory_order_acquire)};
+		if (instance == nullptr) {
+			return;
+		}
+		/* Locks that have never been waited on aren't worth timing the holds of */
+		const auto entry{instance->find_lock(lock, kind, waited)};
+		if (entry == nullptr) {
+			return;
+		}
+		const auto site{instance->find_site(lock, caller)};
+		if (waited) {
+			entry->counters.wait(ns);
+			if (site != nullptr) {
+				site->counters.wait(ns);
+			}
+		}
+
+		auto& thread{lock_thread};
+		if (thread.count < thread.held.size()) {
+			thread.held[thread.count++] = {lock, entry, site, stats_clock_ns()};
+		}
+	}
+
+	void lock_profiler_t::releasing(const std::uintptr_t lock) noexcept {
+		auto& thread{lock_thread};
+		/* Most recently taken first, that's nearly always the one being let go of */
+		for (auto idx{thread.count}; idx-- > 0U;) {
+			auto& held{thread.held[idx]};
+			if (held.lock != lock) {
+				continue;
+			}
+			const auto ns{stats_clock_ns() - held.since};
+			static_cast<lock_entry_t*>(held.entry)->counters.hold(ns);
+			if (held.site != nullptr) {
+				static_cast<site_entry_t*>(held.site)->counters.hold(ns);
+			}
+			held = thread.held[--thread.count];
+			return;
+		}
+	}
+
+	void lock_profiler_t::waited(
+		const std::uintptr_t lock, const lock_kind_t kind, const std::uintptr_t caller, const std::uint64_t ns
+	) noexcept {
+		const auto instance{_instance.load(std::memory_order_acquire)};
+		if (instance == nullptr) {
+			return;
+		}
+		const auto entry{instance->find_lock(lock, kind, true)};
+		if (entry == nullptr) {
+			return;
+		}
+		entry->counters.wait(ns);
+		if (const auto site{instance->find_site(lock, caller)}) {
+			site->counters.wait(ns);
+		}
+	}
+
+	bool lock_profiler_t::holding() noexcept {
+		return lock_thread.count != 0U;
+	}
+
+	void lock_profiler_t::clear() noexcept {
+		for (auto& entry : _locks) {
+			entry.counters.reset();
+		}
+		for (auto& site : _sites) {
+			site.counters.reset();
+		}
+	}
+
+	lock_counts_t lock_profiler_t::totals() const noexcept {
+		lock_counts_t res{};
+		for (const auto& entry : _locks) {
+			if (entry.address.load(std::memory_order_acquire) != 0U) {
+				add_counts(res, entry.counters.load());
+			}
+		}
+		return res;
+	}
+
+	std::vector<lock_report_t> lock_profiler_t::report() {
+		std::vector<lock_report_t> res{};
+		std::unordered_map<std::uintptr_t, std::size_t> by_lock{};
+		for (const auto& entry : _locks) {
+			const auto address{entry.address.load(std::memory_order_acquire)};
+			const auto counts{entry.counters.load()};
+			if (address == 0U || !counted(counts)) {
+				continue;
+			}
+			by_lock.emplace(address, res.size());
+			res.push_back({address, entry.kind.load(std::memory_order_relaxed), {}, counts, {}});
+		}
+
+		for (const auto& site : _sites) {
+			const auto lock{site.lock.load(std::memory_order_acquire)};
+			const auto caller{site.caller.load(std::memory_order_acquire)};
+			const auto counts{site.counters.load()};
+			const auto owner{by_lock.find(lock)};
+			if (caller == 0U || !counted(counts) || owner == by_lock.end()) {
+				continue;
+			}
+			auto& sites{res[owner->second].sites};
+			const auto known{std::find_if(sites.begin(), sites.end(), [&](const lock_site_t& other) {
+				return other.caller == caller;
+			})};
+			if (known != sites.end()) {
+				add_counts(known->counts, counts);
+			} else {
+				sites.push_back({caller, {}, counts});
+			}
+		}
+
+		/* Return addresses point past the call, one back lands in it */
+		std::vector<std::uintptr_t> addrs{};
+		for (const auto& lock : res) {
+			addrs.push_back(lock.address);
+			for (const auto& site : lock.sites) {
+				addrs.push_back(site.caller - 1U);
+			}
+		}
+		const auto names{_symbols.symbolize_many(addrs)};
+		auto name{names.begin()};
+		for (auto& lock : res) {
+			lock.name = (name++)->str();
+			for (auto& site : lock.sites) {
+				site.name = (name++)->str();
+			}
+			std::sort(lock.sites.begin(), lock.sites.end(), [](const lock_site_t& a, const lock_site_t& b) {
+				return a.counts.wait_ns > b.counts.wait_ns;
+			});
+		}
+		std::sort(res.begin(), res.end(), [](const lock_report_t& a, const lock_report_t& b) {
+			return a.counts.wait_ns > b.counts.wait_ns;
+		});
+		return res;
+	}
+
+	namespace {
+		/*
+			Looked up on first use without a function local static, whose guard can take a pthread mutex.
+			A race just looks it up twice.
+		*/
+		template<typename T>
+		[[nodiscard]]
+		T next_symbol(std::atomic<T>& cache, const char* const name, const char* const version = nullptr) noexcept {
+			auto res{cache.load(std::memory_order_acquire)};
+			if (__builtin_expect(res != nullptr, 1)) {
+				return res;
+			}
+			if (version != nullptr) {
+				res = reinterpret_cast<T>(dlvsym(RTLD_NEXT, name, version));
+			}
+			if (res == nullptr) {
+				res = reinterpret_cast<T>(dlsym(RTLD_NEXT, name));
+			}
+			cache.store(res, std::memory_order_release);
+			return res;
+		}
+
+		/* A robust mutex whose owner died is still handed over, the caller has to be told with EOWNERDEAD */
+		[[nodiscard]]
+		constexpr bool holds(const std::int32_t res) noexcept {
+			return res == 0 || res == EOWNERDEAD;
+		}
+
+		/*
+			Tries `try_lock` first and only times `lock` if it was busy. Anything else the try says is
+			the answer the blocking call would have given too, and on a robust mutex the caller might
+			already hold it, so it's handed straight back.
+		*/
+		template<typename T, typename L>
+		[[gnu::always_inline]]
+		inline std::int32_t acquire(
+			T* const lock, const lock_kind_t kind, const std::uintptr_t caller, std::int32_t (*const try_lock)(T*), L&& blocking
+		) noexcept {
+			if (try_lock == nullptr) {
+				return blocking();
+			}
+			const auto addr{reinterpret_cast<std::uintptr_t>(lock)};
+			const auto tried{try_lock(lock)};
+			if (tried != EBUSY) {
+				if (holds(tried)) {
+					const auto err{errno};
+					lock_profiler_t::acquired(addr, kind, caller, false, 0U);
+					errno = err;
+				}
+				return tried;
+			}
+			const auto start{stats_clock_ns()};
+			const auto res{blocking()};
+			const auto elapsed{stats_clock_ns() - start};
+			if (holds(res)) {
+				const auto err{errno};
+				lock_profiler_t::acquired(addr, kind, caller, true, elapsed);
+				errno = err;
+			} else if (res == ETIMEDOUT) {
+				/* Given up on, it was still waited for */
+				const auto err{errno};
+				lock_profiler_t::waited(addr, kind, caller, elapsed);
+				errno = err;
+			}
+			return res;
+		}
+
+		/* The mutex is let go of for the wait on `cond` and taken back before `blocking` returns */
+		template<typename L>
+		[[gnu::always_inline]]
+		inline std::int32_t cond_wait(
+			pthread_cond_t* const cond, pthread_mutex_t* const mutex, const std::uintptr_t caller, L&& blocking
+		) noexcept {
+			const auto addr{reinterpret_cast<std::uintptr_t>(mutex)};
+			lock_profiler_t::releasing(addr);
+			const auto start{stats_clock_ns()};
+			const auto res{blocking()};
+			const auto elapsed{stats_clock_ns() - start};
+			const auto err{errno};
+			lock_profiler_t::waited(reinterpret_cast<std::uintptr_t>(cond), lock_kind_t::condvar, caller, elapsed);
+			lock_profiler_t::acquired(addr, lock_kind_t::mutex, caller, false, 0U);
+			errno = err;
+			return res;
+		}
+
+		using mutex_fn_t = std::int32_t (*)(pthread_mutex_t*);
+		using rwlock_fn_t = std::int32_t (*)(pthread_rwlock_t*);
+		using cond_wait_t = std::int32_t (*)(pthread_cond_t*, pthread_mutex_t*);
+		using mutex_timed_t = std::int32_t (*)(pthread_mutex_t*, const timespec*);
+		using mutex_clock_t = std::int32_t (*)(pthread_mutex_t*, clockid_t, const timespec*);
+		using rwlock_timed_t = std::int32_t (*)(pthread_rwlock_t*, const timespec*);
+		using rwlock_clock_t = std::int32_t (*)(pthread_rwlock_t*, clockid_t, const timespec*);
+		using cond_timedwait_t = std::int32_t (*)(pthread_cond_t*, pthread_mutex_t*, const timespec*);
+		using cond_clockwait_t = std::int32_t (*)(pthread_cond_t*, pthread_mutex_t*, clockid_t, const timespec*);
+
+		std::atomic<mutex_fn_t> real_mutex_lock{nullptr};
+		std::atomic<mutex_fn_t> real_mutex_trylock{nullptr};
+		std::atomic<mutex_timed_t> real_mutex_timedlock{nullptr};
+		std::atomic<mutex_clock_t> real_mutex_clocklock{nullptr};
+		std::atomic<mutex_fn_t> real_mutex_unlock{nullptr};
+		std::atomic<rwlock_fn_t> real_rwlock_rdlock{nullptr};
+		std::atomic<rwlock_fn_t> real_rwlock_tryrdlock{nullptr};
+		std::atomic<rwlock_timed_t> real_rwlock_timedrdlock{nullptr};
+		std::atomic<rwlock_clock_t> real_rwlock_clockrdlock{nullptr};
+		std::atomic<rwlock_fn_t> real_rwlock_wrlock{nullptr};
+		std::atomic<rwlock_fn_t> real_rwlock_trywrlock{nullptr};
+		std::atomic<rwlock_timed_t> real_rwlock_timedwrlock{nullptr};
+		std::atomic<rwlock_clock_t> real_rwlock_clockwrlock{nullptr};
+		std::atomic<rwlock_fn_t> real_rwlock_unlock{nullptr};
+		std::atomic<cond_wait_t> real_cond_wait{nullptr};
+		std::atomic<cond_timedwait_t> real_cond_timedwait{nullptr};
+		std::atomic<cond_clockwait_t> real_cond_clockwait{nullptr};
+
+		/* Without the real one there's nothing sensible to do with a lock */
+		[[noreturn]]
+		void missing() noexcept {
+			std::abort();
+		}
+	}
+}
+
+using sycophant::lock_kind_t;
+using sycophant::lock_profiler_t;
+
+#define SYCOPHANT_CALLER reinterpret_cast<std::uintptr_t>(__builtin_return_address(0))
+/* The old condvar ABI is what plain dlsym finds */
+#define SYCOPHANT_COND_VERSION "GLIBC_2.3.2"
+
+extern "C" {
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_mutex_lock(pthread_mutex_t* const mutex) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_mutex_lock, "pthread_mutex_lock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(mutex);
+		}
+		const auto try_lock{sycophant::next_symbol(sycophant::real_mutex_trylock, "pthread_mutex_trylock")};
+		return sycophant::acquire(mutex, lock_kind_t::mutex, SYCOPHANT_CALLER, try_lock, [&]() { return real(mutex); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_mutex_timedlock(pthread_mutex_t* const mutex, const timespec* const until) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_mutex_timedlock, "pthread_mutex_timedlock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(mutex, until);
+		}
+		const auto try_lock{sycophant::next_symbol(sycophant::real_mutex_trylock, "pthread_mutex_trylock")};
+		return sycophant::acquire(mutex, lock_kind_t::mutex, SYCOPHANT_CALLER, try_lock, [&]() { return real(mutex, until); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_mutex_clocklock(pthread_mutex_t* const mutex, const clockid_t clock, const timespec* const until) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_mutex_clocklock, "pthread_mutex_clocklock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(mutex, clock, until);
+		}
+		const auto try_lock{sycophant::next_symbol(sycophant::real_mutex_trylock, "pthread_mutex_trylock")};
+		return sycophant::acquire(
+			mutex, lock_kind_t::mutex, SYCOPHANT_CALLER, try_lock, [&]() { return real(mutex, clock, until); }
+		);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_mutex_unlock(pthread_mutex_t* const mutex) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_mutex_unlock, "pthread_mutex_unlock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (lock_profiler_t::holding()) {
+			lock_profiler_t::releasing(reinterpret_cast<std::uintptr_t>(mutex));
+		}
+		return real(mutex);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_rwlock_rdlock(pthread_rwlock_t* const rwlock) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_rwlock_rdlock, "pthread_rwlock_rdlock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(rwlock);
+		}
+		const auto try_lock{sycophant::next_symbol(sycophant::real_rwlock_tryrdlock, "pthread_rwlock_tryrdlock")};
+		return sycophant::acquire(rwlock, lock_kind_t::rwlock, SYCOPHANT_CALLER, try_lock, [&]() { return real(rwlock); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_rwlock_timedrdlock(pthread_rwlock_t* const rwlock, const timespec* const until) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_rwlock_timedrdlock, "pthread_rwlock_timedrdlock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(rwlock, until);
+		}
+		const auto try_lock{sycophant::next_symbol(sycophant::real_rwlock_tryrdlock, "pthread_rwlock_tryrdlock")};
+		return sycophant::acquire(
+			rwlock, lock_kind_t::rwlock, SYCOPHANT_CALLER, try_lock, [&]() { return real(rwlock, until); }
+		);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_rwlock_clockrdlock(
+		pthread_rwlock_t* const rwlock, const clockid_t clock, const timespec* const until
+	) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_rwlock_clockrdlock, "pthread_rwlock_clockrdlock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(rwlock, clock, until);
+		}
+		const auto try_lock{sycophant::next_symbol(sycophant::real_rwlock_tryrdlock, "pthread_rwlock_tryrdlock")};
+		return sycophant::acquire(
+			rwlock, lock_kind_t::rwlock, SYCOPHANT_CALLER, try_lock, [&]() { return real(rwlock, clock, until); }
+		);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_rwlock_wrlock(pthread_rwlock_t* const rwlock) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_rwlock_wrlock, "pthread_rwlock_wrlock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(rwlock);
+		}
+		const auto try_lock{sycophant::next_symbol(sycophant::real_rwlock_trywrlock, "pthread_rwlock_trywrlock")};
+		return sycophant::acquire(rwlock, lock_kind_t::rwlock, SYCOPHANT_CALLER, try_lock, [&]() { return real(rwlock); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_rwlock_timedwrlock(pthread_rwlock_t* const rwlock, const timespec* const until) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_rwlock_timedwrlock, "pthread_rwlock_timedwrlock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(rwlock, until);
+		}
+		const auto try_lock{sycophant::next_symbol(sycophant::real_rwlock_trywrlock, "pthread_rwlock_trywrlock")};
+		return sycophant::acquire(
+			rwlock, lock_kind_t::rwlock, SYCOPHANT_CALLER, try_lock, [&]() { return real(rwlock, until); }
+		);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_rwlock_clockwrlock(
+		pthread_rwlock_t* const rwlock, const clockid_t clock, const timespec* const until
+	) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_rwlock_clockwrlock, "pthread_rwlock_clockwrlock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(rwlock, clock, until);
+		}
+		const auto try_lock{sycophant::next_symbol(sycophant::real_rwlock_trywrlock, "pthread_rwlock_trywrlock")};
+		return sycophant::acquire(
+			rwlock, lock_kind_t::rwlock, SYCOPHANT_CALLER, try_lock, [&]() { return real(rwlock, clock, until); }
+		);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_rwlock_unlock(pthread_rwlock_t* const rwlock) noexcept {
+		const auto real{sycophant::next_symbol(sycophant::real_rwlock_unlock, "pthread_rwlock_unlock")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (lock_profiler_t::holding()) {
+			lock_profiler_t::releasing(reinterpret_cast<std::uintptr_t>(rwlock));
+		}
+		return real(rwlock);
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_cond_wait(pthread_cond_t* const cond, pthread_mutex_t* const mutex) {
+		const auto real{sycophant::next_symbol(sycophant::real_cond_wait, "pthread_cond_wait", SYCOPHANT_COND_VERSION)};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(cond, mutex);
+		}
+		return sycophant::cond_wait(cond, mutex, SYCOPHANT_CALLER, [&]() { return real(cond, mutex); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_cond_timedwait(pthread_cond_t* const cond, pthread_mutex_t* const mutex, const timespec* const until) {
+		const auto real{sycophant::next_symbol(sycophant::real_cond_timedwait, "pthread_cond_timedwait", SYCOPHANT_COND_VERSION)};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(cond, mutex, until);
+		}
+		return sycophant::cond_wait(cond, mutex, SYCOPHANT_CALLER, [&]() { return real(cond, mutex, until); });
+	}
+
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t pthread_cond_clockwait(
+		pthread_cond_t* const cond, pthread_mutex_t* const mutex, const clockid_t clock, const timespec* const until
+	) {
+		/* Newer than the condvar ABI change, there's only the one version of it */
+		const auto real{sycophant::next_symbol(sycophant::real_cond_clockwait, "pthread_cond_clockwait")};
+		if (real == nullptr) {
+			sycophant::missing();
+		}
+		if (!lock_profiler_t::active()) {
+			return real(cond, mutex, clock, until);
+		}
+		return sycophant::cond_wait(cond, mutex, SYCOPHANT_CALLER, [&]() { return real(cond, mutex, clock, until); });
+	}
+}
+
+#undef SYCOPHANT_COND_VERSION
+#undef SYCOPHANT_CALLER
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* locks.hh - Lock contention profiler */
+#pragma once
+#if !defined(SYCOPHANT_LOCKS_HH)
+#define SYCOPHANT_LOCKS_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <symbols.hh>
+
+namespace sycophant {
+	enum struct lock_kind_t : std::uint8_t {
+		mutex,
+		rwlock,
+		condvar,
+		count,
+	};
+
+	inline constexpr std::array<std::string_view, static_cast<std::size_t>(lock_kind_t::count)> lock_kind_names{{
+		"mutex",
+		"rwlock",
+		"condvar",
+	}};
+
+	/* Waits are only the acquisitions that had to block, every wait on a condvar counts as one */
+	struct lock_counts_t final {
+		std::uint64_t waits;
+		std::uint64_t wait_ns;
+		std::uint64_t max_wait_ns;
+		/* Only timed once the lock has been waited on at least once */
+		std::uint64_t holds;
+		std::uint64_t hold_ns;
+		std::uint64_t max_hold_ns;
+	};
+
+	struct lock_site_t final {
+		/* The return address of the call that took the lock */
+		std::uintptr_t caller;
+		std::string name;
+		lock_counts_t counts;
+	};
+
+	struct lock_report_t final {
+		std::uintptr_t address;
+		lock_kind_t kind;
+		/* Only globals and statics have anything better than their address */
+		std::string name;
+		lock_counts_t counts;
+		/* Most waited on first */
+		std::vector<lock_site_t> sites;
+	};
+
+	/*
+		Interposes the pthread mutex, rwlock and condvar calls, timed and clock variants included, the
+		interposers live in locks.cc. Every acquisition tries the lock first and only a try that fails
+		gets timed, so an uncontended lock costs the try and nothing else. A timed acquisition that runs
+		out of time still counts as a wait, but not as a hold. Wait time is kept per lock and per lock and call site in a pair
+		of fixed size tables that are filled in with a CAS on the key and never shrink, anything that
+		doesn't fit is counted in `dropped`.
+
+		Once a lock has been waited on, each thread also keeps a short stack of when it took it so the
+		unlock can charge how long it was held. Waiting on a condvar ends the hold on its mutex and starts
+		a new one when it wakes up.
+
+		Locks libc takes for itself don't go through the interposers.
+	*/
+	struct lock_profiler_t final {
+	private:
+		static constexpr std::size_t max_locks{1024U};
+		static constexpr std::size_t max_sites{4096U};
+		static constexpr std::size_t max_probe{64U};
+
+		struct counters_t final {
+			std::atomic<std::uint64_t> waits{0U};
+			std::atomic<std::uint64_t> wait_ns{0U};
+			std::atomic<std::uint64_t> max_wait_ns{0U};
+			std::atomic<std::uint64_t> holds{0U};
+			std::atomic<std::uint64_t> hold_ns{0U};
+			std::atomic<std::uint64_t> max_hold_ns{0U};
+
+			void wait(std::uint64_t ns) noexcept;
+			void hold(std::uint64_t ns) noexcept;
+			void reset() noexcept;
+			[[nodiscard]]
+			lock_counts_t load() const noexcept;
+		};
+
+		struct lock_entry_t final {
+			std::atomic<std::uintptr_t> address{0U};
+			std::atomic<lock_kind_t> kind{lock_kind_t::mutex};
+			counters_t counters{};
+		};
+
+		/* Claimed by its lock, a site that's still being filled in has a caller of 0 and is passed over */
+		struct site_entry_t final {
+			std::atomic<std::uintptr_t> lock{0U};
+			std::atomic<std::uintptr_t> caller{0U};
+			counters_t counters{};
+		};
+
+		/* The profiler the interposers feed, there's only ever the one */
+		static std::atomic<lock_profiler_t*> _instance;
+
+		symbol_index_t& _symbols;
+		std::atomic<bool> _running{false};
+		std::atomic<std::uint64_t> _dropped{0U};
+		std::array<lock_entry_t, max_locks> _locks{};
+		std::array<site_entry_t, max_sites> _sites{};
+
+		/* nullptr if it isn't there and `insert` is false, or if there's no room for it */
+		[[nodiscard]]
+		lock_entry_t* find_lock(std::uintptr_t lock, lock_kind_t kind, bool insert) noexcept;
+		[[nodiscard]]
+		site_entry_t* find_site(std::uintptr_t lock, std::uintptr_t caller) noexcept;
+
+	public:
+		explicit lock_profiler_t(symbol_index_t& symbols) noexcept;
+		~lock_profiler_t() noexcept;
+
+		lock_profiler_t(const lock_profiler_t&) = delete;
+		lock_profiler_t& operator=(const lock_profiler_t&) = delete;
+		lock_profiler_t(lock_profiler_t&&) = delete;
+		lock_profiler_t& operator=(lock_profiler_t&&) = delete;
+
+		void start() noexcept { _running.store(true, std::memory_order_release); }
+		void stop() noexcept { _running.store(false, std::memory_order_release); }
+		/* Zeroes every count, the locks and sites already seen keep their place in the tables */
+		void clear() noexcept;
+
+		[[nodiscard]]
+		bool running() const noexcept { return _running.load(std::memory_order_relaxed); }
+		[[nodiscard]]
+		std::uint64_t dropped() const noexcept { return _dropped.load(std::memory_order_relaxed); }
+
+		/* Everything counted against every lock, without symbolizing anything */
+		[[nodiscard]]
+		lock_counts_t totals() const noexcept;
+		/* Every lock with anything counted against it, most waited on first */
+		[[nodiscard]]
+		std::vector<lock_report_t> report();
+
+		[[nodiscard]]
+		static bool active() noexcept {
+			const auto instance{_instance.load(std::memory_order_relaxed)};
+			return instance != nullptr && instance->running();
+		}
+
+		/* Called from the interposers once the calling thread holds `lock`, `ns` is how long it waited if it did */
+		static void acquired(std::uintptr_t lock, lock_kind_t kind, std::uintptr_t caller, bool waited, std::uint64_t ns) noexcept;
+		/* Called from the interposers before `lock` is let go of, a no-op unless the thread is timing its hold */
+		static void releasing(std::uintptr_t lock) noexcept;
+		/* Called from the interposers once a wait on a condvar is over, or a timed wait on a lock gave up */
+		static void waited(std::uintptr_t lock, lock_kind_t kind, std::uintptr_t caller, std::uint64_t ns) noexcept;
+		/* Whether the thread is timing any holds at all, which lets unlocks skip everything else */
+		[[nodiscard]]
+		static bool holding() noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_LOCKS_HH */
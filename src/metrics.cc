@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* metrics.cc - Counters and histograms published in shared memory */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <fd.hh>
+#include <metrics.hh>
+#include <stats.hh>
+
+namespace sycophant {
+	namespace {
+		[[nodiscard]]
+		std::string shm_name(const std::string_view name) {
+			return name.front() == '/' ? std::string{name} : '/' + std::string{name};
+		}
+	}
+
+	metrics_record_t* metrics_t::record(const std::string_view name, const metrics_kind_t kind) noexcept {
+		auto& head{header()};
+		const auto records{reinterpret_cast<metrics_record_t*>(&head + 1)};
+		try {
+			const auto known{_ids.find(std::string{name})};
+			if (known != _ids.end()) {
+				return records + known->second;
+			}
+
+			const auto idx{head.count.load(std::memory_order_relaxed)};
+			if (idx >= head.capacity) {
+				++_dropped;
+				return nullptr;
+			}
+			auto& record{*new(records + idx) metrics_record_t{}};
+			record.kind = kind;
+			const auto length{std::min(name.size(), metrics_name_max - 1U)};
+			std::memcpy(record.name.data(), name.data(), length);
+			record.name[length] = '\0';
+			_ids.emplace(name, idx);
+			/* Readers never look past `count`, so it's all there by the time they see it */
+			head.count.store(idx + 1U, std::memory_order_release);
+			return &record;
+		} catch (...) {
+			++_dropped;
+			return nullptr;
+		}
+	}
+
+	void metrics_t::write(const std::string_view name, const metrics_kind_t kind, const metrics_values_t& values) noexcept {
+		const auto record{this->record(name, kind)};
+		if (record == nullptr) {
+			return;
+		}
+		const auto seq{record->seq.load(std::memory_order_relaxed)};
+		record->seq.store(seq + 1U, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		std::memcpy(&record->values, &values, sizeof(values));
+		record->seq.store(seq + 2U, std::memory_order_release);
+	}
+
+	void metrics_t::counter(const std::string_view name, const std::uint64_t value) noexcept {
+		write(name, metrics_kind_t::counter, {value, 0U, 0U, 0U, 0U, 0U, 0U, 0U});
+	}
+
+	void metrics_t::gauge(const std::string_view name, const std::uint64_t value) noexcept {
+		write(name, metrics_kind_t::gauge, {value, 0U, 0U, 0U, 0U, 0U, 0U, 0U});
+	}
+
+	void metrics_t::histogram(const std::string_view name, const histogram_t& hist) noexcept {
+		write(name, metrics_kind_t::histogram, {
+			hist.count, hist.sum, hist.count != 0U ? hist.min : 0U, hist.max,
+			hist.percentile(0.5), hist.percentile(0.9), hist.percentile(0.99), hist.percentile(0.999)
+		});
+	}
+
+	void metrics_t::update() noexcept {
+		if (!_map.valid() || _owner.load(std::memory_order_relaxed) != ::getpid()) {
+			return;
+		}
+		try {
+			_collect(*this);
+		} catch (...) {
+			/* Whatever it got through is published, the rest is picked up on the next pass */
+		}
+		auto& head{header()};
+		head.updated.store(stats_clock_ns(), std::memory_order_release);
+		head.updates.fetch_add(1U, std::memory_order_release);
+	}
+
+	void metrics_t::publish_loop() noexcept {
+		while (!_stopping.load(std::memory_order_acquire)) {
+			static_cast<void>(::nanosleep(&_interval, nullptr));
+			std::lock_guard<std::mutex> lock{_lock};
+			update();
+		}
+	}
+
+	bool metrics_t::start(
+		const std::string_view name, const std::size_t capacity, const std::uint32_t interval, metrics_collect_t collect
+	) {
+		{
+			std::lock_guard<std::mutex> lock{_lock};
+			if (_map.valid() || name.empty()) {
+				return false;
+			}
+			const auto path{shm_name(name)};
+			fd_t file{::shm_open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)};
+			if (!file.valid()) {
+				return false;
+			}
+			const auto records{std::max<std::size_t>(capacity, 1U)};
+			const auto length{sizeof(metrics_header_t) + (records * sizeof(metrics_record_t))};
+			if (!file.resize(static_cast<::off_t>(length))) {
+				static_cast<void>(::shm_unlink(path.c_str()));
+				return false;
+			}
+			auto map{file.map(prot_t::RW, length, MAP_SHARED)};
+			if (!map.valid()) {
+				static_cast<void>(::shm_unlink(path.c_str()));
+				return false;
+			}
+
+			auto& head{*new(map.address<metrics_header_t>()) metrics_header_t{}};
+			head.magic = metrics_magic;
+			head.version = metrics_version;
+			head.pid = static_cast<std::uint32_t>(::getpid());
+			head.capacity = static_cast<std::uint32_t>(records);
+			head.record_size = sizeof(metrics_record_t);
+			head.interval = interval;
+
+			_map = std::move(map);
+			_owner.store(::getpid(), std::memory_order_relaxed);
+			_name = path;
+			_collect = std::move(collect);
+			_ids.clear();
+			_dropped = 0U;
+			_interval = {
+				static_cast<::time_t>(interval / 1000U), static_cast<long>(interval % 1000U) * 1000000L
+			};
+			update();
+		}
+
+		_stopping.store(false, std::memory_order_release);
+		const auto starter{::pthread_self()};
+		_publisher = std::make_unique<worker_pool_t>(1U, [this, starter]() {
+			/* Without a thread of our own it's only brought up to date by `update_now` */
+			if (!::pthread_equal(::pthread_self(), starter)) {
+				publish_loop();
+			}
+		});
+		return true;
+	}
+
+	void metrics_t::abandon() noexcept {
+		/* Its thread was never here to join, the pool is all that's leaked */
+		static_cast<void>(_publisher.release());
+		_map = mmap_t{};
+		_owner.store(0, std::memory_order_relaxed);
+	}
+
+	void metrics_t::stop() noexcept {
+		/* Checked before the lock, which could have been held by the parent's publisher when it forked */
+		const auto owner{_owner.load(std::memory_order_relaxed)};
+		if (owner != 0 && owner != ::getpid()) {
+			abandon();
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock{_lock};
+			if (!_map.valid()) {
+				return;
+			}
+		}
+		_stopping.store(true, std::memory_order_release);
+		_publisher.reset();
+
+		std::lock_guard<std::mutex> lock{_lock};
+		update();
+		/* Anyone still mapping it can tell nothing else is coming */
+		header().updated.store(0U, std::memory_order_release);
+		static_cast<void>(::shm_unlink(_name.c_str()));
+		_map = mmap_t{};
+		_owner.store(0, std::memory_order_relaxed);
+		_name.clear();
+		_collect = nullptr;
+	}
+
+	void metrics_t::update_now() noexcept {
+		std::lock_guard<std::mutex> lock{_lock};
+		update();
+	}
+
+	bool metrics_t::running() noexcept {
+		/* Never true in a forked child, whose copy isn't publishing anything */
+		return _owner.load(std::memory_order_relaxed) == ::getpid();
+	}
+
+	std::string metrics_t::name() {
+		std::lock_guard<std::mutex> lock{_lock};
+		return _name;
+	}
+
+	std::uint64_t metrics_t::dropped() {
+		std::lock_guard<std::mutex> lock{_lock};
+		return _dropped;
+	}
+}
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* metrics.hh - Counters and histograms published in shared memory */
+#pragma once
+#if !defined(SYCOPHANT_METRICS_HH)
+#define SYCOPHANT_METRICS_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <time.h>
+#include <sys/types.h>
+
+#include <mmap.hh>
+#include <histogram.hh>
+#include <workers.hh>
+
+namespace sycophant {
+	/*
+		A metrics segment is a `metrics_header_t` followed by `capacity` records of `record_size` bytes.
+		Records are only ever added, a record's kind and name never change once `count` covers it. Its
+		values are guarded by `seq`, which is odd while they're being written, so a reader copies them
+		out and keeps the copy if `seq` was the same even value before and after.
+
+		Segments are named `sycophant.<pid>` unless asked otherwise, shm_open puts them in /dev/shm.
+	*/
+	inline constexpr std::array<char, 8> metrics_magic{{'S', 'Y', 'C', 'O', 'M', 'T', 'R', 'C'}};
+	inline constexpr std::uint32_t metrics_version{1U};
+	inline constexpr std::size_t metrics_name_max{48U};
+
+	enum struct metrics_kind_t : std::uint32_t {
+		/* Only ever goes up */
+		counter = 1U,
+		/* Can go either way */
+		gauge = 2U,
+		histogram = 3U,
+	};
+
+	struct metrics_header_t final {
+		std::array<char, 8> magic;
+		std::uint32_t version;
+		std::uint32_t pid;
+		std::uint32_t capacity;
+		std::uint32_t record_size;
+		/* How often the values are brought up to date, in milliseconds */
+		std::uint32_t interval;
+		std::atomic<std::uint32_t> count;
+		/* CLOCK_MONOTONIC nanoseconds of the last update, 0 once the process has stopped publishing */
+		std::atomic<std::uint64_t> updated;
+		std::atomic<std::uint64_t> updates;
+		std::array<std::uint64_t, 2> _reserved;
+	};
+	static_assert(sizeof(metrics_header_t) == 64U);
+
+	/* What's behind a record's `seq`, counters and gauges only have `value` */
+	struct metrics_values_t final {
+		/* The count for a histogram */
+		std::uint64_t value;
+		std::uint64_t sum;
+		std::uint64_t min;
+		std::uint64_t max;
+		std::uint64_t p50;
+		std::uint64_t p90;
+		std::uint64_t p99;
+		std::uint64_t p999;
+	};
+
+	struct metrics_record_t final {
+		std::atomic<std::uint64_t> seq;
+		metrics_kind_t kind;
+		std::uint32_t _pad;
+		/* NUL terminated */
+		std::array<char, metrics_name_max> name;
+		metrics_values_t values;
+	};
+	static_assert(sizeof(metrics_record_t) == 128U);
+
+	/* Records a segment has room for unless asked otherwise */
+	inline constexpr std::size_t metrics_capacity_default{1024U};
+	/* Milliseconds between updates unless asked otherwise */
+	inline constexpr std::uint32_t metrics_interval_default{100U};
+
+	struct metrics_t;
+	using metrics_collect_t = std::function<void(metrics_t&)>;
+
+	/*
+		Publishes whatever `collect` hands it into a shared memory segment from a thread of its own, so
+		another process can map it and read it as often as it likes without making the target do
+		anything. Nothing in here touches the interpreter.
+
+		`collect` is run on the publishing thread with the lock held and calls `counter`, `gauge` and
+		`histogram`, a name that hasn't been seen before gets a new record if there's room.
+	*/
+	struct metrics_t final {
+	private:
+		std::mutex _lock{};
+		mmap_t _map{};
+		std::string _name{};
+		metrics_collect_t _collect{};
+		std::unordered_map<std::string, std::uint32_t> _ids{};
+		timespec _interval{};
+		/* Names that didn't fit */
+		std::uint64_t _dropped{0U};
+
+		std::atomic<bool> _stopping{false};
+		/* The process that started it, a child forked without exec has a copy of all this but not the thread */
+		std::atomic<::pid_t> _owner{0};
+		/* Declared last so it's joined before anything it uses goes away */
+		std::unique_ptr<worker_pool_t> _publisher{};
+
+		[[nodiscard]]
+		metrics_header_t& header() noexcept { return *_map.address<metrics_header_t>(); }
+		/* nullptr if there's no room left for it */
+		[[nodiscard]]
+		metrics_record_t* record(std::string_view name, metrics_kind_t kind) noexcept;
+		void write(std::string_view name, metrics_kind_t kind, const metrics_values_t& values) noexcept;
+		/* `_lock` must be held */
+		void update() noexcept;
+		void publish_loop() noexcept;
+		/* Lets go of a forked child's copy without touching the parent's thread, lock or segment */
+		void abandon() noexcept;
+
+	public:
+		metrics_t() noexcept = default;
+		~metrics_t() noexcept { stop(); }
+
+		metrics_t(const metrics_t&) = delete;
+		metrics_t& operator=(const metrics_t&) = delete;
+		metrics_t(metrics_t&&) = delete;
+		metrics_t& operator=(metrics_t&&) = delete;
+
+		/* Creates the segment `name` and starts updating it every `interval` ms, false if it's already running or couldn't be created */
+		[[nodiscard]]
+		bool start(std::string_view name, std::size_t capacity, std::uint32_t interval, metrics_collect_t collect);
+		/* Brings it up to date one last time and removes the segment */
+		void stop() noexcept;
+		/* Brings it up to date right now */
+		void update_now() noexcept;
+
+		[[nodiscard]]
+		bool running() noexcept;
+		/* The segment's name, empty if it isn't running */
+		[[nodiscard]]
+		std::string name();
+		[[nodiscard]]
+		std::uint64_t dropped();
+
+		/* Only to be called from `collect` */
+		void counter(std::string_view name, std::uint64_t value) noexcept;
+		void gauge(std::string_view name, std::uint64_t value) noexcept;
+		void histogram(std::string_view name, const histogram_t& hist) noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_METRICS_HH */
@@ -0,0 +1,222 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* modules.cc - Registry of the modules the dynamic loader has mapped */
+#include <link.h>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+#include <modules.hh>
+#include <elf.hh>
+
+namespace fs = std::filesystem;
+
+namespace sycophant {
+	namespace {
+		struct counters_t final {
+			std::uint64_t adds;
+			std::uint64_t subs;
+		};
+
+		[[nodiscard]]
+		counters_t loader_counters() noexcept {
+			counters_t res{};
+			dl_iterate_phdr([](dl_phdr_info* info, std::size_t size, void* data) -> int {
+				if (size >= offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+					auto& counters{*static_cast<counters_t*>(data)};
+					counters.adds = info->dlpi_adds;
+					counters.subs = info->dlpi_subs;
+				}
+				/* The counters are the same for every module, so we only need the first one */
+				return 1;
+			}, &res);
+			return res;
+		}
+
+		[[nodiscard]]
+		std::string module_path(const std::string& name) {
+			if (name.empty()) {
+				std::error_code ec{};
+				auto exe{fs::read_symlink("/proc/self/exe", ec)};
+				return ec ? std::string{} : exe.string();
+			}
+			/* The vDSO and anything else that doesn't have a backing file */
+			if (name.front() != '/') {
+				return {};
+			}
+			return name;
+		}
+
+		[[nodiscard]]
+		std::shared_ptr<const module_t> read_module(const dl_phdr_info& info, const std::size_t size, const std::uint64_t serial) {
+			auto mod{std::make_shared<module_t>()};
+			mod->name = info.dlpi_name != nullptr ? info.dlpi_name : "";
+			mod->path = module_path(mod->name);
+			mod->serial = serial;
+			mod->bias = static_cast<std::uintptr_t>(info.dlpi_addr);
+			mod->phdrs = info.dlpi_phdr;
+			mod->phnum = info.dlpi_phnum;
+			if (size >= offsetof(dl_phdr_info, dlpi_tls_modid) + sizeof(info.dlpi_tls_modid)) {
+				mod->tls_modid = info.dlpi_tls_modid;
+			}
+
+			for (std::size_t idx{}; idx < mod->phnum; ++idx) {
+				const auto& phdr{mod->phdrs[idx]};
+				const auto addr{mod->bias + phdr.p_vaddr};
+				switch (phdr.p_type) {
+					case PT_LOAD:
+						mod->segments.push_back({addr, addr + phdr.p_memsz, phdr.p_offset, phdr.p_flags});
+						break;
+					case PT_DYNAMIC:
+						mod->dynamic = reinterpret_cast<const Elf64_Dyn*>(addr);
+						break;
+					case PT_NOTE: {
+						if (!mod->build_id.empty()) {
+							break;
+						}
+						const elf_notes_t notes{{reinterpret_cast<const std::uint8_t*>(addr), phdr.p_memsz}, phdr.p_align};
+						for (const auto note : notes) {
+							if (note.type == NT_GNU_BUILD_ID && note.name == "GNU") {
+								mod->build_id.assign(note.desc.data, note.desc.data + note.desc.size);
+								break;
+							}
+						}
+						break;
+					}
+					default:
+						break;
+				}
+			}
+
+			std::sort(mod->segments.begin(), mod->segments.end(), [](const auto& a, const auto& b) {
+				return a.start < b.start;
+			});
+			if (!mod->segments.empty()) {
+				mod->start = mod->segments.front().start;
+				mod->end = mod->segments.back().end;
+			}
+			return mod;
+		}
+
+		struct walk_t final {
+			const std::vector<std::shared_ptr<const module_t>>& known;
+			std::vector<std::shared_ptr<const module_t>> modules;
+			std::uint64_t serial;
+			bool changed;
+		};
+	}
+
+	bool module_t::contains(const std::uintptr_t addr) const noexcept {
+		return segment(addr) != nullptr;
+	}
+
+	const module_segment_t* module_t::segment(const std::uintptr_t addr) const noexcept {
+		if (addr < start || addr >= end) {
+			return nullptr;
+		}
+		for (const auto& seg : segments) {
+			if (addr >= seg.start && addr < seg.end) {
+				return &seg;
+			}
+		}
+		return nullptr;
+	}
+
+	std::string module_t::build_id_hex() const {
+		constexpr std::string_view digits{"0123456789abcdef"};
+		std::string res{};
+		res.reserve(build_id.size() * 2U);
+		for (const auto byte : build_id) {
+			res.push_back(digits[byte >> 4U]);
+			res.push_back(digits[byte & 0x0FU]);
+		}
+		return res;
+	}
+
+	bool module_registry_t::refresh() {
+		const auto counters{loader_counters()};
+		{
+			auto registry = _registry.read();
+			if (!registry->modules.empty() && counters.adds == registry->adds && counters.subs == registry->subs) {
+				return false;
+			}
+		}
+
+		auto registry = _registry.write();
+		/* Someone else might have beaten us to it */
+		if (!registry->modules.empty() && counters.adds == registry->adds && counters.subs == registry->subs) {
+			return false;
+		}
+
+		walk_t walk{registry->modules, {}, registry->serial, false};
+		walk.modules.reserve(registry->modules.size());
+		dl_iterate_phdr([](dl_phdr_info* info, std::size_t size, void* data) -> int {
+			auto& state{*static_cast<walk_t*>(data)};
+			const auto name{info->dlpi_name != nullptr ? std::string_view{info->dlpi_name} : std::string_view{}};
+			const auto existing = std::find_if(state.known.begin(), state.known.end(), [&](const auto& mod) {
+				return mod->bias == info->dlpi_addr && mod->phdrs == info->dlpi_phdr && mod->name == name;
+			});
+			if (existing != state.known.end()) {
+				state.modules.push_back(*existing);
+			} else {
+				state.modules.push_back(read_module(*info, size, state.serial++));
+				state.changed = true;
+			}
+			return 0;
+		}, &walk);
+
+		std::sort(walk.modules.begin(), walk.modules.end(), [](const auto& a, const auto& b) {
+			return a->start < b->start;
+		});
+		walk.changed |= walk.modules.size() != registry->modules.size();
+
+		registry->modules = std::move(walk.modules);
+		registry->serial = walk.serial;
+		registry->adds = counters.adds;
+		registry->subs = counters.subs;
+		if (walk.changed) {
+			++registry->generation;
+		}
+		return walk.changed;
+	}
+
+	std::uint64_t module_registry_t::generation() noexcept {
+		return _registry.read()->generation;
+	}
+
+	std::vector<std::shared_ptr<const module_t>> module_registry_t::modules() {
+		refresh();
+		return _registry.read()->modules;
+	}
+
+	std::optional<module_addr_t> module_registry_t::resolve(const std::uintptr_t addr) {
+		const auto lookup = [&]() -> std::optional<module_addr_t> {
+			auto registry = _registry.read();
+			const auto& modules{registry->modules};
+			auto it = std::upper_bound(modules.begin(), modules.end(), addr, [](const std::uintptr_t val, const auto& mod) {
+				return val < mod->start;
+			});
+			if (it == modules.begin() || !(*--it)->contains(addr)) {
+				return std::nullopt;
+			}
+			return module_addr_t{*it, addr - (*it)->bias};
+		};
+
+		if (auto res = lookup()) {
+			return res;
+		}
+		/* It could have been loaded since we last looked */
+		if (refresh()) {
+			return lookup();
+		}
+		return std::nullopt;
+	}
+
+	std::shared_ptr<const module_t> module_registry_t::find(const std::string_view name) {
+		for (const auto& mod : modules()) {
+			if (mod->name == name || mod->path == name || fs::path{mod->path}.filename() == name) {
+				return mod;
+			}
+		}
+		return nullptr;
+	}
+}
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* modules.hh - Registry of the modules the dynamic loader has mapped */
+#pragma once
+#if !defined(SYCOPHANT_MODULES_HH)
+#define SYCOPHANT_MODULES_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <elf.h>
+
+#include <rwlock.hh>
+
+namespace sycophant {
+	struct module_segment_t final {
+		/* Absolute addresses, `end` is one past the last byte of the segment in memory */
+		std::uintptr_t start;
+		std::uintptr_t end;
+		std::uint64_t offset;
+		std::uint32_t flags;
+	};
+
+	struct module_t final {
+		/* As the loader reports it, the main executable has an empty name */
+		std::string name{};
+		/* The backing file, empty for things like the vDSO */
+		std::string path{};
+		/* Increases in the order the modules were loaded, which is the order the loader searches them in */
+		std::uint64_t serial{};
+		std::uintptr_t bias{};
+		const Elf64_Phdr* phdrs{nullptr};
+		std::size_t phnum{};
+		/* PT_LOAD segments sorted by address */
+		std::vector<module_segment_t> segments{};
+		std::uintptr_t start{};
+		std::uintptr_t end{};
+		const Elf64_Dyn* dynamic{nullptr};
+		/* 0 if the module has no PT_TLS segment */
+		std::size_t tls_modid{};
+		std::vector<std::uint8_t> build_id{};
+
+		[[nodiscard]]
+		bool contains(const std::uintptr_t addr) const noexcept;
+		[[nodiscard]]
+		const module_segment_t* segment(std::uintptr_t addr) const noexcept;
+		/* The lowercase hex build-id, which is how it's spelled in /usr/lib/debug/.build-id */
+		[[nodiscard]]
+		std::string build_id_hex() const;
+	};
+
+	/* An address resolved to the module it falls in, `offset` is relative to the load bias (the link-time address) */
+	struct module_addr_t final {
+		std::shared_ptr<const module_t> module;
+		std::uintptr_t offset;
+	};
+
+	/*
+		The set of modules as seen through dl_iterate_phdr, kept sorted by load address so address
+		lookups are a binary search. The loader's add/sub counters are checked before re-walking the
+		module list so a refresh with nothing loaded or unloaded is cheap, and modules that are still
+		mapped keep their existing entry.
+	*/
+	struct module_registry_t final {
+	private:
+		struct registry_t final {
+			std::uint64_t adds{};
+			std::uint64_t subs{};
+			std::uint64_t generation{};
+			std::uint64_t serial{};
+			std::vector<std::shared_ptr<const module_t>> modules{};
+		};
+		rwlock_t<registry_t> _registry{};
+
+	public:
+		module_registry_t() noexcept = default;
+
+		/* Returns true if the set of modules changed */
+		bool refresh();
+
+		/* Bumped every time the set of modules changes */
+		[[nodiscard]]
+		std::uint64_t generation() noexcept;
+
+		/* Sorted by address */
+		[[nodiscard]]
+		std::vector<std::shared_ptr<const module_t>> modules();
+		[[nodiscard]]
+		std::optional<module_addr_t> resolve(std::uintptr_t addr);
+		[[nodiscard]]
+		std::shared_ptr<const module_t> find(std::string_view name);
+	};
+}
+
+#endif /* SYCOPHANT_MODULES_HH */
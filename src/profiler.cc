@@ -0,0 +1,482 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* profiler.cc - Sampling CPU profiler */
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <cerrno>
+#include <algorithm>
+#include <map>
+#include <new>
+
+#include <profiler.hh>
+
+namespace sycophant {
+	namespace {
+		constexpr std::int64_t ns_per_sec{1000000000};
+		/* How long the aggregator sleeps between draining the rings */
+		constexpr timespec aggregate_interval{0, 10000000};
+
+		/*
+			What pthread_getcpuclockid hands out (CPUCLOCK_SCHED | CPUCLOCK_PERTHREAD_MASK), worked out
+			from the tid so we never touch the handle of a thread that might be on its way out
+		*/
+		[[nodiscard]]
+		constexpr clockid_t thread_cpu_clock(const pid_t tid) noexcept {
+			return static_cast<clockid_t>((~static_cast<std::uint32_t>(tid) << 3U) | 6U);
+		}
+	}
+
+	std::atomic<profiler_t*> profiler_t::_active{nullptr};
+	std::atomic<std::uint64_t> profiler_t::_unloads{0U};
+	std::atomic<std::uint32_t> profiler_t::_unloading{0U};
+	std::atomic<std::uint32_t> profiler_t::_unwinding{0U};
+
+	const eh_unwind_table_t* profiler_t::unwind_tables_t::find(const std::uintptr_t addr) const noexcept {
+		const auto it = std::upper_bound(tables.begin(), tables.end(), addr, [](const std::uintptr_t val, const eh_unwind_table_t& table) {
+			return val < table.start;
+		});
+		if (it == tables.begin() || addr >= (it - 1)->end) {
+			return nullptr;
+		}
+		return &*(it - 1);
+	}
+
+	profiler_t::profiler_t(thread_registry_t& threads, module_registry_t& modules, symbol_index_t& symbols) noexcept :
+		_threads{threads}, _modules{modules}, _symbols{symbols},
+		_observer{&profiler_t::on_thread_start, &profiler_t::on_thread_exit, this} {
+		static_cast<void>(::pthread_atfork(nullptr, nullptr, &fork_child));
+	}
+
+	std::uint32_t profiler_t::unwind(const void* const context, const thread_profile_t& profile, sample_t& sample) const noexcept {
+		const auto& gregs{static_cast<const ucontext_t*>(context)->uc_mcontext.gregs};
+		unwind_regs_t regs{
+			static_cast<std::uintptr_t>(gregs[REG_RIP]), static_cast<std::uintptr_t>(gregs[REG_RSP]),
+			static_cast<std::uintptr_t>(gregs[REG_RBP])
+		};
+		sample.frames[0] = regs.pc;
+
+		const auto lo{regs.sp};
+		const auto hi{profile.stack_hi};
+		/* Nothing past the leaf if we don't know where the stack is, or we're on some other stack */
+		if (hi == 0U || lo < profile.stack_lo || lo >= hi) {
+			return 1U;
+		}
+		/* Announced before checking for a dlclose, which checks for us the other way round */
+		_unwinding.fetch_add(1U, std::memory_order_seq_cst);
+		auto tables{_current.load(std::memory_order_acquire)};
+		if (tables != nullptr && (
+			_unloading.load(std::memory_order_seq_cst) != 0U ||
+			_unloads.load(std::memory_order_acquire) != tables->unloads
+		)) {
+			tables = nullptr;
+		}
+
+		/* Follows rbp as long as it points up the stack and the return address lands in a module we know */
+		const auto frame_step = [&]() noexcept {
+			const auto fp{regs.fp};
+			if (fp < regs.sp || fp >= hi || hi - fp < sizeof(std::uintptr_t) * 2U || (fp % alignof(std::uintptr_t)) != 0U) {
+				return false;
+			}
+			const auto next{reinterpret_cast<const std::uintptr_t*>(fp)[0]};
+			const auto ret{reinterpret_cast<const std::uintptr_t*>(fp)[1]};
+			if (ret == 0U || (next != 0U && next <= fp) || (tables != nullptr && tables->find(ret - 1U) == nullptr)) {
+				return false;
+			}
+			regs = {ret, fp + (sizeof(std::uintptr_t) * 2U), next};
+			return true;
+		};
+
+		std::uint32_t depth{1U};
+		while (depth < max_depth) {
+			const auto caller{depth > 1U};
+			const auto table{tables != nullptr ? tables->find(caller ? regs.pc - 1U : regs.pc) : nullptr};
+			bool stepped{false};
+			/* The interrupted function may not have set up its frame yet, or may not keep one at all */
+			if (!caller && table != nullptr) {
+				stepped = eh_unwind_step(*table, regs, false, lo, hi);
+			}
+			if (!stepped) {
+				stepped = frame_step();
+			}
+			if (!stepped && caller && table != nullptr) {
+				stepped = eh_unwind_step(*table, regs, true, lo, hi);
+			}
+			if (!stepped || regs.pc == 0U) {
+				break;
+			}
+			sample.frames[depth++] = regs.pc - 1U;
+		}
+		_unwinding.fetch_sub(1U, std::memory_order_release);
+		return depth;
+	}
+
+	void profiler_t::unloading() noexcept {
+		_unloading.fetch_add(1U, std::memory_order_seq_cst);
+		while (_unwinding.load(std::memory_order_seq_cst) != 0U) {
+			static_cast<void>(::sched_yield());
+		}
+	}
+
+	void profiler_t::unloaded() noexcept {
+		_unloads.fetch_add(1U, std::memory_order_release);
+		_unloading.fetch_sub(1U, std::memory_order_release);
+	}
+
+	void profiler_t::fork_child() noexcept {
+		_unwinding.store(0U, std::memory_order_relaxed);
+	}
+
+	void profiler_t::on_signal(std::int32_t, siginfo_t*, void* const context) noexcept {
+		const auto saved_errno{errno};
+		const auto profiler{_active.load(std::memory_order_acquire)};
+		const auto slot{thread_registry_t::current()};
+		if (profiler != nullptr && slot != nullptr) {
+			if (const auto profile{static_cast<thread_profile_t*>(slot->profile.load(std::memory_order_acquire))}) {
+				const auto head{profile->head.load(std::memory_order_relaxed)};
+				if (head - profile->tail.load(std::memory_order_acquire) >= ring_size) {
+					profile->dropped.fetch_add(1U, std::memory_order_relaxed);
+				} else {
+					auto& sample{profile->ring[head % ring_size]};
+					sample.depth = profiler->unwind(context, *profile, sample);
+					profile->head.store(head + 1U, std::memory_order_release);
+				}
+			}
+		}
+		errno = saved_errno;
+	}
+
+	void profiler_t::on_thread_start(void* const ctx, thread_slot_t& slot) noexcept {
+		try {
+			static_cast<profiler_t*>(ctx)->attach(slot);
+		} catch (...) {
+			/* The thread just goes unsampled */
+		}
+	}
+
+	void profiler_t::on_thread_exit(void*, thread_slot_t& slot) noexcept {
+		if (const auto profile{static_cast<thread_profile_t*>(slot.profile.load(std::memory_order_acquire))}) {
+			detach(slot, *profile);
+		}
+	}
+
+	void profiler_t::attach(thread_slot_t& slot) {
+		const auto state{slot.state.load(std::memory_order_acquire)};
+		const auto tid{slot.tid.load(std::memory_order_acquire)};
+		if (tid == 0 || slot.profile.load(std::memory_order_acquire) != nullptr) {
+			return;
+		}
+
+		std::unique_ptr<thread_profile_t> profile{new (std::nothrow) thread_profile_t{}};
+		if (profile == nullptr) {
+			return;
+		}
+		profile->slot = &slot;
+		/* Recorded by the thread itself, its handle is never touched as it might be on its way out */
+		profile->stack_lo = slot.stack_lo.load(std::memory_order_relaxed);
+		profile->stack_hi = slot.stack_hi.load(std::memory_order_relaxed);
+
+		sigevent event{};
+		event.sigev_notify = SIGEV_THREAD_ID;
+		event.sigev_signo = SIGPROF;
+		event._sigev_un._tid = tid;
+		if (::timer_create(thread_cpu_clock(tid), &event, &profile->timer) != 0) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock{_lock};
+		void* expected{nullptr};
+		if (!_running || !slot.profile.compare_exchange_strong(expected, profile.get(), std::memory_order_acq_rel)) {
+			static_cast<void>(::timer_delete(profile->timer));
+			return;
+		}
+		/* The thread went away and its slot was handed to another one while we were setting up */
+		if (slot.state.load(std::memory_order_acquire) != state) {
+			detach(slot, *profile);
+			return;
+		}
+		_profiles.push_back(std::move(profile));
+
+		const itimerspec spec{
+			{_interval / ns_per_sec, _interval % ns_per_sec},
+			{_interval / ns_per_sec, _interval % ns_per_sec}
+		};
+		static_cast<void>(::timer_settime(_profiles.back()->timer, 0, &spec, nullptr));
+	}
+
+	void profiler_t::detach(thread_slot_t& slot, thread_profile_t& profile) noexcept {
+		void* expected{&profile};
+		if (!slot.profile.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel)) {
+			return;
+		}
+		static_cast<void>(::timer_delete(profile.timer));
+		profile.done.store(true, std::memory_order_release);
+	}
+
+	void profiler_t::refresh_tables() {
+		/* Read first, a module that's unloaded while we're walking them leaves it out of date */
+		const auto unloads{_unloads.load(std::memory_order_acquire)};
+		const auto changed{_modules.refresh()};
+		const auto current{_current.load(std::memory_order_acquire)};
+		const auto generation{_modules.generation()};
+		if (current != nullptr && !changed && current->generation == generation && current->unloads == unloads) {
+			return;
+		}
+
+		auto fresh{std::make_unique<unwind_tables_t>()};
+		fresh->generation = generation;
+		fresh->unloads = unloads;
+		for (const auto& mod : _modules.modules()) {
+			if (const auto table{eh_unwind_table(*mod)}) {
+				fresh->tables.push_back(*table);
+			}
+		}
+		std::sort(fresh->tables.begin(), fresh->tables.end(), [](const eh_unwind_table_t& a, const eh_unwind_table_t& b) {
+			return a.start < b.start;
+		});
+
+		std::lock_guard<std::mutex> lock{_lock};
+		_current.store(fresh.get(), std::memory_order_release);
+		_tables.push_back(std::move(fresh));
+	}
+
+	void profiler_t::drain() {
+		for (auto it{_profiles.begin()}; it != _profiles.end();) {
+			auto& profile{**it};
+			/* Read before draining so a ring that's done is known to have nothing left in it */
+			const auto done{profile.done.load(std::memory_order_acquire)};
+			const auto head{profile.head.load(std::memory_order_acquire)};
+			for (auto tail{profile.tail.load(std::memory_order_relaxed)}; tail != head; ++tail) {
+				const auto& sample{profile.ring[tail % ring_size]};
+				std::uint32_t node{0U};
+				for (auto idx{sample.depth}; idx-- > 0U;) {
+					const auto [edge, inserted] = _edges.try_emplace(
+						std::make_pair(node, sample.frames[idx]), static_cast<std::uint32_t>(_nodes.size())
+					);
+					if (inserted) {
+						_nodes.push_back({node, sample.frames[idx], 0U});
+					}
+					node = edge->second;
+				}
+				++_nodes[node].self;
+				++_samples;
+				profile.tail.store(tail + 1U, std::memory_order_release);
+			}
+			_dropped += profile.dropped.exchange(0U, std::memory_order_relaxed);
+
+			/* A signal handler could still be on its way out of it, so it's given one more pass */
+			if (done) {
+				if (profile.retired == 0U) {
+					profile.retired = _pass + 1U;
+				} else if (profile.retired <= _pass) {
+					it = _profiles.erase(it);
+					continue;
+				}
+			}
+			++it;
+		}
+	}
+
+	void profiler_t::aggregate() noexcept {
+		while (!_stopping.load(std::memory_order_acquire)) {
+			static_cast<void>(::nanosleep(&aggregate_interval, nullptr));
+			try {
+				refresh_tables();
+				std::lock_guard<std::mutex> lock{_lock};
+				drain();
+				++_pass;
+			} catch (...) {
+				/* Whatever was in the rings is picked up on the next pass */
+			}
+		}
+	}
+
+	bool profiler_t::start(const std::uint32_t hz) {
+		{
+			std::lock_guard<std::mutex> lock{_lock};
+			profiler_t* expected{nullptr};
+			if (_running || !_active.compare_exchange_strong(expected, this, std::memory_order_acq_rel)) {
+				return false;
+			}
+			_interval = ns_per_sec / std::clamp<std::int64_t>(hz, 1, 10000);
+
+			struct sigaction action{};
+			action.sa_sigaction = &profiler_t::on_signal;
+			action.sa_flags = SA_SIGINFO | SA_RESTART;
+			sigemptyset(&action.sa_mask);
+			if (::sigaction(SIGPROF, &action, &_old_action) != 0) {
+				_active.store(nullptr, std::memory_order_release);
+				return false;
+			}
+			_running = true;
+		}
+		refresh_tables();
+
+		_threads.observe(&_observer);
+		_threads.for_each([this](thread_slot_t& slot) { attach(slot); });
+
+		_stopping.store(false, std::memory_order_release);
+		_owner.store(::getpid(), std::memory_order_relaxed);
+		const auto starter{::pthread_self()};
+		_aggregator = std::make_unique<worker_pool_t>(1U, [this, starter]() {
+			/* Without a thread of our own the rings are only drained when someone asks for the results */
+			if (!::pthread_equal(::pthread_self(), starter)) {
+				aggregate();
+			}
+		});
+		return true;
+	}
+
+	void profiler_t::abandon() noexcept {
+		/* Its thread was never here to join and timers aren't inherited, so there's nothing to stop */
+		static_cast<void>(_aggregator.release());
+		_threads.observe(nullptr);
+		static_cast<void>(::sigaction(SIGPROF, &_old_action, nullptr));
+		_running = false;
+		_active.store(nullptr, std::memory_order_release);
+		_owner.store(0, std::memory_order_relaxed);
+	}
+
+	void profiler_t::stop() noexcept {
+		/* Checked before the lock, which could have been held by the parent's aggregator when it forked */
+		const auto owner{_owner.load(std::memory_order_relaxed)};
+		if (owner != 0 && owner != ::getpid()) {
+			abandon();
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock{_lock};
+			if (!_running) {
+				return;
+			}
+			_running = false;
+		}
+		_threads.observe(nullptr);
+		_stopping.store(true, std::memory_order_release);
+		_aggregator.reset();
+
+		std::lock_guard<std::mutex> lock{_lock};
+		for (const auto& profile : _profiles) {
+			detach(*profile->slot, *profile);
+		}
+		static_cast<void>(::sigaction(SIGPROF, &_old_action, nullptr));
+		try {
+			drain();
+		} catch (...) {
+			/* Anything left over is dropped along with the rings by `clear` */
+		}
+		_active.store(nullptr, std::memory_order_release);
+		_owner.store(0, std::memory_order_relaxed);
+	}
+
+	void profiler_t::clear() noexcept {
+		std::lock_guard<std::mutex> lock{_lock};
+		/* Keeps the root, which also means this never has to allocate */
+		_nodes.erase(_nodes.begin() + 1, _nodes.end());
+		_nodes.front().self = 0U;
+		_edges.clear();
+		_samples = 0U;
+		_dropped = 0U;
+		if (!_running) {
+			_profiles.clear();
+			_current.store(nullptr, std::memory_order_release);
+			_tables.clear();
+		}
+	}
+
+	bool profiler_t::running() noexcept {
+		std::lock_guard<std::mutex> lock{_lock};
+		return _running;
+	}
+
+	profile_stats_t profiler_t::stats() noexcept {
+		std::lock_guard<std::mutex> lock{_lock};
+		try {
+			drain();
+		} catch (...) {
+			/* Counted next time */
+		}
+		const auto threads{std::count_if(_profiles.begin(), _profiles.end(), [](const auto& profile) {
+			return !profile->done.load(std::memory_order_relaxed);
+		})};
+		return {_samples, _dropped, static_cast<std::size_t>(threads), _nodes.size() - 1U};
+	}
+
+	std::string profiler_t::folded() {
+		std::vector<node_t> nodes{};
+		{
+			std::lock_guard<std::mutex> lock{_lock};
+			drain();
+			nodes = _nodes;
+		}
+		if (nodes.size() < 2U) {
+			return {};
+		}
+
+		/* Symbolized without holding the lock so new threads aren't held up attaching */
+		std::vector<std::uintptr_t> pcs{};
+		pcs.reserve(nodes.size() - 1U);
+		for (std::size_t idx{1U}; idx < nodes.size(); ++idx) {
+			pcs.push_back(nodes[idx].pc);
+		}
+		std::sort(pcs.begin(), pcs.end());
+		pcs.erase(std::unique(pcs.begin(), pcs.end()), pcs.end());
+		const auto syms{_symbols.symbolize_many(pcs)};
+		const auto name = [&](const std::uintptr_t pc) -> const symbolized_t& {
+			return syms[static_cast<std::size_t>(std::lower_bound(pcs.begin(), pcs.end(), pc) - pcs.begin())];
+		};
+
+		/* Different pcs in the same functions fold into the same line */
+		std::map<std::string, std::uint64_t> stacks{};
+		std::vector<std::uint32_t> path{};
+		for (std::uint32_t idx{1U}; idx < nodes.size(); ++idx) {
+			if (nodes[idx].self == 0U) {
+				continue;
+			}
+			path.clear();
+			for (auto node{idx}; node != 0U; node = nodes[node].parent) {
+				path.push_back(node);
+			}
+			std::string stack{};
+			for (auto it{path.rbegin()}; it != path.rend(); ++it) {
+				if (!stack.empty()) {
+					stack.push_back(';');
+				}
+				stack.append(name(nodes[*it].pc).frame());
+			}
+			stacks[stack] += nodes[idx].self;
+		}
+
+		std::string res{};
+		for (const auto& [stack, count] : stacks) {
+			res.append(stack);
+			res.push_back(' ');
+			res.append(std::to_string(count));
+			res.push_back('\n');
+		}
+		return res;
+	}
+}
+
+extern "C" {
+	[[gnu::used, gnu::visibility("default")]]
+	std::int32_t dlclose(void* const handle) noexcept {
+		/* Constant initialized so there's no guard, a race just looks it up twice */
+		static std::atomic<std::int32_t (*)(void*)> cache{nullptr};
+		auto real{cache.load(std::memory_order_acquire)};
+		if (real == nullptr) {
+			real = reinterpret_cast<std::int32_t (*)(void*)>(dlsym(RTLD_NEXT, "dlclose"));
+			if (real == nullptr) {
+				return -1;
+			}
+			cache.store(real, std::memory_order_release);
+		}
+		sycophant::profiler_t::unloading();
+		const auto res{real(handle)};
+		const auto err{errno};
+		sycophant::profiler_t::unloaded();
+		errno = err;
+		return res;
+	}
+}
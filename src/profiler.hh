@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* profiler.hh - Sampling CPU profiler */
+#pragma once
+#if !defined(SYCOPHANT_PROFILER_HH)
+#define SYCOPHANT_PROFILER_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <threads.hh>
+#include <modules.hh>
+#include <symbols.hh>
+#include <dwarf.hh>
+#include <workers.hh>
+
+namespace sycophant {
+	struct profile_stats_t final {
+		/* Samples taken into the call tree */
+		std::uint64_t samples;
+		/* Samples thrown away because a thread's ring was full */
+		std::uint64_t dropped;
+		/* Threads currently being sampled */
+		std::size_t threads;
+		/* Distinct call paths in the call tree */
+		std::size_t nodes;
+	};
+
+	/*
+		Samples the stacks of every thread in the process. Each thread gets its own CLOCK_THREAD_CPUTIME_ID
+		timer that sends it SIGPROF, so only threads that are actually burning CPU get sampled. The handler
+		walks the frame pointer chain, stepping through a frame with its .eh_frame CFI instead whenever the
+		chain doesn't check out, and writes the stack into the thread's preallocated ring. It never
+		allocates or takes a lock.
+
+		A background thread drains the rings into a call tree every few milliseconds. Threads started
+		while profiling are picked up through the thread registry and dropped again when they exit.
+	*/
+	struct profiler_t final {
+	private:
+		static constexpr std::size_t max_depth{64U};
+		static constexpr std::size_t ring_size{64U};
+
+		struct sample_t final {
+			std::uint32_t depth;
+			/* The interrupted pc followed by return addresses - 1 */
+			std::array<std::uintptr_t, max_depth> frames;
+		};
+
+		/* A single producer (the thread's signal handler) single consumer (the aggregator) ring */
+		struct thread_profile_t final {
+			thread_slot_t* slot{nullptr};
+			timer_t timer{};
+			std::uintptr_t stack_lo{0U};
+			std::uintptr_t stack_hi{0U};
+			std::atomic<std::uint32_t> head{0U};
+			std::atomic<std::uint32_t> tail{0U};
+			std::atomic<std::uint64_t> dropped{0U};
+			/* Set once the timer is gone and nothing will write to the ring again */
+			std::atomic<bool> done{false};
+			/* The aggregator pass that first saw it done and drained, it's freed on the one after */
+			std::uint64_t retired{0U};
+			std::array<sample_t, ring_size> ring{};
+		};
+
+		/* The unwind tables of the loaded modules sorted by address, as seen by the signal handler */
+		struct unwind_tables_t final {
+			std::uint64_t generation{};
+			/* `_unloads` from before the modules were walked, any other value means one might be gone */
+			std::uint64_t unloads{};
+			std::vector<eh_unwind_table_t> tables{};
+
+			[[nodiscard]]
+			const eh_unwind_table_t* find(std::uintptr_t addr) const noexcept;
+		};
+
+		struct node_t final {
+			std::uint32_t parent;
+			std::uintptr_t pc;
+			std::uint64_t self;
+		};
+
+		struct edge_hash_t final {
+			[[nodiscard]]
+			std::size_t operator()(const std::pair<std::uint32_t, std::uintptr_t>& edge) const noexcept {
+				return std::hash<std::uintptr_t>{}(edge.second * 31U + edge.first);
+			}
+		};
+
+		/* The profiler the signal handler feeds, there's only ever one running */
+		static std::atomic<profiler_t*> _active;
+		/* dlclose calls that have finished, and those still going */
+		static std::atomic<std::uint64_t> _unloads;
+		static std::atomic<std::uint32_t> _unloading;
+		/* Signal handlers reading the unwind tables, which a dlclose waits out before unmapping anything */
+		static std::atomic<std::uint32_t> _unwinding;
+
+		thread_registry_t& _threads;
+		module_registry_t& _modules;
+		symbol_index_t& _symbols;
+		const thread_observer_t _observer;
+
+		std::mutex _lock{};
+		bool _running{false};
+		std::int64_t _interval{0};
+		struct sigaction _old_action{};
+		std::vector<std::unique_ptr<thread_profile_t>> _profiles{};
+		std::uint64_t _pass{0U};
+		std::uint64_t _samples{0U};
+		std::uint64_t _dropped{0U};
+		/* Node 0 is the root, edges are keyed by (parent, pc) */
+		std::vector<node_t> _nodes{{0U, 0U, 0U}};
+		std::unordered_map<std::pair<std::uint32_t, std::uintptr_t>, std::uint32_t, edge_hash_t> _edges{};
+
+		/* Superseded tables are kept until `stop` as a handler might still be using them */
+		std::vector<std::unique_ptr<unwind_tables_t>> _tables{};
+		std::atomic<const unwind_tables_t*> _current{nullptr};
+
+		std::atomic<bool> _stopping{false};
+		/* The process that started it, a child forked without exec has a copy of all this but not the thread */
+		std::atomic<::pid_t> _owner{0};
+		/* Declared last so it's joined before anything it uses goes away */
+		std::unique_ptr<worker_pool_t> _aggregator{};
+
+		static void on_signal(std::int32_t signo, siginfo_t* info, void* context) noexcept;
+		static void on_thread_start(void* ctx, thread_slot_t& slot) noexcept;
+		static void on_thread_exit(void* ctx, thread_slot_t& slot) noexcept;
+		/* A handler that was running when the parent forked never finishes in the child */
+		static void fork_child() noexcept;
+
+		[[nodiscard]]
+		std::uint32_t unwind(const void* context, const thread_profile_t& profile, sample_t& sample) const noexcept;
+
+		/* Starts sampling `slot`'s thread, `_lock` must not be held */
+		void attach(thread_slot_t& slot);
+		/* Stops sampling, only one of the thread itself and `stop` ends up doing it */
+		static void detach(thread_slot_t& slot, thread_profile_t& profile) noexcept;
+
+		void refresh_tables();
+		/* Moves everything in the rings into the call tree, `_lock` must be held */
+		void drain();
+		void aggregate() noexcept;
+		/* Lets go of a forked child's copy without touching the parent's thread or lock */
+		void abandon() noexcept;
+
+	public:
+		profiler_t(thread_registry_t& threads, module_registry_t& modules, symbol_index_t& symbols) noexcept;
+		~profiler_t() noexcept { stop(); }
+
+		profiler_t(const profiler_t&) = delete;
+		profiler_t& operator=(const profiler_t&) = delete;
+		profiler_t(profiler_t&&) = delete;
+		profiler_t& operator=(profiler_t&&) = delete;
+
+		/* Starts sampling every thread `hz` times per second of CPU time, false if it's already running */
+		[[nodiscard]]
+		bool start(std::uint32_t hz);
+		/* Stops sampling, what was collected is kept until `clear` */
+		void stop() noexcept;
+		void clear() noexcept;
+
+		[[nodiscard]]
+		bool running() noexcept;
+		[[nodiscard]]
+		profile_stats_t stats() noexcept;
+
+		/* The call tree as folded stacks, `outer;...;inner count` per line as flamegraph.pl expects */
+		[[nodiscard]]
+		std::string folded();
+
+		/*
+			Called from the dlclose interposer around the real one. Until the tables are rebuilt without
+			it, the signal handler walks frame pointers and leaves the unwind tables alone.
+		*/
+		static void unloading() noexcept;
+		static void unloaded() noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_PROFILER_HH */
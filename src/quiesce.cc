@@ -0,0 +1,658 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* quiesce.cc - Stop-the-world thread quiescence for live code patching */
+
+#include <quiesce.hh>
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <algorithm>
+
+#include <strutils.hh>
+#include <fd.hh>
+#include <threads.hh>
+
+namespace sycophant {
+	namespace {
+		enum struct park_state_t : std::uint32_t {
+			SIGNALLED = 0U,
+			PARKED    = 1U,
+			GONE      = 2U,
+		};
+
+		struct parked_t final {
+			::pid_t tid{};
+			std::uint32_t seen{};
+			std::uintptr_t pc{};
+			std::atomic<park_state_t> state{park_state_t::SIGNALLED};
+			std::atomic<std::uint32_t> kick{0};
+		};
+
+		static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "futex words must be 32-bits");
+
+		std::mutex stw_lock{};
+		std::once_flag handler_once{};
+		bool sync_core{false};
+
+		/* Kept open between stops, and re-opened if we find ourselves in a forked child */
+		fd_t tasks{};
+		::pid_t tasks_pid{-1};
+
+		/* Arrays are only ever grown, the old ones are leaked as a late signal may still be looking at them */
+		parked_t* parked{nullptr};
+		std::size_t parked_cap{0};
+		std::size_t signalled{0};
+		/* Open addressed tid -> index + 1 into `parked`, twice its size rounded up to a power of two */
+		std::uint32_t* parked_index{nullptr};
+		std::size_t parked_index_cap{0};
+
+		/* The threads we know about, set for the duration of a stop */
+		const thread_registry_t* tracked{nullptr};
+
+		std::uint32_t epoch_counter{0};
+		std::atomic<std::uint32_t> active_epoch{0};
+		std::atomic<std::uint32_t> parked_count{0};
+		std::atomic<std::uint32_t> resumed_count{0};
+		std::atomic<std::uint32_t> release_gen{0};
+		/* The parked count the controller is waiting for, so only the last thread in has to wake it */
+		std::atomic<std::uint32_t> park_target{0};
+
+		/* How long we wait for every thread to show up before giving up on the stop */
+		constexpr std::int64_t stop_deadline_ns{500'000'000};
+		/* How many times a patch batch is retried if a thread is sitting inside of a patch window */
+		constexpr std::size_t patch_attempts{64};
+
+		inline void futex_wait(std::atomic<std::uint32_t>& word, const std::uint32_t expected, const ::timespec* timeout) noexcept {
+			::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+		}
+
+		inline void futex_wake(std::atomic<std::uint32_t>& word) noexcept {
+			::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+		}
+
+		[[nodiscard]]
+		inline std::int64_t monotonic_ns() noexcept {
+			::timespec ts{};
+			::clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (std::int64_t{ts.tv_sec} * 1'000'000'000) + ts.tv_nsec;
+		}
+
+		[[nodiscard]]
+		inline std::uintptr_t context_pc(const void* const uctx) noexcept {
+			const auto ctx{static_cast<const ucontext_t*>(uctx)};
+#if defined(__x86_64__)
+			return static_cast<std::uintptr_t>(ctx->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__i386__)
+			return static_cast<std::uintptr_t>(ctx->uc_mcontext.gregs[REG_EIP]);
+#elif defined(__aarch64__)
+			return static_cast<std::uintptr_t>(ctx->uc_mcontext.pc);
+#else
+#	error "Unsupported architecture for thread quiescence"
+#endif
+		}
+
+		void park_handler(std::int32_t, siginfo_t* info, void* uctx) noexcept {
+			const auto saved_errno{errno};
+			/* This must be loaded before the epoch check so we can't miss a release from an abort */
+			const auto gen{release_gen.load()};
+			const auto cookie{reinterpret_cast<std::uintptr_t>(info->si_value.sival_ptr)};
+			const auto epoch{static_cast<std::uint32_t>(cookie >> 32U)};
+			const auto idx{static_cast<std::size_t>(cookie & 0xFFFFFFFFU)};
+
+			if (info->si_code != SI_QUEUE || epoch == 0 || epoch != active_epoch.load() || idx >= parked_cap) {
+				errno = saved_errno;
+				return;
+			}
+
+			auto& rec{parked[idx]};
+			rec.pc = context_pc(uctx);
+			rec.state.store(park_state_t::PARKED);
+			if ((parked_count.fetch_add(1U) + 1U) - resumed_count.load() >= park_target.load()) {
+				futex_wake(parked_count);
+			}
+
+			while (release_gen.load() == gen && rec.kick.load() == 0U) {
+				futex_wait(release_gen, gen, nullptr);
+			}
+
+			rec.kick.store(0U);
+			if (resumed_count.fetch_add(1U) + 1U >= parked_count.load()) {
+				futex_wake(resumed_count);
+			}
+			errno = saved_errno;
+		}
+
+		void install_handler() noexcept {
+			struct sigaction act{};
+			act.sa_sigaction = park_handler;
+			act.sa_flags = SA_SIGINFO | SA_RESTART;
+			sigfillset(&act.sa_mask);
+			::sigaction(quiesce_signal(), &act, nullptr);
+
+			/* Only needed on weakly ordered machines, on x86 returning from the handler serializes the core */
+			const auto cmds{::syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0U, 0)};
+			if (cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE) != 0) {
+				sync_core = ::syscall(
+					SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE, 0U, 0
+				) == 0;
+			}
+		}
+
+		[[nodiscard]]
+		bool send_park(const ::pid_t tid, const std::size_t idx) noexcept {
+			const auto pid{::getpid()};
+			siginfo_t info{};
+			info.si_signo = quiesce_signal();
+			info.si_code  = SI_QUEUE;
+			info.si_pid   = pid;
+			info.si_uid   = ::getuid();
+			info.si_value.sival_ptr = reinterpret_cast<void*>((std::uintptr_t{active_epoch.load()} << 32U) | idx);
+			return ::syscall(SYS_rt_tgsigqueueinfo, pid, tid, quiesce_signal(), &info) == 0;
+		}
+
+		/* Walks `/proc/self/task` with getdents64(2) directly so we never touch the heap */
+		template<typename F>
+		[[nodiscard]]
+		bool for_each_task(F&& func) noexcept {
+			constexpr std::size_t reclen_offset{16U};
+			constexpr std::size_t name_offset{19U};
+
+			if (tasks_pid != ::getpid()) {
+				tasks = fd_t{"/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC};
+				tasks_pid = ::getpid();
+			}
+
+			if (!tasks.valid() || ::lseek(tasks, 0, SEEK_SET) != 0) {
+				return false;
+			}
+
+			alignas(8) std::array<char, 4096> buff{};
+			while (true) {
+				const auto len{::syscall(SYS_getdents64, std::int32_t(tasks), buff.data(), buff.size())};
+				if (len < 0) {
+					return false;
+				} else if (len == 0) {
+					return true;
+				}
+
+				for (std::size_t pos{}; pos < static_cast<std::size_t>(len);) {
+					std::uint16_t reclen{};
+					std::memcpy(&reclen, buff.data() + pos + reclen_offset, sizeof(reclen));
+					const char* const name{buff.data() + pos + name_offset};
+					if (name[0] != '.') {
+						func(static_cast<::pid_t>(toint_t<std::int32_t>(name).from_dec()));
+					}
+					pos += reclen;
+				}
+			}
+		}
+
+		[[nodiscard]]
+		bool reserve(const std::size_t count) noexcept {
+			if (count <= parked_cap) {
+				std::fill_n(parked_index, parked_index_cap, 0U);
+				return true;
+			}
+
+			std::size_t index_cap{64U};
+			while (index_cap < count * 2U) {
+				index_cap *= 2U;
+			}
+			auto recs{new(std::nothrow) parked_t[count]()};
+			auto index{new(std::nothrow) std::uint32_t[index_cap]()};
+			if (recs == nullptr || index == nullptr) {
+				delete[] recs;
+				delete[] index;
+				return false;
+			}
+
+			/* Only the index can go, no signal handler ever looks at it */
+			delete[] parked_index;
+			parked = recs;
+			parked_cap = count;
+			parked_index = index;
+			parked_index_cap = index_cap;
+			return true;
+		}
+
+		[[nodiscard]]
+		std::optional<std::size_t> find_parked(const ::pid_t tid) noexcept {
+			const auto mask{parked_index_cap - 1U};
+			for (auto pos{static_cast<std::size_t>(tid) & mask}; parked_index[pos] != 0U; pos = (pos + 1U) & mask) {
+				const auto idx{parked_index[pos] - 1U};
+				if (parked[idx].tid == tid) {
+					return idx;
+				}
+			}
+			return std::nullopt;
+		}
+
+		void index_parked(const ::pid_t tid, const std::size_t idx) noexcept {
+			const auto mask{parked_index_cap - 1U};
+			auto pos{static_cast<std::size_t>(tid) & mask};
+			while (parked_index[pos] != 0U) {
+				pos = (pos + 1U) & mask;
+			}
+			parked_index[pos] = static_cast<std::uint32_t>(idx + 1U);
+		}
+
+		[[nodiscard]]
+		std::uint32_t parked_now() noexcept {
+			return parked_count.load() - resumed_count.load();
+		}
+
+		/*
+			Signals any new threads and waits until everything we know about is parked, this is
+			re-run until a scan of the task list turns up nothing new.
+		*/
+		[[nodiscard]]
+		bool settle() noexcept {
+			const auto self{static_cast<::pid_t>(::syscall(SYS_gettid))};
+			const auto deadline{monotonic_ns() + stop_deadline_ns};
+			static std::uint32_t scan{0};
+			park_target.store(UINT32_MAX);
+
+			while (true) {
+				bool found_new{false};
+				bool overflow{false};
+				++scan;
+
+				const auto signal = [&](const ::pid_t tid) noexcept {
+					if (tid == self || overflow) {
+						return;
+					}
+
+					if (const auto idx{find_parked(tid)}) {
+						parked[*idx].seen = scan;
+						return;
+					}
+
+					if (signalled == parked_cap) {
+						overflow = true;
+						return;
+					}
+
+					auto& rec{parked[signalled]};
+					rec.tid  = tid;
+					rec.seen = scan;
+					rec.pc   = 0U;
+					rec.kick.store(0U);
+					rec.state.store(park_state_t::SIGNALLED);
+
+					if (!send_park(tid, signalled)) {
+						if (errno != ESRCH) {
+							overflow = true;
+							return;
+						}
+						rec.state.store(park_state_t::GONE);
+					}
+					index_parked(tid, signalled);
+					++signalled;
+					found_new = true;
+				};
+
+				/*
+					The tracked threads get their signals before we start reading the task list, so they're
+					already on their way to parking while we look for anything we didn't see start
+				*/
+				if (tracked != nullptr) {
+					tracked->for_each([&](const thread_slot_t& slot) {
+						const auto tid{slot.tid.load(std::memory_order_acquire)};
+						if (tid != 0) {
+							signal(tid);
+						}
+					});
+				}
+				const auto scanned{for_each_task(signal)};
+
+				if (!scanned || overflow) {
+					return false;
+				}
+
+				/* Anything we signalled that has vanished from the task list exited before it could park */
+				std::uint32_t expected{};
+				for (std::size_t idx{}; idx < signalled; ++idx) {
+					auto& rec{parked[idx]};
+					if (rec.state.load() == park_state_t::SIGNALLED && rec.seen != scan) {
+						rec.state.store(park_state_t::GONE);
+					}
+					if (rec.state.load() != park_state_t::GONE) {
+						++expected;
+					}
+				}
+
+				if (!found_new && parked_now() >= expected) {
+					return true;
+				}
+
+				/* Only go back to re-scanning the task list once everyone has checked in or we've waited a while */
+				const auto now{monotonic_ns()};
+				if (now > deadline) {
+					/* Someone has our signal blocked, we can't know where they are so bail */
+					return false;
+				}
+
+				park_target.store(expected);
+				const auto rescan{now + 1'000'000};
+				for (auto waited{now}; parked_now() < expected && waited < rescan; waited = monotonic_ns()) {
+					const auto count{parked_count.load()};
+					const ::timespec timeout{0, rescan - waited};
+					futex_wait(parked_count, count, &timeout);
+				}
+			}
+		}
+
+		void release_all() noexcept {
+			active_epoch.store(0U);
+			release_gen.fetch_add(1U);
+			futex_wake(release_gen);
+
+			while (true) {
+				const auto resumed{resumed_count.load()};
+				if (resumed >= parked_count.load()) {
+					break;
+				}
+				const ::timespec timeout{0, 1'000'000};
+				futex_wait(resumed_count, resumed, &timeout);
+			}
+		}
+
+		/*
+			Lets just the parked threads matching `pred` run for a moment and then parks them again,
+			every other thread stays put so they'll generally get the CPU straight away.
+		*/
+		template<typename F>
+		[[nodiscard]]
+		bool nudge(F&& pred) noexcept {
+			std::uint32_t kicked{};
+			const auto resumed_before{resumed_count.load()};
+
+			for (std::size_t idx{}; idx < signalled; ++idx) {
+				auto& rec{parked[idx]};
+				if (rec.state.load() == park_state_t::PARKED && pred(rec.pc)) {
+					rec.state.store(park_state_t::SIGNALLED);
+					rec.kick.store(1U);
+					++kicked;
+				}
+			}
+
+			if (kicked == 0U) {
+				return true;
+			}
+
+			futex_wake(release_gen);
+			const auto deadline{monotonic_ns() + stop_deadline_ns};
+			while (resumed_count.load() - resumed_before < kicked) {
+				if (monotonic_ns() > deadline) {
+					return false;
+				}
+				const auto resumed{resumed_count.load()};
+				const ::timespec timeout{0, 1'000'000};
+				futex_wait(resumed_count, resumed, &timeout);
+			}
+
+			const ::timespec delay{0, 50'000};
+			::nanosleep(&delay, nullptr);
+
+			for (std::size_t idx{}; idx < signalled; ++idx) {
+				auto& rec{parked[idx]};
+				if (rec.state.load() == park_state_t::SIGNALLED && !send_park(rec.tid, idx)) {
+					rec.state.store(park_state_t::GONE);
+				}
+			}
+
+			return settle();
+		}
+
+		[[nodiscard]]
+		std::int32_t prot_for(const std::vector<mapentry_t>& maps, const std::uintptr_t page) noexcept {
+			const auto entry{std::find_if(std::begin(maps), std::end(maps), [&](const mapentry_t& map) {
+				return page >= map.addr_s && page < map.addr_e;
+			})};
+
+			if (entry == std::end(maps)) {
+				return -1;
+			}
+
+			std::int32_t prot{PROT_NONE};
+			if ((entry->flags & mapentry_flags_t::READ) == mapentry_flags_t::READ) {
+				prot |= PROT_READ;
+			}
+			if ((entry->flags & mapentry_flags_t::WRITE) == mapentry_flags_t::WRITE) {
+				prot |= PROT_WRITE;
+			}
+			if ((entry->flags & mapentry_flags_t::EXEC) == mapentry_flags_t::EXEC) {
+				prot |= PROT_EXEC;
+			}
+			return prot;
+		}
+	}
+
+	std::int32_t quiesce_signal() noexcept {
+		return SIGRTMAX - 3;
+	}
+
+	quiesce_t::quiesce_t(const thread_registry_t* const threads) noexcept : _held{true} {
+		stw_lock.lock();
+		std::call_once(handler_once, install_handler);
+		const auto start{monotonic_ns()};
+		tracked = threads;
+
+		std::size_t initial{};
+		if (!for_each_task([&](::pid_t) { ++initial; })) {
+			return;
+		}
+
+		/* Leave plenty of headroom for threads that get spawned while we're stopping things */
+		if (!reserve((initial * 2U) + 64U)) {
+			return;
+		}
+
+		if (++epoch_counter == 0) {
+			++epoch_counter;
+		}
+
+		signalled = 0;
+		parked_count.store(0U);
+		resumed_count.store(0U);
+		active_epoch.store(epoch_counter);
+
+		if (!settle()) {
+			release_all();
+			return;
+		}
+
+		_stopped = true;
+		_count = parked_now();
+		_stopped_at = monotonic_ns();
+		_suspend_ns = _stopped_at - start;
+	}
+
+	quiesce_t::~quiesce_t() noexcept {
+		resume();
+	}
+
+	void quiesce_t::resume() noexcept {
+		if (!_held) {
+			return;
+		}
+		if (_stopped) {
+			const auto start{monotonic_ns()};
+			_frozen_ns = start - _stopped_at;
+			release_all();
+			_resume_ns = monotonic_ns() - start;
+			_stopped = false;
+		}
+		tracked = nullptr;
+		_held = false;
+		stw_lock.unlock();
+	}
+
+	std::int64_t quiesce_t::frozen_ns() const noexcept {
+		return _stopped ? monotonic_ns() - _stopped_at : _frozen_ns;
+	}
+
+	bool quiesce_t::pc_in(const std::uintptr_t start, const std::uintptr_t end) const noexcept {
+		if (!_stopped) {
+			return false;
+		}
+
+		for (std::size_t idx{}; idx < signalled; ++idx) {
+			const auto& rec{parked[idx]};
+			if (rec.state.load() == park_state_t::PARKED && rec.pc >= start && rec.pc < end) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void patch_batch_t::add(const std::uintptr_t addr, std::vector<std::uint8_t> data) {
+		if (!data.empty()) {
+			_patches.push_back({addr, std::move(data)});
+		}
+	}
+
+	void patch_batch_t::add(const std::uintptr_t addr, const std::uint8_t* const data, const std::size_t len) {
+		add(addr, std::vector<std::uint8_t>(data, data + len));
+	}
+
+	bool patch_batch_t::commit(const std::vector<mapentry_t>& maps) noexcept {
+		if (_patches.empty()) {
+			return true;
+		}
+
+		struct span_t final {
+			std::uintptr_t page;
+			std::size_t len;
+			std::int32_t prot;
+		};
+
+		const auto page_size{static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE))};
+		std::vector<span_t> spans{};
+
+		/* Everything that can allocate has to happen before the world is stopped */
+		try {
+			std::sort(std::begin(_patches), std::end(_patches), [](const patch_t& a, const patch_t& b) {
+				return a.addr < b.addr;
+			});
+
+			for (const auto& patch : _patches) {
+				const auto first{patch.addr & ~(page_size - 1U)};
+				const auto last{(patch.addr + patch.data.size() - 1U) & ~(page_size - 1U)};
+				for (auto page{first}; page <= last; page += page_size) {
+					const auto prot{prot_for(maps, page)};
+					if (prot == -1) {
+						return false;
+					}
+
+					if (!spans.empty()) {
+						auto& span{spans.back()};
+						const auto end{span.page + span.len};
+						if (page < end) {
+							continue;
+						} else if (page == end && span.prot == prot) {
+							span.len += page_size;
+							continue;
+						}
+					}
+					spans.push_back({page, page_size, prot});
+				}
+			}
+		} catch (const std::bad_alloc&) {
+			return false;
+		}
+
+		/*
+			A thread is only in the way if it's part way through a patch window, sitting right at the
+			start is fine as it'll just pick up the new instruction. The patches are sorted so each
+			parked PC is a binary search.
+		*/
+		const auto in_window{[&](const std::uintptr_t pc) noexcept {
+			auto patch{std::upper_bound(std::begin(_patches), std::end(_patches), pc,
+				[](const std::uintptr_t addr, const patch_t& p) { return addr < p.addr; }
+			)};
+			if (patch == std::begin(_patches)) {
+				return false;
+			}
+			--patch;
+			return pc > patch->addr && pc < patch->addr + patch->data.size();
+		}};
+
+		const auto busy{[&]() noexcept {
+			for (std::size_t idx{}; idx < signalled; ++idx) {
+				const auto& rec{parked[idx]};
+				if (rec.state.load() == park_state_t::PARKED && in_window(rec.pc)) {
+					return true;
+				}
+			}
+			return false;
+		}};
+
+		for (std::size_t attempt{}; attempt < patch_attempts; ++attempt) {
+			{
+				const quiesce_t world{};
+				if (!world.stopped()) {
+					return false;
+				}
+
+				bool settled{true};
+				for (std::size_t nudges{}; settled && nudges < patch_attempts && busy(); ++nudges) {
+					settled = nudge(in_window);
+				}
+
+				if (settled && !busy()) {
+					std::size_t unlocked{};
+					for (; unlocked < spans.size(); ++unlocked) {
+						const auto& span{spans[unlocked]};
+						if (::mprotect(reinterpret_cast<void*>(span.page), span.len, PROT_READ | PROT_WRITE | PROT_EXEC) != 0) {
+							break;
+						}
+					}
+
+					const auto ok{unlocked == spans.size()};
+					if (ok) {
+						for (const auto& patch : _patches) {
+							std::memcpy(reinterpret_cast<void*>(patch.addr), patch.data.data(), patch.data.size());
+						}
+					}
+
+					for (std::size_t idx{}; idx < unlocked; ++idx) {
+						const auto& span{spans[idx]};
+						static_cast<void>(::mprotect(reinterpret_cast<void*>(span.page), span.len, span.prot));
+					}
+
+					if (ok) {
+						for (const auto& span : spans) {
+							__builtin___clear_cache(
+								reinterpret_cast<char*>(span.page), reinterpret_cast<char*>(span.page + span.len)
+							);
+						}
+						if (sync_core) {
+							::syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE, 0U, 0);
+						}
+					}
+					return ok;
+				}
+			}
+
+			/* Someone is stuck executing the bytes we want to change, give everyone a moment to move along */
+			const ::timespec delay{0, 1'000'000};
+			::nanosleep(&delay, nullptr);
+		}
+
+		return false;
+	}
+}
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* quiesce.hh - Stop-the-world thread quiescence for live code patching */
+#pragma once
+#if !defined(SYCOPHANT_QUIESCE_HH)
+#define SYCOPHANT_QUIESCE_HH
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+
+#include <types.hh>
+#include <threads.hh>
+
+namespace sycophant {
+
+	/* The real-time signal used to park threads, kept clear of the glibc internal ones and SIGRTMIN+n */
+	[[nodiscard]]
+	std::int32_t quiesce_signal() noexcept;
+
+	/*
+		Parks every other thread in the process inside of a signal handler for the lifetime of the
+		object, recording the PC each one was interrupted at.
+
+		Threads are discovered from `/proc/self/task`, so anything spawned before the preload or with a
+		raw `clone(2)` is caught too, and it's re-scanned until no new threads show up. If `threads` is
+		given everything it tracks is signalled before the task list is read. Nothing in here allocates
+		once the signals start going out, so it's safe to stop threads that are holding the heap lock.
+	*/
+	struct quiesce_t final {
+	private:
+		bool _held{false};
+		bool _stopped{false};
+		std::size_t _count{0};
+		std::int64_t _stopped_at{0};
+		std::int64_t _suspend_ns{0};
+		std::int64_t _frozen_ns{0};
+		std::int64_t _resume_ns{0};
+
+	public:
+		explicit quiesce_t(const thread_registry_t* threads = nullptr) noexcept;
+		~quiesce_t() noexcept;
+
+		quiesce_t(const quiesce_t&) = delete;
+		quiesce_t& operator=(const quiesce_t&) = delete;
+
+		[[nodiscard]]
+		bool stopped() const noexcept { return _stopped; }
+
+		/* Number of threads that are currently parked */
+		[[nodiscard]]
+		std::size_t count() const noexcept { return _count; }
+
+		/* Returns true if any parked thread has its PC in [start, end) */
+		[[nodiscard]]
+		bool pc_in(std::uintptr_t start, std::uintptr_t end) const noexcept;
+
+		/* Lets everything go before we're destroyed, once this is done the timings below are final */
+		void resume() noexcept;
+
+		/* How long it took to get every thread parked */
+		[[nodiscard]]
+		std::int64_t suspend_ns() const noexcept { return _suspend_ns; }
+		/* How long the threads have been (or were) parked for */
+		[[nodiscard]]
+		std::int64_t frozen_ns() const noexcept;
+		/* How long it took for every thread to leave the handler once released */
+		[[nodiscard]]
+		std::int64_t resume_ns() const noexcept { return _resume_ns; }
+	};
+
+	struct patch_t final {
+		std::uintptr_t addr;
+		std::vector<std::uint8_t> data;
+	};
+
+	/*
+		A set of code patches that are applied together under a single stop-the-world, if any
+		thread is parked with its PC inside of a patch window then the world is resumed and the
+		whole batch is retried a little later.
+	*/
+	struct patch_batch_t final {
+	private:
+		std::vector<patch_t> _patches{};
+
+	public:
+		patch_batch_t() = default;
+
+		void add(std::uintptr_t addr, std::vector<std::uint8_t> data);
+		void add(std::uintptr_t addr, const std::uint8_t* data, std::size_t len);
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return _patches.size(); }
+		[[nodiscard]]
+		bool empty() const noexcept { return _patches.empty(); }
+		void clear() noexcept { _patches.clear(); }
+
+		/* Applies all the patches, `maps` is used to restore the original page protections */
+		[[nodiscard]]
+		bool commit(const std::vector<mapentry_t>& maps) noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_QUIESCE_HH */
@@ -4,9 +4,12 @@
 #if !defined(SYCOPHANT_RWLOCK_HH)
 #define SYCOPHANT_RWLOCK_HH
 
+#include <cstdint>
 #include <utility>
+#include <atomic>
 #include <mutex>
 #include <shared_mutex>
+#include <time.h>
 
 
 namespace sycophant {
@@ -14,14 +17,36 @@ namespace sycophant {
 	template<typename T>
 	struct rwlock_t final {
 	private:
+		/* Only a lock that's already held gets its wait timed */
+		struct waits_t final {
+			std::atomic<std::uint64_t> count{0U};
+			std::atomic<std::uint64_t> ns{0U};
+
+			template<typename lock_t>
+			void acquire(lock_t& lock) noexcept {
+				if (lock.try_lock()) {
+					return;
+				}
+				timespec start{};
+				timespec end{};
+				::clock_gettime(CLOCK_MONOTONIC, &start);
+				lock.lock();
+				::clock_gettime(CLOCK_MONOTONIC, &end);
+				count.fetch_add(1U, std::memory_order_relaxed);
+				ns.fetch_add(static_cast<std::uint64_t>(
+					((end.tv_sec - start.tv_sec) * 1000000000) + (end.tv_nsec - start.tv_nsec)
+				), std::memory_order_relaxed);
+			}
+		};
+
 		template<typename U, template<typename> typename lock_t>
 		struct lockresult_t final {
 		private:
 			lock_t<std::shared_mutex> _lock;
 			U& _obj;
 		public:
-			constexpr lockresult_t(std::shared_mutex& mut, U& obj) noexcept :
-				_lock{mut}, _obj{obj} { }
+			lockresult_t(std::shared_mutex& mut, U& obj, waits_t& waits) noexcept :
+				_lock{mut, std::defer_lock}, _obj{obj} { waits.acquire(_lock); }
 
 			[[nodiscard]]
 			U* operator->() noexcept { return &_obj; }
@@ -33,6 +58,7 @@ namespace sycophant {
 		using lockrw_t = lockresult_t<T, std::unique_lock>;
 
 		std::shared_mutex _mutex{};
+		waits_t _waits{};
 		T _obj;
 	public:
 		template<typename ...args_t>
@@ -41,13 +67,19 @@ namespace sycophant {
 
 		[[nodiscard]]
 		lockro_t read() noexcept {
-			return {_mutex, _obj};
+			return {_mutex, _obj, _waits};
 		}
 
 		[[nodiscard]]
 		lockrw_t write() noexcept {
-			return {_mutex, _obj};
+			return {_mutex, _obj, _waits};
 		}
+
+		/* How many times taking the lock had to wait, and for how long all up */
+		[[nodiscard]]
+		std::uint64_t waits() const noexcept { return _waits.count.load(std::memory_order_relaxed); }
+		[[nodiscard]]
+		std::uint64_t wait_ns() const noexcept { return _waits.ns.load(std::memory_order_relaxed); }
 	};
 }
 
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* stats.cc - Counters for what sycophant itself costs */
+#include <new>
+
+#include <stats.hh>
+
+namespace sycophant {
+	stats_t::owner_t::~owner_t() noexcept {
+		if (block != nullptr) {
+			block->owned.store(false, std::memory_order_release);
+		}
+	}
+
+	stats_t::block_t& stats_t::block() noexcept {
+		/* There's only the one stats_t, so which one the block belongs to doesn't need tracking */
+		static thread_local owner_t current{};
+		if (current.block != nullptr) {
+			return *current.block;
+		}
+
+		for (auto block{_blocks.load(std::memory_order_acquire)}; block != nullptr; block = block->next) {
+			auto owned{false};
+			if (block->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+				current.block = block;
+				return *block;
+			}
+		}
+
+		auto block{new (std::nothrow) block_t{}};
+		if (block == nullptr) {
+			/* Out of memory, anything counted into this is dropped */
+			static block_t fallback{};
+			return fallback;
+		}
+		block->next = _blocks.load(std::memory_order_relaxed);
+		while (!_blocks.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed)) { }
+		current.block = block;
+		return *block;
+	}
+
+	void stats_t::phase(std::string name, const std::uint64_t ns) {
+		std::lock_guard<std::mutex> lock{_lock};
+		_phases.emplace_back(std::move(name), ns);
+	}
+
+	std::array<std::uint64_t, static_cast<std::size_t>(counter_t::count)> stats_t::totals() const noexcept {
+		std::array<std::uint64_t, static_cast<std::size_t>(counter_t::count)> res{};
+		for (auto block{_blocks.load(std::memory_order_acquire)}; block != nullptr; block = block->next) {
+			for (std::size_t idx{}; idx < res.size(); ++idx) {
+				res[idx] += block->values[idx].load(std::memory_order_relaxed);
+			}
+		}
+		return res;
+	}
+
+	std::vector<std::pair<std::string, std::uint64_t>> stats_t::phases() const {
+		std::lock_guard<std::mutex> lock{_lock};
+		return _phases;
+	}
+}
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* stats.hh - Counters for what sycophant itself costs */
+#pragma once
+#if !defined(SYCOPHANT_STATS_HH)
+#define SYCOPHANT_STATS_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <time.h>
+
+namespace sycophant {
+	enum struct counter_t : std::size_t {
+		pthread_creates,
+		pthread_exits,
+		maps_refreshes,
+		maps_refresh_ns,
+		mem_reads,
+		mem_read_bytes,
+		mem_writes,
+		mem_write_bytes,
+		handler_calls,
+		handler_ns,
+		gil_wait_ns,
+		count,
+	};
+
+	inline constexpr std::array<std::string_view, static_cast<std::size_t>(counter_t::count)> counter_names{{
+		"pthread_creates",
+		"pthread_exits",
+		"maps_refreshes",
+		"maps_refresh_ns",
+		"mem_reads",
+		"mem_read_bytes",
+		"mem_writes",
+		"mem_write_bytes",
+		"handler_calls",
+		"handler_ns",
+		"gil_wait_ns",
+	}};
+
+	[[nodiscard]]
+	inline std::uint64_t stats_clock_ns() noexcept {
+		timespec now{};
+		::clock_gettime(CLOCK_MONOTONIC, &now);
+		return (static_cast<std::uint64_t>(now.tv_sec) * 1000000000U) + static_cast<std::uint64_t>(now.tv_nsec);
+	}
+
+	/*
+		Every thread counts into a block of its own, each on its own cache lines, so counting never
+		bounces a line between cores. Blocks are handed to the next thread once their owner exits
+		and are never freed, `totals` just adds them all up.
+	*/
+	struct stats_t final {
+	private:
+		struct alignas(64) block_t final {
+			std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(counter_t::count)> values{};
+			std::atomic<bool> owned{true};
+			block_t* next{nullptr};
+		};
+
+		/* Lets go of the thread's block when it exits so the next new thread can have it */
+		struct owner_t final {
+			block_t* block{nullptr};
+			~owner_t() noexcept;
+		};
+
+		std::atomic<block_t*> _blocks{nullptr};
+
+		mutable std::mutex _lock{};
+		std::vector<std::pair<std::string, std::uint64_t>> _phases{};
+
+		[[nodiscard]]
+		block_t& block() noexcept;
+
+	public:
+		stats_t() noexcept = default;
+
+		stats_t(const stats_t&) = delete;
+		stats_t& operator=(const stats_t&) = delete;
+
+		/* Only ever written by the owning thread, so there's no need for a locked add */
+		void add(const counter_t stat, const std::uint64_t value = 1U) noexcept {
+			auto& counter{block().values[static_cast<std::size_t>(stat)]};
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		/* Startup phases are kept in the order they finished */
+		void phase(std::string name, std::uint64_t ns);
+
+		[[nodiscard]]
+		std::array<std::uint64_t, static_cast<std::size_t>(counter_t::count)> totals() const noexcept;
+		[[nodiscard]]
+		std::vector<std::pair<std::string, std::uint64_t>> phases() const;
+	};
+
+	/* Times its scope as a startup phase */
+	struct stats_phase_t final {
+	private:
+		stats_t& _stats;
+		std::string _name;
+		const std::uint64_t _start{stats_clock_ns()};
+
+	public:
+		stats_phase_t(stats_t& stats, std::string name) noexcept : _stats{stats}, _name{std::move(name)} { }
+		~stats_phase_t() noexcept {
+			try {
+				_stats.phase(std::move(_name), stats_clock_ns() - _start);
+			} catch (...) { }
+		}
+
+		stats_phase_t(const stats_phase_t&) = delete;
+		stats_phase_t& operator=(const stats_phase_t&) = delete;
+	};
+}
+
+#endif /* SYCOPHANT_STATS_HH */
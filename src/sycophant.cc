@@ -16,8 +16,12 @@
 #include <functional>
 #include <string_view>
 #include <variant>
+#include <tuple>
 #include <map>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #if !defined(_GNU_SOURCE)
 #define _GNU_SOURCE
@@ -27,6 +31,7 @@
 
 #include <pybind11/embed.h>
 #include <pybind11/stl.h>
+#include <marshal.h>
 
 #include <config.hh>
 #include <types.hh>
@@ -36,29 +41,103 @@
 #include <rwlock.hh>
 #include <fd.hh>
 #include <mmap.hh>
+#include <lazymap.hh>
 #include <elf.hh>
+#include <quiesce.hh>
+#include <hook.hh>
+#include <modules.hh>
+#include <symbols.hh>
+#include <threads.hh>
+#include <histogram.hh>
+#include <profiler.hh>
+#include <heap.hh>
+#include <io.hh>
+#include <locks.hh>
+#include <metrics.hh>
+#include <workers.hh>
+#include <bundle.hh>
+#include <channels.hh>
+#include <interpreters.hh>
+#include <stats.hh>
+#include <trace.hh>
 
 namespace fs = std::filesystem;
 namespace py = pybind11;
 
 namespace sycophant {
+	/*
+		SYCOPHANT_STARTUP picks when the interpreter comes up:
+			eager    - before the process runs any of its own code (the default)
+			deferred - on a background thread while the process initializes and runs main()
+
+		When deferred, main() only waits on the module named by SYCOPHANT_BEFORE_MAIN. It's imported
+		first so whatever it hooks is in place before main() runs, SYCOPHANT_MODULE is imported after
+		that and can land at any point. `sycophant.startup.main_started()` tells the two apart.
+	*/
+	struct startup_t final {
+		main_t main{nullptr};
+		bool deferred{false};
+		std::atomic<bool> main_started{false};
+
+		std::mutex lock{};
+		std::condition_variable cond{};
+		bool released{false};
+
+		void release() noexcept {
+			{
+				std::lock_guard<std::mutex> guard{lock};
+				released = true;
+			}
+			cond.notify_all();
+		}
+
+		void wait() {
+			std::unique_lock<std::mutex> guard{lock};
+			cond.wait(guard, [this]() { return released; });
+		}
+	};
+
 	struct sycophant_t final {
 		std::unique_ptr<libc_start_main_t> old_libc_start{nullptr};
 		std::unique_ptr<pthread_create_t> old_pthread_create{nullptr};
-		std::unique_ptr<pthread_join_t> old_pthread_join{nullptr};
+		std::unique_ptr<pthread_exit_t> old_pthread_exit{nullptr};
 
 		std::map<std::string_view, py::module> imports{};
 		std::map<std::string_view, std::string_view> envmap{};
 		rwlock_t<std::vector<mapentry_t>> procmaps{};
-		rwlock_t<std::vector<std::uint64_t>> threads{};
-
-		mmap_t self;
-		mmap_t trampoline{-1, 8192, prot_t::RWX, MAP_PRIVATE | MAP_ANONYMOUS};
+		stats_t stats{};
+		trace_t trace{};
+		thread_registry_t threads{};
+		module_registry_t modules{};
+		symbol_index_t symbols{modules};
+		profiler_t profiler{threads, modules, symbols};
+		heap_profiler_t heap{symbols};
+		io_profiler_t io{};
+		lock_profiler_t locks{symbols};
+		/* After everything it reads so its publisher is stopped first */
+		metrics_t metrics{};
+
+		lazy_map_t self{};
+		bundle_t bundle{};
+		channel_registry_t channels{};
+		interpreter_pool_t interpreters{channels, bundle};
+
+		startup_t startup{};
+		/* Declared last so a deferred startup is done with everything else before it goes away */
+		std::unique_ptr<worker_pool_t> starter{};
 	} state{};
 
+	/* The meta path finder that imports straight out of `state.bundle` */
+	struct bundle_importer_t final { };
+
 	[[nodiscard]]
 	std::size_t param_count(py::function& func) {
-		const auto res = state.imports["inspect"].attr("signature")(func);
+		/* inspect drags in a good chunk of the standard library, so only pay for it once a hook needs it */
+		auto inspect{state.imports.find("inspect")};
+		if (inspect == state.imports.end()) {
+			inspect = state.imports.insert({"inspect", py::module::import("inspect")}).first;
+		}
+		const auto res = inspect->second.attr("signature")(func);
 		return py::len(res.attr("parameters"));
 	}
 
@@ -94,13 +173,548 @@ namespace sycophant {
 		return fs::path(path);
 	}
 
+	void refresh_maps(std::vector<mapentry_t>& maps) noexcept {
+		const auto start{stats_clock_ns()};
+		build_maps(maps);
+		state.stats.add(counter_t::maps_refreshes);
+		state.stats.add(counter_t::maps_refresh_ns, stats_clock_ns() - start);
+	}
+
+	/* Everything counted so far plus the waits on the maps lock */
+	[[nodiscard]]
+	std::vector<std::pair<std::string_view, std::uint64_t>> stats_counters() {
+		const auto totals{state.stats.totals()};
+		std::vector<std::pair<std::string_view, std::uint64_t>> res{};
+		for (std::size_t idx{}; idx < totals.size(); ++idx) {
+			res.emplace_back(counter_names[idx], totals[idx]);
+		}
+		res.emplace_back("maps_lock_waits", state.procmaps.waits());
+		res.emplace_back("maps_lock_wait_ns", state.procmaps.wait_ns());
+		return res;
+	}
+
+	[[nodiscard]]
+	std::string stats_report() {
+		std::string res{"[sycophant] startup phases\n"};
+		const auto line{[&](const std::string_view name, const std::uint64_t value, const char* const unit) {
+			std::array<char, 96> buff{};
+			std::snprintf(buff.data(), buff.size(), "  %-24.*s %12lu%s\n", static_cast<int>(name.size()), name.data(), value, unit);
+			res.append(buff.data());
+		}};
+		for (const auto& [name, ns] : state.stats.phases()) {
+			line(name, ns / 1000U, " us");
+		}
+		res.append("[sycophant] counters\n");
+		for (const auto& [name, value] : stats_counters()) {
+			line(name, value, "");
+		}
+		return res;
+	}
+
+	/* SYCOPHANT_STATS dumps the report to stderr as the process exits */
+	void dump_stats() noexcept {
+		try {
+			std::fputs(stats_report().c_str(), stderr);
+		} catch (...) { }
+	}
+
+	/*
+		SYCOPHANT_INGEST picks when the loaded modules get indexed:
+			lazy       - the first time a query needs them (the default)
+			parallel   - all at once on worker threads, before the interpreter starts
+			background - the same, but startup and main() carry on while the workers run
+		SYCOPHANT_INGEST_THREADS caps the number of workers, it's one per CPU otherwise.
+	*/
+	void start_ingest() {
+		const auto mode = getenv("SYCOPHANT_INGEST");
+		if (!mode || mode->get() == "lazy") {
+			return;
+		}
+		std::size_t threads{};
+		if (const auto count = getenv("SYCOPHANT_INGEST_THREADS")) {
+			threads = static_cast<std::size_t>(std::max(toint_t<std::int32_t>(count->get()).from_dec(), 0));
+		}
+		state.symbols.ingest(threads, mode->get() != "background");
+	}
+
+	[[nodiscard]]
+	std::optional<trace_mode_t> trace_mode(const std::string_view mode) noexcept {
+		if (mode == "flight") {
+			return trace_mode_t::flight;
+		} else if (mode == "continuous") {
+			return trace_mode_t::continuous;
+		}
+		return std::nullopt;
+	}
+
+	/*
+		SYCOPHANT_TRACE starts tracing into the given file before the process runs any of its own code.
+		SYCOPHANT_TRACE_MODE is `flight` (the default) or `continuous`, and SYCOPHANT_TRACE_SIZE is how
+		many KiB of ring each thread gets.
+	*/
+	void start_trace() {
+		const auto path = getenv("SYCOPHANT_TRACE");
+		if (!path) {
+			return;
+		}
+		auto mode{trace_mode_t::flight};
+		if (const auto env = getenv("SYCOPHANT_TRACE_MODE")) {
+			mode = trace_mode(env->get()).value_or(trace_mode_t::flight);
+		}
+		auto size{trace_ring_default};
+		if (const auto env = getenv("SYCOPHANT_TRACE_SIZE")) {
+			size = static_cast<std::size_t>(std::max(toint_t<std::int32_t>(env->get()).from_dec(), 0)) * 1024U;
+		}
+		static_cast<void>(state.trace.start(fs::path{std::string{path->get()}}, mode, size));
+	}
+
+	/* SYCOPHANT_HEAP starts the heap profiler right away, sampling every that many bytes on average */
+	void start_heap() {
+		const auto interval = getenv("SYCOPHANT_HEAP");
+		if (!interval) {
+			return;
+		}
+		const auto bytes{toint_t<std::int64_t>(interval->get()).from_dec()};
+		static_cast<void>(state.heap.start(bytes > 0 ? static_cast<std::size_t>(bytes) : heap_interval_default));
+	}
+
+	/* Everything the metrics segment carries, run on its publishing thread so it mustn't go near Python */
+	void collect_metrics(metrics_t& metrics) {
+		for (const auto& [name, value] : stats_counters()) {
+			metrics.counter("stats." + std::string{name}, value);
+		}
+
+		histogram_t spawn_latency{};
+		histogram_t lifetime{};
+		for (const auto& routine : state.threads.routines()) {
+			spawn_latency.merge(routine.spawn_latency);
+			lifetime.merge(routine.lifetime);
+		}
+		metrics.histogram("threads.spawn_latency_ns", spawn_latency);
+		metrics.histogram("threads.lifetime_ns", lifetime);
+
+		metrics.counter("trace.dropped", state.trace.dropped());
+		metrics.counter("profiler.samples", state.profiler.stats().samples);
+
+		if (state.heap.running()) {
+			const auto heap{state.heap.stats()};
+			metrics.gauge("heap.live_bytes", heap.live_bytes);
+			metrics.gauge("heap.live_count", heap.live_count);
+			metrics.counter("heap.allocated_bytes", heap.allocated_bytes);
+			metrics.counter("heap.samples", heap.samples);
+		}
+
+		if (state.io.running()) {
+			std::array<histogram_t, static_cast<std::size_t>(io_op_t::count)> latency{};
+			std::array<histogram_t, static_cast<std::size_t>(io_op_t::count)> bytes{};
+			for (const auto& entry : state.io.snapshot().entries) {
+				latency[static_cast<std::size_t>(entry.op)].merge(entry.latency);
+				bytes[static_cast<std::size_t>(entry.op)].merge(entry.bytes);
+			}
+			for (std::size_t op{}; op < latency.size(); ++op) {
+				/* Calls that haven't been made yet don't get a record until they are */
+				if (latency[op].count == 0U) {
+					continue;
+				}
+				const auto prefix{"io." + std::string{io_op_names[op]}};
+				metrics.histogram(prefix + ".latency_ns", latency[op]);
+				if (bytes[op].count != 0U) {
+					metrics.histogram(prefix + ".bytes", bytes[op]);
+				}
+			}
+		}
+
+		if (state.locks.running()) {
+			const auto locks{state.locks.totals()};
+			metrics.counter("locks.waits", locks.waits);
+			metrics.counter("locks.wait_ns", locks.wait_ns);
+			metrics.counter("locks.holds", locks.holds);
+			metrics.counter("locks.hold_ns", locks.hold_ns);
+		}
+	}
+
+	[[nodiscard]]
+	std::string metrics_name(const std::string_view name) {
+		if (name.empty() || name == "1") {
+			return "sycophant." + std::to_string(::getpid());
+		}
+		return std::string{name};
+	}
+
+	/*
+		SYCOPHANT_METRICS publishes the counters and histograms into the shared memory segment it names,
+		`sycophant.<pid>` if it's set to 1 or nothing, for contrib/metrics/sycophant-metrics to read.
+		SYCOPHANT_METRICS_INTERVAL is how many milliseconds go between updates.
+	*/
+	void start_metrics() {
+		const auto name = getenv("SYCOPHANT_METRICS");
+		if (!name) {
+			return;
+		}
+		auto interval{metrics_interval_default};
+		if (const auto env = getenv("SYCOPHANT_METRICS_INTERVAL")) {
+			const auto ms{toint_t<std::int32_t>(env->get()).from_dec()};
+			interval = ms > 0 ? static_cast<std::uint32_t>(ms) : metrics_interval_default;
+		}
+		static_cast<void>(state.metrics.start(metrics_name(name->get()), metrics_capacity_default, interval, collect_metrics));
+	}
+
+	/* The GIL must be held */
+	void import_module(std::string_view key, const char* name) {
+		/* For the hook module this is how long its body took to run */
+		stats_phase_t phase{state.stats, std::string{"import "} + name};
+		state.imports.insert({key, py::module::import(name)});
+	}
+
+	/*
+		SYCOPHANT_BUNDLE points at a precompiled bundle that's searched before anything on sys.path,
+		either one built by contrib/bundle/sycophant-bundle or a plain zip/zipapp.
+	*/
+	void load_bundle() {
+		const auto path = getenv("SYCOPHANT_BUNDLE");
+		if (!path) {
+			return;
+		}
+		const fs::path bundle{std::string{path->get()}};
+		if (!state.bundle.open(bundle)) {
+			/* zipimport takes care of anything that isn't one of ours */
+			state.imports["sys"].attr("path").attr("insert")(0, bundle.c_str());
+			return;
+		}
+		if (state.bundle.pyc_magic() != static_cast<std::uint32_t>(PyImport_GetMagicNumber())) {
+			std::fprintf(stderr, "[sycophant] %s was built for a different version of Python, ignoring it\n", bundle.c_str());
+			return;
+		}
+		state.imports["sys"].attr("meta_path").attr("insert")(0, py::cast(bundle_importer_t{}));
+	}
+
+	void import_modules(const fs::path& user_modules) {
+		// Preload some modules
+		import_module("sys", "sys");
+
+		// Check to see if the user modules exist, and add them to the path if so
+		if (fs::exists(user_modules)) {
+			state.imports["sys"].attr("path").attr("insert")(0, user_modules.c_str());
+		}
+
+		load_bundle();
+	}
+
+	/*
+		SYCOPHANT_ISOLATED starts Python with its isolated config and without the site module, so
+		none of the PYTHON* variables, the user site directory or site-packages get looked at. The
+		hook module then has to come from a bundle, the user module directory or the standard library.
+	*/
+	void start_interpreter(const bool signals, const std::int32_t argc, char** const argv) {
+		stats_phase_t phase{state.stats, "interpreter"};
+		interpreter_pool_t::prepare();
+#if PY_VERSION_HEX >= 0x03080000
+		if (getenv("SYCOPHANT_ISOLATED")) {
+			PyConfig config{};
+			PyConfig_InitIsolatedConfig(&config);
+			config.site_import = 0;
+			config.install_signal_handlers = signals ? 1 : 0;
+			py::initialize_interpreter(&config, argc, argv, false);
+			return;
+		}
+#endif
+		py::initialize_interpreter(signals, argc, argv, true);
+	}
+
+	void import_hooks() {
+		// Load up the hook module if specified, otherwise the default one
+		if (auto mod = getenv("SYCOPHANT_MODULE")) {
+			import_module("sycophant", mod->get().data());
+		} else {
+			import_module("sycophant", "sycophant_hooks");
+		}
+	}
+
+	/*
+		Runs on the starter thread, which holds the interpreter's main thread state and lets go of
+		the GIL for good once it's done. Python's signal handlers are left out as it only ever runs
+		them on that thread. An import that fails is reported and the process carries on unhooked.
+	*/
+	void start_deferred(const fs::path& user_modules, std::int32_t argc, char** argv) noexcept {
+		start_interpreter(false, argc, argv);
+		try {
+			import_modules(user_modules);
+			if (auto early = getenv("SYCOPHANT_BEFORE_MAIN")) {
+				import_module("before_main", early->get().data());
+			}
+			state.startup.release();
+			import_hooks();
+		} catch (py::error_already_set& err) {
+			err.restore();
+			PyErr_Print();
+		} catch (const std::exception& err) {
+			std::fprintf(stderr, "[sycophant] deferred startup failed: %s\n", err.what());
+		}
+		state.startup.release();
+		static_cast<void>(PyEval_SaveThread());
+	}
+
+	std::int32_t start_main(std::int32_t argc, char** argv, char** envp) {
+		state.startup.wait();
+		state.startup.main_started.store(true, std::memory_order_release);
+		return state.startup.main(argc, argv, envp);
+	}
+
+	[[nodiscard]]
+	bool commit_patches(patch_batch_t& batch) {
+		auto maps = state.procmaps.write();
+		refresh_maps(*maps);
+
+		const auto res{batch.commit(*maps)};
+		batch.clear();
+		return res;
+	}
+
+	/* Anything other than a Python error escaping a handler is reported the way Python's own are */
+	void discard_unraisable(const char* const what, const py::handle func) noexcept {
+		PyErr_SetString(PyExc_RuntimeError, what);
+		PyErr_WriteUnraisable(func.ptr());
+	}
+
+	/* Wraps a Python callable so it can be run from the native hook dispatch on any thread */
+	[[nodiscard]]
+	hook_t::handler_t make_handler(py::function func) {
+		const auto nargs{std::min(param_count(func), hook_max_args)};
+
+		return [func = std::move(func), nargs](hook_t&, hook_regs_t& regs) {
+			/* The interpreter might already be gone if we're called late into process teardown */
+			if (!Py_IsInitialized()) {
+				return;
+			}
+
+			const auto start{stats_clock_ns()};
+			py::gil_scoped_acquire gil{};
+			const auto acquired{stats_clock_ns()};
+			state.stats.add(counter_t::gil_wait_ns, acquired - start);
+			/* Nothing can be let out, the hook dispatch is noexcept */
+			try {
+				py::tuple args{nargs};
+				for (std::size_t idx{}; idx < nargs; ++idx) {
+					args[idx] = py::int_(regs.arg(idx));
+				}
+				func(*args);
+			} catch (py::error_already_set& e) {
+				e.discard_as_unraisable(func);
+			} catch (const std::exception& e) {
+				discard_unraisable(e.what(), func);
+			} catch (...) {
+				discard_unraisable("unknown exception in hook handler", func);
+			}
+			state.stats.add(counter_t::handler_calls);
+			state.stats.add(counter_t::handler_ns, stats_clock_ns() - acquired);
+		};
+	}
+
+	/* Exit handlers are given the raw return value and the number of cycles spent in the call */
+	[[nodiscard]]
+	hook_t::exit_handler_t make_exit_handler(py::function func) {
+		return [func = std::move(func)](hook_t&, hook_ret_t& ret) {
+			if (!Py_IsInitialized()) {
+				return;
+			}
+
+			const auto start{stats_clock_ns()};
+			py::gil_scoped_acquire gil{};
+			const auto acquired{stats_clock_ns()};
+			state.stats.add(counter_t::gil_wait_ns, acquired - start);
+			try {
+				func(ret.rax, ret.cycles);
+			} catch (py::error_already_set& e) {
+				e.discard_as_unraisable(func);
+			} catch (const std::exception& e) {
+				discard_unraisable(e.what(), func);
+			} catch (...) {
+				discard_unraisable("unknown exception in hook exit handler", func);
+			}
+			state.stats.add(counter_t::handler_calls);
+			state.stats.add(counter_t::handler_ns, stats_clock_ns() - acquired);
+		};
+	}
+
+	/*
+		Starts the isolated interpreter pool the first time a hook wants it, SYCOPHANT_INTERPRETERS
+		sets how many (one per CPU otherwise). They get the main interpreter's sys.path as it is now.
+	*/
+	void start_interpreters(std::size_t count) {
+		if (!interpreter_pool_t::supported()) {
+			throw std::runtime_error("isolated handlers need Python 3.12 or newer");
+		}
+		if (count == 0U) {
+			if (const auto env = getenv("SYCOPHANT_INTERPRETERS")) {
+				count = static_cast<std::size_t>(std::max(toint_t<std::int32_t>(env->get()).from_dec(), 0));
+			}
+		}
+		std::vector<std::string> path{};
+		for (const auto& entry : py::module::import("sys").attr("path")) {
+			if (py::isinstance<py::str>(entry)) {
+				path.push_back(entry.cast<std::string>());
+			}
+		}
+		if (state.interpreters.start(count, path) == 0U) {
+			throw std::runtime_error("unable to start any isolated interpreters");
+		}
+	}
+
+#if defined(Py_GIL_DISABLED)
+	/* Free-threaded builds don't serialize handlers to begin with, so "module:function" is just imported here */
+	[[nodiscard]]
+	py::function import_handler(const std::string& spec) {
+		const auto split{spec.find(':')};
+		if (split == std::string::npos) {
+			throw std::invalid_argument("isolated handlers are named 'module:function'");
+		}
+		return py::module::import(spec.substr(0, split).c_str()).attr(spec.substr(split + 1U).c_str());
+	}
+#endif
+
+	/* A handler is either a callable run in the main interpreter or a "module:function" run in the isolated pool */
+	[[nodiscard]]
+	hook_t::handler_t make_entry_handler(py::object handler) {
+		if (!py::isinstance<py::str>(handler)) {
+			return make_handler(handler.cast<py::function>());
+		}
+#if defined(Py_GIL_DISABLED)
+		return make_handler(import_handler(handler.cast<std::string>()));
+#else
+		if (state.interpreters.size() == 0U) {
+			start_interpreters(0U);
+		}
+		return [spec = handler.cast<std::string>()](hook_t&, hook_regs_t& regs) {
+			if (!Py_IsInitialized()) {
+				return;
+			}
+			std::array<std::uint64_t, hook_max_args> args{};
+			for (std::size_t idx{}; idx < args.size(); ++idx) {
+				args[idx] = regs.arg(idx);
+			}
+			state.interpreters.call(spec, args.data(), args.size());
+		};
+#endif
+	}
+
+	[[nodiscard]]
+	hook_t::exit_handler_t make_return_handler(py::object handler) {
+		if (!py::isinstance<py::str>(handler)) {
+			return make_exit_handler(handler.cast<py::function>());
+		}
+#if defined(Py_GIL_DISABLED)
+		return make_exit_handler(import_handler(handler.cast<std::string>()));
+#else
+		if (state.interpreters.size() == 0U) {
+			start_interpreters(0U);
+		}
+		return [spec = handler.cast<std::string>()](hook_t&, hook_ret_t& ret) {
+			if (!Py_IsInitialized()) {
+				return;
+			}
+			const std::array<std::uint64_t, 2> args{{ret.rax, ret.cycles}};
+			state.interpreters.call(spec, args.data(), args.size());
+		};
+#endif
+	}
 
+	hook_t& install_hook(
+		hook_batch_t& batch, std::uintptr_t addr, std::optional<py::object> on_entry,
+		std::optional<py::object> on_exit, bool nested
+	) {
+		if (!on_entry && !on_exit) {
+			throw std::invalid_argument("a hook needs at least an entry or exit handler");
+		}
+
+		auto entry_handler{on_entry ? make_entry_handler(std::move(*on_entry)) : hook_t::handler_t{}};
+		auto exit_handler{on_exit ? make_return_handler(std::move(*on_exit)) : hook_t::exit_handler_t{}};
+
+		/* A hook with both handlers is traced as a span, otherwise each call is an instant */
+		const auto symbol{state.symbols.symbolize(addr)};
+		const auto name{state.trace.intern(symbol.function.empty() ? symbol.str() : symbol.function)};
+		if (entry_handler) {
+			const auto event{exit_handler ? trace_event_t::begin : trace_event_t::instant};
+			entry_handler = [name, event, handler = std::move(entry_handler)](hook_t& hook, hook_regs_t& regs) {
+				state.trace.record(event, name, regs.arg(0));
+				handler(hook, regs);
+			};
+		}
+		if (exit_handler) {
+			const auto event{entry_handler ? trace_event_t::end : trace_event_t::instant};
+			exit_handler = [name, event, handler = std::move(exit_handler)](hook_t& hook, hook_ret_t& ret) {
+				handler(hook, ret);
+				state.trace.record(event, name, ret.rax);
+			};
+		}
+		auto maps = state.procmaps.write();
+		refresh_maps(*maps);
+
+		return batch.install(addr, std::move(entry_handler), std::move(exit_handler), nested, *maps);
+	}
+
+	/* Everything handed out by an elf_t points into it, so the Python side has to keep it alive */
+	template<typename range_t>
+	void elf_extend(py::list& res, const py::object& owner, const range_t& range) {
+		for (auto&& item : range) {
+			if constexpr (std::is_lvalue_reference_v<decltype(*std::begin(range))>) {
+				res.append(py::cast(&item, py::return_value_policy::reference_internal, owner));
+			} else {
+				auto obj{py::cast(item, py::return_value_policy::copy)};
+				/* The callback holds `owner` until `obj` is collected, then drops the weakref and with it `owner` */
+				const py::cpp_function release{[owner](const py::handle ref) { ref.dec_ref(); }};
+				static_cast<void>(py::weakref(obj, release).release());
+				res.append(obj);
+			}
+		}
+	}
+
+	template<typename range_t>
+	[[nodiscard]]
+	py::list elf_list(const py::object& owner, const range_t& range) {
+		py::list res{};
+		elf_extend(res, owner, range);
+		return res;
+	}
+
+	[[nodiscard]]
+	bool commit_hooks(hook_batch_t& batch) {
+		auto maps = state.procmaps.write();
+		refresh_maps(*maps);
+
+		const auto res{batch.commit(*maps)};
+		batch.clear();
+		return res;
+	}
 }
 
 PYBIND11_EMBEDDED_MODULE(sycophant, m) {
 	m.attr("__version__") = sycophant::config::version;
 	m.attr("__doc__") = "Sycophant Python API";
 
+	py::class_<sycophant::histogram_t>(m, "histogram")
+		.def_readonly("count", &sycophant::histogram_t::count)
+		.def_readonly("sum",   &sycophant::histogram_t::sum  )
+		.def_property_readonly("min", [](const sycophant::histogram_t& hist) {
+			return hist.count != 0U ? hist.min : 0U;
+		})
+		.def_readonly("max",   &sycophant::histogram_t::max  )
+		.def("mean", &sycophant::histogram_t::mean)
+		.def("percentile", &sycophant::histogram_t::percentile, py::arg("quantile"))
+		.def("bins", [](const sycophant::histogram_t& hist) {
+			std::vector<std::tuple<std::uint64_t, std::uint64_t, std::uint64_t>> res{};
+			for (const auto& bin : hist.bins()) {
+				res.emplace_back(bin.lower, bin.upper, bin.count);
+			}
+			return res;
+		})
+		.def("__len__", [](const sycophant::histogram_t& hist) {
+			return hist.count;
+		})
+		.def("__repr__", [](const sycophant::histogram_t& hist) {
+			return "<histogram count=" + std::to_string(hist.count) + " p50=" + std::to_string(hist.percentile(0.5)) +
+				" p99=" + std::to_string(hist.percentile(0.99)) + " max=" + std::to_string(hist.max) + ">";
+		});
+
 	auto proc = m.def_submodule("proc", "interact with the running process");
 
 
@@ -115,6 +729,8 @@ PYBIND11_EMBEDDED_MODULE(sycophant, m) {
 			mem.resize(to_read);
 			std::memcpy(mem.data(), reinterpret_cast<const void*>(addr), to_read);
 		}
+		sycophant::state.stats.add(sycophant::counter_t::mem_reads);
+		sycophant::state.stats.add(sycophant::counter_t::mem_read_bytes, mem.size());
 
 		return mem;
 	});
@@ -126,17 +742,883 @@ PYBIND11_EMBEDDED_MODULE(sycophant, m) {
 			const auto to_write{std::min(buff.size(), (map->get()).size)};
 
 			std::memcpy(reinterpret_cast<void*>(addr), buff.data(), to_write);
+			sycophant::state.stats.add(sycophant::counter_t::mem_writes);
+			sycophant::state.stats.add(sycophant::counter_t::mem_write_bytes, to_write);
 			return to_write;
 		}
 		return 0U;
 	});
 
+	proc_mem.def("patch", [](std::uintptr_t addr, std::vector<std::uint8_t> buff) {
+		sycophant::patch_batch_t batch{};
+		batch.add(addr, std::move(buff));
+		return sycophant::commit_patches(batch);
+	});
+
+	py::class_<sycophant::patch_batch_t>(proc_mem, "patch_batch")
+		.def(py::init<>())
+		.def("add", [](sycophant::patch_batch_t& batch, std::uintptr_t addr, std::vector<std::uint8_t> buff) {
+			batch.add(addr, std::move(buff));
+		})
+		.def("commit", [](sycophant::patch_batch_t& batch) {
+			return sycophant::commit_patches(batch);
+		})
+		.def("__len__", &sycophant::patch_batch_t::size)
+		.def("__enter__", [](sycophant::patch_batch_t& batch) -> sycophant::patch_batch_t& {
+			return batch;
+		}, py::return_value_policy::reference)
+		.def("__exit__", [](sycophant::patch_batch_t& batch, py::object exc_type, py::object, py::object) {
+			if (exc_type.is_none()) {
+				if (!sycophant::commit_patches(batch)) {
+					throw std::runtime_error("unable to apply patch batch");
+				}
+			} else {
+				batch.clear();
+			}
+			return false;
+		});
+
+	auto hooks = m.def_submodule("hooks", "inline function hooks");
+
+	py::class_<sycophant::hook_t>(hooks, "hook")
+		.def_readonly("address",  &sycophant::hook_t::target  )
+		.def_readonly("original", &sycophant::hook_t::original)
+		.def_property_readonly("installed", [](const sycophant::hook_t& hook) {
+			return hook.installed.load();
+		})
+		.def_property("nested", [](const sycophant::hook_t& hook) {
+			return hook.nested.load();
+		}, [](sycophant::hook_t& hook, bool nested) {
+			hook.nested.store(nested);
+		})
+		.def_property_readonly("calls", [](const sycophant::hook_t& hook) {
+			return hook.calls.load();
+		})
+		.def_property_readonly("bypassed", [](const sycophant::hook_t& hook) {
+			return hook.bypassed.load();
+		})
+		.def_property_readonly("dropped", [](const sycophant::hook_t& hook) {
+			return hook.dropped.load();
+		})
+		.def("remove", [](sycophant::hook_t& hook) {
+			sycophant::hook_batch_t batch{};
+			batch.remove(hook);
+			return sycophant::commit_hooks(batch);
+		})
+		.def("__repr__", [](const sycophant::hook_t& hook) {
+			const auto addr{sycophant::fromint_t(hook.target).to_hex()};
+			return "<hook " + addr + (hook.installed.load() ? " installed>" : ">");
+		});
+
+	hooks.def("install", [](
+		std::uintptr_t addr, std::optional<py::object> handler, bool nested, std::optional<py::object> on_exit
+	) -> sycophant::hook_t& {
+		sycophant::hook_batch_t batch{};
+		auto& hook = sycophant::install_hook(batch, addr, std::move(handler), std::move(on_exit), nested);
+		if (!sycophant::commit_hooks(batch)) {
+			throw std::runtime_error("unable to install hook");
+		}
+		return hook;
+	}, py::arg("address"), py::arg("handler") = py::none(), py::arg("nested") = false, py::arg("on_exit") = py::none(),
+		py::return_value_policy::reference);
+
+	hooks.def("all", []() {
+		return sycophant::hooks();
+	}, py::return_value_policy::reference);
+
+	hooks.def("in_handler", &sycophant::in_hook_handler);
+
+	py::class_<sycophant::hook_batch_t>(hooks, "batch")
+		.def(py::init<>())
+		.def("install", [](
+			sycophant::hook_batch_t& batch, std::uintptr_t addr, std::optional<py::object> handler, bool nested,
+			std::optional<py::object> on_exit
+		) -> sycophant::hook_t& {
+			return sycophant::install_hook(batch, addr, std::move(handler), std::move(on_exit), nested);
+		}, py::arg("address"), py::arg("handler") = py::none(), py::arg("nested") = false, py::arg("on_exit") = py::none(),
+			py::return_value_policy::reference)
+		.def("remove", &sycophant::hook_batch_t::remove)
+		.def("commit", [](sycophant::hook_batch_t& batch) {
+			return sycophant::commit_hooks(batch);
+		})
+		.def("__len__", &sycophant::hook_batch_t::size)
+		.def("__enter__", [](sycophant::hook_batch_t& batch) -> sycophant::hook_batch_t& {
+			return batch;
+		}, py::return_value_policy::reference)
+		.def("__exit__", [](sycophant::hook_batch_t& batch, py::object exc_type, py::object, py::object) {
+			if (exc_type.is_none()) {
+				if (!sycophant::commit_hooks(batch)) {
+					throw std::runtime_error("unable to apply hook batch");
+				}
+			} else {
+				batch.clear();
+			}
+			return false;
+		});
+
+	auto elf_mod = m.def_submodule("elf", "ELF image introspection");
+
+	py::class_<Elf64_Phdr>(elf_mod, "program_header")
+		.def_readonly("type",   &Elf64_Phdr::p_type  )
+		.def_readonly("flags",  &Elf64_Phdr::p_flags )
+		.def_readonly("offset", &Elf64_Phdr::p_offset)
+		.def_readonly("vaddr",  &Elf64_Phdr::p_vaddr )
+		.def_readonly("paddr",  &Elf64_Phdr::p_paddr )
+		.def_readonly("filesz", &Elf64_Phdr::p_filesz)
+		.def_readonly("memsz",  &Elf64_Phdr::p_memsz )
+		.def_readonly("align",  &Elf64_Phdr::p_align );
+
+	py::class_<Elf64_Shdr>(elf_mod, "section")
+		.def_readonly("type",      &Elf64_Shdr::sh_type     )
+		.def_readonly("flags",     &Elf64_Shdr::sh_flags    )
+		.def_readonly("addr",      &Elf64_Shdr::sh_addr     )
+		.def_readonly("offset",    &Elf64_Shdr::sh_offset   )
+		.def_readonly("size",      &Elf64_Shdr::sh_size     )
+		.def_readonly("link",      &Elf64_Shdr::sh_link     )
+		.def_readonly("info",      &Elf64_Shdr::sh_info     )
+		.def_readonly("addralign", &Elf64_Shdr::sh_addralign)
+		.def_readonly("entsize",   &Elf64_Shdr::sh_entsize  );
+
+	py::class_<Elf64_Dyn>(elf_mod, "dynamic_entry")
+		.def_readonly("tag", &Elf64_Dyn::d_tag)
+		.def_property_readonly("value", [](const Elf64_Dyn& dyn) {
+			return dyn.d_un.d_val;
+		});
+
+	py::class_<sycophant::elf_sym_t>(elf_mod, "symbol")
+		.def_readonly("name", &sycophant::elf_sym_t::name)
+		.def_property_readonly("value", [](const sycophant::elf_sym_t& sym) {
+			return sym.sym->st_value;
+		})
+		.def_property_readonly("size", [](const sycophant::elf_sym_t& sym) {
+			return sym.sym->st_size;
+		})
+		.def_property_readonly("section_index", [](const sycophant::elf_sym_t& sym) {
+			return sym.sym->st_shndx;
+		})
+		.def_property_readonly("type", &sycophant::elf_sym_t::type)
+		.def_property_readonly("bind", &sycophant::elf_sym_t::bind)
+		.def_property_readonly("defined", &sycophant::elf_sym_t::defined);
+
+	py::class_<sycophant::elf_note_t>(elf_mod, "note")
+		.def_readonly("type", &sycophant::elf_note_t::type)
+		.def_readonly("name", &sycophant::elf_note_t::name)
+		.def_property_readonly("desc", [](const sycophant::elf_note_t& note) {
+			return py::bytes(reinterpret_cast<const char*>(note.desc.data), note.desc.size);
+		});
+
+	py::class_<sycophant::elf_reloc_t>(elf_mod, "relocation")
+		.def_readonly("offset", &sycophant::elf_reloc_t::offset)
+		.def_readonly("type",   &sycophant::elf_reloc_t::type  )
+		.def_readonly("symbol", &sycophant::elf_reloc_t::sym   )
+		.def_readonly("addend", &sycophant::elf_reloc_t::addend);
+
+	py::class_<sycophant::elf_t>(elf_mod, "elf")
+		.def(py::init([](const std::string& path) {
+			return sycophant::elf_t{fs::path{path}};
+		}))
+		.def_property_readonly("valid", &sycophant::elf_t::valid)
+		.def_property_readonly("type", [](const sycophant::elf_t& elf) -> std::optional<std::uint16_t> {
+			if (!elf.valid()) {
+				return std::nullopt;
+			}
+			return elf.header().e_type;
+		})
+		.def_property_readonly("machine", [](const sycophant::elf_t& elf) -> std::optional<std::uint16_t> {
+			if (!elf.valid()) {
+				return std::nullopt;
+			}
+			return elf.header().e_machine;
+		})
+		.def_property_readonly("entry", [](const sycophant::elf_t& elf) -> std::optional<std::uint64_t> {
+			if (!elf.valid()) {
+				return std::nullopt;
+			}
+			return elf.header().e_entry;
+		})
+		.def_property_readonly("build_id", [](const sycophant::elf_t& elf) -> std::optional<py::bytes> {
+			if (const auto id = elf.build_id()) {
+				return py::bytes(reinterpret_cast<const char*>(id->data), id->size);
+			}
+			return std::nullopt;
+		})
+		.def("program_headers", [](const py::object& self) {
+			return sycophant::elf_list(self, self.cast<const sycophant::elf_t&>().program_headers());
+		})
+		.def("sections", [](const py::object& self) {
+			return sycophant::elf_list(self, self.cast<const sycophant::elf_t&>().sections());
+		})
+		.def("section", [](const sycophant::elf_t& elf, std::string_view name) {
+			return elf.section(name);
+		}, py::return_value_policy::reference_internal)
+		.def("section_name", &sycophant::elf_t::section_name)
+		.def("dynamic", [](const py::object& self) {
+			return sycophant::elf_list(self, self.cast<const sycophant::elf_t&>().dynamic());
+		})
+		.def("symbols", [](const py::object& self) {
+			return sycophant::elf_list(self, self.cast<const sycophant::elf_t&>().symbols());
+		})
+		.def("dynamic_symbols", [](const py::object& self) {
+			return sycophant::elf_list(self, self.cast<const sycophant::elf_t&>().dynamic_symbols());
+		})
+		.def("notes", [](const py::object& self) {
+			const auto& elf = self.cast<const sycophant::elf_t&>();
+			py::list res{};
+			for (const auto& phdr : elf.program_headers()) {
+				sycophant::elf_extend(res, self, elf.notes(phdr));
+			}
+			/* Relocatable objects only have note sections */
+			if (py::len(res) == 0U) {
+				for (const auto& sect : elf.sections()) {
+					sycophant::elf_extend(res, self, elf.notes(sect));
+				}
+			}
+			return res;
+		})
+		.def("relocations", [](const sycophant::elf_t& elf) {
+			std::vector<sycophant::elf_reloc_t> res{};
+			for (const auto& sect : elf.sections()) {
+				const auto relocs{elf.relocations(sect)};
+				res.insert(res.end(), relocs.begin(), relocs.end());
+			}
+			return res;
+		})
+		.def("vaddr_to_offset", &sycophant::elf_t::vaddr_to_offset);
+
+	elf_mod.def("self", []() {
+		return sycophant::elf_t{sycophant::state.self};
+	});
+
+	elf_mod.def("trim_self", []() {
+		sycophant::state.self.trim();
+	});
+
+	elf_mod.def("from_map", [](const sycophant::mapentry_t& entry) -> std::optional<sycophant::elf_t> {
+		if ((entry.flags & sycophant::mapentry_flags_t::BACKED) != sycophant::mapentry_flags_t::BACKED) {
+			return std::nullopt;
+		}
+		return std::make_optional<sycophant::elf_t>(fs::path{entry.path});
+	});
+
+	auto modules = m.def_submodule("modules", "modules mapped by the dynamic loader");
+
+	py::class_<sycophant::module_segment_t>(modules, "segment")
+		.def_readonly("start",  &sycophant::module_segment_t::start )
+		.def_readonly("end",    &sycophant::module_segment_t::end   )
+		.def_readonly("offset", &sycophant::module_segment_t::offset)
+		.def_readonly("flags",  &sycophant::module_segment_t::flags );
+
+	py::class_<sycophant::module_t, std::shared_ptr<sycophant::module_t>>(modules, "module")
+		.def_readonly("name",      &sycophant::module_t::name     )
+		.def_readonly("path",      &sycophant::module_t::path     )
+		.def_readonly("bias",      &sycophant::module_t::bias     )
+		.def_readonly("start",     &sycophant::module_t::start    )
+		.def_readonly("end",       &sycophant::module_t::end      )
+		.def_readonly("segments",  &sycophant::module_t::segments )
+		.def_readonly("tls_modid", &sycophant::module_t::tls_modid)
+		.def_property_readonly("dynamic", [](const sycophant::module_t& mod) {
+			return reinterpret_cast<std::uintptr_t>(mod.dynamic);
+		})
+		.def_property_readonly("build_id", [](const sycophant::module_t& mod) -> std::optional<py::bytes> {
+			if (mod.build_id.empty()) {
+				return std::nullopt;
+			}
+			return py::bytes(reinterpret_cast<const char*>(mod.build_id.data()), mod.build_id.size());
+		})
+		.def("contains", &sycophant::module_t::contains)
+		.def("__repr__", [](const sycophant::module_t& mod) {
+			return "<module '" + (mod.path.empty() ? mod.name : mod.path) + "'>";
+		});
+
+	modules.def("all", []() {
+		std::vector<std::shared_ptr<sycophant::module_t>> res{};
+		for (const auto& mod : sycophant::state.modules.modules()) {
+			res.push_back(std::const_pointer_cast<sycophant::module_t>(mod));
+		}
+		return res;
+	});
+
+	modules.def("refresh", []() {
+		return sycophant::state.modules.refresh();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	modules.def("resolve", [](std::uintptr_t addr) -> std::optional<std::tuple<std::shared_ptr<sycophant::module_t>, std::uintptr_t>> {
+		if (auto res = sycophant::state.modules.resolve(addr)) {
+			return std::make_tuple(std::const_pointer_cast<sycophant::module_t>(res->module), res->offset);
+		}
+		return std::nullopt;
+	}, py::arg("address"));
+
+	modules.def("find", [](std::string_view name) {
+		return std::const_pointer_cast<sycophant::module_t>(sycophant::state.modules.find(name));
+	}, py::arg("name"));
+
+	auto symbols = m.def_submodule("symbols", "process wide symbol lookups");
+
+	symbols.def("lookup", [](const std::string& name) {
+		return sycophant::state.symbols.lookup(name);
+	}, py::arg("name"), py::call_guard<py::gil_scoped_release>());
+
+	symbols.def("lookup_many", [](const std::vector<std::string>& names) {
+		std::vector<std::vector<std::uintptr_t>> addrs{};
+		{
+			py::gil_scoped_release nogil{};
+			addrs = sycophant::state.symbols.lookup_many(names);
+		}
+
+		py::dict res{};
+		for (std::size_t idx{}; idx < names.size(); ++idx) {
+			res[py::str(names[idx])] = py::cast(addrs[idx]);
+		}
+		return res;
+	}, py::arg("names"));
+
+	symbols.def("refresh", []() {
+		sycophant::state.symbols.refresh();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	py::class_<sycophant::symbolized_t>(symbols, "symbolized")
+		.def_readonly("address",  &sycophant::symbolized_t::address )
+		.def_readonly("function", &sycophant::symbolized_t::function)
+		.def_readonly("offset",   &sycophant::symbolized_t::offset  )
+		.def_readonly("file",     &sycophant::symbolized_t::file    )
+		.def_readonly("line",     &sycophant::symbolized_t::line    )
+		.def_property_readonly("module", [](const sycophant::symbolized_t& sym) {
+			return std::const_pointer_cast<sycophant::module_t>(sym.module);
+		})
+		.def("__str__", &sycophant::symbolized_t::str)
+		.def("__repr__", [](const sycophant::symbolized_t& sym) {
+			return "<symbolized '" + sym.str() + "'>";
+		});
+
+	symbols.def("symbolize", [](std::uintptr_t addr) {
+		return sycophant::state.symbols.symbolize(addr);
+	}, py::arg("address"), py::call_guard<py::gil_scoped_release>());
+
+	symbols.def("symbolize_many", [](const std::vector<std::uintptr_t>& addrs) {
+		return sycophant::state.symbols.symbolize_many(addrs);
+	}, py::arg("addresses"), py::call_guard<py::gil_scoped_release>());
+
+	symbols.def("function_bounds", [](std::uintptr_t addr) {
+		return sycophant::state.symbols.function_bounds(addr);
+	}, py::arg("address"), py::call_guard<py::gil_scoped_release>());
+
+	symbols.def("modules", []() {
+		return sycophant::state.symbols.modules();
+	});
+
+	symbols.def("ingest", [](std::size_t threads, bool wait) {
+		sycophant::state.symbols.ingest(threads, wait);
+	}, py::arg("threads") = 0, py::arg("wait") = true, py::call_guard<py::gil_scoped_release>());
+
+	symbols.def("wait", []() {
+		sycophant::state.symbols.join_ingest();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	symbols.def("pending", []() {
+		return sycophant::state.symbols.pending();
+	});
+
+	auto profiler = m.def_submodule("profiler", "sampling CPU profiler");
+
+	py::class_<sycophant::profile_stats_t>(profiler, "profile_stats")
+		.def_readonly("samples", &sycophant::profile_stats_t::samples)
+		.def_readonly("dropped", &sycophant::profile_stats_t::dropped)
+		.def_readonly("threads", &sycophant::profile_stats_t::threads)
+		.def_readonly("nodes",   &sycophant::profile_stats_t::nodes  )
+		.def("__repr__", [](const sycophant::profile_stats_t& stats) {
+			return "<profile_stats samples=" + std::to_string(stats.samples) + " dropped=" + std::to_string(stats.dropped) + ">";
+		});
+
+	profiler.def("start", [](std::uint32_t hz) {
+		return sycophant::state.profiler.start(hz);
+	}, py::arg("hz") = 99, py::call_guard<py::gil_scoped_release>());
+
+	profiler.def("stop", []() {
+		sycophant::state.profiler.stop();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	profiler.def("clear", []() {
+		sycophant::state.profiler.clear();
+	});
+
+	profiler.def("running", []() {
+		return sycophant::state.profiler.running();
+	});
+
+	profiler.def("stats", []() {
+		return sycophant::state.profiler.stats();
+	});
+
+	profiler.def("folded", []() {
+		return sycophant::state.profiler.folded();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	auto heap = m.def_submodule("heap", "sampling heap profiler");
+
+	py::class_<sycophant::heap_stats_t>(heap, "heap_stats")
+		.def_readonly("samples",         &sycophant::heap_stats_t::samples        )
+		.def_readonly("live_count",      &sycophant::heap_stats_t::live_count     )
+		.def_readonly("live_bytes",      &sycophant::heap_stats_t::live_bytes     )
+		.def_readonly("allocated_count", &sycophant::heap_stats_t::allocated_count)
+		.def_readonly("allocated_bytes", &sycophant::heap_stats_t::allocated_bytes)
+		.def_readonly("elapsed",         &sycophant::heap_stats_t::elapsed        )
+		.def_readonly("sites",           &sycophant::heap_stats_t::sites          )
+		.def("rate", [](const sycophant::heap_stats_t& stats) {
+			return stats.elapsed != 0U ? static_cast<double>(stats.allocated_bytes) * 1e9 / static_cast<double>(stats.elapsed) : 0.0;
+		})
+		.def("__repr__", [](const sycophant::heap_stats_t& stats) {
+			return "<heap_stats samples=" + std::to_string(stats.samples) + " live_bytes=" + std::to_string(stats.live_bytes) +
+				" allocated_bytes=" + std::to_string(stats.allocated_bytes) + ">";
+		});
+
+	heap.def("start", [](std::size_t interval) {
+		return sycophant::state.heap.start(interval);
+	}, py::arg("interval") = sycophant::heap_interval_default, py::call_guard<py::gil_scoped_release>());
+
+	heap.def("stop", []() {
+		sycophant::state.heap.stop();
+	});
+
+	heap.def("clear", []() {
+		sycophant::state.heap.clear();
+	});
+
+	heap.def("running", []() {
+		return sycophant::state.heap.running();
+	});
+
+	heap.def("stats", []() {
+		return sycophant::state.heap.stats();
+	});
+
+	heap.def("live", []() {
+		return sycophant::state.heap.live();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	heap.def("allocated", []() {
+		return sycophant::state.heap.allocated();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	auto io = m.def_submodule("io", "latency and size histograms for I/O calls");
+
+	py::class_<sycophant::io_entry_t>(io, "io_entry")
+		.def_readonly("fd",         &sycophant::io_entry_t::fd        )
+		.def_readonly("generation", &sycophant::io_entry_t::generation)
+		.def_property_readonly("op", [](const sycophant::io_entry_t& entry) {
+			return sycophant::io_op_names[static_cast<std::size_t>(entry.op)];
+		})
+		.def_property_readonly("path", [](const sycophant::io_entry_t& entry) -> std::optional<std::string> {
+			if (entry.path.empty()) {
+				return std::nullopt;
+			}
+			return entry.path;
+		})
+		.def_readonly("latency",    &sycophant::io_entry_t::latency   )
+		.def_readonly("bytes",      &sycophant::io_entry_t::bytes     )
+		.def("__repr__", [](const sycophant::io_entry_t& entry) {
+			const auto name{entry.path.empty() ? "fd " + std::to_string(entry.fd) : entry.path};
+			return "<io_entry " + std::string{sycophant::io_op_names[static_cast<std::size_t>(entry.op)]} + " " + name +
+				" count=" + std::to_string(entry.latency.count) + " p50=" + std::to_string(entry.latency.percentile(0.5)) + "ns>";
+		});
+
+	py::class_<sycophant::io_snapshot_t>(io, "io_snapshot")
+		.def_readonly("taken",   &sycophant::io_snapshot_t::taken  )
+		.def_readonly("entries", &sycophant::io_snapshot_t::entries)
+		.def("diff", &sycophant::io_snapshot_t::diff, py::arg("before"), py::call_guard<py::gil_scoped_release>())
+		.def("by_path", &sycophant::io_snapshot_t::by_path, py::call_guard<py::gil_scoped_release>())
+		.def("__len__", [](const sycophant::io_snapshot_t& snapshot) {
+			return snapshot.entries.size();
+		})
+		.def("__repr__", [](const sycophant::io_snapshot_t& snapshot) {
+			return "<io_snapshot entries=" + std::to_string(snapshot.entries.size()) + ">";
+		});
+
+	io.def("start", []() {
+		sycophant::state.io.start();
+	});
+
+	io.def("stop", []() {
+		sycophant::state.io.stop();
+	});
+
+	io.def("reset", []() {
+		sycophant::state.io.reset();
+	});
+
+	io.def("running", []() {
+		return sycophant::state.io.running();
+	});
+
+	io.def("dropped", []() {
+		return sycophant::state.io.dropped();
+	});
+
+	io.def("snapshot", []() {
+		return sycophant::state.io.snapshot();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	auto locks = m.def_submodule("locks", "pthread lock contention profiler");
+
+	py::class_<sycophant::lock_counts_t>(locks, "lock_counts")
+		.def_readonly("waits",       &sycophant::lock_counts_t::waits      )
+		.def_readonly("wait_ns",     &sycophant::lock_counts_t::wait_ns    )
+		.def_readonly("max_wait_ns", &sycophant::lock_counts_t::max_wait_ns)
+		.def_readonly("holds",       &sycophant::lock_counts_t::holds      )
+		.def_readonly("hold_ns",     &sycophant::lock_counts_t::hold_ns    )
+		.def_readonly("max_hold_ns", &sycophant::lock_counts_t::max_hold_ns)
+		.def("__repr__", [](const sycophant::lock_counts_t& counts) {
+			return "<lock_counts waits=" + std::to_string(counts.waits) + " wait_ns=" + std::to_string(counts.wait_ns) +
+				" holds=" + std::to_string(counts.holds) + " hold_ns=" + std::to_string(counts.hold_ns) + ">";
+		});
+
+	py::class_<sycophant::lock_site_t>(locks, "lock_site")
+		.def_readonly("caller", &sycophant::lock_site_t::caller)
+		.def_readonly("name",   &sycophant::lock_site_t::name  )
+		.def_readonly("counts", &sycophant::lock_site_t::counts)
+		.def("__repr__", [](const sycophant::lock_site_t& site) {
+			return "<lock_site " + site.name + " waits=" + std::to_string(site.counts.waits) +
+				" wait_ns=" + std::to_string(site.counts.wait_ns) + ">";
+		});
+
+	py::class_<sycophant::lock_report_t>(locks, "lock_report")
+		.def_readonly("address", &sycophant::lock_report_t::address)
+		.def_property_readonly("kind", [](const sycophant::lock_report_t& lock) {
+			return sycophant::lock_kind_names[static_cast<std::size_t>(lock.kind)];
+		})
+		.def_readonly("name",    &sycophant::lock_report_t::name   )
+		.def_readonly("counts",  &sycophant::lock_report_t::counts )
+		.def_readonly("sites",   &sycophant::lock_report_t::sites  )
+		.def("__repr__", [](const sycophant::lock_report_t& lock) {
+			return "<lock_report " + std::string{sycophant::lock_kind_names[static_cast<std::size_t>(lock.kind)]} + " " +
+				lock.name + " waits=" + std::to_string(lock.counts.waits) + " wait_ns=" + std::to_string(lock.counts.wait_ns) + ">";
+		});
+
+	locks.def("start", []() {
+		sycophant::state.locks.start();
+	});
+
+	locks.def("stop", []() {
+		sycophant::state.locks.stop();
+	});
+
+	locks.def("clear", []() {
+		sycophant::state.locks.clear();
+	});
+
+	locks.def("running", []() {
+		return sycophant::state.locks.running();
+	});
+
+	locks.def("dropped", []() {
+		return sycophant::state.locks.dropped();
+	});
+
+	locks.def("report", []() {
+		return sycophant::state.locks.report();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	auto metrics = m.def_submodule("metrics", "counters and histograms published in shared memory");
+
+	metrics.def("start", [](const std::string& name, std::uint32_t interval, std::size_t capacity) {
+		return sycophant::state.metrics.start(sycophant::metrics_name(name), capacity, interval, sycophant::collect_metrics);
+	}, py::arg("name") = "", py::arg("interval") = sycophant::metrics_interval_default,
+		py::arg("capacity") = sycophant::metrics_capacity_default, py::call_guard<py::gil_scoped_release>());
+
+	metrics.def("stop", []() {
+		sycophant::state.metrics.stop();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	metrics.def("update", []() {
+		sycophant::state.metrics.update_now();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	metrics.def("running", []() {
+		return sycophant::state.metrics.running();
+	});
+
+	metrics.def("name", []() -> std::optional<std::string> {
+		auto name{sycophant::state.metrics.name()};
+		if (name.empty()) {
+			return std::nullopt;
+		}
+		return name;
+	});
+
+	metrics.def("dropped", []() {
+		return sycophant::state.metrics.dropped();
+	});
+
+	auto startup = m.def_submodule("startup", "how and when the interpreter was started");
+
+	startup.def("deferred", []() {
+		return sycophant::state.startup.deferred;
+	});
+
+	startup.def("main_started", []() {
+		return sycophant::state.startup.main_started.load(std::memory_order_acquire);
+	});
+
+	py::class_<sycophant::bundle_importer_t>(startup, "bundle_importer")
+		.def("find_spec", [](py::object self, const std::string& name, py::object, py::object) -> py::object {
+			const auto module{sycophant::state.bundle.find(name)};
+			if (!module) {
+				return py::none();
+			}
+			/* Always loaded by the time anything is imported, so this never goes near the path */
+			return py::module::import("_frozen_importlib").attr("ModuleSpec")(
+				name, self, py::arg("origin") = "<bundle>", py::arg("is_package") = module->package
+			);
+		}, py::arg("fullname"), py::arg("path") = py::none(), py::arg("target") = py::none())
+		.def("create_module", [](const sycophant::bundle_importer_t&, py::object) {
+			return py::none();
+		})
+		.def("exec_module", [](const sycophant::bundle_importer_t&, py::object module) {
+			const auto name{module.attr("__spec__").attr("name").cast<std::string>()};
+			const auto found{sycophant::state.bundle.find(name)};
+			if (!found) {
+				throw py::import_error{"no module named " + name + " in the bundle"};
+			}
+			/* Unmarshalled straight out of the mapping, there's no intermediate bytes object */
+			const auto code{py::reinterpret_steal<py::object>(
+				PyMarshal_ReadObjectFromString(found->code, static_cast<Py_ssize_t>(found->length))
+			)};
+			if (!code) {
+				throw py::error_already_set{};
+			}
+			const auto globals{module.attr("__dict__")};
+			const auto res{py::reinterpret_steal<py::object>(PyEval_EvalCode(code.ptr(), globals.ptr(), globals.ptr()))};
+			if (!res) {
+				throw py::error_already_set{};
+			}
+		});
+
+	auto channels = m.def_submodule("channels", "lock-free message channels shared with the isolated interpreters");
+
+	/* The same calls as `sycophant_worker` has in the isolated interpreters, handles are good in both */
+	channels.def("open", [](const std::string& name, std::uint32_t capacity, std::uint32_t size) {
+		const auto handle{sycophant::state.channels.open(name, capacity, size)};
+		if (handle < 0) {
+			throw std::runtime_error("too many channels");
+		}
+		return handle;
+	}, py::arg("name"), py::arg("capacity") = 1024U, py::arg("size") = 256U);
+
+	const auto channel{[](std::int32_t handle) -> sycophant::channel_t& {
+		if (const auto res{sycophant::state.channels.get(handle)}) {
+			return *res;
+		}
+		throw std::invalid_argument("not a channel handle");
+	}};
+
+	channels.def("send", [channel](std::int32_t handle, const py::buffer& data) {
+		const auto info{data.request()};
+		return channel(handle).send(info.ptr, static_cast<std::size_t>(info.size * info.itemsize));
+	});
+
+	channels.def("receive", [channel](std::int32_t handle) -> py::object {
+		py::object res{py::none()};
+		static_cast<void>(channel(handle).receive([&](const std::uint8_t* data, const std::size_t length) {
+			res = py::bytes(reinterpret_cast<const char*>(data), length);
+		}));
+		return res;
+	});
+
+	channels.def("size", [channel](std::int32_t handle) {
+		return channel(handle).size();
+	});
+
+	channels.def("refused", [channel](std::int32_t handle) {
+		return channel(handle).refused();
+	});
+
+	auto interpreters = m.def_submodule("interpreters", "isolated sub-interpreters for hook handlers");
+
+	interpreters.def("supported", &sycophant::interpreter_pool_t::supported);
+
+	interpreters.def("start", [](std::size_t count) {
+		sycophant::start_interpreters(count);
+		return sycophant::state.interpreters.size();
+	}, py::arg("count") = 0U);
+
+	interpreters.def("size", []() {
+		return sycophant::state.interpreters.size();
+	});
+
+	auto trace = m.def_submodule("trace", "binary per-thread event tracing");
+
+	trace.def("start", [](const std::string& path, const std::string& mode, std::size_t size) {
+		const auto trace_mode{sycophant::trace_mode(mode)};
+		if (!trace_mode) {
+			throw std::invalid_argument("trace mode must be 'flight' or 'continuous'");
+		}
+		return sycophant::state.trace.start(path, *trace_mode, size);
+	}, py::arg("path"), py::arg("mode") = "flight", py::arg("size") = sycophant::trace_ring_default);
+
+	trace.def("stop", []() {
+		sycophant::state.trace.stop();
+	});
+
+	trace.def("flush", []() {
+		sycophant::state.trace.flush();
+	});
+
+	trace.def("running", []() {
+		return sycophant::state.trace.running();
+	});
+
+	trace.def("dropped", []() {
+		return sycophant::state.trace.dropped();
+	});
+
+	trace.def("begin", [](const std::string& name) {
+		sycophant::state.trace.record(sycophant::trace_event_t::begin, sycophant::state.trace.intern(name));
+	}, py::arg("name"));
+
+	trace.def("end", [](const std::string& name, std::uint64_t value) {
+		sycophant::state.trace.record(sycophant::trace_event_t::end, sycophant::state.trace.intern(name), value);
+	}, py::arg("name"), py::arg("value") = 0U);
+
+	trace.def("marker", [](const std::string& name, std::uint64_t value) {
+		sycophant::state.trace.record(sycophant::trace_event_t::instant, sycophant::state.trace.intern(name), value);
+	}, py::arg("name"), py::arg("value") = 0U);
+
+	trace.def("counter", [](const std::string& name, std::uint64_t value) {
+		sycophant::state.trace.record(sycophant::trace_event_t::counter, sycophant::state.trace.intern(name), value);
+	}, py::arg("name"), py::arg("value"));
+
+	auto stats_mod = m.def_submodule("stats", "what sycophant itself has cost the process");
+
+	stats_mod.def("phases", []() {
+		py::list res{};
+		for (const auto& [name, ns] : sycophant::state.stats.phases()) {
+			res.append(py::make_tuple(name, ns));
+		}
+		return res;
+	});
+
+	stats_mod.def("counters", []() {
+		py::dict res{};
+		for (const auto& [name, value] : sycophant::stats_counters()) {
+			res[py::str(name.data(), name.size())] = value;
+		}
+		return res;
+	});
+
+	stats_mod.def("report", &sycophant::stats_report);
+
 	auto proc_threads = proc.def_submodule("threads", "process thread information");
 
 	proc_threads.def("known", []() {
-		return *(sycophant::state.threads.read());
+		return sycophant::state.threads.handles();
+	});
+
+	py::class_<sycophant::thread_info_t>(proc_threads, "thread")
+		.def_readonly("handle",  &sycophant::thread_info_t::handle )
+		.def_readonly("tid",     &sycophant::thread_info_t::tid    )
+		.def_readonly("name",    &sycophant::thread_info_t::name   )
+		.def_readonly("start",   &sycophant::thread_info_t::start  )
+		.def_readonly("created", &sycophant::thread_info_t::created)
+		.def_readonly("creator", &sycophant::thread_info_t::creator)
+		.def("__repr__", [](const sycophant::thread_info_t& thread) {
+			return "<thread " + std::to_string(thread.tid) + " '" + thread.name + "'>";
+		});
+
+	proc_threads.def("info", []() {
+		return sycophant::state.threads.info();
 	});
 
+	proc_threads.def("snapshot", []() {
+		sycophant::thread_stats_t stats{};
+		std::vector<std::uintptr_t> start{};
+		std::vector<std::uint64_t> created{};
+		std::vector<pid_t> creator{};
+		{
+			py::gil_scoped_release release{};
+			stats = sycophant::read_thread_stats();
+			auto known{sycophant::state.threads.info()};
+			std::sort(known.begin(), known.end(), [](const auto& a, const auto& b) {
+				return a.tid < b.tid;
+			});
+			start.reserve(stats.size());
+			created.reserve(stats.size());
+			creator.reserve(stats.size());
+			/* Threads we didn't see start get zeros */
+			for (const auto tid : stats.tid) {
+				const auto thread = std::lower_bound(known.begin(), known.end(), tid, [](const auto& info, const pid_t val) {
+					return info.tid < val;
+				});
+				const auto found{thread != known.end() && thread->tid == tid};
+				start.push_back(found ? thread->start : 0U);
+				created.push_back(found ? thread->created : 0U);
+				creator.push_back(found ? thread->creator : 0);
+			}
+		}
+
+		py::dict res{};
+		res["tid"]     = std::move(stats.tid);
+		res["name"]    = std::move(stats.name);
+		res["state"]   = std::string{stats.state.begin(), stats.state.end()};
+		res["user"]    = std::move(stats.user);
+		res["system"]  = std::move(stats.system);
+		res["cpu"]     = std::move(stats.cpu);
+		res["run"]     = std::move(stats.run);
+		res["wait"]    = std::move(stats.wait);
+		res["slices"]  = std::move(stats.slices);
+		res["start"]   = std::move(start);
+		res["created"] = std::move(created);
+		res["creator"] = std::move(creator);
+		return res;
+	});
+
+	py::class_<sycophant::thread_routine_info_t>(proc_threads, "routine")
+		.def_readonly("start",         &sycophant::thread_routine_info_t::start        )
+		.def_readonly("spawned",       &sycophant::thread_routine_info_t::spawned      )
+		.def_readonly("returned",      &sycophant::thread_routine_info_t::returned     )
+		.def_readonly("exited",        &sycophant::thread_routine_info_t::exited       )
+		.def_readonly("cancelled",     &sycophant::thread_routine_info_t::cancelled    )
+		.def_readonly("spawn_latency", &sycophant::thread_routine_info_t::spawn_latency)
+		.def_readonly("lifetime",      &sycophant::thread_routine_info_t::lifetime     )
+		.def("__repr__", [](const sycophant::thread_routine_info_t& routine) {
+			return "<routine " + sycophant::fromint_t(routine.start).to_hex() + " spawned=" + std::to_string(routine.spawned) + ">";
+		});
+
+	proc_threads.def("routines", []() {
+		return sycophant::state.threads.routines();
+	}, py::call_guard<py::gil_scoped_release>());
+
+	proc_threads.def("reset_routines", []() {
+		sycophant::state.threads.reset_routines();
+	});
+
+	py::class_<sycophant::quiesce_t>(proc_threads, "freeze",
+		"Parks every other thread in a signal handler until resume() or the end of the with block.\n\n"
+		"A parked thread can be holding the malloc arena lock, or the heap profiler's or the trace's\n"
+		"own locks, so anything in the block that ends up in malloc can deadlock the whole process.\n"
+		"Python allocates as it goes, keep the block to reading memory and patching code and do\n"
+		"everything else before freezing or after resuming."
+	)
+		.def(py::init([]() {
+			auto world{std::make_unique<sycophant::quiesce_t>(&sycophant::state.threads)};
+			if (!world->stopped()) {
+				throw std::runtime_error("unable to stop all threads");
+			}
+			return world;
+		}))
+		.def_property_readonly("frozen",     &sycophant::quiesce_t::stopped   )
+		.def_property_readonly("threads",    &sycophant::quiesce_t::count     )
+		.def_property_readonly("suspend_ns", &sycophant::quiesce_t::suspend_ns)
+		.def_property_readonly("frozen_ns",  &sycophant::quiesce_t::frozen_ns )
+		.def_property_readonly("resume_ns",  &sycophant::quiesce_t::resume_ns )
+		.def("resume", &sycophant::quiesce_t::resume)
+		.def("__enter__", [](sycophant::quiesce_t& world) -> sycophant::quiesce_t& {
+			return world;
+		}, py::return_value_policy::reference)
+		.def("__exit__", [](sycophant::quiesce_t& world, py::object, py::object, py::object) {
+			world.resume();
+			return false;
+		});
+
 	auto proc_maps = proc.def_submodule("maps", "process map information");
 
 	proc_maps.def("all", []() {
@@ -155,7 +1637,7 @@ PYBIND11_EMBEDDED_MODULE(sycophant, m) {
 	proc_maps.def("refresh", []() {
 		auto maps = sycophant::state.procmaps.write();
 
-		sycophant::build_maps(*maps);
+		sycophant::refresh_maps(*maps);
 	});
 
 	proc_maps.def("has_addr", [](std::uintptr_t addr) {
@@ -278,30 +1760,30 @@ PYBIND11_EMBEDDED_MODULE(sycophant, m) {
 extern "C" {
 	// cheeky-hack to re-name the symbol because it's dragged in from one of our includes
 	std::int32_t sycophant_pthread_create(pthread_t* pid, const void* attr, void*(*start)(void*), void* args) asm ("pthread_create");
-	std::int32_t sycophant_pthread_join(pthread_t pid, void** retval) asm ("pthread_join");
 
 	[[gnu::used, gnu::visibility("default")]]
 	std::int32_t sycophant_pthread_create(pthread_t* pid, const void* attr, void*(*start)(void*), void* args) {
 		std::int32_t ret{};
+		sycophant::state.stats.add(sycophant::counter_t::pthread_creates);
 		if (*sycophant::state.old_pthread_create != nullptr) {
-			ret = (*sycophant::state.old_pthread_create)(pid, attr, start, args);
-			auto thrds = sycophant::state.threads.write();
-			thrds->push_back(*pid);
+			ret = sycophant::state.threads.create(*sycophant::state.old_pthread_create, pid, attr, start, args);
 		}
 
 		return ret;
 	}
 
-	[[gnu::used, gnu::visibility("default")]]
-	std::int32_t sycophant_pthread_join(pthread_t pid, void** retval) {
-		std::int32_t ret{};
-		if (*sycophant::state.old_pthread_join != nullptr) {
-			ret = (*sycophant::state.old_pthread_join)(pid, retval);
-			auto thrds = sycophant::state.threads.write();
-			thrds->erase(std::find(std::begin(*thrds), std::end(*thrds), pid));
-		}
+	[[noreturn]]
+	void sycophant_pthread_exit(void* ret) asm ("pthread_exit");
 
-		return ret;
+	[[gnu::used, gnu::visibility("default"), noreturn]]
+	void sycophant_pthread_exit(void* ret) {
+		sycophant::thread_registry_t::exiting();
+		sycophant::state.stats.add(sycophant::counter_t::pthread_exits);
+		if (*sycophant::state.old_pthread_exit != nullptr) {
+			(*sycophant::state.old_pthread_exit)(ret);
+		}
+		/* The real one never returns, if we get here we couldn't find it */
+		std::abort();
 	}
 
 	[[gnu::used, gnu::visibility("default")]]
@@ -312,55 +1794,91 @@ extern "C" {
 		std::int32_t ret{1};
 		char** envp = &argv[argc + 1];
 
-		/* Find the end of the env block so we can map it to a span */
-		for (char** env = envp; *env != nullptr; ++env) {
-			const std::string_view e{*env};
-			const auto tok = e.find("=");
+		{
+			sycophant::stats_phase_t phase{sycophant::state.stats, "env"};
+			/* Index the env block and take our own variables out of it so the process never sees them */
+			char** kept{envp};
+			for (char** env = envp; *env != nullptr; ++env) {
+				const std::string_view e{*env};
+				const auto tok = e.find("=");
 
-			sycophant::state.envmap.insert({e.substr(0, tok), e.substr(tok + 1, e.length())});
+				sycophant::state.envmap.insert({e.substr(0, tok), e.substr(tok + 1, e.length())});
 
-			if (std::strncmp("LD_PRELOAD", *env, 10) == 0) {
-				std::memset(env, 0, std::strlen(*env));
-			} else if (std::strncmp("SYCOPHANT", *env, 9) == 0) {
-				std::memset(env, 0, std::strlen(*env));
+				if (std::strncmp("LD_PRELOAD", *env, 10) != 0 && std::strncmp("SYCOPHANT", *env, 9) != 0) {
+					*kept++ = *env;
+				}
 			}
+			*kept = nullptr;
 		}
 
-		const fs::path user_modules{sycophant::expanduser("~/.config/sycophant"sv)};
-
-		// Build out memory map
-		sycophant::build_maps(*(sycophant::state.procmaps.write()));
+		/* The main thread never goes through pthread_create */
+		sycophant::state.threads.adopt();
+		sycophant::start_trace();
+		sycophant::start_heap();
+		if (sycophant::getenv("SYCOPHANT_IO")) {
+			sycophant::state.io.start();
+		}
+		if (sycophant::getenv("SYCOPHANT_LOCKS")) {
+			sycophant::state.locks.start();
+		}
+		sycophant::start_metrics();
 
-		// Map our current process into memory
-		sycophant::state.self = sycophant::fd_t("/proc/self/exe", O_RDONLY).map(sycophant::prot_t::R);
-		/* Now that pre-init is over we can spin up the interpreter */
+		const fs::path user_modules{sycophant::expanduser("~/.config/sycophant"sv)};
+		sycophant::state.symbols.cache_dir(user_modules / "cache" / "symbols");
 
-		py::scoped_interpreter guard{
-			true, argc, argv, true
-		};
+		{
+			sycophant::stats_phase_t phase{sycophant::state.stats, "ingest"};
+			sycophant::start_ingest();
+		}
 
-		// Preload some modules
-		sycophant::state.imports.insert({"sys",     py::module::import("sys")    });
-		sycophant::state.imports.insert({"inspect", py::module::import("inspect")});
+		{
+			sycophant::stats_phase_t phase{sycophant::state.stats, "maps"};
+			// Build out memory map
+			sycophant::refresh_maps(*(sycophant::state.procmaps.write()));
+		}
 
-		// Check to see if the user modules exist, and add them to the path if so
-		if (fs::exists(user_modules)) {
-			sycophant::state.imports["sys"].attr("path").attr("insert")(0, user_modules.c_str());
+		{
+			sycophant::stats_phase_t phase{sycophant::state.stats, "self_map"};
+			// Map our current process into memory, only the headers are mapped until something reads further
+			static_cast<void>(sycophant::state.self.open("/proc/self/exe"));
+		}
+		if (sycophant::getenv("SYCOPHANT_STATS")) {
+			std::atexit(sycophant::dump_stats);
 		}
+		/* Now that pre-init is over we can spin up the interpreter */
 
-		// Load up the hook module if specified, otherwise the default one
-		if (auto mod = sycophant::getenv("SYCOPHANT_MODULE")) {
-			sycophant::state.imports.insert({"sycophant", py::module::import((mod->get()).data())});
-		} else {
-			sycophant::state.imports.insert({"sycophant", py::module::import("sycophant_hooks")});
+		auto& startup{sycophant::state.startup};
+		startup.main = main;
+		if (const auto mode = sycophant::getenv("SYCOPHANT_STARTUP")) {
+			startup.deferred = mode->get() == "deferred";
 		}
 
+		if (startup.deferred) {
+			if (!sycophant::getenv("SYCOPHANT_BEFORE_MAIN")) {
+				startup.release();
+			}
+			/* If the thread can't be started this runs it right here, which is just an eager start */
+			sycophant::state.starter = std::make_unique<sycophant::worker_pool_t>(1U, [user_modules, argc, argv]() {
+				sycophant::start_deferred(user_modules, argc, argv);
+			});
+
+			if (*sycophant::state.old_libc_start != nullptr) {
+				ret = (*sycophant::state.old_libc_start)(sycophant::start_main, argc, argv, init, fini, rtld_fini, stack_end);
+			}
+			return ret;
+		}
 
+		sycophant::start_interpreter(true, argc, argv);
 
+		sycophant::import_modules(user_modules);
+		sycophant::import_hooks();
+		startup.release();
 
 		// If we have the original __libc_start_main then call it now that we're all setup
 		if (*sycophant::state.old_libc_start != nullptr) {
-			ret = (*sycophant::state.old_libc_start)(main, argc, argv, init, fini, rtld_fini, stack_end);
+			/* Let go of the GIL so hooks can run their handlers from any thread */
+			py::gil_scoped_release release{};
+			ret = (*sycophant::state.old_libc_start)(sycophant::start_main, argc, argv, init, fini, rtld_fini, stack_end);
 		}
 
 		return ret;
@@ -377,8 +1895,8 @@ extern "C" {
 			reinterpret_cast<pthread_create_t>(dlsym(RTLD_NEXT, "pthread_create"))
 		);
 
-		sycophant::state.old_pthread_join = std::make_unique<pthread_join_t>(
-			reinterpret_cast<pthread_join_t>(dlsym(RTLD_NEXT, "pthread_join"))
+		sycophant::state.old_pthread_exit = std::make_unique<pthread_exit_t>(
+			reinterpret_cast<pthread_exit_t>(dlsym(RTLD_NEXT, "pthread_exit"))
 		);
 
 		if (*sycophant::state.old_libc_start == nullptr) {
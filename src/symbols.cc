@@ -0,0 +1,494 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* symbols.cc - Process wide symbol name index */
+#include <sys/auxv.h>
+#include <cstring>
+#include <cstdio>
+#include <cinttypes>
+#include <array>
+#include <algorithm>
+#include <thread>
+#include <filesystem>
+#include <system_error>
+
+#include <symbols.hh>
+
+namespace fs = std::filesystem;
+
+namespace sycophant {
+	namespace {
+		[[nodiscard]]
+		std::string to_hex(const std::uintptr_t val) {
+			std::array<char, 17> buf{};
+			std::snprintf(buf.data(), buf.size(), "%" PRIxPTR, val);
+			return buf.data();
+		}
+
+		[[nodiscard]]
+		bool usable(const Elf64_Sym& sym) noexcept {
+			if (sym.st_shndx == SHN_UNDEF || sym.st_value == 0U) {
+				return false;
+			}
+			const auto type{ELF64_ST_TYPE(sym.st_info)};
+			return type != STT_TLS && type != STT_SECTION && type != STT_FILE;
+		}
+
+		/*
+			Exported IFUNCs are run through their resolver the same as the loader would so we hand out the
+			implementation. Only ever called for .dynsym, a local IFUNC's resolver can expect loader state
+			that's only there while relocating.
+		*/
+		[[nodiscard]]
+		std::uintptr_t resolve(const std::uintptr_t addr, const std::uint8_t type) noexcept {
+			if (type == STT_GNU_IFUNC) {
+				using resolver_t = std::uintptr_t(*)(unsigned long);
+				return reinterpret_cast<resolver_t>(addr)(getauxval(AT_HWCAP));
+			}
+			return addr;
+		}
+
+		[[nodiscard]]
+		std::uintptr_t address(const Elf64_Sym& sym, const std::uintptr_t bias) noexcept {
+			if (sym.st_shndx == SHN_ABS) {
+				return sym.st_value;
+			}
+			return resolve(bias + sym.st_value, ELF64_ST_TYPE(sym.st_info));
+		}
+
+		void append(std::vector<std::uintptr_t>& res, const std::uintptr_t addr) {
+			if (std::find(res.begin(), res.end(), addr) == res.end()) {
+				res.push_back(addr);
+			}
+		}
+
+		/*
+			glibc relocates the address entries in the dynamic section when it loads a module, the vDSO
+			and other loaders leave them as link-time addresses.
+		*/
+		template<typename T>
+		[[nodiscard]]
+		const T* dyn_ptr(const Elf64_Dyn& dyn, const std::uintptr_t bias) noexcept {
+			auto ptr{static_cast<std::uintptr_t>(dyn.d_un.d_ptr)};
+			if (ptr < bias) {
+				ptr += bias;
+			}
+			return reinterpret_cast<const T*>(ptr);
+		}
+
+		[[nodiscard]]
+		dynsyms_t read_dynamic(const module_t& mod) noexcept {
+			dynsyms_t res{};
+			if (mod.dynamic == nullptr) {
+				return res;
+			}
+
+			for (auto dyn{mod.dynamic}; dyn->d_tag != DT_NULL; ++dyn) {
+				switch (dyn->d_tag) {
+					case DT_SYMTAB: res.symtab = dyn_ptr<Elf64_Sym>(*dyn, mod.bias); break;
+					case DT_STRTAB: res.strtab = dyn_ptr<char>(*dyn, mod.bias); break;
+					case DT_STRSZ: res.strsz = dyn->d_un.d_val; break;
+					case DT_GNU_HASH: res.gnu_hash = dyn_ptr<std::uint32_t>(*dyn, mod.bias); break;
+					case DT_HASH: res.sysv_hash = dyn_ptr<std::uint32_t>(*dyn, mod.bias); break;
+					default: break;
+				}
+			}
+
+			if (res.symtab == nullptr || res.strtab == nullptr) {
+				return {};
+			}
+			return res;
+		}
+
+		[[nodiscard]]
+		bool name_matches(const dynsyms_t& dyn, const Elf64_Sym& sym, const std::string_view name) noexcept {
+			if (sym.st_name >= dyn.strsz || dyn.strsz - sym.st_name <= name.size()) {
+				return false;
+			}
+			const auto str{dyn.strtab + sym.st_name};
+			return std::memcmp(str, name.data(), name.size()) == 0 && str[name.size()] == '\0';
+		}
+
+		void gnu_lookup(
+			const dynsyms_t& dyn, const std::uintptr_t bias, const std::string_view name, const std::uint32_t hash,
+			std::vector<std::uintptr_t>& res
+		) {
+			const auto table{dyn.gnu_hash};
+			const auto nbuckets{table[0]};
+			const auto symoffset{table[1]};
+			const auto bloom_size{table[2]};
+			const auto bloom_shift{table[3]};
+			if (nbuckets == 0U || bloom_size == 0U) {
+				return;
+			}
+			/* The bloom filter is 64-bit words, copied out so nothing leans on the table being 8 byte aligned */
+			const auto bloom{table + 4};
+			const auto buckets{bloom + (std::size_t{bloom_size} * 2U)};
+			const auto chain{buckets + nbuckets};
+
+			std::uint64_t word{};
+			std::memcpy(&word, bloom + (((hash / 64U) % bloom_size) * 2U), sizeof(word));
+			const auto mask{(std::uint64_t{1U} << (hash % 64U)) | (std::uint64_t{1U} << ((hash >> bloom_shift) % 64U))};
+			if ((word & mask) != mask) {
+				return;
+			}
+
+			auto idx{buckets[hash % nbuckets]};
+			if (idx < symoffset) {
+				return;
+			}
+			/* Every version of a symbol shares its hash, so keep going to the end of the chain */
+			for (;; ++idx) {
+				const auto entry{chain[idx - symoffset]};
+				const auto& sym{dyn.symtab[idx]};
+				if ((entry | 1U) == (hash | 1U) && usable(sym) && name_matches(dyn, sym, name)) {
+					append(res, address(sym, bias));
+				}
+				if ((entry & 1U) != 0U) {
+					break;
+				}
+			}
+		}
+
+		void sysv_lookup(
+			const dynsyms_t& dyn, const std::uintptr_t bias, const std::string_view name, std::vector<std::uintptr_t>& res
+		) {
+			const auto table{dyn.sysv_hash};
+			const auto nbucket{table[0]};
+			const auto nchain{table[1]};
+			if (nbucket == 0U) {
+				return;
+			}
+			const auto buckets{table + 2};
+			const auto chain{buckets + nbucket};
+
+			for (auto idx{buckets[sysv_hash(name) % nbucket]}; idx != STN_UNDEF && idx < nchain; idx = chain[idx]) {
+				const auto& sym{dyn.symtab[idx]};
+				if (usable(sym) && name_matches(dyn, sym, name)) {
+					append(res, address(sym, bias));
+				}
+			}
+		}
+
+		void index_symtab(module_symbols_t& mod, const fs::path& cache_dir) {
+			if (mod.module->path.empty()) {
+				return;
+			}
+			const elf_bytes_t build_id{mod.module->build_id.data(), mod.module->build_id.size()};
+			mod.symtab = symcache_t::load(cache_dir, build_id);
+			if (!mod.symtab.valid()) {
+				/* Separate debug info has the full .symtab that got stripped out of the module */
+				const fs::path path{mod.module->path};
+				const auto debug{find_debug_file(path, build_id)};
+				mod.symtab = symcache_t::build(cache_dir, build_id, debug.empty() ? path : debug);
+			}
+		}
+
+	}
+
+	void module_symbols_t::index(const fs::path& cache_dir) {
+		if (ready.load(std::memory_order_acquire)) {
+			return;
+		}
+		std::call_once(indexed, [&]() {
+			dynsyms = read_dynamic(*module);
+			index_symtab(*this, cache_dir);
+			ready.store(true, std::memory_order_release);
+		});
+	}
+
+	void module_symbols_t::index_frames() {
+		std::lock_guard<std::mutex> lock{debug_lock};
+		if (!frames) {
+			frames = eh_frame_t{*module};
+		}
+	}
+
+	void module_symbols_t::lookup(
+		const std::string_view name, const std::uint32_t hash, std::vector<std::uintptr_t>& res
+	) const {
+		const auto bias{module->bias};
+		const auto found{res.size()};
+		if (dynsyms.gnu_hash != nullptr) {
+			gnu_lookup(dynsyms, bias, name, hash, res);
+		} else if (dynsyms.sysv_hash != nullptr) {
+			sysv_lookup(dynsyms, bias, name, res);
+		}
+		const auto exported{res.size() != found};
+
+		/* The cache has .dynsym in it too, an IFUNC that was exported has already been resolved above */
+		symtab.lookup(name, hash, [&](const symcache_entry_t& entry) {
+			if (entry.absolute != 0U) {
+				append(res, entry.value);
+			} else if (entry.type != STT_GNU_IFUNC || !exported) {
+				append(res, bias + entry.value);
+			}
+		});
+	}
+
+	std::optional<module_function_t> module_symbols_t::function(const std::uint64_t vaddr) {
+		const auto entry{symtab.find(vaddr)};
+		if (entry != nullptr && entry->size != 0U) {
+			return module_function_t{symtab.name(*entry), entry->value, entry->value + entry->size};
+		}
+
+		if (!frames) {
+			frames = eh_frame_t{*module};
+		}
+		const auto range{frames->find(vaddr)};
+		if (range == nullptr) {
+			if (entry == nullptr) {
+				return std::nullopt;
+			}
+			return module_function_t{symtab.name(*entry), entry->value, entry->value};
+		}
+		/* An unsized symbol inside the FDE is most likely a label in hand written assembly */
+		if (entry == nullptr || entry->value < range->start) {
+			return module_function_t{{}, range->start, range->end};
+		}
+		return module_function_t{symtab.name(*entry), entry->value, range->end};
+	}
+
+	void symbol_index_t::refresh() {
+		_modules.refresh();
+		const auto generation{_modules.generation()};
+		if (_index.read()->generation == generation) {
+			return;
+		}
+
+		auto loaded{_modules.modules()};
+		std::sort(loaded.begin(), loaded.end(), [](const auto& a, const auto& b) {
+			return a->serial < b->serial;
+		});
+
+		auto index = _index.write();
+		if (index->generation == generation) {
+			return;
+		}
+		std::vector<std::shared_ptr<module_symbols_t>> modules{};
+		modules.reserve(loaded.size());
+		for (const auto& mod : loaded) {
+			const auto existing = std::find_if(index->modules.begin(), index->modules.end(), [&](const auto& sym) {
+				return sym != nullptr && sym->module == mod;
+			});
+			if (existing != index->modules.end()) {
+				modules.push_back(std::move(*existing));
+			} else {
+				auto sym{std::make_shared<module_symbols_t>()};
+				sym->module = mod;
+				modules.push_back(std::move(sym));
+			}
+		}
+
+		index->modules = std::move(modules);
+		index->generation = generation;
+	}
+
+	void symbol_index_t::cache_dir(const fs::path& dir) {
+		_index.write()->cache_dir = dir;
+	}
+
+	void symbol_index_t::ingest(const std::size_t threads, const bool wait) {
+		refresh();
+
+		struct work_t final {
+			std::vector<std::shared_ptr<module_symbols_t>> modules;
+			fs::path cache_dir;
+			std::atomic<std::size_t> next;
+		};
+		auto work{std::make_shared<work_t>()};
+		{
+			auto index = _index.read();
+			for (const auto& mod : index->modules) {
+				if (!mod->ready.load(std::memory_order_acquire)) {
+					work->modules.push_back(mod);
+				}
+			}
+			work->cache_dir = index->cache_dir;
+		}
+		if (work->modules.empty()) {
+			return;
+		}
+		/* Biggest first so one large library doesn't end up being the tail */
+		std::sort(work->modules.begin(), work->modules.end(), [](const auto& a, const auto& b) {
+			return (a->module->end - a->module->start) > (b->module->end - b->module->start);
+		});
+
+		auto count{threads != 0U ? threads : std::max(std::size_t{std::thread::hardware_concurrency()}, std::size_t{1U})};
+		count = std::min(count, work->modules.size());
+
+		std::lock_guard<std::mutex> lock{_ingest_lock};
+		_ingest.reset();
+		_ingest = std::make_unique<worker_pool_t>(count, [work]() {
+			for (auto idx{work->next++}; idx < work->modules.size(); idx = work->next++) {
+				const auto& mod{work->modules[idx]};
+				mod->index(work->cache_dir);
+				mod->index_frames();
+			}
+		});
+		if (wait) {
+			_ingest.reset();
+		}
+	}
+
+	void symbol_index_t::join_ingest() noexcept {
+		std::lock_guard<std::mutex> lock{_ingest_lock};
+		_ingest.reset();
+	}
+
+	std::size_t symbol_index_t::pending() {
+		refresh();
+		auto index = _index.read();
+		return static_cast<std::size_t>(std::count_if(index->modules.begin(), index->modules.end(), [](const auto& mod) {
+			return !mod->ready.load(std::memory_order_acquire);
+		}));
+	}
+
+	std::vector<std::uintptr_t> symbol_index_t::lookup(const std::string_view name) {
+		refresh();
+
+		std::vector<std::uintptr_t> res{};
+		const auto hash{gnu_hash(name)};
+		auto index = _index.read();
+		for (const auto& mod : index->modules) {
+			mod->index(index->cache_dir);
+			mod->lookup(name, hash, res);
+		}
+		return res;
+	}
+
+	std::vector<std::vector<std::uintptr_t>> symbol_index_t::lookup_many(const std::vector<std::string>& names) {
+		refresh();
+
+		std::vector<std::vector<std::uintptr_t>> res(names.size());
+		auto index = _index.read();
+		for (const auto& mod : index->modules) {
+			mod->index(index->cache_dir);
+		}
+		for (std::size_t idx{}; idx < names.size(); ++idx) {
+			const auto hash{gnu_hash(names[idx])};
+			for (const auto& mod : index->modules) {
+				mod->lookup(names[idx], hash, res[idx]);
+			}
+		}
+		return res;
+	}
+
+	std::vector<symbolized_t> symbol_index_t::symbolize_many(const std::vector<std::uintptr_t>& addrs) {
+		refresh();
+
+		std::vector<symbolized_t> res(addrs.size());
+		std::vector<std::size_t> order(addrs.size());
+		for (std::size_t idx{}; idx < order.size(); ++idx) {
+			order[idx] = idx;
+		}
+		std::sort(order.begin(), order.end(), [&](const std::size_t a, const std::size_t b) {
+			return addrs[a] < addrs[b];
+		});
+
+		auto index = _index.read();
+		std::vector<module_symbols_t*> by_address{};
+		by_address.reserve(index->modules.size());
+		for (const auto& mod : index->modules) {
+			by_address.push_back(mod.get());
+		}
+		std::sort(by_address.begin(), by_address.end(), [](const module_symbols_t* a, const module_symbols_t* b) {
+			return a->module->start < b->module->start;
+		});
+
+		module_symbols_t* mod{nullptr};
+		std::unique_lock<std::mutex> debug_lock{};
+		for (const auto idx : order) {
+			const auto addr{addrs[idx]};
+			auto& sym{res[idx]};
+			sym.address = addr;
+
+			if (mod == nullptr || !mod->module->contains(addr)) {
+				auto it = std::upper_bound(by_address.begin(), by_address.end(), addr, [](const std::uintptr_t val, const module_symbols_t* m) {
+					return val < m->module->start;
+				});
+				mod = (it == by_address.begin() || !(*--it)->module->contains(addr)) ? nullptr : *it;
+				if (mod == nullptr) {
+					continue;
+				}
+				mod->index(index->cache_dir);
+				/* Held until we move on to the next module */
+				debug_lock = std::unique_lock{mod->debug_lock};
+				if (!mod->dwarf) {
+					const auto& build_id{mod->module->build_id};
+					mod->dwarf = mod->module->path.empty() ?
+						dwarf_t{} : open_dwarf(fs::path{mod->module->path}, {build_id.data(), build_id.size()});
+				}
+			}
+
+			const auto vaddr{addr - mod->module->bias};
+			sym.module = mod->module;
+			sym.offset = vaddr;
+			if (const auto func = mod->function(vaddr)) {
+				sym.function = func->name.empty() ? "sub_" + to_hex(func->start) : std::string{func->name};
+				sym.offset = vaddr - func->start;
+			}
+			if (const auto loc = mod->dwarf->location(vaddr)) {
+				sym.file = loc->file;
+				sym.line = loc->line;
+			}
+		}
+		return res;
+	}
+
+	symbolized_t symbol_index_t::symbolize(const std::uintptr_t addr) {
+		return std::move(symbolize_many({addr}).front());
+	}
+
+	std::optional<std::pair<std::uintptr_t, std::uintptr_t>> symbol_index_t::function_bounds(const std::uintptr_t addr) {
+		refresh();
+
+		auto index = _index.read();
+		const auto mod = std::find_if(index->modules.begin(), index->modules.end(), [&](const auto& sym) {
+			return sym->module->contains(addr);
+		});
+		if (mod == index->modules.end()) {
+			return std::nullopt;
+		}
+
+		(*mod)->index(index->cache_dir);
+		const auto bias{(*mod)->module->bias};
+		std::lock_guard<std::mutex> lock{(*mod)->debug_lock};
+		const auto func{(*mod)->function(addr - bias)};
+		if (!func || func->end == func->start) {
+			return std::nullopt;
+		}
+		return std::make_pair(bias + func->start, bias + func->end);
+	}
+
+	symbolized_t::~symbolized_t() noexcept = default;
+
+	std::string symbolized_t::str() const {
+		std::string res{};
+		if (!function.empty()) {
+			res = function;
+		} else if (module != nullptr) {
+			res = fs::path{module->path.empty() ? module->name : module->path}.filename().string();
+		} else {
+			return "0x" + to_hex(address);
+		}
+		res += "+0x" + to_hex(offset);
+		if (!file.empty()) {
+			res += " (" + file + ":" + std::to_string(line) + ")";
+		}
+		return res;
+	}
+
+	std::string symbolized_t::frame() const {
+		if (!function.empty()) {
+			return function;
+		}
+		std::string res{};
+		if (module != nullptr && !module->path.empty()) {
+			res = fs::path{module->path}.filename().string() + '+';
+		}
+		return res + "0x" + to_hex(module != nullptr ? offset : address);
+	}
+
+	std::size_t symbol_index_t::modules() noexcept {
+		return _index.read()->modules.size();
+	}
+}
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* symbols.hh - Process wide symbol name index */
+#pragma once
+#if !defined(SYCOPHANT_SYMBOLS_HH)
+#define SYCOPHANT_SYMBOLS_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <utility>
+#include <filesystem>
+#include <elf.h>
+
+#include <types.hh>
+#include <rwlock.hh>
+#include <elf.hh>
+#include <modules.hh>
+#include <symcache.hh>
+#include <dwarf.hh>
+#include <workers.hh>
+
+namespace sycophant {
+	/* The in-memory dynamic symbol table of a loaded module and the hash table that goes with it */
+	struct dynsyms_t final {
+		const Elf64_Sym* symtab{nullptr};
+		const char* strtab{nullptr};
+		std::size_t strsz{0};
+		const std::uint32_t* gnu_hash{nullptr};
+		const std::uint32_t* sysv_hash{nullptr};
+	};
+
+	/* A function's link-time bounds, `name` is empty if only its unwind info is known and `end` is `start` if its size isn't */
+	struct module_function_t final {
+		std::string_view name;
+		std::uint64_t start;
+		std::uint64_t end;
+	};
+
+	struct module_symbols_t final {
+		std::shared_ptr<const module_t> module{};
+		/* Set once `dynsyms` and `symtab` are filled in, see `index` */
+		std::once_flag indexed{};
+		std::atomic<bool> ready{false};
+		dynsyms_t dynsyms{};
+		/*
+			Everything in the .symtab and .dynsym of the module's file, or of its separate debug file if it
+			has one, which covers the names the hash table doesn't export
+		*/
+		symcache_t symtab{};
+
+		/* Line info and unwind table function bounds, loaded the first time they're needed */
+		std::mutex debug_lock{};
+		std::optional<dwarf_t> dwarf{};
+		std::optional<eh_frame_t> frames{};
+
+		/*
+			Reads the dynamic symbols and maps or builds the symbol cache. Only the first call does any
+			work, anyone else calling it in the meantime waits for it to finish.
+		*/
+		void index(const fs::path& cache_dir);
+		/* Builds the unwind table function bounds ahead of time */
+		void index_frames();
+
+		void lookup(std::string_view name, std::uint32_t gnu_hash, std::vector<std::uintptr_t>& res) const;
+
+		/*
+			The function containing the link-time address `vaddr`. A sized symbol wins, otherwise the
+			.eh_frame FDE covering the address is used so stripped code still gets bounds. `debug_lock`
+			must be held.
+		*/
+		[[nodiscard]]
+		std::optional<module_function_t> function(std::uint64_t vaddr);
+	};
+
+	/* An address turned into `function+offset (file:line)`, any part we couldn't find is left empty */
+	struct symbolized_t final {
+		std::uintptr_t address{};
+		std::shared_ptr<const module_t> module{};
+		std::string function{};
+		/* From the start of `function`, or from the module's load bias if the function is unknown */
+		std::uintptr_t offset{};
+		std::string file{};
+		std::uint32_t line{};
+
+		symbolized_t() noexcept = default;
+		~symbolized_t() noexcept;
+		symbolized_t(const symbolized_t&) = default;
+		symbolized_t(symbolized_t&&) noexcept = default;
+		symbolized_t& operator=(const symbolized_t&) = default;
+		symbolized_t& operator=(symbolized_t&&) noexcept = default;
+
+		[[nodiscard]]
+		std::string str() const;
+		/* Just the function, or module+offset if it isn't known, as it goes in a folded stack */
+		[[nodiscard]]
+		std::string frame() const;
+	};
+
+	/*
+		Name to address lookups across every loaded module. Exported names are found through each module's
+		own DT_GNU_HASH (or DT_HASH) table, so a lookup is a bloom filter check per module and a short
+		chain walk in the ones that might have it. Non-exported and local names come out of the module's
+		symbol cache, which is mapped from the cache directory when one is set.
+
+		The index follows the module registry, it's brought up to date on lookup whenever modules were
+		loaded or unloaded. New modules are only indexed once a query needs them, or ahead of time by
+		`ingest`.
+	*/
+	struct symbol_index_t final {
+	private:
+		struct index_t final {
+			std::uint64_t generation{};
+			fs::path cache_dir{};
+			std::vector<std::shared_ptr<module_symbols_t>> modules{};
+		};
+		module_registry_t& _modules;
+		rwlock_t<index_t> _index{};
+		/* Declared last so a background ingest is joined before anything it uses goes away */
+		std::mutex _ingest_lock{};
+		std::unique_ptr<worker_pool_t> _ingest{};
+
+	public:
+		explicit symbol_index_t(module_registry_t& modules) noexcept : _modules{modules} { }
+
+		void refresh();
+		/*
+			Indexes every loaded module on `threads` internal worker threads (one per CPU if it's 0, never
+			more than there are modules to index). When `wait` is false this
+			returns straight away and the workers carry on in the background, a query that needs a module
+			they haven't gotten to yet indexes it itself or waits for the worker that's on it.
+		*/
+		void ingest(std::size_t threads, bool wait);
+		/* Waits for a background ingest to finish */
+		void join_ingest() noexcept;
+		/* The number of loaded modules that haven't been indexed yet */
+		[[nodiscard]]
+		std::size_t pending();
+		/* Where symbol caches are kept, only modules indexed after this is set use it */
+		void cache_dir(const fs::path& dir);
+
+		/* Every address `name` resolves to, in load order */
+		[[nodiscard]]
+		std::vector<std::uintptr_t> lookup(std::string_view name);
+		[[nodiscard]]
+		std::vector<std::vector<std::uintptr_t>> lookup_many(const std::vector<std::string>& names);
+
+		/*
+			Symbolizes a batch of addresses, they're handled in address order so each module's symbols and
+			debug info are only visited once. Return addresses should be passed in as `address - 1` so they
+			land in the call instruction.
+		*/
+		[[nodiscard]]
+		std::vector<symbolized_t> symbolize_many(const std::vector<std::uintptr_t>& addrs);
+		[[nodiscard]]
+		symbolized_t symbolize(std::uintptr_t addr);
+
+		/* The [start, end) of the function containing `addr`, if its size is known */
+		[[nodiscard]]
+		std::optional<std::pair<std::uintptr_t, std::uintptr_t>> function_bounds(std::uintptr_t addr);
+
+		[[nodiscard]]
+		std::size_t modules() noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_SYMBOLS_HH */
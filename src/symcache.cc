@@ -0,0 +1,288 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* symcache.cc - Memory-mapped on-disk symbol table cache */
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <system_error>
+
+#include <symcache.hh>
+#include <fd.hh>
+
+namespace sycophant {
+	namespace {
+		struct pending_t final {
+			std::string_view name;
+			const Elf64_Sym* sym;
+		};
+
+		[[nodiscard]]
+		bool cacheable(const elf_sym_t& sym) noexcept {
+			if (sym.name.empty() || !sym.defined() || sym.sym->st_value == 0U) {
+				return false;
+			}
+			const auto type{sym.type()};
+			return type != STT_TLS && type != STT_SECTION && type != STT_FILE;
+		}
+
+		[[nodiscard]]
+		constexpr std::uint64_t align8(const std::uint64_t val) noexcept {
+			return (val + 7U) & ~std::uint64_t{7U};
+		}
+
+		[[nodiscard]]
+		bool same_build_id(const symcache_header_t& hdr, const elf_bytes_t build_id) noexcept {
+			return hdr.build_id_len == build_id.size &&
+				std::memcmp(hdr.build_id.data(), build_id.data, build_id.size) == 0;
+		}
+	}
+
+	symcache_t::symcache_t(const fs::path& path, const elf_bytes_t build_id) noexcept :
+		_map{fd_t{path, O_RDONLY | O_CLOEXEC}.map(prot_t::R, MAP_PRIVATE)},
+		_data{_map.address<std::uint8_t>()}, _len{_map.length()} {
+		validate(build_id);
+	}
+
+	symcache_t::symcache_t(const elf_t& image, const elf_bytes_t build_id) {
+		std::vector<pending_t> syms{};
+		for (const auto& table : {image.symbols(), image.dynamic_symbols()}) {
+			for (const auto sym : table) {
+				if (cacheable(sym)) {
+					syms.push_back({sym.name, sym.sym});
+				}
+			}
+		}
+		/* Sized and global symbols sort first so `find` lands on the most useful alias */
+		std::sort(syms.begin(), syms.end(), [](const pending_t& a, const pending_t& b) {
+			if (a.sym->st_value != b.sym->st_value) {
+				return a.sym->st_value < b.sym->st_value;
+			}
+			if ((a.sym->st_size == 0U) != (b.sym->st_size == 0U)) {
+				return a.sym->st_size != 0U;
+			}
+			const auto a_local{ELF64_ST_BIND(a.sym->st_info) == STB_LOCAL};
+			const auto b_local{ELF64_ST_BIND(b.sym->st_info) == STB_LOCAL};
+			if (a_local != b_local) {
+				return b_local;
+			}
+			/* Prefer `malloc` over `__libc_malloc` */
+			const auto a_under{a.name.find_first_not_of('_')};
+			const auto b_under{b.name.find_first_not_of('_')};
+			if (a_under != b_under) {
+				return a_under < b_under;
+			}
+			return a.name < b.name;
+		});
+		/* .dynsym mostly repeats .symtab */
+		syms.erase(std::unique(syms.begin(), syms.end(), [](const pending_t& a, const pending_t& b) {
+			return a.sym->st_value == b.sym->st_value && a.name == b.name;
+		}), syms.end());
+
+		std::string strings{};
+		std::unordered_map<std::string_view, std::uint32_t> string_offsets{};
+		std::vector<symcache_entry_t> entries{};
+		entries.reserve(syms.size());
+		for (const auto& sym : syms) {
+			auto [it, inserted] = string_offsets.try_emplace(sym.name, static_cast<std::uint32_t>(strings.size()));
+			if (inserted) {
+				strings.append(sym.name);
+				strings.push_back('\0');
+			}
+			entries.push_back({
+				sym.sym->st_value, sym.sym->st_size, it->second, gnu_hash(sym.name),
+				ELF64_ST_TYPE(sym.sym->st_info), ELF64_ST_BIND(sym.sym->st_info),
+				static_cast<std::uint8_t>(sym.sym->st_shndx == SHN_ABS), {}
+			});
+		}
+
+		symcache_header_t hdr{};
+		hdr.magic = symcache_magic;
+		hdr.version = symcache_version;
+		hdr.build_id_len = static_cast<std::uint32_t>(std::min(build_id.size, hdr.build_id.size()));
+		std::copy_n(build_id.data, hdr.build_id_len, hdr.build_id.begin());
+		hdr.count = entries.size();
+		hdr.nbuckets = entries.size() / 2U + 1U;
+		hdr.entries = align8(sizeof(hdr));
+		hdr.buckets = hdr.entries + (hdr.count * sizeof(symcache_entry_t));
+		hdr.chain = hdr.buckets + (hdr.nbuckets * sizeof(std::uint32_t));
+		hdr.strings = hdr.chain + (hdr.count * sizeof(std::uint32_t));
+		hdr.strings_len = strings.size();
+
+		std::vector<std::uint32_t> buckets(hdr.nbuckets, symcache_end);
+		std::vector<std::uint32_t> chain(hdr.count, symcache_end);
+		/* Built back to front so each chain ends up in address order */
+		for (auto idx{entries.size()}; idx-- > 0U;) {
+			auto& head{buckets[entries[idx].hash % hdr.nbuckets]};
+			chain[idx] = head;
+			head = static_cast<std::uint32_t>(idx);
+		}
+
+		_owned.resize(hdr.strings + hdr.strings_len);
+		std::memcpy(_owned.data(), &hdr, sizeof(hdr));
+		std::memcpy(_owned.data() + hdr.entries, entries.data(), entries.size() * sizeof(symcache_entry_t));
+		std::memcpy(_owned.data() + hdr.buckets, buckets.data(), buckets.size() * sizeof(std::uint32_t));
+		std::memcpy(_owned.data() + hdr.chain, chain.data(), chain.size() * sizeof(std::uint32_t));
+		std::memcpy(_owned.data() + hdr.strings, strings.data(), strings.size());
+
+		_data = _owned.data();
+		_len = _owned.size();
+	}
+
+	void symcache_t::validate(const elf_bytes_t build_id) noexcept {
+		const auto invalidate = [&]() noexcept {
+			_map = mmap_t{};
+			_data = nullptr;
+			_len = 0U;
+		};
+
+		if (
+			_data == nullptr || _len < sizeof(symcache_header_t) ||
+			reinterpret_cast<std::uintptr_t>(_data) % alignof(symcache_header_t) != 0U
+		) {
+			return invalidate();
+		}
+		const auto& hdr{header()};
+		if (hdr.magic != symcache_magic || hdr.version != symcache_version || !same_build_id(hdr, build_id)) {
+			return invalidate();
+		}
+
+		const auto fits = [&](const std::uint64_t offset, const std::uint64_t count, const std::uint64_t size) noexcept {
+			return offset <= _len && count <= (_len - offset) / size;
+		};
+		if (
+			hdr.count >= symcache_end || hdr.entries % alignof(symcache_entry_t) != 0U ||
+			hdr.buckets % alignof(std::uint32_t) != 0U || hdr.chain % alignof(std::uint32_t) != 0U ||
+			!fits(hdr.entries, hdr.count, sizeof(symcache_entry_t)) ||
+			!fits(hdr.buckets, hdr.nbuckets, sizeof(std::uint32_t)) ||
+			!fits(hdr.chain, hdr.count, sizeof(std::uint32_t)) ||
+			!fits(hdr.strings, hdr.strings_len, 1U)
+		) {
+			return invalidate();
+		}
+
+		/* Every link has to land on an entry or end the chain, `lookup` caps the walk in case they loop */
+		const auto linked = [&](const std::uint32_t* const links, const std::uint64_t count) noexcept {
+			return std::all_of(links, links + count, [&](const std::uint32_t link) {
+				return link < hdr.count || link == symcache_end;
+			});
+		};
+		if (!linked(buckets(), hdr.nbuckets) || !linked(chain(), hdr.count)) {
+			return invalidate();
+		}
+	}
+
+	symcache_t symcache_t::load(const fs::path& dir, const elf_bytes_t build_id) noexcept {
+		if (dir.empty() || build_id.empty()) {
+			return {};
+		}
+		return {path(dir, build_id), build_id};
+	}
+
+	symcache_t symcache_t::build(const fs::path& dir, const elf_bytes_t build_id, const fs::path& image) {
+		const elf_t elf{image};
+		if (!elf.valid()) {
+			return {};
+		}
+		symcache_t cache{elf, build_id};
+		if (dir.empty() || build_id.empty()) {
+			return cache;
+		}
+
+		const auto file{path(dir, build_id)};
+		if (cache.write(file)) {
+			/* Swap to the mapping so the heap copy can go away and the page cache is shared with other processes */
+			symcache_t mapped{file, build_id};
+			if (mapped.valid()) {
+				return mapped;
+			}
+		}
+		return cache;
+	}
+
+	fs::path symcache_t::path(const fs::path& dir, const elf_bytes_t build_id) {
+		constexpr std::string_view digits{"0123456789abcdef"};
+		std::string name{};
+		name.reserve((build_id.size * 2U) + 9U);
+		for (std::size_t idx{}; idx < build_id.size; ++idx) {
+			name.push_back(digits[build_id.data[idx] >> 4U]);
+			name.push_back(digits[build_id.data[idx] & 0x0FU]);
+		}
+		name.append(".symcache");
+		return dir / name;
+	}
+
+	bool symcache_t::write(const fs::path& file) const noexcept {
+		if (!valid()) {
+			return false;
+		}
+
+		std::error_code ec{};
+		fs::create_directories(file.parent_path(), ec);
+		if (ec) {
+			return false;
+		}
+
+		/* Written to the side and renamed into place so nobody ever maps a partial cache */
+		auto tmp{file};
+		tmp += "." + std::to_string(::getpid()) + ".tmp";
+		bool written{false};
+		{
+			const fd_t fd{tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644};
+			if (!fd.valid()) {
+				return false;
+			}
+			written = fd.write(_data, _len);
+		}
+
+		if (!written) {
+			fs::remove(tmp, ec);
+			return false;
+		}
+		fs::rename(tmp, file, ec);
+		if (ec) {
+			fs::remove(tmp, ec);
+			return false;
+		}
+		return true;
+	}
+
+	std::string_view symcache_t::name(const symcache_entry_t& entry) const noexcept {
+		const auto& hdr{header()};
+		if (entry.name >= hdr.strings_len) {
+			return {};
+		}
+		const auto str{reinterpret_cast<const char*>(_data + hdr.strings + entry.name)};
+		return {str, ::strnlen(str, hdr.strings_len - entry.name)};
+	}
+
+	const symcache_entry_t* symcache_t::find(const std::uint64_t value) const noexcept {
+		if (empty()) {
+			return nullptr;
+		}
+		const auto begin{entries()};
+		const auto end{begin + size()};
+		const auto it = std::upper_bound(begin, end, value, [](const std::uint64_t val, const symcache_entry_t& entry) {
+			return val < entry.value;
+		});
+		if (it == begin) {
+			return nullptr;
+		}
+
+		const auto closest{(it - 1)->value};
+		const auto first = std::lower_bound(begin, it, closest, [](const symcache_entry_t& entry, const std::uint64_t val) {
+			return entry.value < val;
+		});
+		/* Sized symbols sort ahead of unsized ones at the same address */
+		if (first->size == 0U) {
+			return first;
+		}
+		for (auto entry{first}; entry != it && entry->size != 0U; ++entry) {
+			if (value - entry->value < entry->size) {
+				return entry;
+			}
+		}
+		return nullptr;
+	}
+}
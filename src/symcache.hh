@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* symcache.hh - Memory-mapped on-disk symbol table cache */
+#pragma once
+#if !defined(SYCOPHANT_SYMCACHE_HH)
+#define SYCOPHANT_SYMCACHE_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+#include <string_view>
+#include <filesystem>
+
+#include <mmap.hh>
+#include <elf.hh>
+
+namespace fs = std::filesystem;
+
+namespace sycophant {
+	inline constexpr std::array<char, 8> symcache_magic{{'S', 'Y', 'C', 'S', 'Y', 'M', 'S', '\0'}};
+	inline constexpr std::uint32_t symcache_version{1U};
+	inline constexpr std::uint32_t symcache_end{0xFFFFFFFFU};
+
+	/*
+		The layout of a cache file, all offsets are from the start of the file:
+
+		header | entries (sorted by value) | hash buckets | hash chain | string blob
+
+		The hash table is the same shape as DT_GNU_HASH minus the bloom filter, a bucket holds the
+		index of the first entry with that hash and the chain links entries with the same bucket.
+	*/
+	struct symcache_header_t final {
+		std::array<char, 8> magic;
+		std::uint32_t version;
+		std::uint32_t build_id_len;
+		std::array<std::uint8_t, 64> build_id;
+		std::uint64_t count;
+		std::uint64_t nbuckets;
+		std::uint64_t entries;
+		std::uint64_t buckets;
+		std::uint64_t chain;
+		std::uint64_t strings;
+		std::uint64_t strings_len;
+	};
+
+	struct symcache_entry_t final {
+		/* Link-time address, the module's load bias needs to be added unless `absolute` is set */
+		std::uint64_t value;
+		std::uint64_t size;
+		std::uint32_t name;
+		std::uint32_t hash;
+		std::uint8_t type;
+		std::uint8_t bind;
+		std::uint8_t absolute;
+		std::uint8_t _pad[5];
+	};
+
+	/*
+		A module's symbols (.symtab and .dynsym) flattened into something that can be mapped straight
+		off disk and used with no parsing. Caches are keyed by build-id so they never go stale, they're
+		built from the ELF image the first time a module is seen and written out for next time.
+	*/
+	struct symcache_t final {
+	private:
+		mmap_t _map{};
+		std::vector<std::uint8_t> _owned{};
+		const std::uint8_t* _data{nullptr};
+		std::size_t _len{0};
+
+		/* Only ever used on offsets `validate` has checked are aligned for `T` */
+		template<typename T>
+		[[nodiscard]]
+		const T* at(const std::uint64_t offset) const noexcept {
+			return static_cast<const T*>(__builtin_assume_aligned(_data + offset, alignof(T)));
+		}
+
+		[[nodiscard]]
+		const symcache_header_t& header() const noexcept { return *at<symcache_header_t>(0U); }
+		[[nodiscard]]
+		const std::uint32_t* buckets() const noexcept { return at<std::uint32_t>(header().buckets); }
+		[[nodiscard]]
+		const std::uint32_t* chain() const noexcept { return at<std::uint32_t>(header().chain); }
+
+		void validate(elf_bytes_t build_id) noexcept;
+
+	public:
+		symcache_t() noexcept = default;
+		/* Maps an existing cache, it's left invalid if it's malformed or doesn't match `build_id` */
+		symcache_t(const fs::path& path, elf_bytes_t build_id) noexcept;
+		/* Builds the cache in memory from `image` */
+		symcache_t(const elf_t& image, elf_bytes_t build_id);
+
+		symcache_t(symcache_t&& cache) noexcept : symcache_t{} { swap(cache); }
+		void operator=(symcache_t&& cache) noexcept { swap(cache); }
+		symcache_t(const symcache_t&) = delete;
+		symcache_t& operator=(const symcache_t&) = delete;
+
+		void swap(symcache_t& cache) noexcept {
+			_map.swap(cache._map);
+			_owned.swap(cache._owned);
+			std::swap(_data, cache._data);
+			std::swap(_len, cache._len);
+		}
+
+		/* Maps the cache for `build_id` out of `dir`, it's invalid if there isn't one */
+		[[nodiscard]]
+		static symcache_t load(const fs::path& dir, elf_bytes_t build_id) noexcept;
+		/*
+			Builds the cache for `build_id` from the ELF file at `image` and writes it out to `dir`, if it
+			can't be written the in-memory copy is used.
+		*/
+		[[nodiscard]]
+		static symcache_t build(const fs::path& dir, elf_bytes_t build_id, const fs::path& image);
+
+		[[nodiscard]]
+		static fs::path path(const fs::path& dir, elf_bytes_t build_id);
+
+		/* Atomically writes the cache to `file` */
+		[[nodiscard]]
+		bool write(const fs::path& file) const noexcept;
+
+		[[nodiscard]]
+		bool valid() const noexcept { return _data != nullptr; }
+		[[nodiscard]]
+		bool mapped() const noexcept { return _map.valid(); }
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return valid() ? header().count : 0U; }
+		[[nodiscard]]
+		bool empty() const noexcept { return size() == 0U; }
+
+		[[nodiscard]]
+		const symcache_entry_t* entries() const noexcept {
+			return valid() ? at<symcache_entry_t>(header().entries) : nullptr;
+		}
+		[[nodiscard]]
+		std::string_view name(const symcache_entry_t& entry) const noexcept;
+
+		/* Calls `func` with every entry named `name`, `hash` is its gnu_hash */
+		template<typename func_t>
+		void lookup(const std::string_view name, const std::uint32_t hash, func_t&& func) const {
+			if (empty() || header().nbuckets == 0U) {
+				return;
+			}
+			const auto ents{entries()};
+			/* No chain visits an entry twice unless the file is corrupt */
+			std::uint64_t steps{};
+			for (
+				auto idx{buckets()[hash % header().nbuckets]}; idx < header().count && steps < header().count;
+				idx = chain()[idx], ++steps
+			) {
+				if (ents[idx].hash == hash && this->name(ents[idx]) == name) {
+					func(ents[idx]);
+				}
+			}
+		}
+
+		/* The symbol covering the link-time address `value`, sized symbols are preferred */
+		[[nodiscard]]
+		const symcache_entry_t* find(std::uint64_t value) const noexcept;
+	};
+
+	inline void swap(symcache_t& a, symcache_t& b) noexcept { a.swap(b); }
+}
+
+#endif /* SYCOPHANT_SYMCACHE_HH */
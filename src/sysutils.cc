@@ -11,11 +11,45 @@
 #include <optional>
 
 #include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
 
 #include <strutils.hh>
 #include <fd.hh>
 
 namespace sycophant {
+	namespace {
+		/* Reads all of a small procfs file into `buff` in one go, returning what was read */
+		[[nodiscard]]
+		std::string_view read_small(const std::int32_t dir, const char* const path, std::vector<char>& buff) noexcept {
+			const fd_t fd{::openat(dir, path, O_RDONLY | O_CLOEXEC)};
+			if (!fd.valid()) {
+				return {};
+			}
+			const auto len{::read(fd, buff.data(), buff.size())};
+			return len > 0 ? std::string_view{buff.data(), static_cast<std::size_t>(len)} : std::string_view{};
+		}
+
+		[[nodiscard]]
+		std::uint64_t to_u64(const std::string_view value) noexcept {
+			return static_cast<std::uint64_t>(std::max<std::int64_t>(toint_t<std::int64_t>(value).from_dec(), 0));
+		}
+
+		/* Pulls the next space separated field off the front of `str` */
+		[[nodiscard]]
+		std::string_view next_field(std::string_view& str) noexcept {
+			const auto begin{str.find_first_not_of(' ')};
+			if (begin == std::string_view::npos) {
+				str = {};
+				return {};
+			}
+			str.remove_prefix(begin);
+			const auto end{std::min(str.find_first_of(" \n"), str.size())};
+			const auto field{str.substr(0U, end)};
+			str.remove_prefix(end);
+			return field;
+		}
+	}
 
 	void build_maps(std::vector<mapentry_t>& map_entries) noexcept {
 		map_entries.clear();
@@ -86,6 +120,75 @@ namespace sycophant {
 		}
 	}
 
+	thread_stats_t::~thread_stats_t() noexcept = default;
+
+	thread_stats_t read_thread_stats() {
+		thread_stats_t stats{};
+		const auto task_dir{::opendir("/proc/self/task")};
+		if (task_dir == nullptr) {
+			return stats;
+		}
+		const auto dir{::dirfd(task_dir)};
+		const auto tick_ns{1000000000U / static_cast<std::uint64_t>(std::max(::sysconf(_SC_CLK_TCK), 1L))};
+
+		/* One buffer for every read, the lines are a few hundred bytes at most */
+		std::vector<char> buff(4096U);
+		std::string path{};
+		while (const auto entry{::readdir(task_dir)}) {
+			const std::string_view tid{entry->d_name};
+			if (tid.empty() || tid[0] < '0' || tid[0] > '9') {
+				continue;
+			}
+
+			path.assign(tid).append("/stat");
+			auto line{read_small(dir, path.c_str(), buff)};
+			/* The name can have spaces and parens in it, so everything is found relative to the last paren */
+			const auto name_start{line.find('(')};
+			const auto name_end{line.rfind(')')};
+			if (name_start == std::string_view::npos || name_end == std::string_view::npos || name_end < name_start) {
+				continue;
+			}
+
+			stats.tid.push_back(toint_t<std::int32_t>(tid).from_dec());
+			stats.name.emplace_back(line.substr(name_start + 1U, name_end - name_start - 1U));
+			line.remove_prefix(name_end + 1U);
+
+			/* Fields are numbered from 1 as in proc(5), the state is field 3 */
+			std::uint64_t user{};
+			std::uint64_t system{};
+			std::int32_t cpu{-1};
+			char state{'?'};
+			for (std::size_t field{3U}; !line.empty(); ++field) {
+				const auto value{next_field(line)};
+				if (value.empty()) {
+					break;
+				}
+				switch (field) {
+					case 3U: state = value[0]; break;
+					case 14U: user = to_u64(value) * tick_ns; break;
+					case 15U: system = to_u64(value) * tick_ns; break;
+					case 39U: cpu = toint_t<std::int32_t>(value).from_dec(); break;
+					default: break;
+				}
+				if (field == 39U) {
+					break;
+				}
+			}
+			stats.state.push_back(state);
+			stats.user.push_back(user);
+			stats.system.push_back(system);
+			stats.cpu.push_back(cpu);
+
+			path.assign(tid).append("/schedstat");
+			auto sched{read_small(dir, path.c_str(), buff)};
+			stats.run.push_back(to_u64(next_field(sched)));
+			stats.wait.push_back(to_u64(next_field(sched)));
+			stats.slices.push_back(to_u64(next_field(sched)));
+		}
+		::closedir(task_dir);
+		return stats;
+	}
+
 	[[nodiscard]]
 	std::optional<std::reference_wrapper<const mapentry_t>> get_map_entry(const std::vector<mapentry_t>& map_entries, std::uintptr_t addr) noexcept {
 		auto res = std::find_if(std::begin(map_entries), std::end(map_entries), [&](const mapentry_t& entry){
@@ -5,14 +5,46 @@
 #define SYCOPHANT_SYSUTILS_HH
 
 #include <vector>
+#include <string>
+#include <cstdint>
+#include <sys/types.h>
 #include <optional>
 
 #include <types.hh>
 
 namespace sycophant {
+	/* Scheduler stats for every thread in the process, stored as columns with one row per thread */
+	struct thread_stats_t final {
+		std::vector<pid_t> tid{};
+		std::vector<std::string> name{};
+		/* The single letter state from /proc, `R`, `S`, `D` and so on */
+		std::vector<char> state{};
+		/* CPU time in nanoseconds, only as precise as the clock tick */
+		std::vector<std::uint64_t> user{};
+		std::vector<std::uint64_t> system{};
+		/* The CPU it last ran on */
+		std::vector<std::int32_t> cpu{};
+		/* From schedstat, nanoseconds spent running and waiting to run, and how many times it was scheduled */
+		std::vector<std::uint64_t> run{};
+		std::vector<std::uint64_t> wait{};
+		std::vector<std::uint64_t> slices{};
+
+		thread_stats_t() noexcept = default;
+		/* Out of line, tearing down nine vectors is too much to inline everywhere one goes away */
+		~thread_stats_t() noexcept;
+		thread_stats_t(thread_stats_t&&) noexcept = default;
+		thread_stats_t& operator=(thread_stats_t&&) noexcept = default;
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return tid.size(); }
+	};
 
 	void build_maps(std::vector<mapentry_t>& map_entries) noexcept;
 
+	/* Reads /proc/self/task/<tid>/{stat,schedstat} for every thread in one go */
+	[[nodiscard]]
+	thread_stats_t read_thread_stats();
+
 	[[nodiscard]]
 	std::optional<std::reference_wrapper<const mapentry_t>> get_map_entry(const std::vector<mapentry_t>& map_entries, std::uintptr_t addr) noexcept;
 }
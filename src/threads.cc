@@ -0,0 +1,396 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* threads.cc - Registry of the threads the process has started */
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#include <algorithm>
+#include <cxxabi.h>
+
+#include <threads.hh>
+
+namespace sycophant {
+	namespace {
+		struct launch_t final {
+			thread_registry_t* registry;
+			thread_slot_t* slot;
+			std::uint64_t generation;
+			void*(*start)(void*);
+			void* args;
+			thread_routine_stats_t* routine;
+			/* CLOCK_MONOTONIC, when pthread_create was called */
+			std::uint64_t spawned;
+		};
+
+		enum struct exit_reason_t : std::uint8_t {
+			returned,
+			exited,
+			cancelled,
+		};
+
+		[[nodiscard]]
+		std::uint64_t monotonic_ns() noexcept {
+			timespec now{};
+			::clock_gettime(CLOCK_MONOTONIC, &now);
+			return (static_cast<std::uint64_t>(now.tv_sec) * 1000000000U) + static_cast<std::uint64_t>(now.tv_nsec);
+		}
+
+		/* Gives the slot back when the thread goes away, however it goes away */
+		struct thread_exit_t final {
+			thread_registry_t* registry{nullptr};
+			thread_slot_t* slot{nullptr};
+			thread_routine_stats_t* routine{nullptr};
+			std::uint64_t entered{0U};
+			exit_reason_t reason{exit_reason_t::cancelled};
+
+			~thread_exit_t() noexcept {
+				if (routine != nullptr) {
+					routine->lifetime.record(monotonic_ns() - entered);
+					switch (reason) {
+						case exit_reason_t::returned:
+							routine->returned.fetch_add(1U, std::memory_order_relaxed);
+							break;
+						case exit_reason_t::exited:
+							routine->exited.fetch_add(1U, std::memory_order_relaxed);
+							break;
+						case exit_reason_t::cancelled:
+							routine->cancelled.fetch_add(1U, std::memory_order_relaxed);
+							break;
+					}
+				}
+				if (registry != nullptr && slot != nullptr) {
+					registry->exited(*slot);
+				}
+			}
+		};
+
+		thread_local thread_exit_t thread_exit{};
+		/* Kept apart from `thread_exit` as it has no destructor, so reading it never needs any TLS setup */
+		[[gnu::tls_model("initial-exec")]]
+		thread_local thread_slot_t* current_slot{nullptr};
+
+		[[nodiscard]]
+		std::uint64_t realtime_ns() noexcept {
+			timespec now{};
+			::clock_gettime(CLOCK_REALTIME, &now);
+			return (static_cast<std::uint64_t>(now.tv_sec) * 1000000000U) + static_cast<std::uint64_t>(now.tv_nsec);
+		}
+
+		void describe(thread_slot_t& slot, const std::uintptr_t start) noexcept {
+			slot.start.store(start, std::memory_order_relaxed);
+			slot.created.store(realtime_ns(), std::memory_order_relaxed);
+			/* Saves a syscall per spawn when the creator is one of ours */
+			const auto creator{current_slot != nullptr ? current_slot->tid.load(std::memory_order_relaxed) : 0};
+			slot.creator.store(creator != 0 ? creator : ::gettid(), std::memory_order_relaxed);
+			slot.tid.store(0, std::memory_order_relaxed);
+		}
+
+		/* Only ever asked of the calling thread, another thread's descriptor may be freed as it exits */
+		void locate_stack(thread_slot_t& slot) noexcept {
+			std::uintptr_t lo{0U};
+			std::uintptr_t hi{0U};
+			pthread_attr_t attr{};
+			if (::pthread_getattr_np(::pthread_self(), &attr) == 0) {
+				void* addr{nullptr};
+				std::size_t size{};
+				if (::pthread_attr_getstack(&attr, &addr, &size) == 0) {
+					lo = reinterpret_cast<std::uintptr_t>(addr);
+					hi = lo + size;
+				}
+				static_cast<void>(::pthread_attr_destroy(&attr));
+			}
+			slot.stack_lo.store(lo, std::memory_order_relaxed);
+			slot.stack_hi.store(hi, std::memory_order_relaxed);
+		}
+
+		/* Run on the thread itself */
+		void identify(thread_slot_t& slot) noexcept {
+			slot.name.fill('\0');
+			static_cast<void>(::prctl(PR_GET_NAME, slot.name.data()));
+			locate_stack(slot);
+			slot.tid.store(::gettid(), std::memory_order_release);
+		}
+	}
+
+	thread_slot_t* thread_registry_t::slot(const std::uint32_t index) const noexcept {
+		const auto chunk{_chunks[index / chunk_size].load(std::memory_order_acquire)};
+		return chunk != nullptr ? &chunk[index % chunk_size] : nullptr;
+	}
+
+	thread_slot_t* thread_registry_t::allocate(const std::uint32_t index) noexcept {
+		auto& chunk{_chunks[index / chunk_size]};
+		auto slots{chunk.load(std::memory_order_acquire)};
+		if (slots == nullptr) {
+			auto fresh{new (std::nothrow) thread_slot_t[chunk_size]};
+			if (fresh == nullptr) {
+				return nullptr;
+			}
+			const auto base{static_cast<std::uint32_t>(index - (index % chunk_size))};
+			for (std::uint32_t idx{}; idx < chunk_size; ++idx) {
+				fresh[idx].index = base + idx;
+			}
+			/* Someone else may have grown it first, theirs wins */
+			if (chunk.compare_exchange_strong(slots, fresh, std::memory_order_acq_rel)) {
+				slots = fresh;
+			} else {
+				delete[] fresh;
+			}
+		}
+		return &slots[index % chunk_size];
+	}
+
+	thread_slot_t* thread_registry_t::acquire(std::uint64_t& generation) noexcept {
+		thread_slot_t* entry{nullptr};
+		auto head{_free.load(std::memory_order_acquire)};
+		while ((head & 0xFFFFFFFFU) != 0U) {
+			const auto candidate{slot(static_cast<std::uint32_t>(head & 0xFFFFFFFFU) - 1U)};
+			/* The tag changes on every push and pop so a slot that was popped and pushed back under us fails this */
+			const auto next{((head >> 32U) + 1U) << 32U | candidate->next_free.load(std::memory_order_relaxed)};
+			if (_free.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+				entry = candidate;
+				break;
+			}
+		}
+
+		if (entry == nullptr) {
+			/* Only moved on while there's room so racing creators can't carry it past the end of `_chunks` */
+			auto index{_high.load(std::memory_order_relaxed)};
+			do {
+				if (index >= chunk_size * max_chunks) {
+					return nullptr;
+				}
+			} while (!_high.compare_exchange_weak(index, index + 1U, std::memory_order_acq_rel, std::memory_order_relaxed));
+			entry = allocate(index);
+			if (entry == nullptr) {
+				return nullptr;
+			}
+		}
+
+		generation = thread_slot_t::generation(entry->state.load(std::memory_order_relaxed)) + 1U;
+		entry->handle.store(0U, std::memory_order_relaxed);
+		entry->state.store(thread_slot_t::pack(generation, thread_slot_t::status_t::reserved), std::memory_order_release);
+		return entry;
+	}
+
+	void thread_registry_t::publish(thread_slot_t& slot, const std::uint64_t generation, const pthread_t handle) noexcept {
+		/*
+			Both the creator and the thread itself publish it, whoever gets it out of reserved first writes
+			the handle. A late creator finds the slot gone and leaves it be, and `release` waits for one
+			that's part way through, so the slot can't be handed to another thread while it's writing.
+		*/
+		auto expected{thread_slot_t::pack(generation, thread_slot_t::status_t::reserved)};
+		if (!slot.state.compare_exchange_strong(
+			expected, thread_slot_t::pack(generation, thread_slot_t::status_t::publishing), std::memory_order_acq_rel
+		)) {
+			return;
+		}
+		slot.handle.store(handle, std::memory_order_relaxed);
+		/* Counted before it's live so the release that takes it back off can't get there first */
+		_live.fetch_add(1U, std::memory_order_relaxed);
+		slot.state.store(thread_slot_t::pack(generation, thread_slot_t::status_t::live), std::memory_order_release);
+	}
+
+	void thread_registry_t::release(thread_slot_t& slot) noexcept {
+		auto state{slot.state.load(std::memory_order_acquire)};
+		do {
+			/* Only ever a couple of stores away from done */
+			while (thread_slot_t::status(state) == thread_slot_t::status_t::publishing) {
+				state = slot.state.load(std::memory_order_acquire);
+			}
+		} while (!slot.state.compare_exchange_weak(
+			state, thread_slot_t::pack(thread_slot_t::generation(state), thread_slot_t::status_t::free),
+			std::memory_order_acq_rel, std::memory_order_acquire
+		));
+		if (thread_slot_t::status(state) == thread_slot_t::status_t::free) {
+			return;
+		}
+		if (thread_slot_t::status(state) == thread_slot_t::status_t::live) {
+			_live.fetch_sub(1U, std::memory_order_relaxed);
+		}
+
+		auto head{_free.load(std::memory_order_acquire)};
+		do {
+			slot.next_free.store(static_cast<std::uint32_t>(head & 0xFFFFFFFFU), std::memory_order_relaxed);
+		} while (!_free.compare_exchange_weak(
+			head, ((head >> 32U) + 1U) << 32U | (slot.index + 1U), std::memory_order_acq_rel, std::memory_order_acquire
+		));
+	}
+
+	void* thread_registry_t::trampoline(void* const launch) {
+		const auto entered{monotonic_ns()};
+		const auto info{*static_cast<launch_t*>(launch)};
+		delete static_cast<launch_t*>(launch);
+
+		/* Set before anything else so the slot is given back even if the thread never returns normally */
+		thread_exit.registry = info.registry;
+		thread_exit.slot = info.slot;
+		current_slot = info.slot;
+		if (info.routine != nullptr) {
+			info.routine->spawn_latency.record(entered - info.spawned);
+			thread_exit.routine = info.routine;
+			thread_exit.entered = entered;
+		}
+		identify(*info.slot);
+		info.registry->publish(*info.slot, info.generation, ::pthread_self());
+		if (const auto observer{info.registry->_observer.load(std::memory_order_acquire)}) {
+			observer->started(observer->ctx, *info.slot);
+		}
+
+		try {
+			const auto ret{info.start(info.args)};
+			thread_exit.reason = exit_reason_t::returned;
+			return ret;
+		} catch (abi::__forced_unwind&) {
+			/* pthread_exit and cancellation both unwind, only the former goes through `exiting` first */
+			if (thread_exit.reason != exit_reason_t::exited) {
+				thread_exit.reason = exit_reason_t::cancelled;
+			}
+			throw;
+		}
+	}
+
+	void thread_registry_t::exiting() noexcept {
+		thread_exit.reason = exit_reason_t::exited;
+	}
+
+	thread_routine_stats_t* thread_registry_t::routine(const std::uintptr_t start) noexcept {
+		/* Start routines are at least 16 byte aligned more often than not */
+		auto pos{static_cast<std::size_t>((start >> 4U) * 0x9E3779B97F4A7C15U) % max_routines};
+		for (std::size_t probe{}; probe < max_routines; ++probe, pos = (pos + 1U) % max_routines) {
+			auto entry{_routines[pos].load(std::memory_order_acquire)};
+			if (entry == nullptr) {
+				const auto fresh{new (std::nothrow) thread_routine_stats_t{start}};
+				if (fresh == nullptr) {
+					return nullptr;
+				}
+				if (_routines[pos].compare_exchange_strong(entry, fresh, std::memory_order_acq_rel)) {
+					return fresh;
+				}
+				delete fresh;
+			}
+			if (entry->start == start) {
+				return entry;
+			}
+		}
+		return nullptr;
+	}
+
+	std::int32_t thread_registry_t::create(
+		const pthread_create_t create, pthread_t* const thread, const void* const attr, void*(*start)(void*), void* const args
+	) noexcept {
+		std::uint64_t generation{};
+		const auto entry{acquire(generation)};
+		if (entry == nullptr) {
+			return create(thread, attr, start, args);
+		}
+		describe(*entry, reinterpret_cast<std::uintptr_t>(start));
+		const auto stats{routine(reinterpret_cast<std::uintptr_t>(start))};
+		const auto launch{new (std::nothrow) launch_t{this, entry, generation, start, args, stats, monotonic_ns()}};
+		if (launch == nullptr) {
+			release(*entry);
+			return create(thread, attr, start, args);
+		}
+
+		const auto ret{create(thread, attr, &thread_registry_t::trampoline, launch)};
+		if (ret != 0) {
+			delete launch;
+			release(*entry);
+			return ret;
+		}
+		if (stats != nullptr) {
+			stats->spawned.fetch_add(1U, std::memory_order_relaxed);
+		}
+		/* The thread might not have gotten around to it yet */
+		publish(*entry, generation, *thread);
+		return ret;
+	}
+
+	void thread_registry_t::adopt() noexcept {
+		if (thread_exit.slot != nullptr) {
+			return;
+		}
+		std::uint64_t generation{};
+		const auto entry{acquire(generation)};
+		if (entry == nullptr) {
+			return;
+		}
+		thread_exit.registry = this;
+		thread_exit.slot = entry;
+		describe(*entry, 0U);
+		entry->creator.store(0, std::memory_order_relaxed);
+		identify(*entry);
+		current_slot = entry;
+		publish(*entry, generation, ::pthread_self());
+	}
+
+	void thread_registry_t::exited(thread_slot_t& slot) noexcept {
+		if (const auto observer{_observer.load(std::memory_order_acquire)}) {
+			observer->exited(observer->ctx, slot);
+		}
+		current_slot = nullptr;
+		release(slot);
+	}
+
+	thread_slot_t* thread_registry_t::current() noexcept {
+		return current_slot;
+	}
+
+	std::vector<pthread_t> thread_registry_t::handles() const {
+		std::vector<pthread_t> res{};
+		res.reserve(size());
+		for_each([&](const thread_slot_t& entry) {
+			res.push_back(entry.handle.load(std::memory_order_relaxed));
+		});
+		return res;
+	}
+
+	std::vector<thread_info_t> thread_registry_t::info() const {
+		std::vector<thread_info_t> res{};
+		res.reserve(size());
+		for_each([&](const thread_slot_t& entry) {
+			const auto tid{entry.tid.load(std::memory_order_acquire)};
+			res.push_back({
+				entry.handle.load(std::memory_order_relaxed), tid,
+				tid != 0 ? std::string{entry.name.data(), ::strnlen(entry.name.data(), entry.name.size())} : std::string{},
+				entry.start.load(std::memory_order_relaxed), entry.created.load(std::memory_order_relaxed),
+				entry.creator.load(std::memory_order_relaxed)
+			});
+		});
+		return res;
+	}
+
+	std::vector<thread_routine_info_t> thread_registry_t::routines() const {
+		std::vector<thread_routine_info_t> res{};
+		for (const auto& entry : _routines) {
+			const auto stats{entry.load(std::memory_order_acquire)};
+			if (stats == nullptr) {
+				continue;
+			}
+			res.push_back({
+				stats->start, stats->spawned.load(std::memory_order_relaxed),
+				stats->returned.load(std::memory_order_relaxed), stats->exited.load(std::memory_order_relaxed),
+				stats->cancelled.load(std::memory_order_relaxed), stats->spawn_latency.snapshot(), stats->lifetime.snapshot()
+			});
+		}
+		std::sort(res.begin(), res.end(), [](const auto& a, const auto& b) {
+			return a.start < b.start;
+		});
+		return res;
+	}
+
+	void thread_registry_t::reset_routines() noexcept {
+		for (const auto& entry : _routines) {
+			if (const auto stats{entry.load(std::memory_order_acquire)}) {
+				stats->spawned.store(0U, std::memory_order_relaxed);
+				stats->returned.store(0U, std::memory_order_relaxed);
+				stats->exited.store(0U, std::memory_order_relaxed);
+				stats->cancelled.store(0U, std::memory_order_relaxed);
+				stats->spawn_latency.reset();
+				stats->lifetime.reset();
+			}
+		}
+	}
+}
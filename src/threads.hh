@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* threads.hh - Registry of the threads the process has started */
+#pragma once
+#if !defined(SYCOPHANT_THREADS_HH)
+#define SYCOPHANT_THREADS_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <sys/types.h>
+
+#include <types.hh>
+#include <histogram.hh>
+
+namespace sycophant {
+	/*
+		A thread's entry in the registry. Slots are never freed, once a thread exits its slot goes back
+		on the free list and is handed to the next thread, `state` carries a generation so anyone still
+		holding on to a stale slot can tell.
+	*/
+	struct thread_slot_t final {
+		enum struct status_t : std::uint64_t {
+			free       = 0U,
+			/* Handed out by pthread_create but the thread hasn't been seen yet */
+			reserved   = 1U,
+			live       = 2U,
+			/* Its handle is being filled in, it can't be released until that's done */
+			publishing = 3U,
+		};
+
+		/* generation << 2 | status */
+		std::atomic<std::uint64_t> state{0U};
+		std::atomic<pthread_t> handle{0U};
+		/* Index + 1 of the next slot on the free list */
+		std::atomic<std::uint32_t> next_free{0U};
+		/* Where we are in the registry, set once when the chunk is allocated */
+		std::uint32_t index{0U};
+
+		/* Filled in by the creating thread before the slot is published */
+		std::atomic<std::uintptr_t> start{0U};
+		/* CLOCK_REALTIME, in nanoseconds */
+		std::atomic<std::uint64_t> created{0U};
+		std::atomic<pid_t> creator{0};
+		/* Filled in by the thread itself once it's running, `name` is only meaningful once `tid` is set */
+		std::array<char, 16> name{};
+		std::atomic<pid_t> tid{0};
+		/* [stack_lo, stack_hi) of the thread's stack, both 0 if it couldn't be found. Set along with `tid`. */
+		std::atomic<std::uintptr_t> stack_lo{0U};
+		std::atomic<std::uintptr_t> stack_hi{0U};
+		/* The profiler's per-thread state while the thread is being sampled */
+		std::atomic<void*> profile{nullptr};
+
+		[[nodiscard]]
+		static constexpr std::uint64_t pack(const std::uint64_t generation, const status_t status) noexcept {
+			return (generation << 2U) | static_cast<std::uint64_t>(status);
+		}
+		[[nodiscard]]
+		static constexpr std::uint64_t generation(const std::uint64_t state) noexcept { return state >> 2U; }
+		[[nodiscard]]
+		static constexpr status_t status(const std::uint64_t state) noexcept { return static_cast<status_t>(state & 3U); }
+
+		[[nodiscard]]
+		bool live() const noexcept { return status(state.load(std::memory_order_acquire)) == status_t::live; }
+	};
+
+	/* Told about threads starting and exiting, both are called on the thread itself */
+	struct thread_observer_t final {
+		void (*started)(void* ctx, thread_slot_t& slot) noexcept;
+		void (*exited)(void* ctx, thread_slot_t& slot) noexcept;
+		void* ctx;
+	};
+
+	/* How the threads started with a given start routine have fared, shared by all of them */
+	struct thread_routine_stats_t final {
+		const std::uintptr_t start;
+		std::atomic<std::uint64_t> spawned{0U};
+		/* The start routine returned */
+		std::atomic<std::uint64_t> returned{0U};
+		/* pthread_exit was called */
+		std::atomic<std::uint64_t> exited{0U};
+		/* Unwound without calling pthread_exit, which is cancellation */
+		std::atomic<std::uint64_t> cancelled{0U};
+		/* From pthread_create being called to the start routine being entered, in nanoseconds */
+		atomic_histogram_t spawn_latency{};
+		/* From the start routine being entered to the thread going away, in nanoseconds */
+		atomic_histogram_t lifetime{};
+
+		explicit thread_routine_stats_t(const std::uintptr_t routine) noexcept : start{routine} { }
+	};
+
+	/* A copy of a `thread_routine_stats_t` */
+	struct thread_routine_info_t final {
+		std::uintptr_t start;
+		std::uint64_t spawned;
+		std::uint64_t returned;
+		std::uint64_t exited;
+		std::uint64_t cancelled;
+		histogram_t spawn_latency;
+		histogram_t lifetime;
+	};
+
+	/* A copy of what the registry knows about a thread */
+	struct thread_info_t final {
+		pthread_t handle;
+		/* 0 if the thread hasn't started running yet */
+		pid_t tid;
+		/* The name the thread started with, threads often rename themselves later */
+		std::string name;
+		std::uintptr_t start;
+		std::uint64_t created;
+		pid_t creator;
+	};
+
+	/*
+		Tracks every thread started through pthread_create (and the main thread) without taking a lock.
+		Slots live in chunks that are allocated as the registry grows and never move, registering pops
+		one off a tagged free list or bumps the high water mark and unregistering pushes it back, so both
+		are O(1) no matter how many threads come and go.
+
+		Threads are started through a trampoline that unregisters them from a TLS destructor when they
+		exit, so detached threads and ones that are never joined are covered as well. Along the way it
+		times how long the thread took to start running and how long it lived, which is kept per start
+		routine.
+	*/
+	struct thread_registry_t final {
+	private:
+		static constexpr std::size_t chunk_size{256U};
+		static constexpr std::size_t max_chunks{4096U};
+
+		std::array<std::atomic<thread_slot_t*>, max_chunks> _chunks{};
+		/* Slots that have ever been handed out */
+		std::atomic<std::uint32_t> _high{0U};
+		/* tag << 32 | index + 1 of the top of the free list */
+		std::atomic<std::uint64_t> _free{0U};
+		std::atomic<std::size_t> _live{0U};
+		std::atomic<const thread_observer_t*> _observer{nullptr};
+
+		/* Open addressed by start routine, entries are never removed so they can be used without a lock */
+		static constexpr std::size_t max_routines{1024U};
+		std::array<std::atomic<thread_routine_stats_t*>, max_routines> _routines{};
+
+		/* The stats for `start`, nullptr if the table is full */
+		[[nodiscard]]
+		thread_routine_stats_t* routine(std::uintptr_t start) noexcept;
+
+		[[nodiscard]]
+		thread_slot_t* slot(std::uint32_t index) const noexcept;
+		[[nodiscard]]
+		thread_slot_t* allocate(std::uint32_t index) noexcept;
+
+		/* Not noexcept, pthread_exit and cancellation unwind through it */
+		static void* trampoline(void* launch);
+
+	public:
+		/* The chunks are never freed, threads can still be exiting while the process tears down */
+		thread_registry_t() noexcept = default;
+
+		thread_registry_t(const thread_registry_t&) = delete;
+		thread_registry_t& operator=(const thread_registry_t&) = delete;
+		thread_registry_t(thread_registry_t&&) = delete;
+		thread_registry_t& operator=(thread_registry_t&&) = delete;
+
+		/* A free slot marked reserved, and its generation, or nullptr if we're out of them */
+		[[nodiscard]]
+		thread_slot_t* acquire(std::uint64_t& generation) noexcept;
+		/* Marks the slot live, does nothing if it's been released and reused since `generation` */
+		void publish(thread_slot_t& slot, std::uint64_t generation, pthread_t handle) noexcept;
+		void release(thread_slot_t& slot) noexcept;
+
+		/* Starts a thread with `create` and tracks it until it exits */
+		[[nodiscard]]
+		std::int32_t create(
+			pthread_create_t create, pthread_t* thread, const void* attr, void*(*start)(void*), void* args
+		) noexcept;
+		/* Tracks the calling thread, for the ones that weren't started through `create` */
+		void adopt() noexcept;
+		/* Run from the exiting thread's TLS destructor, tells the observer and gives the slot back */
+		void exited(thread_slot_t& slot) noexcept;
+		/* Called from pthread_exit so the thread's exit is told apart from it being cancelled */
+		static void exiting() noexcept;
+
+		/* Only one observer at a time, it has to outlive any thread that might still be calling into it */
+		void observe(const thread_observer_t* observer) noexcept { _observer.store(observer, std::memory_order_release); }
+
+		/* The calling thread's slot, or nullptr if it isn't tracked. Safe to call from a signal handler. */
+		[[nodiscard]]
+		static thread_slot_t* current() noexcept;
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return _live.load(std::memory_order_relaxed); }
+
+		template<typename func_t>
+		void for_each(func_t&& func) const {
+			const auto high{_high.load(std::memory_order_acquire)};
+			for (std::uint32_t idx{}; idx < high; ++idx) {
+				const auto entry{slot(idx)};
+				if (entry != nullptr && entry->live()) {
+					func(*entry);
+				}
+			}
+		}
+
+		[[nodiscard]]
+		std::vector<pthread_t> handles() const;
+		[[nodiscard]]
+		std::vector<thread_info_t> info() const;
+
+		/* Spawn latency and lifetime stats for every start routine seen so far */
+		[[nodiscard]]
+		std::vector<thread_routine_info_t> routines() const;
+		void reset_routines() noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_THREADS_HH */
@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* trace.cc - Per-thread binary trace rings */
+#include <fcntl.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <trace.hh>
+#include <stats.hh>
+
+namespace sycophant {
+	namespace {
+		constexpr timespec flush_interval{0, 50000000};
+		constexpr std::int32_t trace_flags{O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC};
+
+		[[nodiscard]]
+		trace_clock_t trace_now() noexcept {
+			return {__rdtsc(), stats_clock_ns()};
+		}
+
+		void append(std::vector<std::uint8_t>& out, const void* const data, const std::size_t length) {
+			const auto bytes{static_cast<const std::uint8_t*>(data)};
+			out.insert(out.end(), bytes, bytes + length);
+		}
+
+		template<typename T>
+		void append(std::vector<std::uint8_t>& out, const T& value) {
+			append(out, &value, sizeof(T));
+		}
+
+		void append_chunk(std::vector<std::uint8_t>& out, const trace_chunk_type_t type, const std::size_t length) {
+			append(out, trace_chunk_t{type, static_cast<std::uint32_t>(length)});
+		}
+	}
+
+	trace_t::ring_t::ring_t(mmap_t&& ring, const std::size_t count) noexcept : map{std::move(ring)}, blocks{count} {
+		for (std::size_t idx{}; idx < blocks; ++idx) {
+			new(map.address<block_t>() + idx) block_t{};
+		}
+	}
+
+	trace_t::cursor_t::~cursor_t() noexcept {
+		if (ring != nullptr) {
+			ring->owned.store(false, std::memory_order_release);
+		}
+	}
+
+	trace_t::cursor_t& trace_t::cursor() noexcept {
+		/* There's only the one trace_t, so which one the ring belongs to doesn't need tracking */
+		static thread_local cursor_t current{};
+		if (current.ring != nullptr) {
+			return current;
+		}
+
+		auto ring{_rings.load(std::memory_order_acquire)};
+		for (; ring != nullptr; ring = ring->next) {
+			auto owned{false};
+			if (ring->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+				break;
+			}
+		}
+
+		if (ring == nullptr) {
+			const auto blocks{std::max<std::size_t>(_ring_size.load(std::memory_order_relaxed) / block_size, 2U)};
+			mmap_t map{-1, blocks * block_size, prot_t::RW, MAP_PRIVATE | MAP_ANONYMOUS};
+			if (!map.valid()) {
+				return current;
+			}
+			ring = new(std::nothrow) ring_t{std::move(map), blocks};
+			if (ring == nullptr) {
+				return current;
+			}
+			ring->next = _rings.load(std::memory_order_relaxed);
+			while (!_rings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed)) { }
+		}
+
+		current.ring = ring;
+		current.block = nullptr;
+		current.tid = static_cast<std::uint32_t>(::gettid());
+		return current;
+	}
+
+	trace_t::block_t* trace_t::next_block(cursor_t& cursor, const std::uint64_t tsc) noexcept {
+		auto& ring{*cursor.ring};
+		const auto seq{ring.head.load(std::memory_order_relaxed)};
+		/* The block we'd reuse hasn't been written out yet */
+		if (_mode == trace_mode_t::continuous && seq >= ring.flushed.load(std::memory_order_acquire) + ring.blocks) {
+			return nullptr;
+		}
+
+		const auto session{_session.load(std::memory_order_relaxed)};
+		auto& block{ring.block(seq)};
+		block.seq.store(block_invalid, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		block.used.store(0U, std::memory_order_relaxed);
+		block.header = {tsc, cursor.tid, session};
+		block.seq.store(seq, std::memory_order_release);
+		ring.head.store(seq + 1U, std::memory_order_release);
+
+		cursor.block = &block;
+		cursor.last = tsc;
+		cursor.session = session;
+		return &block;
+	}
+
+	void trace_t::record(const trace_event_t event, const std::uint32_t name, const std::uint64_t value) noexcept {
+		if (!_active.load(std::memory_order_acquire)) {
+			return;
+		}
+		auto& current{cursor()};
+		if (current.ring == nullptr) {
+			_unmapped.fetch_add(1U, std::memory_order_relaxed);
+			return;
+		}
+
+		const auto tsc{__rdtsc()};
+		auto block{current.block};
+		if (
+			block == nullptr || current.session != _session.load(std::memory_order_relaxed) ||
+			block->used.load(std::memory_order_relaxed) + record_max > block->data.size()
+		) {
+			block = next_block(current, tsc);
+			if (block == nullptr) {
+				/* Only ever written by the owning thread */
+				auto& dropped{current.ring->dropped};
+				dropped.store(dropped.load(std::memory_order_relaxed) + 1U, std::memory_order_relaxed);
+				return;
+			}
+		}
+
+		const auto used{block->used.load(std::memory_order_relaxed)};
+		const auto start{block->data.data() + used};
+		auto out{start};
+		*out++ = static_cast<std::uint8_t>(event);
+		out = varint_write(out, tsc > current.last ? tsc - current.last : 0U);
+		out = varint_write(out, name);
+		if (event != trace_event_t::begin) {
+			out = varint_write(out, value);
+		}
+		current.last = tsc;
+		block->used.store(used + static_cast<std::uint32_t>(out - start), std::memory_order_release);
+	}
+
+	bool trace_t::copy_block(ring_t& ring, const std::uint64_t seq, std::vector<std::uint8_t>& out) const {
+		auto& block{ring.block(seq)};
+		if (block.seq.load(std::memory_order_acquire) != seq) {
+			return false;
+		}
+		const auto used{std::min<std::size_t>(block.used.load(std::memory_order_acquire), block.data.size())};
+		const auto header{block.header};
+		if (header.session != _session.load(std::memory_order_relaxed) || used == 0U) {
+			return false;
+		}
+
+		const auto at{out.size()};
+		append_chunk(out, trace_chunk_type_t::block, sizeof(trace_block_t) + used);
+		append(out, header);
+		append(out, block.data.data(), used);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (block.seq.load(std::memory_order_relaxed) != seq) {
+			out.resize(at);
+			return false;
+		}
+		return true;
+	}
+
+	void trace_t::write_header(std::vector<std::uint8_t>& out) const {
+		append(out, trace_header_t{trace_magic, trace_version, static_cast<std::uint32_t>(::getpid())});
+		append_chunk(out, trace_chunk_type_t::clock, sizeof(trace_clock_t));
+		append(out, _started);
+	}
+
+	void trace_t::write_names(std::vector<std::uint8_t>& out) {
+		std::vector<std::uint8_t> names{};
+		{
+			std::lock_guard<std::mutex> lock{_names_lock};
+			for (; _names_written < _names.size(); ++_names_written) {
+				const auto& name{_names[_names_written]};
+				std::array<std::uint8_t, varint_max * 2U> prefix{};
+				auto end{varint_write(prefix.data(), _names_written)};
+				end = varint_write(end, name.size());
+				append(names, prefix.data(), static_cast<std::size_t>(end - prefix.data()));
+				append(names, name.data(), name.size());
+			}
+		}
+		if (!names.empty()) {
+			append_chunk(out, trace_chunk_type_t::names, names.size());
+			append(out, names.data(), names.size());
+		}
+	}
+
+	void trace_t::write_out(const bool all) {
+		const auto flight{_mode == trace_mode_t::flight};
+		std::vector<std::uint8_t> out{};
+		if (flight) {
+			write_header(out);
+			_names_written = 0U;
+		}
+
+		for (auto ring{_rings.load(std::memory_order_acquire)}; ring != nullptr; ring = ring->next) {
+			const auto head{ring->head.load(std::memory_order_acquire)};
+			auto first{head > ring->blocks ? head - ring->blocks : 0U};
+			auto last{head};
+			/* Streaming only takes the block being written to once nothing else will be */
+			if (!flight) {
+				first = ring->flushed.load(std::memory_order_relaxed);
+				last = std::max(first, all || head == 0U ? head : head - 1U);
+			}
+			for (auto seq{first}; seq < last; ++seq) {
+				static_cast<void>(copy_block(*ring, seq, out));
+			}
+			if (!flight) {
+				ring->flushed.store(last, std::memory_order_release);
+			}
+		}
+
+		/* After the blocks, so every name they use is in the file */
+		write_names(out);
+		append_chunk(out, trace_chunk_type_t::clock, sizeof(trace_clock_t));
+		append(out, trace_now());
+
+		if (flight) {
+			const fd_t file{_path, trace_flags, 0644};
+			static_cast<void>(file.write(out.data(), out.size()));
+		} else {
+			static_cast<void>(_file.write(out.data(), out.size()));
+		}
+	}
+
+	void trace_t::flush_loop() noexcept {
+		while (!_stopping.load(std::memory_order_acquire)) {
+			static_cast<void>(::nanosleep(&flush_interval, nullptr));
+			try {
+				std::lock_guard<std::mutex> lock{_lock};
+				write_out(false);
+			} catch (...) {
+				/* Whatever wasn't written is picked up on the next pass */
+			}
+		}
+	}
+
+	bool trace_t::start(const fs::path& path, const trace_mode_t mode, const std::size_t ring_size) {
+		{
+			std::lock_guard<std::mutex> lock{_lock};
+			if (_active.load(std::memory_order_relaxed)) {
+				return false;
+			}
+			fd_t file{path, trace_flags, 0644};
+			if (!file.valid()) {
+				return false;
+			}
+
+			_path = path;
+			_mode = mode;
+			_ring_size.store(std::max(ring_size, block_size * 2U), std::memory_order_relaxed);
+			_started = trace_now();
+			_names_written = 0U;
+			for (auto ring{_rings.load(std::memory_order_acquire)}; ring != nullptr; ring = ring->next) {
+				ring->flushed.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+			}
+			if (mode == trace_mode_t::continuous) {
+				std::vector<std::uint8_t> out{};
+				write_header(out);
+				static_cast<void>(file.write(out.data(), out.size()));
+				_file = std::move(file);
+			}
+
+			_session.fetch_add(1U, std::memory_order_release);
+			_owner.store(::getpid(), std::memory_order_relaxed);
+			_active.store(true, std::memory_order_release);
+		}
+
+		if (mode == trace_mode_t::continuous) {
+			_stopping.store(false, std::memory_order_release);
+			const auto starter{::pthread_self()};
+			_flusher = std::make_unique<worker_pool_t>(1U, [this, starter]() {
+				/* Without a thread of our own it's all written out by `flush` and `stop` */
+				if (!::pthread_equal(::pthread_self(), starter)) {
+					flush_loop();
+				}
+			});
+		}
+		return true;
+	}
+
+	void trace_t::abandon() noexcept {
+		/* Its thread was never here to join, and what's in the rings is the parent's to write out */
+		static_cast<void>(_flusher.release());
+		_active.store(false, std::memory_order_release);
+		_file = fd_t{};
+		_owner.store(0, std::memory_order_relaxed);
+	}
+
+	void trace_t::stop() noexcept {
+		/* Checked before the lock, which could have been held by the parent's flusher when it forked */
+		const auto owner{_owner.load(std::memory_order_relaxed)};
+		if (owner != 0 && owner != ::getpid()) {
+			abandon();
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock{_lock};
+			if (!_active.load(std::memory_order_relaxed)) {
+				return;
+			}
+			_active.store(false, std::memory_order_release);
+		}
+		_stopping.store(true, std::memory_order_release);
+		_flusher.reset();
+
+		std::lock_guard<std::mutex> lock{_lock};
+		try {
+			write_out(true);
+		} catch (...) { }
+		_file = fd_t{};
+		_owner.store(0, std::memory_order_relaxed);
+	}
+
+	void trace_t::flush() {
+		std::lock_guard<std::mutex> lock{_lock};
+		if (_active.load(std::memory_order_relaxed)) {
+			write_out(false);
+		}
+	}
+
+	std::uint64_t trace_t::dropped() const noexcept {
+		auto res{_unmapped.load(std::memory_order_relaxed)};
+		for (auto ring{_rings.load(std::memory_order_acquire)}; ring != nullptr; ring = ring->next) {
+			res += ring->dropped.load(std::memory_order_relaxed);
+		}
+		return res;
+	}
+
+	std::uint32_t trace_t::intern(const std::string_view name) {
+		std::lock_guard<std::mutex> lock{_names_lock};
+		const auto [entry, inserted] = _name_ids.try_emplace(std::string{name}, static_cast<std::uint32_t>(_names.size()));
+		if (inserted) {
+			_names.emplace_back(name);
+		}
+		return entry->second;
+	}
+}
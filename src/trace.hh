@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* trace.hh - Per-thread binary trace rings */
+#pragma once
+#if !defined(SYCOPHANT_TRACE_HH)
+#define SYCOPHANT_TRACE_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <filesystem>
+#include <sys/types.h>
+
+#include <fd.hh>
+#include <mmap.hh>
+#include <workers.hh>
+
+namespace fs = std::filesystem;
+
+namespace sycophant {
+	/*
+		A trace file is a `trace_header_t` followed by chunks, each a `trace_chunk_t` and its payload:
+			clock - a `trace_clock_t`, every flush adds one so the decoder can turn TSC ticks into time
+			names - (varint id, varint length, bytes)* for the names records refer to
+			block - a `trace_block_t` followed by records
+		A record is its `trace_event_t` byte, the varint TSC delta from the record before it (from the
+		block's TSC for the first one) and the varint name id, everything but `begin` adds a varint value.
+	*/
+	inline constexpr std::array<char, 8> trace_magic{{'S', 'Y', 'C', 'O', 'T', 'R', 'C', 'E'}};
+	inline constexpr std::uint32_t trace_version{1U};
+
+	struct trace_header_t final {
+		std::array<char, 8> magic;
+		std::uint32_t version;
+		std::uint32_t pid;
+	};
+
+	enum struct trace_chunk_type_t : std::uint32_t {
+		clock = 1U,
+		names = 2U,
+		block = 3U,
+	};
+
+	struct trace_chunk_t final {
+		trace_chunk_type_t type;
+		std::uint32_t length;
+	};
+
+	struct trace_clock_t final {
+		std::uint64_t tsc;
+		/* CLOCK_MONOTONIC */
+		std::uint64_t ns;
+	};
+
+	struct trace_block_t final {
+		std::uint64_t tsc;
+		std::uint32_t tid;
+		/* Which `trace_t::start` the block was written under */
+		std::uint32_t session;
+	};
+
+	enum struct trace_event_t : std::uint8_t {
+		begin = 1U,
+		end = 2U,
+		instant = 3U,
+		counter = 4U,
+	};
+
+	constexpr std::size_t varint_max{10U};
+
+	inline std::uint8_t* varint_write(std::uint8_t* out, std::uint64_t value) noexcept {
+		while (value >= 0x80U) {
+			*out++ = static_cast<std::uint8_t>(value | 0x80U);
+			value >>= 7U;
+		}
+		*out++ = static_cast<std::uint8_t>(value);
+		return out;
+	}
+
+	[[nodiscard]]
+	inline bool varint_read(const std::uint8_t*& in, const std::uint8_t* const end, std::uint64_t& value) noexcept {
+		value = 0U;
+		for (std::uint32_t shift{}; in != end && shift < 64U; shift += 7U) {
+			const auto byte{*in++};
+			value |= static_cast<std::uint64_t>(byte & 0x7FU) << shift;
+			if ((byte & 0x80U) == 0U) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/* Bytes of ring each thread gets unless asked otherwise */
+	inline constexpr std::size_t trace_ring_default{1024U * 1024U};
+
+	enum struct trace_mode_t : std::uint8_t {
+		/* Only the newest events are kept, they're written out on `flush` and `stop` */
+		flight,
+		/* Everything is streamed out to the file, a thread drops events when it gets a full ring ahead */
+		continuous,
+	};
+
+	/*
+		Every thread records into a ring of fixed size blocks mapped just for it, so recording never takes
+		a lock and never touches a line another thread writes. A record never spans blocks and every block
+		carries its own timestamp and thread, so any run of blocks decodes on its own. Rings are handed to
+		the next new thread once their owner exits and are never unmapped.
+
+		Blocks are read out with a sequence check rather than stopping the writer, a block that was reused
+		while it was being copied is just left out.
+	*/
+	struct trace_t final {
+	private:
+		static constexpr std::size_t block_size{4096U};
+		static constexpr std::uint64_t block_invalid{~std::uint64_t{}};
+		static constexpr std::size_t record_max{1U + (varint_max * 3U)};
+
+		struct block_t final {
+			std::atomic<std::uint64_t> seq{block_invalid};
+			std::atomic<std::uint32_t> used{0U};
+			std::uint32_t _pad{};
+			trace_block_t header{};
+			std::array<std::uint8_t, block_size - 32U> data{};
+		};
+		static_assert(sizeof(block_t) == block_size);
+
+		struct ring_t final {
+			mmap_t map;
+			std::size_t blocks;
+			/* Blocks ever started, the current one is `head - 1` */
+			std::atomic<std::uint64_t> head{0U};
+			/* Blocks written out in continuous mode */
+			std::atomic<std::uint64_t> flushed{0U};
+			std::atomic<std::uint64_t> dropped{0U};
+			std::atomic<bool> owned{true};
+			ring_t* next{nullptr};
+
+			ring_t(mmap_t&& ring, std::size_t count) noexcept;
+
+			[[nodiscard]]
+			block_t& block(const std::uint64_t seq) noexcept {
+				return map.address<block_t>()[seq % blocks];
+			}
+		};
+
+		/* The thread's own place in its ring */
+		struct cursor_t final {
+			ring_t* ring{nullptr};
+			block_t* block{nullptr};
+			std::uint64_t last{0U};
+			std::uint32_t tid{0U};
+			std::uint32_t session{0U};
+
+			~cursor_t() noexcept;
+		};
+
+		std::atomic<bool> _active{false};
+		std::atomic<std::uint32_t> _session{0U};
+		std::atomic<std::size_t> _ring_size{0U};
+		trace_mode_t _mode{trace_mode_t::flight};
+		std::atomic<ring_t*> _rings{nullptr};
+		/* Events from threads that couldn't get a ring */
+		std::atomic<std::uint64_t> _unmapped{0U};
+
+		std::mutex _names_lock{};
+		std::vector<std::string> _names{};
+		std::unordered_map<std::string, std::uint32_t> _name_ids{};
+
+		/* Held while writing to the file or starting and stopping */
+		std::mutex _lock{};
+		fs::path _path{};
+		fd_t _file{};
+		trace_clock_t _started{};
+		std::size_t _names_written{0U};
+
+		std::atomic<bool> _stopping{false};
+		/* The process that started it, a child forked without exec has a copy of all this but not the thread */
+		std::atomic<::pid_t> _owner{0};
+		/* Declared last so it's joined before anything it uses goes away */
+		std::unique_ptr<worker_pool_t> _flusher{};
+
+		[[nodiscard]]
+		cursor_t& cursor() noexcept;
+		[[nodiscard]]
+		block_t* next_block(cursor_t& cursor, std::uint64_t tsc) noexcept;
+
+		/* Appends the block to `out` if it's still `seq` and from the current session */
+		[[nodiscard]]
+		bool copy_block(ring_t& ring, std::uint64_t seq, std::vector<std::uint8_t>& out) const;
+		void write_header(std::vector<std::uint8_t>& out) const;
+		void write_names(std::vector<std::uint8_t>& out);
+		/* `_lock` must be held, `all` also takes the blocks still being written to */
+		void write_out(bool all);
+		void flush_loop() noexcept;
+		/* Lets go of a forked child's copy without touching the parent's thread, lock or file */
+		void abandon() noexcept;
+
+	public:
+		trace_t() noexcept = default;
+		~trace_t() noexcept { stop(); }
+
+		trace_t(const trace_t&) = delete;
+		trace_t& operator=(const trace_t&) = delete;
+
+		/* Starts recording with `ring_size` bytes of ring per thread, false if it's already running */
+		[[nodiscard]]
+		bool start(const fs::path& path, trace_mode_t mode, std::size_t ring_size);
+		/* Stops recording and writes out what's left */
+		void stop() noexcept;
+		/* Writes out the flight recorder as it is now, replacing whatever was in the file */
+		void flush();
+
+		[[nodiscard]]
+		bool running() const noexcept { return _active.load(std::memory_order_relaxed); }
+		/* Events thrown away because a ring couldn't be mapped or was full of unwritten blocks */
+		[[nodiscard]]
+		std::uint64_t dropped() const noexcept;
+
+		/* Names are interned once and never freed, do this up front rather than per event */
+		[[nodiscard]]
+		std::uint32_t intern(std::string_view name);
+
+		void record(trace_event_t event, std::uint32_t name, std::uint64_t value = 0U) noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_TRACE_HH */
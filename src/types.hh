@@ -17,6 +17,7 @@ using dlsym_t = void*(*)(void*, const char*);
 using pthread_t = unsigned long int;
 using pthread_create_t = std::int32_t(*)(pthread_t*, const void*, void*(*)(void*), void*);
 using pthread_join_t = std::int32_t(*)(pthread_t, void**);
+using pthread_exit_t = void(*)(void*);
 
 namespace sycophant {
 	template<typename F>
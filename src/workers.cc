@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* workers.cc - Short-lived internal worker threads */
+#include <dlfcn.h>
+
+#include <types.hh>
+#include <workers.hh>
+
+namespace sycophant {
+	namespace {
+		[[nodiscard]]
+		pthread_create_t real_pthread_create() noexcept {
+			static const auto func{reinterpret_cast<pthread_create_t>(dlsym(RTLD_NEXT, "pthread_create"))};
+			return func;
+		}
+	}
+
+	worker_pool_t::worker_pool_t(const std::size_t count, std::function<void()> job) : _job{std::move(job)} {
+		const auto create{real_pthread_create()};
+		if (create != nullptr) {
+			_threads.reserve(count);
+			for (std::size_t idx{}; idx < count; ++idx) {
+				pthread_t thread{};
+				if (create(&thread, nullptr, &worker_pool_t::run, this) != 0) {
+					break;
+				}
+				_threads.push_back(thread);
+			}
+		}
+		if (_threads.empty()) {
+			_job();
+		}
+	}
+
+	void* worker_pool_t::run(void* const pool) noexcept {
+		try {
+			static_cast<worker_pool_t*>(pool)->_job();
+		} catch (...) {
+			/* There's nobody to hand it to, whatever the job was is just left undone */
+		}
+		return nullptr;
+	}
+
+	void worker_pool_t::join() noexcept {
+		for (const auto thread : _threads) {
+			pthread_join(thread, nullptr);
+		}
+		_threads.clear();
+	}
+}
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* workers.hh - Short-lived internal worker threads */
+#pragma once
+#if !defined(SYCOPHANT_WORKERS_HH)
+#define SYCOPHANT_WORKERS_HH
+
+#include <cstddef>
+#include <vector>
+#include <functional>
+#include <pthread.h>
+
+namespace sycophant {
+	/*
+		A handful of threads all running the same job, they're joined when the pool goes away. The
+		threads are started with the real pthread_create so they never show up as threads of the
+		process we're attached to. If no thread could be started the job is run on the caller.
+	*/
+	struct worker_pool_t final {
+	private:
+		std::function<void()> _job;
+		std::vector<pthread_t> _threads{};
+
+		static void* run(void* pool) noexcept;
+
+	public:
+		worker_pool_t(std::size_t count, std::function<void()> job);
+		~worker_pool_t() noexcept { join(); }
+
+		worker_pool_t(const worker_pool_t&) = delete;
+		worker_pool_t& operator=(const worker_pool_t&) = delete;
+		worker_pool_t(worker_pool_t&&) = delete;
+		worker_pool_t& operator=(worker_pool_t&&) = delete;
+
+		[[nodiscard]]
+		std::size_t size() const noexcept { return _threads.size(); }
+
+		void join() noexcept;
+	};
+}
+
+#endif /* SYCOPHANT_WORKERS_HH */
@@ -0,0 +1,465 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* x86_64.cc - x86-64 instruction length decoding and relocation */
+
+#include <x86_64.hh>
+
+#include <cstring>
+
+namespace sycophant::x86_64 {
+	namespace {
+		enum struct imm_t : std::uint8_t {
+			NONE,
+			BYTE,
+			WORD,
+			/* 16 or 32-bits depending on the operand size */
+			Z,
+			/* 16, 32, or 64-bits depending on the operand size (mov r, imm) */
+			V,
+			/* `enter` has a 16-bit and an 8-bit immediate */
+			ENTER,
+			/* 32 or 64-bits depending on the address size (mov al, moffs) */
+			MOFFS,
+			REL8,
+			REL32,
+		};
+
+		struct opinfo_t final {
+			bool valid{true};
+			bool modrm{false};
+			imm_t imm{imm_t::NONE};
+			branch_t branch{branch_t::NONE};
+		};
+
+		[[nodiscard]]
+		constexpr bool is_prefix(const std::uint8_t byte) noexcept {
+			switch (byte) {
+				case 0xF0U: case 0xF2U: case 0xF3U:
+				case 0x2EU: case 0x36U: case 0x3EU: case 0x26U: case 0x64U: case 0x65U:
+				case 0x66U: case 0x67U:
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		[[nodiscard]]
+		constexpr opinfo_t invalid() noexcept {
+			return {false, false, imm_t::NONE, branch_t::NONE};
+		}
+
+		[[nodiscard]]
+		constexpr opinfo_t one_byte(const std::uint8_t op) noexcept {
+			switch (op) {
+				case 0x06U: case 0x07U: case 0x0EU: case 0x16U: case 0x17U: case 0x1EU: case 0x1FU:
+				case 0x27U: case 0x2FU: case 0x37U: case 0x3FU: case 0x60U: case 0x61U:
+				case 0x82U: case 0x9AU: case 0xCEU: case 0xD4U: case 0xD5U: case 0xD6U: case 0xEAU:
+					return invalid();
+				default:
+					break;
+			}
+
+			if (op < 0x40U) {
+				switch (op & 0x07U) {
+					case 0x04U: return {true, false, imm_t::BYTE, branch_t::NONE};
+					case 0x05U: return {true, false, imm_t::Z, branch_t::NONE};
+					default:    return {true, true, imm_t::NONE, branch_t::NONE};
+				}
+			}
+
+			if (op >= 0x50U && op <= 0x5FU) {
+				return {};
+			} else if (op >= 0x70U && op <= 0x7FU) {
+				return {true, false, imm_t::REL8, branch_t::JCC_REL8};
+			} else if (op >= 0x84U && op <= 0x8FU) {
+				return {true, true, imm_t::NONE, branch_t::NONE};
+			} else if (op >= 0x90U && op <= 0x9FU) {
+				return {};
+			} else if (op >= 0xA0U && op <= 0xA3U) {
+				return {true, false, imm_t::MOFFS, branch_t::NONE};
+			} else if (op >= 0xB0U && op <= 0xB7U) {
+				return {true, false, imm_t::BYTE, branch_t::NONE};
+			} else if (op >= 0xB8U && op <= 0xBFU) {
+				return {true, false, imm_t::V, branch_t::NONE};
+			} else if ((op >= 0xD0U && op <= 0xD3U) || (op >= 0xD8U && op <= 0xDFU)) {
+				return {true, true, imm_t::NONE, branch_t::NONE};
+			} else if (op >= 0xE0U && op <= 0xE3U) {
+				return {true, false, imm_t::REL8, branch_t::SHORT_ONLY};
+			} else if (op >= 0xE4U && op <= 0xE7U) {
+				return {true, false, imm_t::BYTE, branch_t::NONE};
+			}
+
+			switch (op) {
+				case 0x63U: return {true, true,  imm_t::NONE,  branch_t::NONE};
+				case 0x68U: return {true, false, imm_t::Z,     branch_t::NONE};
+				case 0x69U: return {true, true,  imm_t::Z,     branch_t::NONE};
+				case 0x6AU: return {true, false, imm_t::BYTE,  branch_t::NONE};
+				case 0x6BU: return {true, true,  imm_t::BYTE,  branch_t::NONE};
+				case 0x80U: return {true, true,  imm_t::BYTE,  branch_t::NONE};
+				case 0x81U: return {true, true,  imm_t::Z,     branch_t::NONE};
+				case 0x83U: return {true, true,  imm_t::BYTE,  branch_t::NONE};
+				case 0xA8U: return {true, false, imm_t::BYTE,  branch_t::NONE};
+				case 0xA9U: return {true, false, imm_t::Z,     branch_t::NONE};
+				case 0xC0U: return {true, true,  imm_t::BYTE,  branch_t::NONE};
+				case 0xC1U: return {true, true,  imm_t::BYTE,  branch_t::NONE};
+				case 0xC2U: return {true, false, imm_t::WORD,  branch_t::TERMINATOR};
+				case 0xC3U: return {true, false, imm_t::NONE,  branch_t::TERMINATOR};
+				case 0xC6U: return {true, true,  imm_t::BYTE,  branch_t::NONE};
+				case 0xC7U: return {true, true,  imm_t::Z,     branch_t::NONE};
+				case 0xC8U: return {true, false, imm_t::ENTER, branch_t::NONE};
+				case 0xCAU: return {true, false, imm_t::WORD,  branch_t::TERMINATOR};
+				case 0xCBU: return {true, false, imm_t::NONE,  branch_t::TERMINATOR};
+				case 0xCCU: return {true, false, imm_t::NONE,  branch_t::TERMINATOR};
+				case 0xCDU: return {true, false, imm_t::BYTE,  branch_t::NONE};
+				case 0xCFU: return {true, false, imm_t::NONE,  branch_t::TERMINATOR};
+				case 0xE8U: return {true, false, imm_t::REL32, branch_t::CALL_REL32};
+				case 0xE9U: return {true, false, imm_t::REL32, branch_t::JMP_REL32};
+				case 0xEBU: return {true, false, imm_t::REL8,  branch_t::JMP_REL8};
+				case 0xF4U: return {true, false, imm_t::NONE,  branch_t::TERMINATOR};
+				/* These depend on the ModRM reg field, they're fixed up after the ModRM is read */
+				case 0xF6U: case 0xF7U: case 0xFEU: case 0xFFU:
+					return {true, true, imm_t::NONE, branch_t::NONE};
+				default:
+					/* Everything else left over has no operands (string ops, flags, etc) */
+					return {};
+			}
+		}
+
+		[[nodiscard]]
+		constexpr bool two_byte_imm8(const std::uint8_t op) noexcept {
+			return (op >= 0x70U && op <= 0x73U) || op == 0xA4U || op == 0xACU || op == 0xBAU ||
+				op == 0xC2U || (op >= 0xC4U && op <= 0xC6U);
+		}
+
+		[[nodiscard]]
+		constexpr opinfo_t two_byte(const std::uint8_t op) noexcept {
+			switch (op) {
+				case 0x04U: case 0x0AU: case 0x0CU: case 0x0FU: case 0x24U: case 0x25U: case 0x26U: case 0x27U:
+				case 0x39U: case 0x3BU: case 0x3CU: case 0x3DU: case 0x3EU: case 0x3FU:
+				case 0x7AU: case 0x7BU: case 0xA6U: case 0xA7U:
+					return invalid();
+				case 0x0BU:
+					return {true, false, imm_t::NONE, branch_t::TERMINATOR};
+				case 0x05U: case 0x06U: case 0x07U: case 0x08U: case 0x09U: case 0x0EU: case 0x77U:
+				case 0xA0U: case 0xA1U: case 0xA2U: case 0xA8U: case 0xA9U: case 0xAAU:
+					return {};
+				default:
+					break;
+			}
+
+			if ((op >= 0x30U && op <= 0x37U) || (op >= 0xC8U && op <= 0xCFU)) {
+				return {};
+			} else if (op >= 0x80U && op <= 0x8FU) {
+				return {true, false, imm_t::REL32, branch_t::JCC_REL32};
+			}
+
+			return {true, true, two_byte_imm8(op) ? imm_t::BYTE : imm_t::NONE, branch_t::NONE};
+		}
+
+		[[nodiscard]]
+		std::int32_t read_i32(const std::uint8_t* const ptr) noexcept {
+			std::int32_t val{};
+			std::memcpy(&val, ptr, sizeof(val));
+			return val;
+		}
+
+		void write_i32(std::uint8_t* const ptr, const std::int32_t val) noexcept {
+			std::memcpy(ptr, &val, sizeof(val));
+		}
+
+		void emit_i32(std::vector<std::uint8_t>& out, const std::int32_t val) {
+			std::uint8_t buff[sizeof(val)]{};
+			write_i32(buff, val);
+			out.insert(out.end(), std::begin(buff), std::end(buff));
+		}
+	}
+
+	std::optional<insn_t> decode(const std::uint8_t* const code) noexcept {
+		insn_t insn{};
+		std::size_t pos{};
+		bool opsize{false};
+		bool addrsize{false};
+		bool rex_w{false};
+
+		for (; pos < max_insn_len && is_prefix(code[pos]); ++pos) {
+			if (code[pos] == 0x66U) {
+				opsize = true;
+			} else if (code[pos] == 0x67U) {
+				addrsize = true;
+			}
+		}
+
+		if (pos >= max_insn_len) {
+			return std::nullopt;
+		}
+
+		if ((code[pos] & 0xF0U) == 0x40U) {
+			rex_w = (code[pos] & 0x08U) != 0U;
+			++pos;
+		}
+
+		const auto op{code[pos++]};
+		opinfo_t info{};
+
+		if (op == 0xC4U || op == 0xC5U || op == 0x62U) {
+			/* VEX/EVEX, the implied leading opcode bytes come from the map select field */
+			std::uint8_t map{1U};
+			if (op == 0x62U) {
+				map = code[pos] & 0x03U;
+				pos += 3U;
+			} else if (op == 0xC4U) {
+				map = code[pos] & 0x1FU;
+				rex_w = (code[pos + 1U] & 0x80U) != 0U;
+				pos += 2U;
+			} else {
+				pos += 1U;
+			}
+
+			const auto vop{code[pos++]};
+			switch (map) {
+				case 1U:
+					info = {true, vop != 0x77U, two_byte_imm8(vop) ? imm_t::BYTE : imm_t::NONE, branch_t::NONE};
+					break;
+				case 2U:
+					info = {true, true, imm_t::NONE, branch_t::NONE};
+					break;
+				case 3U:
+					info = {true, true, imm_t::BYTE, branch_t::NONE};
+					break;
+				default:
+					return std::nullopt;
+			}
+		} else if (op == 0x0FU) {
+			const auto op2{code[pos++]};
+			if (op2 == 0x38U) {
+				++pos;
+				info = {true, true, imm_t::NONE, branch_t::NONE};
+			} else if (op2 == 0x3AU) {
+				++pos;
+				info = {true, true, imm_t::BYTE, branch_t::NONE};
+			} else {
+				info = two_byte(op2);
+				insn.cond = op2 & 0x0FU;
+			}
+		} else {
+			info = one_byte(op);
+			insn.cond = op & 0x0FU;
+		}
+
+		if (!info.valid) {
+			return std::nullopt;
+		}
+
+		if (info.modrm) {
+			const auto modrm{code[pos++]};
+			const auto mod{static_cast<std::uint8_t>(modrm >> 6U)};
+			const auto reg{static_cast<std::uint8_t>((modrm >> 3U) & 0x07U)};
+			const auto rm{static_cast<std::uint8_t>(modrm & 0x07U)};
+
+			if (mod != 3U) {
+				std::size_t disp{};
+				if (rm == 4U) {
+					const auto sib{code[pos++]};
+					if (mod == 0U && (sib & 0x07U) == 5U) {
+						disp = 4U;
+					}
+				} else if (mod == 0U && rm == 5U) {
+					insn.rip_rel = true;
+					insn.rel_offset = pos;
+					disp = 4U;
+				}
+
+				if (mod == 1U) {
+					disp = 1U;
+				} else if (mod == 2U) {
+					disp = 4U;
+				}
+				pos += disp;
+			}
+
+			switch (op) {
+				case 0xF6U:
+					info.imm = reg < 2U ? imm_t::BYTE : imm_t::NONE;
+					break;
+				case 0xF7U:
+					info.imm = reg < 2U ? imm_t::Z : imm_t::NONE;
+					break;
+				case 0xFFU:
+					if (reg == 2U || reg == 3U) {
+						info.branch = branch_t::CALL_INDIRECT;
+					} else if (reg == 4U || reg == 5U) {
+						info.branch = branch_t::TERMINATOR;
+					}
+					break;
+				case 0xC7U:
+					/* xbegin carries a branch offset, we'll never see one in a prologue anyway */
+					if (modrm == 0xF8U) {
+						return std::nullopt;
+					}
+					break;
+				default:
+					break;
+			}
+		}
+
+		if (info.branch != branch_t::NONE && info.branch != branch_t::TERMINATOR &&
+			info.branch != branch_t::CALL_INDIRECT) {
+			if (opsize) {
+				return std::nullopt;
+			}
+			insn.rel_offset = pos;
+		}
+
+		switch (info.imm) {
+			case imm_t::NONE:
+				break;
+			case imm_t::BYTE:
+			case imm_t::REL8:
+				pos += 1U;
+				break;
+			case imm_t::WORD:
+				pos += 2U;
+				break;
+			case imm_t::ENTER:
+				pos += 3U;
+				break;
+			case imm_t::Z:
+				pos += opsize ? 2U : 4U;
+				break;
+			case imm_t::V:
+				pos += rex_w ? 8U : (opsize ? 2U : 4U);
+				break;
+			case imm_t::MOFFS:
+				pos += addrsize ? 4U : 8U;
+				break;
+			case imm_t::REL32:
+				pos += 4U;
+				break;
+		}
+
+		if (pos > max_insn_len) {
+			return std::nullopt;
+		}
+
+		insn.len = pos;
+		insn.branch = info.branch;
+		return insn;
+	}
+
+	void emit_abs_jmp(std::vector<std::uint8_t>& out, const std::uintptr_t target) {
+		const std::uint8_t jmp[]{0xFFU, 0x25U, 0x00U, 0x00U, 0x00U, 0x00U};
+		out.insert(out.end(), std::begin(jmp), std::end(jmp));
+		std::uint8_t addr[sizeof(target)]{};
+		std::memcpy(addr, &target, sizeof(target));
+		out.insert(out.end(), std::begin(addr), std::end(addr));
+	}
+
+	bool emit_rel_jmp(std::vector<std::uint8_t>& out, const std::uintptr_t from, const std::uintptr_t to) {
+		const auto disp{static_cast<std::int64_t>(to - (from + 5U))};
+		if (!fits_rel32(disp)) {
+			return false;
+		}
+		out.push_back(0xE9U);
+		emit_i32(out, static_cast<std::int32_t>(disp));
+		return true;
+	}
+
+	std::optional<std::size_t> relocate(
+		const std::uint8_t* const src, const std::uintptr_t src_addr, const std::size_t min_len,
+		std::vector<std::uint8_t>& out, const std::uintptr_t dst_addr
+	) {
+		std::size_t consumed{};
+		/* Only checked once we know how much is being overwritten */
+		std::vector<std::uintptr_t> targets{};
+
+		while (consumed < min_len) {
+			const auto insn{decode(src + consumed)};
+			if (!insn) {
+				return std::nullopt;
+			}
+
+			const auto bytes{src + consumed};
+			const auto from{src_addr + consumed};
+			const auto here{dst_addr + out.size()};
+			const auto next{from + insn->len};
+			consumed += insn->len;
+
+			switch (insn->branch) {
+				case branch_t::NONE:
+				case branch_t::TERMINATOR: {
+					const auto start{out.size()};
+					out.insert(out.end(), bytes, bytes + insn->len);
+
+					if (insn->rip_rel) {
+						const auto target{next + static_cast<std::uintptr_t>(std::int64_t{read_i32(bytes + insn->rel_offset)})};
+						const auto disp{static_cast<std::int64_t>(target - (here + insn->len))};
+						if (!fits_rel32(disp)) {
+							return std::nullopt;
+						}
+						write_i32(out.data() + start + insn->rel_offset, static_cast<std::int32_t>(disp));
+					}
+
+					/* Whatever follows a terminator isn't ours to move, so it has to be the last thing we take */
+					if (insn->branch == branch_t::TERMINATOR && consumed < min_len) {
+						return std::nullopt;
+					}
+					break;
+				}
+				case branch_t::JMP_REL8:
+				case branch_t::JMP_REL32: {
+					const auto rel{insn->branch == branch_t::JMP_REL8 ?
+						std::int64_t{static_cast<std::int8_t>(bytes[insn->rel_offset])} :
+						std::int64_t{read_i32(bytes + insn->rel_offset)}
+					};
+					const auto target{next + static_cast<std::uintptr_t>(rel)};
+					targets.push_back(target);
+					if (!emit_rel_jmp(out, here, target)) {
+						emit_abs_jmp(out, target);
+					}
+
+					if (consumed < min_len) {
+						return std::nullopt;
+					}
+					break;
+				}
+				case branch_t::JCC_REL8:
+				case branch_t::JCC_REL32: {
+					const auto rel{insn->branch == branch_t::JCC_REL8 ?
+						std::int64_t{static_cast<std::int8_t>(bytes[insn->rel_offset])} :
+						std::int64_t{read_i32(bytes + insn->rel_offset)}
+					};
+					const auto target{next + static_cast<std::uintptr_t>(rel)};
+					targets.push_back(target);
+					const auto disp{static_cast<std::int64_t>(target - (here + 6U))};
+
+					if (fits_rel32(disp)) {
+						out.push_back(0x0FU);
+						out.push_back(static_cast<std::uint8_t>(0x80U | insn->cond));
+						emit_i32(out, static_cast<std::int32_t>(disp));
+					} else {
+						/* Invert the condition to hop over an absolute jump to the real target */
+						out.push_back(static_cast<std::uint8_t>(0x70U | (insn->cond ^ 0x01U)));
+						out.push_back(14U);
+						emit_abs_jmp(out, target);
+					}
+					break;
+				}
+				/*
+					A call would leave a return address pointing into the bytes we're about to overwrite, and
+					there's no rel32 form of the short-only branches, so neither can be moved.
+				*/
+				case branch_t::CALL_REL32:
+				case branch_t::CALL_INDIRECT:
+				case branch_t::SHORT_ONLY:
+					return std::nullopt;
+			}
+		}
+
+		/* A branch back into what's been overwritten would land in the middle of the hook's jump */
+		for (const auto target : targets) {
+			if (target - src_addr < consumed) {
+				return std::nullopt;
+			}
+		}
+		return consumed;
+	}
+}
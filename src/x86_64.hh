@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* x86_64.hh - x86-64 instruction length decoding and relocation */
+#pragma once
+#if !defined(SYCOPHANT_X86_64_HH)
+#define SYCOPHANT_X86_64_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace sycophant::x86_64 {
+	enum struct branch_t : std::uint8_t {
+		NONE,
+		JMP_REL8,
+		JMP_REL32,
+		JCC_REL8,
+		JCC_REL32,
+		CALL_REL32,
+		CALL_INDIRECT,
+		/* loop/jrcxz and friends, there is no rel32 form for these so we can't move them */
+		SHORT_ONLY,
+		/* ret/int3/ud2 etc, nothing after these is guaranteed to be part of the same function */
+		TERMINATOR,
+	};
+
+	struct insn_t final {
+		std::size_t len{};
+		/* Offset of the displacement or branch offset, only valid if `rip_rel` or `branch` is set */
+		std::size_t rel_offset{};
+		bool rip_rel{false};
+		branch_t branch{branch_t::NONE};
+		/* For conditional branches, the condition code nibble */
+		std::uint8_t cond{};
+	};
+
+	constexpr std::size_t max_insn_len{15U};
+
+	/* Length decodes a single instruction, returns nothing if it's not something we understand */
+	[[nodiscard]]
+	std::optional<insn_t> decode(const std::uint8_t* code) noexcept;
+
+	/*
+		Copies whole instructions from `src` until at least `min_len` bytes have been consumed, fixing
+		up any RIP relative operands and branches so they work when run from `dst_addr`.
+
+		Returns the number of bytes consumed from `src`, or nothing if the instructions can't be moved
+		(calls, short-only branches, leaving the function, a target out of rel32 range, or a branch back
+		into the bytes being moved).
+	*/
+	[[nodiscard]]
+	std::optional<std::size_t> relocate(
+		const std::uint8_t* src, std::uintptr_t src_addr, std::size_t min_len,
+		std::vector<std::uint8_t>& out, std::uintptr_t dst_addr
+	);
+
+	/* Emits a `jmp [rip+0]` with the absolute target following it, 14 bytes */
+	void emit_abs_jmp(std::vector<std::uint8_t>& out, std::uintptr_t target);
+
+	/* Emits a `jmp rel32` from `from` to `to`, returns false if it's out of range */
+	[[nodiscard]]
+	bool emit_rel_jmp(std::vector<std::uint8_t>& out, std::uintptr_t from, std::uintptr_t to);
+
+	[[nodiscard]]
+	inline bool fits_rel32(const std::int64_t disp) noexcept {
+		return disp >= INT32_MIN && disp <= INT32_MAX;
+	}
+}
+
+#endif /* SYCOPHANT_X86_64_HH */